@@ -132,6 +132,27 @@ bolt_bouncer_check_action (BoltBouncer           *bnc,
   return TRUE;
 }
 
+/* exporting the keys hands out the secrets that are
+ * needed to impersonate the devices; that needs admin
+ * rights every time, not just the right to manage */
+static const char *
+export_store_action (GDBusMethodInvocation *inv)
+{
+  g_auto(GStrv) names = NULL;
+  GVariant *params;
+  const char *str;
+
+  params = g_dbus_method_invocation_get_parameters (inv);
+  g_variant_get_child (params, 1, "&s", &str);
+  names = g_strsplit (str, "|", -1);
+
+  for (guint i = 0; names[i] != NULL; i++)
+    if (bolt_streq (g_strstrip (names[i]), "keys"))
+      return "org.freedesktop.bolt.export-keys";
+
+  return "org.freedesktop.bolt.manage";
+}
+
 static gboolean
 handle_authorize_method (BoltExported          *exported,
                          GDBusMethodInvocation *inv,
@@ -163,6 +184,10 @@ handle_authorize_method (BoltExported          *exported,
     action = "org.freedesktop.bolt.manage";
   else if (bolt_streq (method_name, "ForcePower"))
     action = "org.freedesktop.bolt.manage";
+  else if (bolt_streq (method_name, "ExportStore"))
+    action = export_store_action (inv);
+  else if (bolt_streq (method_name, "ImportStore"))
+    action = "org.freedesktop.bolt.import-store";
   else if (bolt_streq (method_name, "ListDomains"))
     authorized = TRUE;
   else if (bolt_streq (method_name, "DomainById"))
@@ -48,6 +48,10 @@ handle_sigterm (gpointer user_data)
 {
   bolt_debug (LOG_TOPIC ("signal"), "got SIGTERM; shutting down...");
 
+  /* make sure nothing is lost, e.g. pending timestamps */
+  if (manager != NULL)
+    bolt_manager_flush (manager);
+
   if (g_main_loop_is_running (main_loop))
     g_main_loop_quit (main_loop);
 
@@ -1173,6 +1173,7 @@ bolt_device_new_for_udev (struct udev_device *udev,
                           GError            **error)
 {
   g_auto(BoltIdent) id = BOLT_IDENT_INIT;
+  g_autoptr(BoltSysfsSnapshot) snap = NULL;
   const char *uid;
   BoltDevInfo info;
   BoltStatus status;
@@ -1186,11 +1187,15 @@ bolt_device_new_for_udev (struct udev_device *udev,
   g_return_val_if_fail (domain != NULL, NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  uid = bolt_sysfs_device_get_unique_id (udev, error);
+  snap = bolt_sysfs_snapshot_new (udev, error);
+  if (snap == NULL)
+    return NULL;
+
+  uid = bolt_sysfs_snapshot_get_unique_id (snap, error);
   if (uid == NULL)
     return NULL;
 
-  ok = bolt_sysfs_info_for_device (udev, TRUE, &info, error);
+  ok = bolt_sysfs_info_for_device (snap, TRUE, &info, error);
   if (!ok)
     return NULL;
 
@@ -1200,9 +1205,9 @@ bolt_device_new_for_udev (struct udev_device *udev,
     type = BOLT_DEVICE_PERIPHERAL;
 
   if (type == BOLT_DEVICE_HOST)
-    ok = bolt_sysfs_host_ident (udev, &id, error);
+    ok = bolt_sysfs_host_ident (snap, &id, error);
   else
-    ok = bolt_sysfs_device_ident (udev, &id, error);
+    ok = bolt_sysfs_device_ident (snap, &id, error);
 
   if (!ok)
     return NULL;
@@ -1300,9 +1305,10 @@ bolt_device_connected (BoltDevice         *dev,
                        BoltDomain         *domain,
                        struct udev_device *udev)
 {
+  g_autoptr(BoltSysfsSnapshot) snap = NULL;
   g_autoptr(GError) err = NULL;
   BoltAuthFlags aflags;
-  BoltDevInfo info;
+  BoltDevInfo info = {.authorized = -1, .keysize = -1, .boot = -1, .ctim = -1};
   BoltStatus status;
   gboolean change;
   gboolean ok;
@@ -1311,7 +1317,12 @@ bolt_device_connected (BoltDevice         *dev,
   g_return_val_if_fail (BOLT_IS_DEVICE (dev), BOLT_STATUS_UNKNOWN);
   g_return_val_if_fail (BOLT_IS_DOMAIN (domain), BOLT_STATUS_UNKNOWN);
 
-  ok = bolt_sysfs_info_for_device (udev, TRUE, &info, &err);
+  snap = bolt_sysfs_snapshot_new (udev, &err);
+  ok = snap != NULL;
+
+  if (ok)
+    ok = bolt_sysfs_info_for_device (snap, TRUE, &info, &err);
+
   if (!ok)
     {
       bolt_warn_err (err, LOG_DEV (dev), LOG_TOPIC ("udev"),
@@ -1408,6 +1419,7 @@ BoltStatus
 bolt_device_update_from_udev (BoltDevice         *dev,
                               struct udev_device *udev)
 {
+  g_autoptr(BoltSysfsSnapshot) snap = NULL;
   g_autoptr(GError) err = NULL;
   BoltLinkSpeed linkspeed;
   BoltAuthFlags aflags;
@@ -1429,7 +1441,11 @@ bolt_device_update_from_udev (BoltDevice         *dev,
   if (dev->status == BOLT_STATUS_AUTHORIZING)
     return dev->status;
 
-  ok = bolt_sysfs_info_for_device (udev, FALSE, &info, &err);
+  snap = bolt_sysfs_snapshot_new (udev, &err);
+  ok = snap != NULL;
+
+  if (ok)
+    ok = bolt_sysfs_info_for_device (snap, FALSE, &info, &err);
 
   if (!ok)
     {
@@ -1460,7 +1476,7 @@ bolt_device_update_from_udev (BoltDevice         *dev,
 
   device_set_status_internal (dev, status, TRUE);
 
-  bolt_sysfs_read_link_speed (udev, &linkspeed);
+  bolt_sysfs_read_link_speed (snap, &linkspeed);
   if (!bolt_link_speed_equal (&dev->linkspeed, &linkspeed))
     {
       dev->linkspeed = linkspeed;
@@ -1729,14 +1745,39 @@ void
 bolt_bootacl_add (gpointer domain,
                   gpointer device)
 {
-  g_autoptr(GError) err = NULL;
-  BoltDomain *dom = BOLT_DOMAIN (domain);
   BoltDevice *dev = BOLT_DEVICE (device);
-  const char *uid = bolt_device_get_uid (dev);
+
+  bolt_bootacl_add_uid (domain, (gpointer) bolt_device_get_uid (dev));
+}
+
+static void
+bootacl_add_done (GObject      *source,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree char *uid = user_data;
+  BoltDomain *dom = BOLT_DOMAIN (source);
   gboolean ok;
 
+  ok = bolt_domain_bootacl_add_finish (dom, res, &err);
+  if (!ok)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("bootacl"),
+                     LOG_DOM (dom), LOG_DEV_UID (uid),
+                     "could not add device");
+    }
+}
+
+void
+bolt_bootacl_add_uid (gpointer domain,
+                      gpointer device_uid)
+{
+  BoltDomain *dom = BOLT_DOMAIN (domain);
+  const char *uid = device_uid;
+
   bolt_info (LOG_TOPIC ("bootacl"),
-             LOG_DOM (dom), LOG_DEV (dev),
+             LOG_DOM (dom), LOG_DEV_UID (uid),
              "adding %.17s... ", uid);
 
   if (!bolt_domain_supports_bootacl (dom))
@@ -1745,27 +1786,48 @@ bolt_bootacl_add (gpointer domain,
   if (bolt_domain_bootacl_contains (dom, uid))
     return;
 
-  ok = bolt_domain_bootacl_add (dom, uid, &err);
+  bolt_domain_bootacl_add_async (dom, uid, NULL,
+                                 bootacl_add_done,
+                                 g_strdup (uid));
+}
+
+void
+bolt_bootacl_del (gpointer domain,
+                  gpointer device)
+{
+  BoltDevice *dev = BOLT_DEVICE (device);
+
+  bolt_bootacl_del_uid (domain, (gpointer) bolt_device_get_uid (dev));
+}
+
+static void
+bootacl_del_done (GObject      *source,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree char *uid = user_data;
+  BoltDomain *dom = BOLT_DOMAIN (source);
+  gboolean ok;
+
+  ok = bolt_domain_bootacl_del_finish (dom, res, &err);
   if (!ok)
     {
       bolt_warn_err (err, LOG_TOPIC ("bootacl"),
-                     LOG_DOM (dom), LOG_DEV_UID (uid),
-                     "could not add device");
+                     LOG_DEV_UID (uid), LOG_DOM (dom),
+                     "could not remove device");
     }
 }
 
 void
-bolt_bootacl_del (gpointer domain,
-                  gpointer device)
+bolt_bootacl_del_uid (gpointer domain,
+                      gpointer device_uid)
 {
-  g_autoptr(GError) err = NULL;
   BoltDomain *dom = BOLT_DOMAIN (domain);
-  BoltDevice *dev = BOLT_DEVICE (device);
-  const char *uid = bolt_device_get_uid (dev);
-  gboolean ok;
+  const char *uid = device_uid;
 
   bolt_info (LOG_TOPIC ("bootacl"),
-             LOG_DOM (dom), LOG_DEV (dev),
+             LOG_DOM (dom), LOG_DEV_UID (uid),
              "removing %.17s...", uid);
 
   if (!bolt_domain_supports_bootacl (dom))
@@ -1774,11 +1836,7 @@ bolt_bootacl_del (gpointer domain,
   if (!bolt_domain_bootacl_contains (dom, uid))
     return;
 
-  ok = bolt_domain_bootacl_del (dom, uid, &err);
-  if (!ok)
-    {
-      bolt_warn_err (err, LOG_TOPIC ("bootacl"),
-                     LOG_DEV_UID (uid), LOG_DOM (dom),
-                     "could not remove device");
-    }
+  bolt_domain_bootacl_del_async (dom, uid, NULL,
+                                 bootacl_del_done,
+                                 g_strdup (uid));
 }
@@ -124,7 +124,13 @@ gboolean          bolt_device_load_key (BoltDevice *dev,
 void              bolt_bootacl_add (gpointer domain,
                                     gpointer device);
 
+void              bolt_bootacl_add_uid (gpointer domain,
+                                        gpointer device_uid);
+
 void              bolt_bootacl_del (gpointer domain,
                                     gpointer device);
 
+void              bolt_bootacl_del_uid (gpointer domain,
+                                        gpointer device_uid);
+
 G_END_DECLS
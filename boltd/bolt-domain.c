@@ -508,10 +508,12 @@ bolt_domain_bootacl_sync (BoltDomain *domain,
                           GStrv      *sysacl)
 {
   g_autoptr(GError) err = NULL;
-  g_autoptr(GPtrArray) diff = NULL;
   g_auto(GStrv) acl = NULL;
   BoltJournal *log = domain->acllog;
+  const BoltJournalItem *item;
+  BoltJournalIter iter;
   gboolean ok;
+  guint n = 0;
 
   if (bolt_strv_isempty (sysacl) || log == NULL)
     return;
@@ -519,24 +521,24 @@ bolt_domain_bootacl_sync (BoltDomain *domain,
   bolt_info (LOG_TOPIC ("bootacl"), LOG_DOM (domain), "synchronizing journal");
 
   acl = g_strdupv (*sysacl);
-  diff = bolt_journal_list (log, &err);
 
-  if (diff == NULL)
+  /* the items are borrowed from the journal, which must
+   * therefore not be modified until we are done */
+  ok = bolt_journal_iter_init (&iter, log, &err);
+
+  if (!ok)
     {
       bolt_warn_err (err, LOG_TOPIC ("bootacl"), LOG_DOM (domain),
                      "could not list bootacl changes");
       return;
     }
 
-  bolt_debug (LOG_TOPIC ("bootacl"), LOG_DOM (domain),
-              "journal contains %u entries", diff->len);
-
-  for (guint i = 0; i < diff->len; i++)
+  while (bolt_journal_iter_next (&iter, &item))
     {
-      BoltJournalItem *item = g_ptr_array_index (diff, i);
       BoltJournalOp op = item->op;
       const char *uid = item->id;
       ok = TRUE;
+      n++;
 
       bolt_debug (LOG_TOPIC ("bootacl"), LOG_DOM (domain),
                   "applying op '%c' for '%s'", op, uid);
@@ -582,6 +584,9 @@ bolt_domain_bootacl_sync (BoltDomain *domain,
         }
     }
 
+  bolt_debug (LOG_TOPIC ("bootacl"), LOG_DOM (domain),
+              "journal contained %u entries", n);
+
   ok = bolt_journal_reset (log, &err);
 
   if (!ok)
@@ -1221,6 +1226,189 @@ bolt_domain_bootacl_del (BoltDomain *domain,
   return TRUE;
 }
 
+static void
+bolt_domain_bootacl_put_done (GObject      *source,
+                              GAsyncResult *res,
+                              gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GHashTable) diff = NULL;
+  g_autoptr(GError) err = NULL;
+  g_auto(GStrv) acl = NULL;
+  BoltDomain *domain;
+  const char *uuid;
+  gboolean ok;
+
+  ok = bolt_journal_put_finish (BOLT_JOURNAL (source), res, &err);
+
+  if (!ok)
+    {
+      g_task_return_error (task, g_steal_pointer (&err));
+      return;
+    }
+
+  domain = g_task_get_source_object (task);
+  uuid = g_task_get_task_data (task);
+
+  /* the acl is recomputed from the current state, since other
+   * changes might have been applied while the entry was being
+   * written out */
+  acl = g_strdupv (domain->bootacl);
+  diff = g_hash_table_new (g_str_hash, g_str_equal);
+
+  if (g_task_get_source_tag (task) == bolt_domain_bootacl_add_async)
+    {
+      if (!bolt_strv_contains (acl, uuid))
+        bolt_domain_bootacl_allocate (domain, acl, uuid);
+
+      g_hash_table_insert (diff, (gpointer) uuid, GINT_TO_POINTER ('+'));
+    }
+  else
+    {
+      bolt_domain_bootacl_remove (domain, acl, uuid, NULL);
+      g_hash_table_insert (diff, (gpointer) uuid, GINT_TO_POINTER ('-'));
+    }
+
+  bolt_domain_bootacl_update (domain, &acl, diff);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+void
+bolt_domain_bootacl_add_async (BoltDomain         *domain,
+                               const char         *uuid,
+                               GCancellable       *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer            user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+
+  g_return_if_fail (BOLT_IS_DOMAIN (domain));
+  g_return_if_fail (uuid != NULL);
+
+  task = g_task_new (domain, cancellable, callback, user_data);
+  g_task_set_source_tag (task, bolt_domain_bootacl_add_async);
+
+  /* online, the change is written to sysfs synchronously */
+  if (domain->syspath != NULL)
+    {
+      ok = bolt_domain_bootacl_add (domain, uuid, &err);
+
+      if (ok)
+        g_task_return_boolean (task, TRUE);
+      else
+        g_task_return_error (task, g_steal_pointer (&err));
+
+      return;
+    }
+
+  ok = bolt_domain_bootacl_can_update (domain, &err);
+
+  if (ok && bolt_domain_bootacl_contains (domain, uuid))
+    {
+      g_set_error (&err, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                   "'%s' already in boot ACL of domain '%s'",
+                   uuid, domain->id);
+      ok = FALSE;
+    }
+
+  if (!ok)
+    {
+      g_task_return_error (task, g_steal_pointer (&err));
+      return;
+    }
+
+  g_task_set_task_data (task, g_strdup (uuid), g_free);
+
+  bolt_journal_put_async (domain->acllog,
+                          uuid,
+                          BOLT_JOURNAL_ADDED,
+                          cancellable,
+                          bolt_domain_bootacl_put_done,
+                          g_steal_pointer (&task));
+}
+
+gboolean
+bolt_domain_bootacl_add_finish (BoltDomain   *domain,
+                                GAsyncResult *res,
+                                GError      **error)
+{
+  g_return_val_if_fail (BOLT_IS_DOMAIN (domain), FALSE);
+  g_return_val_if_fail (g_task_is_valid (res, domain), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+void
+bolt_domain_bootacl_del_async (BoltDomain         *domain,
+                               const char         *uuid,
+                               GCancellable       *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer            user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+
+  g_return_if_fail (BOLT_IS_DOMAIN (domain));
+  g_return_if_fail (uuid != NULL);
+
+  task = g_task_new (domain, cancellable, callback, user_data);
+  g_task_set_source_tag (task, bolt_domain_bootacl_del_async);
+
+  if (domain->syspath != NULL)
+    {
+      ok = bolt_domain_bootacl_del (domain, uuid, &err);
+
+      if (ok)
+        g_task_return_boolean (task, TRUE);
+      else
+        g_task_return_error (task, g_steal_pointer (&err));
+
+      return;
+    }
+
+  ok = bolt_domain_bootacl_can_update (domain, &err);
+
+  if (ok && !bolt_domain_bootacl_contains (domain, uuid))
+    {
+      g_set_error (&err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "device '%s' not in boot ACL of domain '%s'",
+                   uuid, domain->id);
+      ok = FALSE;
+    }
+
+  if (!ok)
+    {
+      g_task_return_error (task, g_steal_pointer (&err));
+      return;
+    }
+
+  g_task_set_task_data (task, g_strdup (uuid), g_free);
+
+  bolt_journal_put_async (domain->acllog,
+                          uuid,
+                          BOLT_JOURNAL_REMOVED,
+                          cancellable,
+                          bolt_domain_bootacl_put_done,
+                          g_steal_pointer (&task));
+}
+
+gboolean
+bolt_domain_bootacl_del_finish (BoltDomain   *domain,
+                                GAsyncResult *res,
+                                GError      **error)
+{
+  g_return_val_if_fail (BOLT_IS_DOMAIN (domain), FALSE);
+  g_return_val_if_fail (g_task_is_valid (res, domain), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (res), error);
+}
+
 BoltDomain *
 bolt_domain_next (BoltDomain *domain)
 {
@@ -95,6 +95,26 @@ gboolean          bolt_domain_bootacl_add (BoltDomain *domain,
 gboolean          bolt_domain_bootacl_del (BoltDomain *domain,
                                            const char *uuid,
                                            GError    **error);
+
+void              bolt_domain_bootacl_add_async (BoltDomain         *domain,
+                                                 const char         *uuid,
+                                                 GCancellable       *cancellable,
+                                                 GAsyncReadyCallback callback,
+                                                 gpointer            user_data);
+
+gboolean          bolt_domain_bootacl_add_finish (BoltDomain   *domain,
+                                                  GAsyncResult *res,
+                                                  GError      **error);
+
+void              bolt_domain_bootacl_del_async (BoltDomain         *domain,
+                                                 const char         *uuid,
+                                                 GCancellable       *cancellable,
+                                                 GAsyncReadyCallback callback,
+                                                 gpointer            user_data);
+
+gboolean          bolt_domain_bootacl_del_finish (BoltDomain   *domain,
+                                                  GAsyncResult *res,
+                                                  GError      **error);
 /* domain list management */
 BoltDomain *      bolt_domain_insert (BoltDomain *list,
                                       BoltDomain *domain) G_GNUC_WARN_UNUSED_RESULT;
@@ -845,6 +845,24 @@ bolt_exported_class_set_interface_info (BoltExportedClass *klass,
   klass->priv->iface_info = info; /* transfer ownership */
 }
 
+GDBusInterfaceInfo *
+bolt_exported_class_get_interface_info (BoltExportedClass *klass)
+{
+  g_return_val_if_fail (BOLT_IS_EXPORTED_CLASS (klass), NULL);
+  g_return_val_if_fail (klass->priv != NULL, NULL);
+
+  return klass->priv->iface_info;
+}
+
+const GDBusInterfaceVTable *
+bolt_exported_class_get_vtable (BoltExportedClass *klass)
+{
+  g_return_val_if_fail (BOLT_IS_EXPORTED_CLASS (klass), NULL);
+
+  /* the user_data for the vtable functions is the instance */
+  return &dbus_vtable;
+}
+
 void
 bolt_exported_class_set_object_path (BoltExportedClass *klass,
                                      const char        *base_path)
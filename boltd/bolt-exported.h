@@ -74,6 +74,12 @@ void     bolt_exported_class_set_interface_info (BoltExportedClass *klass,
                                                  const char        *iface_name,
                                                  const char        *resource_name);
 
+GDBusInterfaceInfo *
+         bolt_exported_class_get_interface_info (BoltExportedClass *klass);
+
+const GDBusInterfaceVTable *
+         bolt_exported_class_get_vtable (BoltExportedClass *klass);
+
 void     bolt_exported_class_set_object_path (BoltExportedClass *klass,
                                               const char        *base_path);
 
@@ -29,10 +29,44 @@
 #include "bolt-macros.h"
 #include "bolt-str.h"
 
-#include <gio/gunixinputstream.h>
-
-#include <errno.h>
 #include <stdio.h>
+#include <string.h>
+
+/* On-disk format (version 1)
+ *
+ * The file starts with a header: the magic "boltjrnl", followed
+ * by the format version and the record size, both as 32 bit
+ * little endian integers. After that come fixed-size records:
+ *
+ *   0  id         NUL padded, BOLT_JOURNAL_ID_MAX + 1 bytes
+ *  48  timestamp  64 bit, little endian
+ *  56  op         one byte, see BoltJournalOp
+ *  57  reserved   three bytes, zero
+ *  60  checksum   CRC32C of the bytes before, little endian
+ *
+ * Journals in the old, line based text format are converted
+ * when they are loaded for the first time.
+ */
+#define JOURNAL_MAGIC "boltjrnl"
+#define JOURNAL_VERSION 1
+
+#define RECORD_ID_SIZE (BOLT_JOURNAL_ID_MAX + 1)
+#define RECORD_TS_OFFSET 48
+#define RECORD_OP_OFFSET 56
+#define RECORD_CRC_OFFSET 60
+
+G_STATIC_ASSERT (RECORD_ID_SIZE == RECORD_TS_OFFSET);
+G_STATIC_ASSERT (RECORD_CRC_OFFSET + 4 == BOLT_JOURNAL_RECORD_SIZE);
+
+/* the file is re-written with the folded state once it has
+ * at least COMPACT_MIN records and COMPACT_RATIO times more
+ * records than live entries */
+#define COMPACT_MIN 64
+#define COMPACT_RATIO 4
+
+/* asynchronous puts arriving within this window are
+ * written and synced to disk together */
+#define COMMIT_DELAY 10 /* ms */
 
 /* ************************************  */
 /* BoltJournal */
@@ -54,6 +88,20 @@ struct _BoltJournal
 
   int      fd;
 
+  /* folded state, loaded on first use */
+  gboolean loaded;
+  GQueue   entries;   /* BoltJournalItem, in order of last change */
+  GHashTable *index;  /* id -> GList link in entries */
+  guint    records;   /* number of records in the file */
+  guint    stamp;     /* changes with the entries, for iterators */
+
+  /* group commit */
+  GMutex     lock;      /* serializes access to 'fd' */
+  GString   *pending;   /* formatted, not yet written entries */
+  GPtrArray *waiting;   /* GTask, for the pending entries */
+  guint      commit_id; /* timeout source */
+  gboolean   committing;
+
   /* serials */
   gint64  sl_time;
   guint32 sl_count;
@@ -87,6 +135,19 @@ bolt_journal_finalize (GObject *object)
   if (journal->fd > -1)
     bolt_close (journal->fd, NULL);
 
+  g_queue_foreach (&journal->entries,
+                   (GFunc) bolt_journal_item_free,
+                   NULL);
+  g_queue_clear (&journal->entries);
+  g_clear_pointer (&journal->index, g_hash_table_unref);
+
+  /* every waiting task holds a reference, so nothing can
+   * be pending or in flight at this point */
+  g_clear_handle_id (&journal->commit_id, g_source_remove);
+  g_string_free (journal->pending, TRUE);
+  g_ptr_array_unref (journal->waiting);
+  g_mutex_clear (&journal->lock);
+
   g_clear_object (&journal->root);
   g_clear_pointer (&journal->name, g_free);
   g_clear_object (&journal->path);
@@ -98,6 +159,13 @@ static void
 bolt_journal_init (BoltJournal *journal)
 {
   journal->fd = -1;
+
+  g_queue_init (&journal->entries);
+  journal->index = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_mutex_init (&journal->lock);
+  journal->pending = g_string_new (NULL);
+  journal->waiting = g_ptr_array_new_with_free_func (g_object_unref);
 }
 
 static void
@@ -243,7 +311,8 @@ bolt_journal_initialize (GInitable    *initable,
   bolt_info (LOG_TOPIC ("journal"), "opened for '%.13s'; size: %s",
              journal->name, size);
 
-  journal->fresh = st.st_size == 0;
+  /* a journal with just the header is empty as well */
+  journal->fresh = st.st_size <= BOLT_JOURNAL_HEADER_SIZE;
   journal->fd = bolt_steal (&fd, -1);
 
   bolt_debug (LOG_TOPIC ("journal"), "fresh: %s, fd: %d",
@@ -253,42 +322,471 @@ bolt_journal_initialize (GInitable    *initable,
 }
 
 /* internal methods */
+static guint32
+bolt_crc32c (const guint8 *data,
+             gsize         len)
+{
+  static guint32 table[256];
+  static gsize inited = 0;
+  guint32 crc = 0xFFFFFFFF;
+
+  if (g_once_init_enter (&inited))
+    {
+      /* Castagnoli polynomial, reversed */
+      for (guint32 i = 0; i < 256; i++)
+        {
+          guint32 c = i;
+
+          for (guint k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+
+          table[i] = c;
+        }
+
+      g_once_init_leave (&inited, 1);
+    }
+
+  for (gsize i = 0; i < len; i++)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+  return crc ^ 0xFFFFFFFF;
+}
+
+static gboolean
+bolt_journal_check_id (const char *id,
+                       GError    **error)
+{
+  if (strlen (id) > BOLT_JOURNAL_ID_MAX)
+    {
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                   "journal id too long: '%s'", id);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+bolt_journal_format_header (GString *out)
+{
+  guint32 version = GUINT32_TO_LE (JOURNAL_VERSION);
+  guint32 size = GUINT32_TO_LE (BOLT_JOURNAL_RECORD_SIZE);
+
+  g_string_append_len (out, JOURNAL_MAGIC, 8);
+  g_string_append_len (out, (const char *) &version, sizeof (version));
+  g_string_append_len (out, (const char *) &size, sizeof (size));
+}
+
+static void
+bolt_journal_format_entry (GString      *out,
+                           const char   *id,
+                           BoltJournalOp op,
+                           guint64       ts)
+{
+  guint8 rec[BOLT_JOURNAL_RECORD_SIZE] = {0, };
+  guint64 tsle = GUINT64_TO_LE (ts);
+  guint32 crc;
+
+  /* ids are checked by the public methods */
+  strncpy ((char *) rec, id, BOLT_JOURNAL_ID_MAX);
+  memcpy (rec + RECORD_TS_OFFSET, &tsle, sizeof (tsle));
+  rec[RECORD_OP_OFFSET] = (guint8) bolt_journal_op_to_string (op)[0];
+
+  crc = GUINT32_TO_LE (bolt_crc32c (rec, RECORD_CRC_OFFSET));
+  memcpy (rec + RECORD_CRC_OFFSET, &crc, sizeof (crc));
+
+  g_string_append_len (out, (const char *) rec, sizeof (rec));
+}
+
 static gboolean
-bolt_journal_write_entry (int           fd,
-                          const char   *id,
-                          BoltJournalOp op,
-                          GError      **error)
+bolt_journal_write_entries (int          fd,
+                            GString     *data,
+                            GError     **error)
 {
   g_autoptr(GError) err = NULL;
-  g_autofree char *data = NULL;
-  const char *opstr;
   gboolean ok;
-  guint64 now;
-  size_t l;
 
   g_return_val_if_fail (fd > -1, FALSE);
 
-  now = (guint64) g_get_real_time ();
-  opstr = bolt_journal_op_to_string (op);
+  /* a single write, so a crash can at most tear the last entry,
+   * which will then be discarded when loading */
+  ok = bolt_write_all (fd, data->str, data->len, &err);
+  if (!ok)
+    {
+      g_propagate_prefixed_error (error, g_steal_pointer (&err),
+                                  "could not add journal entry: ");
+      return FALSE;
+    }
+
+  bolt_debug (LOG_TOPIC ("journal"), "wrote %" G_GSIZE_FORMAT
+              " bytes to %d", data->len, fd);
+
+  return TRUE;
+}
+
+static void
+bolt_journal_fold (BoltJournal  *journal,
+                   const char   *id,
+                   BoltJournalOp op,
+                   guint64       ts)
+{
+  BoltJournalItem *item;
+  GList *link;
+
+  link = g_hash_table_lookup (journal->index, id);
+
+  if (link != NULL)
+    {
+      /* the latest change wins and moves to the end */
+      g_queue_unlink (&journal->entries, link);
+      g_queue_push_tail_link (&journal->entries, link);
+      item = link->data;
+    }
+  else
+    {
+      item = g_slice_new (BoltJournalItem);
+      item->id = g_strdup (id);
+      g_queue_push_tail (&journal->entries, item);
+      g_hash_table_insert (journal->index,
+                           item->id,
+                           journal->entries.tail);
+    }
+
+  item->op = op;
+  item->ts = ts;
+
+  journal->records++;
+  journal->stamp++;
+}
+
+static void
+bolt_journal_clear_state (BoltJournal *journal)
+{
+  g_hash_table_remove_all (journal->index);
+  g_queue_foreach (&journal->entries,
+                   (GFunc) bolt_journal_item_free,
+                   NULL);
+  g_queue_clear (&journal->entries);
+
+  journal->records = 0;
+  journal->loaded = FALSE;
+  journal->stamp++;
+}
+
+static gboolean
+bolt_journal_parse_record (BoltJournal  *journal,
+                           const guint8 *rec)
+{
+  g_autoptr(GError) err = NULL;
+  char opstr[2] = {0, };
+  BoltJournalOp op;
+  guint64 ts;
+  guint32 crc;
+
+  memcpy (&crc, rec + RECORD_CRC_OFFSET, sizeof (crc));
+
+  if (GUINT32_FROM_LE (crc) != bolt_crc32c (rec, RECORD_CRC_OFFSET))
+    return FALSE;
+
+  if (memchr (rec, '\0', RECORD_ID_SIZE) == NULL || rec[0] == '\0')
+    return FALSE;
+
+  opstr[0] = (char) rec[RECORD_OP_OFFSET];
+  op = bolt_journal_op_from_string (opstr, &err);
+
+  if (err != NULL)
+    return FALSE;
+
+  memcpy (&ts, rec + RECORD_TS_OFFSET, sizeof (ts));
+
+  bolt_journal_fold (journal, (const char *) rec, op, GUINT64_FROM_LE (ts));
+
+  return TRUE;
+}
+
+/* returns the length of the valid data */
+static gsize
+bolt_journal_parse_records (BoltJournal *journal,
+                            const char  *data,
+                            gsize        len,
+                            GError     **error)
+{
+  const guint8 *rec = (const guint8 *) data + BOLT_JOURNAL_HEADER_SIZE;
+  const guint8 *end = (const guint8 *) data + len;
+  gsize valid = BOLT_JOURNAL_HEADER_SIZE;
+  guint32 version;
+  guint32 size;
+  guint bad = 0;
+
+  memcpy (&version, data + 8, sizeof (version));
+  memcpy (&size, data + 12, sizeof (size));
+
+  version = GUINT32_FROM_LE (version);
+  size = GUINT32_FROM_LE (size);
+
+  if (version != JOURNAL_VERSION || size != BOLT_JOURNAL_RECORD_SIZE)
+    {
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                   "unsupported journal format: %u (%u)",
+                   version, size);
+      return 0;
+    }
+
+  for (; rec + BOLT_JOURNAL_RECORD_SIZE <= end; rec += BOLT_JOURNAL_RECORD_SIZE)
+    {
+      gboolean ok = bolt_journal_parse_record (journal, rec);
+
+      if (!ok)
+        {
+          bad++;
+          continue;
+        }
+
+      /* a bad record followed by good ones is corruption,
+       * bad ones at the end are from a torn write */
+      if (bad > 0)
+        bolt_warn (LOG_TOPIC ("journal"), "invalid entry: %u skipped", bad);
+
+      bad = 0;
+      valid = (const char *) rec + BOLT_JOURNAL_RECORD_SIZE - data;
+    }
+
+  return valid;
+}
+
+static void
+bolt_journal_parse_line (BoltJournal *journal,
+                         const char  *l)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree char *name = NULL;
+  g_autofree char *opstr = NULL;
+  BoltJournalOp op;
+  guint64 ts;
+  int n;
 
-  data = g_strdup_printf ("%s %s %016"G_GINT64_MODIFIER "X\n",
-                          id, opstr, now);
+  n = sscanf (l, "%ms %ms %016" G_GINT64_MODIFIER "X",
+              &name, &opstr, &ts);
+
+  if (n != 3 || strlen (name) > BOLT_JOURNAL_ID_MAX)
+    {
+      bolt_warn (LOG_TOPIC ("journal"), "invalid entry: '%s'", l);
+      return;
+    }
+
+  op = bolt_journal_op_from_string (opstr, &err);
+
+  if (err != NULL)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("journal"),
+                     "skipping entry '%s'", l);
+      return;
+    }
+
+  bolt_journal_fold (journal, name, op, ts);
+}
+
+/* the old, line based format; returns the length of the valid data */
+static gsize
+bolt_journal_parse_lines (BoltJournal *journal,
+                          const char  *data,
+                          gsize        len)
+{
+  g_autofree char *text = g_strndup (data, len);
+  char *line;
+  char *end;
+
+  for (line = text; (end = strchr (line, '\n')) != NULL; line = end + 1)
+    {
+      *end = '\0';
+      bolt_journal_parse_line (journal, line);
+    }
+
+  return line - text;
+}
+
+static gboolean
+bolt_journal_compact (BoltJournal *journal,
+                      GError     **error)
+{
+  g_autoptr(GString) buf = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *base = NULL;
+  bolt_autoclose int fd = -1;
+  gboolean ok;
+
+  base = g_file_get_path (journal->path);
+  path = g_strdup_printf ("%s.lock", base);
+
+  fd = bolt_open (path,
+                  O_RDWR |  O_CREAT | O_CLOEXEC | O_TRUNC,
+                  0666,
+                  error);
+
+  if (fd < 0)
+    return FALSE;
+
+  buf = g_string_sized_new (BOLT_JOURNAL_HEADER_SIZE +
+                            journal->entries.length * BOLT_JOURNAL_RECORD_SIZE);
+
+  bolt_journal_format_header (buf);
+
+  for (GList *l = journal->entries.head; l; l = l->next)
+    {
+      BoltJournalItem *item = l->data;
+      bolt_journal_format_entry (buf, item->id, item->op, item->ts);
+    }
+
+  ok = bolt_journal_write_entries (fd, buf, error);
+
+  if (ok)
+    ok = bolt_fdatasync (fd, error);
+
+  if (ok)
+    ok = bolt_faddflags (fd, O_APPEND, error);
+
+  if (ok)
+    ok = bolt_rename (path, base, error);
 
-  l = strlen (data);
-  ok = bolt_write_all (fd, data, l, &err);
   if (!ok)
+    {
+      (void) bolt_unlink (path, NULL);
+      return FALSE;
+    }
+
+  bolt_swap (journal->fd, fd);
+
+  bolt_info (LOG_TOPIC ("journal"), "compacted '%.13s': %u -> %u records",
+             journal->name, journal->records, journal->entries.length);
+
+  journal->records = journal->entries.length;
+
+  return TRUE;
+}
+
+static gboolean
+bolt_journal_load (BoltJournal *journal,
+                   GError     **error)
+{
+  g_autoptr(GMappedFile) map = NULL;
+  g_autoptr(GError) err = NULL;
+  const char *data;
+  gboolean legacy;
+  gboolean ok;
+  gsize valid;
+  gsize len;
+
+  if (journal->loaded)
+    return TRUE;
+
+  g_mutex_lock (&journal->lock);
+  map = g_mapped_file_new_from_fd (journal->fd, FALSE, &err);
+  g_mutex_unlock (&journal->lock);
+
+  if (map == NULL)
     {
       g_propagate_prefixed_error (error, g_steal_pointer (&err),
-                                  "could not add journal entry: ");
+                                  "could not read from journal: ");
       return FALSE;
     }
 
-  bolt_debug (LOG_TOPIC ("journal"), "wrote '%.*s' to %d",
-              l - 1, data, fd);
+  data = g_mapped_file_get_contents (map);
+  len = g_mapped_file_get_length (map);
+
+  legacy = len > 0 && (len < BOLT_JOURNAL_HEADER_SIZE ||
+                       memcmp (data, JOURNAL_MAGIC, 8) != 0);
+
+  if (len == 0)
+    {
+      g_autoptr(GString) buf = g_string_new (NULL);
+
+      bolt_journal_format_header (buf);
+
+      g_mutex_lock (&journal->lock);
+      ok = bolt_journal_write_entries (journal->fd, buf, error);
+      g_mutex_unlock (&journal->lock);
+
+      if (!ok)
+        return FALSE;
+
+      valid = len = buf->len;
+    }
+  else if (legacy)
+    {
+      valid = bolt_journal_parse_lines (journal, data, len);
+    }
+  else
+    {
+      valid = bolt_journal_parse_records (journal, data, len, error);
+
+      if (valid == 0)
+        {
+          bolt_journal_clear_state (journal);
+          return FALSE;
+        }
+    }
+
+  /* data at the end that is not a complete entry is the
+   * result of a torn write; drop it, otherwise it would
+   * corrupt the next */
+  if (valid < len)
+    {
+      bolt_warn (LOG_TOPIC ("journal"), "discarding incomplete entry");
+
+      g_mutex_lock (&journal->lock);
+      ok = bolt_ftruncate (journal->fd, valid, &err);
+      g_mutex_unlock (&journal->lock);
+
+      if (!ok)
+        bolt_warn_err (err, LOG_TOPIC ("journal"), "could not truncate");
+    }
+
+  bolt_debug (LOG_TOPIC ("journal"), "loaded %u records, %u entries",
+              journal->records, g_queue_get_length (&journal->entries));
+
+  journal->loaded = TRUE;
+
+  if (legacy)
+    {
+      ok = bolt_journal_compact (journal, &err);
+
+      if (!ok)
+        {
+          bolt_journal_clear_state (journal);
+          g_propagate_prefixed_error (error, g_steal_pointer (&err),
+                                      "could not upgrade journal: ");
+          return FALSE;
+        }
+
+      bolt_info (LOG_TOPIC ("journal"), "upgraded '%.13s' to version %d",
+                 journal->name, JOURNAL_VERSION);
+    }
 
   return TRUE;
 }
 
+static void
+bolt_journal_maybe_compact (BoltJournal *journal)
+{
+  g_autoptr(GError) err = NULL;
+  guint live = journal->entries.length;
+  gboolean ok;
+
+  if (journal->records < COMPACT_MIN ||
+      journal->records < live * COMPACT_RATIO)
+    return;
+
+  /* the file must have all the folded entries */
+  if (journal->committing || journal->waiting->len > 0)
+    return;
+
+  ok = bolt_journal_compact (journal, &err);
+
+  /* not fatal, all records are still in the old file */
+  if (!ok)
+    bolt_warn_err (err, LOG_TOPIC ("journal"), "could not compact");
+}
+
 static void
 bolt_journal_set_fresh (BoltJournal *journal,
                         gboolean     fresh)
@@ -301,6 +799,237 @@ bolt_journal_set_fresh (BoltJournal *journal,
                             journal_props[PROP_FRESH]);
 }
 
+/* group commit */
+
+/* must be called with the lock held; hands out the tasks
+ * waiting for the pending entries and appends the latter
+ * to 'buf', i.e. the caller takes over the responsibility
+ * to write them out and complete the tasks */
+static GPtrArray *
+bolt_journal_steal_pending (BoltJournal *journal,
+                            GString     *buf)
+{
+  GPtrArray *waiting = journal->waiting;
+
+  g_string_append_len (buf,
+                       journal->pending->str,
+                       journal->pending->len);
+
+  g_string_truncate (journal->pending, 0);
+  journal->waiting = g_ptr_array_new_with_free_func (g_object_unref);
+
+  return waiting;
+}
+
+static void
+bolt_journal_complete_waiting (GPtrArray    *waiting,
+                               const GError *error)
+{
+  for (guint i = 0; i < waiting->len; i++)
+    {
+      GTask *task = g_ptr_array_index (waiting, i);
+
+      if (error != NULL)
+        g_task_return_error (task, g_error_copy (error));
+      else
+        g_task_return_boolean (task, TRUE);
+    }
+}
+
+typedef struct CommitBatch
+{
+  GPtrArray *waiting;
+  GError    *error;
+} CommitBatch;
+
+static void
+commit_batch_free (gpointer data)
+{
+  CommitBatch *batch = data;
+
+  g_ptr_array_unref (batch->waiting);
+  g_clear_error (&batch->error);
+  g_slice_free (CommitBatch, batch);
+}
+
+static void
+bolt_journal_commit_thread (GTask        *task,
+                            gpointer      source,
+                            gpointer      task_data,
+                            GCancellable *cancellable)
+{
+  g_autoptr(GString) buf = NULL;
+  BoltJournal *journal = source;
+  CommitBatch *batch;
+  gboolean ok = TRUE;
+
+  batch = g_slice_new0 (CommitBatch);
+  buf = g_string_new (NULL);
+
+  g_mutex_lock (&journal->lock);
+
+  batch->waiting = bolt_journal_steal_pending (journal, buf);
+
+  /* a synchronous put might have written everything already */
+  if (buf->len > 0)
+    {
+      struct stat st;
+      gboolean written;
+
+      ok = bolt_fstat (journal->fd, &st, &batch->error);
+      written = ok && bolt_journal_write_entries (journal->fd, buf,
+                                                  &batch->error);
+
+      /* the whole batch is failed, so none of its entries must
+       * come back when the file is re-read after the failure */
+      if (ok && !written && !bolt_ftruncate (journal->fd, st.st_size, NULL))
+        bolt_warn (LOG_TOPIC ("journal"), "could not truncate");
+
+      ok = written;
+    }
+
+  if (ok && batch->waiting->len > 0)
+    ok = bolt_fdatasync (journal->fd, &batch->error);
+
+  g_mutex_unlock (&journal->lock);
+
+  bolt_debug (LOG_TOPIC ("journal"), "committed %u entries: %s",
+              batch->waiting->len, bolt_okfail (ok));
+
+  g_task_return_pointer (task, batch, commit_batch_free);
+}
+
+static void     bolt_journal_schedule_commit (BoltJournal *journal);
+
+static void
+bolt_journal_commit_done (GObject      *source,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+  BoltJournal *journal = BOLT_JOURNAL (source);
+  CommitBatch *batch;
+
+  journal->committing = FALSE;
+
+  batch = g_task_propagate_pointer (G_TASK (res), NULL);
+  g_return_if_fail (batch != NULL);
+
+  if (batch->error != NULL)
+    {
+      g_autoptr(GPtrArray) rest = NULL;
+      g_autoptr(GString) buf = g_string_new (NULL);
+
+      bolt_warn_err (batch->error, LOG_TOPIC ("journal"),
+                     "group commit failed");
+
+      /* the folded state contains entries that never made
+       * it to disk, as do the ones that are still pending;
+       * fail them all and re-read the file on the next use,
+       * which also discards a torn last entry */
+      rest = bolt_journal_steal_pending (journal, buf);
+      bolt_journal_complete_waiting (rest, batch->error);
+      bolt_journal_clear_state (journal);
+    }
+  else if (journal->waiting->len > 0)
+    {
+      bolt_journal_schedule_commit (journal);
+    }
+
+  bolt_journal_complete_waiting (batch->waiting, batch->error);
+  commit_batch_free (batch);
+
+  if (journal->loaded)
+    bolt_journal_maybe_compact (journal);
+}
+
+static gboolean
+bolt_journal_commit_timeout (gpointer user_data)
+{
+  BoltJournal *journal = user_data;
+  g_autoptr(GTask) task = NULL;
+
+  journal->commit_id = 0;
+
+  if (journal->waiting->len == 0)
+    return G_SOURCE_REMOVE;
+
+  journal->committing = TRUE;
+
+  task = g_task_new (journal, NULL, bolt_journal_commit_done, NULL);
+  g_task_run_in_thread (task, bolt_journal_commit_thread);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+bolt_journal_schedule_commit (BoltJournal *journal)
+{
+  /* a commit in flight will re-schedule when it is done */
+  if (journal->commit_id != 0 || journal->committing)
+    return;
+
+  journal->commit_id = g_timeout_add (COMMIT_DELAY,
+                                      bolt_journal_commit_timeout,
+                                      journal);
+}
+
+/* write 'buf', after all pending entries, and sync it to disk,
+ * which makes those durable as well; 'written' tells if the data
+ * reached the file, in case only the sync failed; a failed write
+ * is cut off again, so no partial entries are left behind. With
+ * 'durable', data that could not be synced is cut off as well */
+static gboolean
+bolt_journal_write_sync (BoltJournal *journal,
+                         GString     *buf,
+                         gboolean     durable,
+                         gboolean    *written,
+                         GError     **error)
+{
+  g_autoptr(GPtrArray) waiting = NULL;
+  g_autoptr(GString) all = NULL;
+  g_autoptr(GError) err = NULL;
+  struct stat st;
+  gboolean ok;
+
+  all = g_string_sized_new (journal->pending->len + buf->len);
+
+  g_mutex_lock (&journal->lock);
+
+  /* entries of earlier asynchronous puts must come first,
+   * otherwise they would override ours when loading */
+  waiting = bolt_journal_steal_pending (journal, all);
+  g_string_append_len (all, buf->str, buf->len);
+
+  ok = bolt_fstat (journal->fd, &st, &err);
+  *written = ok && bolt_journal_write_entries (journal->fd, all, &err);
+
+  if (ok && !*written && !bolt_ftruncate (journal->fd, st.st_size, NULL))
+    bolt_warn (LOG_TOPIC ("journal"), "could not truncate");
+
+  ok = *written && bolt_fdatasync (journal->fd, &err);
+
+  if (durable && *written && !ok)
+    {
+      if (!bolt_ftruncate (journal->fd, st.st_size, NULL))
+        bolt_warn (LOG_TOPIC ("journal"), "could not truncate");
+
+      *written = FALSE;
+    }
+
+  g_mutex_unlock (&journal->lock);
+
+  bolt_journal_complete_waiting (waiting, err);
+
+  /* we cannot tell which of the pending entries made it */
+  if (!*written)
+    bolt_journal_clear_state (journal);
+
+  if (!ok)
+    g_propagate_error (error, g_steal_pointer (&err));
+
+  return ok;
+}
+
 /* public methods */
 
 BoltJournal *
@@ -329,76 +1058,127 @@ bolt_journal_put (BoltJournal  *journal,
                   BoltJournalOp op,
                   GError      **error)
 {
+  g_autoptr(GString) buf = NULL;
+  g_autoptr(GError) err = NULL;
+  gboolean written;
   gboolean ok;
-  int r;
+  guint64 now;
 
   g_return_val_if_fail (BOLT_IS_JOURNAL (journal), FALSE);
   g_return_val_if_fail (id != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-  ok = bolt_journal_write_entry (journal->fd, id, op, error);
+  ok = bolt_journal_check_id (id, error) &&
+       bolt_journal_load (journal, error);
 
   if (!ok)
     return FALSE;
 
-  r = fdatasync (journal->fd);
-  if (r == -1)
+  now = (guint64) g_get_real_time ();
+  buf = g_string_new (NULL);
+  bolt_journal_format_entry (buf, id, op, now);
+
+  ok = bolt_journal_write_sync (journal, buf, FALSE, &written, &err);
+
+  if (!written)
+    {
+      g_propagate_error (error, g_steal_pointer (&err));
+      return FALSE;
+    }
+  else if (!ok)
     {
-      bolt_warn (LOG_TOPIC ("journal"),
-                 "could not flush (fdatasync) journal: %s",
-                 g_strerror (errno));
+      bolt_warn_err (err, LOG_TOPIC ("journal"),
+                     "could not flush journal");
     }
 
+  bolt_journal_fold (journal, id, op, now);
   bolt_journal_set_fresh (journal, FALSE);
 
+  bolt_journal_maybe_compact (journal);
+
   return TRUE;
 }
 
+void
+bolt_journal_put_async (BoltJournal        *journal,
+                        const char         *id,
+                        BoltJournalOp       op,
+                        GCancellable       *cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer            user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+  guint64 now;
+
+  g_return_if_fail (BOLT_IS_JOURNAL (journal));
+  g_return_if_fail (id != NULL);
+
+  task = g_task_new (journal, cancellable, callback, user_data);
+  g_task_set_source_tag (task, bolt_journal_put_async);
+
+  ok = bolt_journal_check_id (id, &err) &&
+       bolt_journal_load (journal, &err);
+
+  if (!ok)
+    {
+      g_task_return_error (task, g_steal_pointer (&err));
+      return;
+    }
+
+  now = (guint64) g_get_real_time ();
+
+  g_mutex_lock (&journal->lock);
+  bolt_journal_format_entry (journal->pending, id, op, now);
+  g_ptr_array_add (journal->waiting, g_steal_pointer (&task));
+  g_mutex_unlock (&journal->lock);
+
+  /* the entry is visible right away, i.e. before it is durable */
+  bolt_journal_fold (journal, id, op, now);
+  bolt_journal_set_fresh (journal, FALSE);
+
+  bolt_journal_schedule_commit (journal);
+}
+
+gboolean
+bolt_journal_put_finish (BoltJournal  *journal,
+                         GAsyncResult *res,
+                         GError      **error)
+{
+  g_return_val_if_fail (BOLT_IS_JOURNAL (journal), FALSE);
+  g_return_val_if_fail (g_task_is_valid (res, journal), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (res), error);
+}
+
 gboolean
 bolt_journal_put_diff (BoltJournal *journal,
                        GHashTable  *diff,
                        GError     **error)
 {
-  g_autoptr(GError) err = NULL;
-  g_autofree char *path = NULL;
-  g_autofree char *base = NULL;
-  bolt_autoclose int fd = -1;
-  struct stat st;
+  g_autoptr(GString) buf = NULL;
   GHashTableIter iter;
   gpointer key, val;
+  gboolean written;
   gboolean ok = TRUE;
+  guint64 now;
 
   g_return_val_if_fail (BOLT_IS_JOURNAL (journal), FALSE);
   g_return_val_if_fail (diff != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-  base = g_file_get_path (journal->path);
-  path = g_strdup_printf ("%s.lock", base);
-
-  fd = bolt_open (path,
-                  O_RDWR |  O_CREAT | O_CLOEXEC | O_TRUNC,
-                  0666,
-                  error);
+  ok = bolt_journal_load (journal, error);
 
-  if (fd < 0)
-    return FALSE;
-
-  memset (&st, 0, sizeof (st));
-  ok = bolt_fstat (journal->fd, &st, &err);
   if (!ok)
-    {
-      g_propagate_prefixed_error (error, g_steal_pointer (&err),
-                                  "could not query journal: ");
-      return FALSE;
-    }
-
-  ok = bolt_lseek (journal->fd, 0, SEEK_SET, NULL, error);
+    return FALSE;
 
-  if (ok)
-    ok = bolt_copy_bytes (journal->fd, fd, st.st_size, error);
+  now = (guint64) g_get_real_time ();
+  buf = g_string_new (NULL);
 
   g_hash_table_iter_init (&iter, diff);
-  while (ok && g_hash_table_iter_next (&iter, &key, &val))
+  while (g_hash_table_iter_next (&iter, &key, &val))
     {
       const char *uid = key;
       const int opcode = GPOINTER_TO_INT (val);
@@ -420,24 +1200,32 @@ bolt_journal_put_diff (BoltJournal *journal,
           return FALSE;
         }
 
-      ok = bolt_journal_write_entry (fd, uid, op, error);
-    }
-
-  if (ok)
-    ok = bolt_fdatasync (fd, error);
+      if (!bolt_journal_check_id (uid, error))
+        return FALSE;
 
-  if (ok)
-    ok = bolt_faddflags (fd, O_APPEND, error);
+      bolt_journal_format_entry (buf, uid, op, now);
+    }
 
-  if (ok)
-    ok = bolt_rename (path, base, error);
+  /* NB: unlike bolt_journal_put, a diff that could not
+   * be synced to disk is not applied but reported */
+  ok = bolt_journal_write_sync (journal, buf, TRUE, &written, error);
 
   if (!ok)
     return FALSE;
 
-  bolt_swap (journal->fd, fd);
+  g_hash_table_iter_init (&iter, diff);
+  while (g_hash_table_iter_next (&iter, &key, &val))
+    {
+      const int opcode = GPOINTER_TO_INT (val);
+      BoltJournalOp op = opcode == '+' ? BOLT_JOURNAL_ADDED : BOLT_JOURNAL_REMOVED;
+
+      bolt_journal_fold (journal, key, op, now);
+    }
+
   bolt_journal_set_fresh (journal, FALSE);
 
+  bolt_journal_maybe_compact (journal);
+
   return TRUE;
 }
 
@@ -445,74 +1233,29 @@ GPtrArray *
 bolt_journal_list (BoltJournal *journal,
                    GError     **error)
 {
-  g_autoptr(GInputStream) is = NULL;
-  g_autoptr(GDataInputStream) ds = NULL;
   GPtrArray *res = NULL;
-  off_t pos;
+  gboolean ok;
 
   g_return_val_if_fail (BOLT_IS_JOURNAL (journal), NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  pos = lseek (journal->fd, 0, SEEK_SET);
-
-  if (pos == (off_t) -1)
-    {
-      int code = errno;
-      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code),
-                   "could not read from journal: %s", g_strerror (code));
-      return NULL;
-    }
-
-  res = g_ptr_array_new_full (16, (GDestroyNotify) bolt_journal_item_free);
+  ok = bolt_journal_load (journal, error);
 
-  is = g_unix_input_stream_new (journal->fd, FALSE);
-  ds = g_data_input_stream_new (is);
+  if (!ok)
+    return NULL;
 
-  g_return_val_if_fail (ds != NULL, res);
+  res = g_ptr_array_new_full (MAX (journal->entries.length, 16),
+                              (GDestroyNotify) bolt_journal_item_free);
 
-  for (;; )
+  for (GList *l = journal->entries.head; l; l = l->next)
     {
-      g_autoptr(GError) err = NULL;
-      g_autofree char *l = NULL;
-      g_autofree char *name = NULL;
-      g_autofree char *opstr = NULL;
+      BoltJournalItem *have = l->data;
       BoltJournalItem *i;
-      BoltJournalOp op;
-      guint64 ts;
-      int n;
-
-      l = g_data_input_stream_read_line (ds, NULL, NULL, &err);
-
-      if (l == NULL)
-        {
-          if (err)
-            bolt_warn_err (err, LOG_TOPIC ("journal"),
-                           "error reading from journal");
-          break;
-        }
-
-      n = sscanf (l, "%ms %ms %016" G_GINT64_MODIFIER "X",
-                  &name, &opstr, &ts);
-
-      if (n != 3)
-        {
-          bolt_warn (LOG_TOPIC ("journal"), "invalid entry: '%s'", l);
-          continue;
-        }
-
-      op = bolt_journal_op_from_string (opstr, &err);
-
-      if (err != NULL)
-        {
-          bolt_warn_err (err, LOG_TOPIC ("journal"),
-                         "skipping entry '%s'", l);
-          continue;
-        }
 
       i = g_slice_new (BoltJournalItem);
-      i->id = g_strdup (name);
-      i->ts = ts;
-      i->op = op;
+      i->id = g_strdup (have->id);
+      i->ts = have->ts;
+      i->op = have->op;
 
       g_ptr_array_add (res, i);
     }
@@ -524,17 +1267,103 @@ gboolean
 bolt_journal_reset (BoltJournal *journal,
                     GError     **error)
 {
+  g_autoptr(GPtrArray) waiting = NULL;
+  g_autoptr(GString) buf = NULL;
+  g_autoptr(GError) err = NULL;
   gboolean ok;
 
   g_return_val_if_fail (BOLT_IS_JOURNAL (journal), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  buf = g_string_new (NULL);
+  bolt_journal_format_header (buf);
+
+  g_mutex_lock (&journal->lock);
+
   ok = bolt_ftruncate (journal->fd, 0, error);
 
+  /* pending entries are dropped along with the rest */
   if (ok)
-    journal->fresh = TRUE;
+    {
+      g_autoptr(GString) dropped = g_string_new (NULL);
 
-  return ok;
+      waiting = bolt_journal_steal_pending (journal, dropped);
+      ok = bolt_journal_write_entries (journal->fd, buf, error);
+    }
+
+  g_mutex_unlock (&journal->lock);
+
+  if (waiting != NULL)
+    {
+      g_set_error_literal (&err, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                           "journal was reset");
+      bolt_journal_complete_waiting (waiting, err);
+    }
+
+  /* on failure, the next load will look at the file again */
+  bolt_journal_clear_state (journal);
+
+  if (!ok)
+    return FALSE;
+
+  journal->loaded = TRUE;
+  journal->fresh = TRUE;
+
+  return TRUE;
+}
+
+/* iterator */
+typedef struct RealIter
+{
+  BoltJournal *journal;
+  GList       *link;
+  guint        stamp;
+} RealIter;
+
+G_STATIC_ASSERT (sizeof (RealIter) <= sizeof (BoltJournalIter));
+
+gboolean
+bolt_journal_iter_init (BoltJournalIter *iter,
+                        BoltJournal     *journal,
+                        GError         **error)
+{
+  RealIter *ri = (RealIter *) iter;
+  gboolean ok;
+
+  g_return_val_if_fail (iter != NULL, FALSE);
+  g_return_val_if_fail (BOLT_IS_JOURNAL (journal), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  ok = bolt_journal_load (journal, error);
+
+  if (!ok)
+    return FALSE;
+
+  ri->journal = journal;
+  ri->link = journal->entries.head;
+  ri->stamp = journal->stamp;
+
+  return TRUE;
+}
+
+gboolean
+bolt_journal_iter_next (BoltJournalIter        *iter,
+                        const BoltJournalItem **item)
+{
+  RealIter *ri = (RealIter *) iter;
+
+  g_return_val_if_fail (iter != NULL, FALSE);
+  g_return_val_if_fail (ri->stamp == ri->journal->stamp, FALSE);
+
+  if (ri->link == NULL)
+    return FALSE;
+
+  if (item)
+    *item = ri->link->data;
+
+  ri->link = ri->link->next;
+
+  return TRUE;
 }
 
 /* journal op methods */
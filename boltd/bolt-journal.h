@@ -28,6 +28,11 @@
 #define BOLT_TYPE_JOURNAL bolt_journal_get_type ()
 G_DECLARE_FINAL_TYPE (BoltJournal, bolt_journal, BOLT, JOURNAL, GObject);
 
+/* on-disk format, see bolt-journal.c */
+#define BOLT_JOURNAL_HEADER_SIZE 16
+#define BOLT_JOURNAL_RECORD_SIZE 64
+#define BOLT_JOURNAL_ID_MAX      47
+
 typedef enum BoltJournalOp {
   BOLT_JOURNAL_FAILED    = -1,
   BOLT_JOURNAL_UNCHANGED =  '=',
@@ -53,6 +58,17 @@ gboolean           bolt_journal_put (BoltJournal  *journal,
                                      BoltJournalOp op,
                                      GError      **error);
 
+void               bolt_journal_put_async (BoltJournal        *journal,
+                                           const char         *id,
+                                           BoltJournalOp       op,
+                                           GCancellable       *cancellable,
+                                           GAsyncReadyCallback callback,
+                                           gpointer            user_data);
+
+gboolean           bolt_journal_put_finish (BoltJournal  *journal,
+                                            GAsyncResult *res,
+                                            GError      **error);
+
 gboolean           bolt_journal_put_diff (BoltJournal *journal,
                                           GHashTable  *diff,
                                           GError     **error);
@@ -63,6 +79,25 @@ GPtrArray *        bolt_journal_list (BoltJournal *journal,
 gboolean           bolt_journal_reset (BoltJournal *journal,
                                        GError     **error);
 
+/* BoltJournalIter - iterate over the folded entries
+ *   the items are owned by the journal and must not be
+ *   modified; any change to the journal invalidates the
+ *   iterator */
+typedef struct BoltJournalIter
+{
+  /*< private >*/
+  gpointer dummy1;
+  gpointer dummy2;
+  guint    dummy3;
+} BoltJournalIter;
+
+gboolean           bolt_journal_iter_init (BoltJournalIter *iter,
+                                           BoltJournal     *journal,
+                                           GError         **error);
+
+gboolean           bolt_journal_iter_next (BoltJournalIter        *iter,
+                                           const BoltJournalItem **item);
+
 /* BoltJournalOp */
 const char *      bolt_journal_op_to_string (BoltJournalOp op);
 
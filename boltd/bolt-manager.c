@@ -25,6 +25,7 @@
 #include "bolt-device.h"
 #include "bolt-domain.h"
 #include "bolt-error.h"
+#include "bolt-io.h"
 #include "bolt-log.h"
 #include "bolt-power.h"
 #include "bolt-store.h"
@@ -37,11 +38,20 @@
 
 #include "bolt-manager.h"
 
+#include <gio/gunixfdlist.h>
+
 #include <libudev.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define PROBING_SETTLE_TIME_MS 2000 /* in milli-seconds */
 
+/* thunderbolt uevents are processed together, as one batch, once
+ * there was no new one for UEVENT_COALESCE_MS, but no later than
+ * UEVENT_COALESCE_MAX_MS after the first; see manager_process_uevents */
+#define UEVENT_COALESCE_MS     20  /* in milli-seconds */
+#define UEVENT_COALESCE_MAX_MS 200 /* in milli-seconds */
+
 typedef struct udev_device udev_device;
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (udev_device, udev_device_unref);
 
@@ -90,6 +100,20 @@ static gboolean      manager_load_devices (BoltManager *mgr,
 static void          manager_register_device (BoltManager *mgr,
                                               BoltDevice  *device);
 
+static void          manager_reindex_syspath (BoltManager *mgr,
+                                              BoltDevice  *dev,
+                                              const char  *old);
+
+static void          manager_topo_link (BoltManager *mgr,
+                                        BoltDevice  *dev);
+
+static void          manager_topo_unlink (BoltManager *mgr,
+                                          BoltDevice  *dev);
+
+static void          manager_topo_subtree (BoltManager *mgr,
+                                           BoltDevice  *dev,
+                                           GPtrArray   *out);
+
 static void          manager_deregister_device (BoltManager *mgr,
                                                 BoltDevice  *device);
 
@@ -100,6 +124,19 @@ static BoltDevice *  manager_find_device_by_uid (BoltManager *mgr,
                                                  const char  *uid,
                                                  GError     **error);
 
+static gboolean      manager_add_stub (BoltManager    *mgr,
+                                       const char     *uid,
+                                       BoltDeviceType *type,
+                                       GError        **error);
+
+static gboolean      manager_remove_stub (BoltManager *mgr,
+                                          const char  *uid);
+
+static BoltDevice *  manager_materialize_stub (BoltManager *mgr,
+                                               const char  *uid);
+
+static void          manager_materialize_all (BoltManager *mgr);
+
 static BoltDevice *  bolt_manager_get_parent (BoltManager *mgr,
                                               BoltDevice  *dev);
 
@@ -110,10 +147,11 @@ static void          bolt_manager_label_device (BoltManager *mgr,
                                                 BoltDevice  *target);
 
 /* udev events */
-static void         handle_uevent_udev (BoltUdev           *udev,
-                                        const char         *action,
-                                        struct udev_device *device,
-                                        gpointer            user_data);
+static void         handle_uevent_udev (BoltUdev  *udev,
+                                        GPtrArray *uevents,
+                                        gpointer   user_data);
+
+static gboolean      manager_process_uevents (gpointer user_data);
 
 static void          handle_udev_domain_event (BoltManager        *mgr,
                                                struct udev_device *device,
@@ -150,10 +188,18 @@ static void          handle_store_device_added (BoltStore   *store,
                                                 const char  *uid,
                                                 BoltManager *mgr);
 
+static void          handle_store_device_changed (BoltStore   *store,
+                                                  const char  *uid,
+                                                  BoltManager *mgr);
+
 static void          handle_store_device_removed (BoltStore   *store,
                                                   const char  *uid,
                                                   BoltManager *mgr);
 
+static void          handle_store_reclaimed (GObject    *gobject,
+                                             GParamSpec *pspec,
+                                             gpointer    user_data);
+
 static void          handle_domain_security_changed (BoltManager *mgr,
                                                      GParamSpec  *unused,
                                                      BoltDomain  *domain);
@@ -226,6 +272,81 @@ static GVariant *  handle_forget_device (BoltExported          *object,
                                          GDBusMethodInvocation *invocation,
                                          GError               **error);
 
+static GVariant *  handle_export_store (BoltExported          *object,
+                                        GVariant              *params,
+                                        GDBusMethodInvocation *invocation,
+                                        GError               **error);
+
+static GVariant *  handle_import_store (BoltExported          *object,
+                                        GVariant              *params,
+                                        GDBusMethodInvocation *invocation,
+                                        GError               **error);
+
+/* stored devices that are not connected are kept as
+ * stubs until a full device object is needed */
+typedef struct DeviceStub
+{
+  char      *uid;
+  char      *opath;
+  char      *node; /* last element of opath */
+  char      *name;
+  char      *vendor;
+  BoltPolicy policy;
+} DeviceStub;
+
+static void
+device_stub_free (gpointer data)
+{
+  DeviceStub *stub = data;
+
+  g_free (stub->uid);
+  g_free (stub->opath);
+  g_free (stub->node);
+  g_free (stub->name);
+  g_free (stub->vendor);
+  g_slice_free (DeviceStub, stub);
+}
+
+/* a queued thunderbolt uevent */
+typedef struct UEvent
+{
+  char        *action;
+  udev_device *device;
+  guint64      seqnum; /* of the kernel */
+  guint        seq;   /* arrival order */
+  guint        depth; /* of the syspath */
+  gboolean     dropped;
+} UEvent;
+
+static void
+uevent_free (gpointer data)
+{
+  UEvent *ev = data;
+
+  g_free (ev->action);
+  udev_device_unref (ev->device);
+  g_slice_free (UEvent, ev);
+}
+
+/* the place of a connected device in the topology, i.e.
+ * the device tree that is formed by the syspaths */
+typedef struct TopoNode
+{
+  BoltDevice *parent;   /* borrowed */
+  GPtrArray  *children; /* BoltDevice, borrowed */
+  char       *waiting;  /* syspath of the parent, while orphaned */
+} TopoNode;
+
+static void
+topo_node_free (gpointer data)
+{
+  TopoNode *node = data;
+
+  g_ptr_array_unref (node->children);
+  g_free (node->waiting);
+  g_slice_free (TopoNode, node);
+}
+
 /*  */
 struct _BoltManager
 {
@@ -238,6 +359,15 @@ struct _BoltManager
   BoltStore   *store;
   BoltDomain  *domains;
   GPtrArray   *devices;
+  GHashTable  *devices_by_uid;     /* uid -> BoltDevice, borrowed */
+  GHashTable  *devices_by_syspath; /* syspath -> BoltDevice, borrowed */
+  GHashTable  *topology;           /* BoltDevice -> TopoNode */
+  GHashTable  *orphans;            /* parent syspath -> GPtrArray of
+                                      BoltDevice, borrowed, that wait
+                                      for the parent to show up */
+  GHashTable  *stubs;              /* uid -> DeviceStub */
+  GHashTable  *stubs_by_node;      /* opath node -> DeviceStub, borrowed */
+  guint        stubs_subtree;      /* dbus registration id */
   BoltPower   *power;
   BoltSecurity security;
   BoltAuthMode authmode;
@@ -257,6 +387,12 @@ struct _BoltManager
   gint64     probing_tstamp;  /* time stamp of last activity */
   guint      probing_tsettle; /* how long to indicate after the last activity */
 
+  /* uevents */
+  GPtrArray *uevents;         /* UEvent, queued for processing */
+  guint      uevents_id;      /* timeout source */
+  guint      uevents_seq;
+  gint64     uevents_since;   /* time stamp of the first queued one */
+
   /* watchdog */
   BoltWatchdog *dog;
 };
@@ -271,6 +407,7 @@ enum {
   PROP_AUTHMODE,
   PROP_POWERSTATE,
   PROP_GENERATION,
+  PROP_RECLAIMED,
 
   PROP_LAST,
   PROP_EXPORTED = PROP_VERSION
@@ -290,8 +427,19 @@ bolt_manager_finalize (GObject *object)
 {
   BoltManager *mgr = BOLT_MANAGER (object);
 
+  if (mgr->stubs_subtree > 0)
+    {
+      GDBusConnection *bus = bolt_exported_get_connection (BOLT_EXPORTED (mgr));
+
+      g_dbus_connection_unregister_subtree (bus, mgr->stubs_subtree);
+      mgr->stubs_subtree = 0;
+    }
+
   g_clear_object (&mgr->udev);
 
+  g_clear_handle_id (&mgr->uevents_id, g_source_remove);
+  g_clear_pointer (&mgr->uevents, g_ptr_array_unref);
+
   if (mgr->probing_timeout)
     {
       g_source_remove (mgr->probing_timeout);
@@ -301,7 +449,13 @@ bolt_manager_finalize (GObject *object)
   g_clear_pointer (&mgr->probing_roots, g_ptr_array_unref);
 
   g_clear_object (&mgr->store);
+  g_clear_pointer (&mgr->devices_by_uid, g_hash_table_unref);
+  g_clear_pointer (&mgr->devices_by_syspath, g_hash_table_unref);
+  g_clear_pointer (&mgr->topology, g_hash_table_unref);
+  g_clear_pointer (&mgr->orphans, g_hash_table_unref);
   g_ptr_array_free (mgr->devices, TRUE);
+  g_clear_pointer (&mgr->stubs_by_node, g_hash_table_unref);
+  g_clear_pointer (&mgr->stubs, g_hash_table_unref);
   bolt_domain_clear (&mgr->domains);
 
   g_clear_pointer (&mgr->config, g_key_file_unref);
@@ -353,6 +507,10 @@ bolt_manager_get_property (GObject    *object,
       g_value_set_uint (value, mgr->generation);
       break;
 
+    case PROP_RECLAIMED:
+      g_value_set_uint (value, bolt_store_get_reclaimed (mgr->store));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -362,6 +520,17 @@ static void
 bolt_manager_init (BoltManager *mgr)
 {
   mgr->devices = g_ptr_array_new_with_free_func (g_object_unref);
+  mgr->devices_by_uid = g_hash_table_new (g_str_hash, g_str_equal);
+  mgr->devices_by_syspath = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, NULL);
+  mgr->topology = g_hash_table_new_full (NULL, NULL, NULL, topo_node_free);
+  mgr->orphans = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify) g_ptr_array_unref);
+  mgr->stubs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                      NULL, device_stub_free);
+  mgr->stubs_by_node = g_hash_table_new (g_str_hash, g_str_equal);
+
+  mgr->uevents = g_ptr_array_new_with_free_func (uevent_free);
 
   mgr->probing_roots = g_ptr_array_new_with_free_func (g_free);
   mgr->probing_tsettle = PROBING_SETTLE_TIME_MS; /* milliseconds */
@@ -428,6 +597,12 @@ bolt_manager_class_init (BoltManagerClass *klass)
                        G_PARAM_READABLE |
                        G_PARAM_STATIC_STRINGS);
 
+  props[PROP_RECLAIMED] =
+    g_param_spec_uint ("store-reclaimed", "StoreReclaimed", NULL,
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE |
+                       G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (gobject_class, PROP_LAST, props);
 
 
@@ -467,6 +642,14 @@ bolt_manager_class_init (BoltManagerClass *klass)
   bolt_exported_class_export_method (exported_class,
                                      "ForgetDevice",
                                      handle_forget_device);
+
+  bolt_exported_class_export_method (exported_class,
+                                     "ExportStore",
+                                     handle_export_store);
+
+  bolt_exported_class_export_method (exported_class,
+                                     "ImportStore",
+                                     handle_import_store);
 }
 
 static void
@@ -481,9 +664,9 @@ bolt_manager_initialize (GInitable    *initable,
                          GError      **error)
 {
   g_autoptr(BoltGuard) power = NULL;
+  g_autoptr(GPtrArray) devices = NULL;
+  g_autoptr(GError) err = NULL;
   BoltManager *mgr;
-  struct udev_enumerate *enumerate;
-  struct udev_list_entry *l, *devices;
   gboolean upgraded = FALSE;
   gboolean ok;
 
@@ -516,7 +699,7 @@ bolt_manager_initialize (GInitable    *initable,
   if (mgr->udev == NULL)
     return FALSE;
 
-  g_signal_connect_object (mgr->udev, "uevent",
+  g_signal_connect_object (mgr->udev, "uevent-batch",
                            (GCallback) handle_uevent_udev,
                            mgr, 0);
 
@@ -543,50 +726,36 @@ bolt_manager_initialize (GInitable    *initable,
     bolt_info (LOG_TOPIC ("manager"), "acquired power guard '%s'",
                bolt_guard_get_id (power));
 
-  /* TODO: error checking */
-  enumerate =  bolt_udev_new_enumerate (mgr->udev, NULL);
-  udev_enumerate_add_match_subsystem (enumerate, "thunderbolt");
-  /* only devices (i.e. not the domain controller) */
-
+  /* one walk over sysfs; domains and devices come in
+   * topology order, i.e. parents before their children */
   bolt_info (LOG_TOPIC ("udev"), "enumerating devices");
-  udev_enumerate_scan_devices (enumerate);
-  devices = udev_enumerate_get_list_entry (enumerate);
+  devices = bolt_udev_enumerate_thunderbolt (mgr->udev, &err);
 
-  udev_list_entry_foreach (l, devices)
+  if (devices == NULL)
+    bolt_warn_err (err, LOG_TOPIC ("udev"), "enumerating devices");
+
+  for (guint i = 0; devices && i < devices->len; i++)
     {
-      g_autoptr(GError) err = NULL;
-      g_autoptr(udev_device) udevice = NULL;
-      const char *syspath;
+      struct udev_device *udevice = g_ptr_array_index (devices, i);
       const char *devtype;
 
-      syspath = udev_list_entry_get_name (l);
-      udevice = bolt_udev_device_new_from_syspath (mgr->udev,
-                                                   syspath,
-                                                   &err);
-
-      if (udevice == NULL)
-        {
-          bolt_warn_err (err, "enumerating devices");
-          continue;
-        }
-
       devtype = udev_device_get_devtype (udevice);
 
       if (bolt_streq (devtype, "thunderbolt_domain"))
         handle_udev_domain_event (mgr, udevice, "add");
-
-      if (bolt_streq (devtype, "thunderbolt_device"))
+      else
         handle_udev_device_event (mgr, udevice, "add");
     }
 
-  udev_enumerate_unref (enumerate);
-
   /* upgrade the store, if needed */
   bolt_manager_store_upgrade (mgr, &upgraded);
 
   if (upgraded)
     manager_cleanup_stale_domains (mgr);
 
+  /* remove left-overs, once we are idle */
+  bolt_store_gc_start (mgr->store);
+
   manager_sd_notify_status (mgr);
 
   return TRUE;
@@ -605,10 +774,18 @@ bolt_manager_store_init (BoltManager *mgr, GError **error)
                            G_CALLBACK (handle_store_device_added),
                            mgr, 0);
 
+  g_signal_connect_object (mgr->store, "device-changed",
+                           G_CALLBACK (handle_store_device_changed),
+                           mgr, 0);
+
   g_signal_connect_object (mgr->store, "device-removed",
                            G_CALLBACK (handle_store_device_removed),
                            mgr, 0);
 
+  g_signal_connect_object (mgr->store, "notify::reclaimed",
+                           G_CALLBACK (handle_store_reclaimed),
+                           mgr, 0);
+
   return TRUE;
 }
 
@@ -759,12 +936,38 @@ manager_load_domains (BoltManager *mgr,
   return TRUE;
 }
 
+static void
+bootacl_sync_device (BoltDomain *domain,
+                     GStrv       acl,
+                     const char *duid,
+                     BoltPolicy  policy)
+{
+  gboolean polok, inacl, sync;
+
+  polok = policy == BOLT_POLICY_AUTO;
+  inacl = bolt_domain_bootacl_contains (domain, duid);
+  sync = polok && !inacl;
+
+  bolt_info (LOG_TOPIC ("bootacl"), LOG_DOM (domain),
+             LOG_DEV_UID (duid),
+             "sync '%.13s…' %s [policy: %3s, in acl: %3s]",
+             duid, bolt_yesno (sync), bolt_yesno (polok),
+             bolt_yesno (inacl));
+
+  if (!sync)
+    return;
+
+  bolt_domain_bootacl_allocate (domain, acl, duid);
+}
+
 static void
 manager_bootacl_inital_sync (BoltManager *mgr,
                              BoltDomain  *domain)
 {
   g_autoptr(GError) err = NULL;
   g_auto(GStrv) acl = NULL;
+  GHashTableIter iter;
+  DeviceStub *stub;
   gboolean ok;
   guint n, empty;
 
@@ -786,25 +989,16 @@ manager_bootacl_inital_sync (BoltManager *mgr,
   for (guint i = 0; i < mgr->devices->len; i++)
     {
       BoltDevice *dev = g_ptr_array_index (mgr->devices, i);
-      const char *duid = bolt_device_get_uid (dev);
-      gboolean polok, inacl, sync;
 
-      polok = bolt_device_get_policy (dev) == BOLT_POLICY_AUTO;
-      inacl = bolt_domain_bootacl_contains (domain, duid);
-      sync = polok && !inacl;
-
-      bolt_info (LOG_TOPIC ("bootacl"), LOG_DOM (domain),
-                 LOG_DEV_UID (duid),
-                 "sync '%.13s…' %s [policy: %3s, in acl: %3s]",
-                 duid, bolt_yesno (sync), bolt_yesno (polok),
-                 bolt_yesno (inacl));
-
-      if (!sync)
-        continue;
-
-      bolt_domain_bootacl_allocate (domain, acl, duid);
+      bootacl_sync_device (domain, acl,
+                           bolt_device_get_uid (dev),
+                           bolt_device_get_policy (dev));
     }
 
+  g_hash_table_iter_init (&iter, mgr->stubs);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stub))
+    bootacl_sync_device (domain, acl, stub->uid, stub->policy);
+
   ok = bolt_domain_bootacl_set (domain, acl, &err);
 
   if (!ok && err != NULL)
@@ -1141,17 +1335,24 @@ manager_load_devices (BoltManager *mgr,
       return FALSE;
     }
 
+  /* the heavy lifting, i.e. parsing the entries, is done
+   * by the store when building its index, possibly in
+   * parallel; here we only create and register the objects,
+   * which we do in a well-defined order */
+  qsort (ids, g_strv_length (ids), sizeof (char *), bolt_comparefn_strcmp);
+
   bolt_info (LOG_TOPIC ("store"), "loading devices");
   for (guint i = 0; i < g_strv_length (ids); i++)
     {
       g_autoptr(GError) err = NULL;
-      BoltDevice *dev = NULL;
       const char *uid = ids[i];
+      BoltDeviceType type;
+      gboolean ok;
 
       bolt_info (LOG_DEV_UID (uid), LOG_TOPIC ("store"), "loading device");
 
-      dev = bolt_store_get_device (mgr->store, uid, &err);
-      if (dev == NULL)
+      ok = manager_add_stub (mgr, uid, &type, &err);
+      if (!ok)
         {
           bolt_warn_err (err, LOG_TOPIC ("store"),
                          LOG_DIRECT (BOLT_LOG_DEVICE_UID, uid),
@@ -1159,7 +1360,10 @@ manager_load_devices (BoltManager *mgr,
           continue;
         }
 
-      manager_register_device (mgr, dev);
+      /* hosts affect the manager state, e.g. the generation,
+       * and there are only a few; so load them right away */
+      if (type == BOLT_DEVICE_HOST)
+        manager_materialize_stub (mgr, uid);
     }
 
   return TRUE;
@@ -1169,8 +1373,12 @@ static void
 manager_register_device (BoltManager *mgr,
                          BoltDevice  *dev)
 {
+  const char *uid = bolt_device_get_uid (dev);
 
   g_ptr_array_add (mgr->devices, dev);
+  g_hash_table_insert (mgr->devices_by_uid, (gpointer) uid, dev);
+  manager_reindex_syspath (mgr, dev, NULL);
+
   bolt_bouncer_add_client (mgr->bouncer, dev);
   g_signal_connect_object (dev, "status-changed",
                            G_CALLBACK (handle_device_status_changed),
@@ -1187,12 +1395,244 @@ manager_register_device (BoltManager *mgr,
 
 }
 
+/* the uid of a device never changes, but its syspath does when
+ * it gets connected or disconnected; must be called then with
+ * the @old syspath, so the index can be kept up to date */
+static void
+manager_reindex_syspath (BoltManager *mgr,
+                         BoltDevice  *dev,
+                         const char  *old)
+{
+  const char *syspath = bolt_device_get_syspath (dev);
+
+  if (old != NULL && g_hash_table_lookup (mgr->devices_by_syspath, old) == dev)
+    g_hash_table_remove (mgr->devices_by_syspath, old);
+
+  manager_topo_unlink (mgr, dev);
+
+  if (syspath == NULL)
+    return;
+
+  g_hash_table_insert (mgr->devices_by_syspath, g_strdup (syspath), dev);
+  manager_topo_link (mgr, dev);
+}
+
+static char *
+manager_topo_parent_path (const char *syspath)
+{
+  const char *start;
+  const char *pos;
+
+  if (syspath == NULL)
+    return NULL;
+
+  start = syspath + strlen ("/sys");
+
+  pos = strrchr (start, '/');
+  if (!pos || pos < start + 2)
+    return NULL;
+
+  return g_strndup (syspath, pos - syspath);
+}
+
+static TopoNode *
+manager_topo_node (BoltManager *mgr,
+                   BoltDevice  *dev)
+{
+  TopoNode *node;
+
+  node = g_hash_table_lookup (mgr->topology, dev);
+
+  if (node != NULL)
+    return node;
+
+  node = g_slice_new0 (TopoNode);
+  node->children = g_ptr_array_new ();
+  g_hash_table_insert (mgr->topology, dev, node);
+
+  return node;
+}
+
+/* @path is the syspath of the parent, and owned by the node */
+static void
+manager_topo_orphan (BoltManager *mgr,
+                     BoltDevice  *dev,
+                     char        *path)
+{
+  GPtrArray *waiting;
+  TopoNode *node;
+
+  if (path == NULL)
+    return;
+
+  node = manager_topo_node (mgr, dev);
+  waiting = g_hash_table_lookup (mgr->orphans, path);
+
+  if (waiting == NULL)
+    {
+      waiting = g_ptr_array_new ();
+      g_hash_table_insert (mgr->orphans, g_strdup (path), waiting);
+    }
+
+  g_ptr_array_add (waiting, dev);
+  node->waiting = path;
+}
+
+static void
+manager_topo_unorphan (BoltManager *mgr,
+                       BoltDevice  *dev,
+                       TopoNode    *node)
+{
+  GPtrArray *waiting;
+
+  if (node->waiting == NULL)
+    return;
+
+  waiting = g_hash_table_lookup (mgr->orphans, node->waiting);
+
+  if (waiting != NULL)
+    {
+      g_ptr_array_remove_fast (waiting, dev);
+
+      if (waiting->len == 0)
+        g_hash_table_remove (mgr->orphans, node->waiting);
+    }
+
+  g_clear_pointer (&node->waiting, g_free);
+}
+
+static void
+manager_topo_link (BoltManager *mgr,
+                   BoltDevice  *dev)
+{
+  g_autofree char *path = NULL;
+  const char *syspath;
+  BoltDevice *parent = NULL;
+  GPtrArray *waiting;
+  TopoNode *node;
+
+  syspath = bolt_device_get_syspath (dev);
+  node = manager_topo_node (mgr, dev);
+
+  /* adopt the devices that showed up before us */
+  waiting = g_hash_table_lookup (mgr->orphans, syspath);
+
+  for (guint i = 0; waiting != NULL && i < waiting->len; i++)
+    {
+      BoltDevice *child = g_ptr_array_index (waiting, i);
+      TopoNode *cn = manager_topo_node (mgr, child);
+
+      g_clear_pointer (&cn->waiting, g_free);
+      cn->parent = dev;
+      g_ptr_array_add (node->children, child);
+    }
+
+  if (waiting != NULL)
+    g_hash_table_remove (mgr->orphans, syspath);
+
+  /* hosts are the roots, their parent is the domain */
+  if (bolt_device_is_host (dev))
+    return;
+
+  path = manager_topo_parent_path (syspath);
+
+  if (path == NULL)
+    return;
+
+  parent = g_hash_table_lookup (mgr->devices_by_syspath, path);
+
+  if (parent != NULL && parent != dev)
+    {
+      node->parent = parent;
+      g_ptr_array_add (manager_topo_node (mgr, parent)->children, dev);
+    }
+  else
+    {
+      manager_topo_orphan (mgr, dev, g_steal_pointer (&path));
+    }
+}
+
+static void
+manager_topo_unlink (BoltManager *mgr,
+                     BoltDevice  *dev)
+{
+  TopoNode *node;
+
+  node = g_hash_table_lookup (mgr->topology, dev);
+
+  if (node == NULL)
+    return;
+
+  manager_topo_unorphan (mgr, dev, node);
+
+  if (node->parent != NULL)
+    {
+      TopoNode *pn = g_hash_table_lookup (mgr->topology, node->parent);
+
+      if (pn != NULL)
+        g_ptr_array_remove_fast (pn->children, dev);
+
+      node->parent = NULL;
+    }
+
+  /* children normally go away first, but if not, they
+   * wait to be adopted again */
+  for (guint i = 0; i < node->children->len; i++)
+    {
+      BoltDevice *child = g_ptr_array_index (node->children, i);
+      const char *syspath = bolt_device_get_syspath (child);
+
+      manager_topo_node (mgr, child)->parent = NULL;
+      manager_topo_orphan (mgr, child, manager_topo_parent_path (syspath));
+    }
+
+  g_ptr_array_set_size (node->children, 0);
+}
+
+/* adds @dev and all the devices below it to @out, parents
+ * always before their children; iterating @out backwards
+ * thus visits the children first */
+static void
+manager_topo_subtree (BoltManager *mgr,
+                      BoltDevice  *dev,
+                      GPtrArray   *out)
+{
+  guint start = out->len;
+
+  g_ptr_array_add (out, g_object_ref (dev));
+
+  for (guint i = start; i < out->len; i++)
+    {
+      TopoNode *node;
+
+      node = g_hash_table_lookup (mgr->topology, g_ptr_array_index (out, i));
+
+      if (node == NULL)
+        continue;
+
+      for (guint k = 0; k < node->children->len; k++)
+        g_ptr_array_add (out, g_object_ref (g_ptr_array_index (node->children, k)));
+    }
+}
+
 static void
 manager_deregister_device (BoltManager *mgr,
                            BoltDevice  *dev)
 {
+  const char *syspath = bolt_device_get_syspath (dev);
+  const char *uid = bolt_device_get_uid (dev);
   const char *opath;
 
+  if (g_hash_table_lookup (mgr->devices_by_uid, uid) == dev)
+    g_hash_table_remove (mgr->devices_by_uid, uid);
+
+  if (syspath && g_hash_table_lookup (mgr->devices_by_syspath, syspath) == dev)
+    g_hash_table_remove (mgr->devices_by_syspath, syspath);
+
+  manager_topo_unlink (mgr, dev);
+  g_hash_table_remove (mgr->topology, dev);
+
+  /* the array holds the reference, the indices borrow it */
   g_ptr_array_remove_fast (mgr->devices, dev);
 
   opath = bolt_device_get_object_path (dev);
@@ -1213,18 +1653,14 @@ static BoltDevice *
 manager_find_device_by_syspath (BoltManager *mgr,
                                 const char  *sysfs)
 {
+  BoltDevice *dev;
 
   g_return_val_if_fail (sysfs != NULL, NULL);
 
-  for (guint i = 0; i < mgr->devices->len; i++)
-    {
-      BoltDevice *dev = g_ptr_array_index (mgr->devices, i);
-      const char *have = bolt_device_get_syspath (dev);
-
-      if (bolt_streq (have, sysfs))
-        return g_object_ref (dev);
+  dev = g_hash_table_lookup (mgr->devices_by_syspath, sysfs);
 
-    }
+  if (dev != NULL)
+    return g_object_ref (dev);
 
   return NULL;
 }
@@ -1234,6 +1670,8 @@ manager_find_device_by_uid (BoltManager *mgr,
                             const char  *uid,
                             GError     **error)
 {
+  BoltDevice *dev;
+
   if (uid == NULL || uid[0] == '\0')
     {
       g_set_error_literal (error, G_IO_ERROR,
@@ -1242,14 +1680,16 @@ manager_find_device_by_uid (BoltManager *mgr,
       return NULL;
     }
 
-  for (guint i = 0; i < mgr->devices->len; i++)
-    {
-      BoltDevice *dev = g_ptr_array_index (mgr->devices, i);
+  dev = g_hash_table_lookup (mgr->devices_by_uid, uid);
 
-      if (bolt_streq (bolt_device_get_uid (dev), uid))
-        return g_object_ref (dev);
+  if (dev != NULL)
+    return g_object_ref (dev);
 
-    }
+  if (g_hash_table_contains (mgr->stubs, uid))
+    dev = manager_materialize_stub (mgr, uid);
+
+  if (dev != NULL)
+    return g_object_ref (dev);
 
   g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
                "device with id '%s' could not be found.",
@@ -1258,49 +1698,162 @@ manager_find_device_by_uid (BoltManager *mgr,
   return NULL;
 }
 
-
-static BoltDevice *
-bolt_manager_get_parent (BoltManager *mgr,
-                         BoltDevice  *dev)
+static gboolean
+manager_add_stub (BoltManager    *mgr,
+                  const char     *uid,
+                  BoltDeviceType *type,
+                  GError        **error)
 {
-  g_autofree char *path = NULL;
-  const char *syspath;
-  const char *start;
-  char *pos;
-
-  syspath = bolt_device_get_syspath (dev);
-  if (syspath == NULL)
-    return NULL;
+  g_autofree char *name = NULL;
+  g_autofree char *vendor = NULL;
+  BoltPolicy policy;
+  DeviceStub *stub;
+  gboolean ok;
 
-  path = g_strdup (syspath);
-  start = path + strlen ("/sys");
+  ok = bolt_store_peek_device (mgr->store, uid,
+                               &name, &vendor,
+                               type, &policy,
+                               error);
+  if (!ok)
+    return FALSE;
 
-  pos = strrchr (start, '/');
-  if (!pos || pos < start + 2)
-    return NULL;
+  stub = g_slice_new0 (DeviceStub);
+  stub->uid = g_strdup (uid);
+  stub->opath = bolt_gen_object_path (BOLT_DBUS_PATH_DEVICES, uid);
+  stub->node = g_path_get_basename (stub->opath);
+  stub->name = g_steal_pointer (&name);
+  stub->vendor = g_steal_pointer (&vendor);
+  stub->policy = policy;
 
-  *pos = '\0';
+  manager_remove_stub (mgr, uid);
+  g_hash_table_insert (mgr->stubs, stub->uid, stub);
+  g_hash_table_insert (mgr->stubs_by_node, stub->node, stub);
 
-  return manager_find_device_by_syspath (mgr, path);
+  return TRUE;
 }
 
-static GPtrArray *
-bolt_manager_get_children (BoltManager *mgr,
-                           BoltDevice  *target)
+static gboolean
+manager_remove_stub (BoltManager *mgr,
+                     const char  *uid)
 {
-  GPtrArray *res;
+  DeviceStub *stub;
 
-  res = g_ptr_array_new_with_free_func (g_object_unref);
+  stub = g_hash_table_lookup (mgr->stubs, uid);
 
-  for (guint i = 0; i < mgr->devices->len; i++)
-    {
-      g_autoptr(BoltDevice) parent = NULL;
-      BoltDevice *dev = g_ptr_array_index (mgr->devices, i);
+  if (stub == NULL)
+    return FALSE;
 
-      parent = bolt_manager_get_parent (mgr, dev);
-      if (parent != target)
-        continue;
+  g_hash_table_remove (mgr->stubs_by_node, stub->node);
+  /* NB: this frees the stub */
+  g_hash_table_remove (mgr->stubs, uid);
+
+  return TRUE;
+}
+
+static BoltDevice *
+manager_materialize_stub (BoltManager *mgr,
+                          const char  *id)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree char *uid = NULL;
+  GDBusConnection *bus;
+  BoltDevice *dev;
+  const char *opath;
+
+  /* NB: id might be owned by the stub */
+  uid = g_strdup (id);
+  manager_remove_stub (mgr, uid);
+
+  dev = bolt_store_get_device (mgr->store, uid, &err);
+  if (dev == NULL)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("store"),
+                     LOG_DIRECT (BOLT_LOG_DEVICE_UID, uid),
+                     "failed to load device (%.7s)", uid);
+      return NULL;
+    }
+
+  bolt_debug (LOG_DEV (dev), LOG_TOPIC ("store"), "materialized");
+  manager_register_device (mgr, dev);
+
+  /* if we have a valid dbus connection */
+  bus = bolt_exported_get_connection (BOLT_EXPORTED (mgr));
+  if (bus == NULL)
+    return dev;
+
+  opath = bolt_device_export (dev, bus, &err);
+  if (opath == NULL)
+    bolt_warn_err (err, LOG_DEV (dev), LOG_TOPIC ("dbus"), "error exporting");
+  else
+    bolt_info (LOG_DEV (dev), LOG_TOPIC ("dbus"),
+               "exported device at %.43s...", opath);
+
+  return dev;
+}
+
+
+static void
+manager_materialize_all (BoltManager *mgr)
+{
+  g_autoptr(GPtrArray) uids = NULL;
+  GHashTableIter iter;
+  DeviceStub *stub;
+
+  if (g_hash_table_size (mgr->stubs) == 0)
+    return;
+
+  uids = g_ptr_array_new_full (g_hash_table_size (mgr->stubs), g_free);
+
+  g_hash_table_iter_init (&iter, mgr->stubs);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stub))
+    g_ptr_array_add (uids, g_steal_pointer (&stub->uid));
+
+  /* drop all stubs in one go, the uids are owned by the array now */
+  g_hash_table_remove_all (mgr->stubs_by_node);
+  g_hash_table_remove_all (mgr->stubs);
+
+  for (guint i = 0; i < uids->len; i++)
+    manager_materialize_stub (mgr, g_ptr_array_index (uids, i));
+}
 
+
+static BoltDevice *
+bolt_manager_get_parent (BoltManager *mgr,
+                         BoltDevice  *dev)
+{
+  g_autofree char *path = NULL;
+  TopoNode *node;
+
+  node = g_hash_table_lookup (mgr->topology, dev);
+
+  if (node != NULL)
+    return node->parent ? g_object_ref (node->parent) : NULL;
+
+  /* not (yet) registered */
+  path = manager_topo_parent_path (bolt_device_get_syspath (dev));
+
+  if (path == NULL)
+    return NULL;
+
+  return manager_find_device_by_syspath (mgr, path);
+}
+
+static GPtrArray *
+bolt_manager_get_children (BoltManager *mgr,
+                           BoltDevice  *target)
+{
+  GPtrArray *res;
+  TopoNode *node;
+
+  res = g_ptr_array_new_with_free_func (g_object_unref);
+  node = g_hash_table_lookup (mgr->topology, target);
+
+  if (node == NULL)
+    return res;
+
+  for (guint i = 0; i < node->children->len; i++)
+    {
+      BoltDevice *dev = g_ptr_array_index (node->children, i);
       g_ptr_array_add (res, g_object_ref (dev));
     }
 
@@ -1314,6 +1867,8 @@ bolt_manager_label_device (BoltManager *mgr,
   g_autofree char *label = NULL;
   const char *name;
   const char *vendor;
+  GHashTableIter iter;
+  DeviceStub *stub;
   guint count = 0;
   static struct
   {
@@ -1340,6 +1895,14 @@ bolt_manager_label_device (BoltManager *mgr,
         count++;
     }
 
+  g_hash_table_iter_init (&iter, mgr->stubs);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stub))
+    {
+      if (bolt_streq (stub->name, name) &&
+          bolt_streq (stub->vendor, vendor))
+        count++;
+    }
+
   /* cleanup name: nicer display names for vendors  */
   for (guint i = 0; i < G_N_ELEMENTS (vendors); i++)
     if (bolt_streq (vendor, vendors[i].from))
@@ -1686,17 +2249,15 @@ manager_auto_enroll (BoltManager *mgr,
 
 /* udev callbacks */
 static void
-handle_uevent_udev (BoltUdev           *udev,
-                    const char         *action,
-                    struct udev_device *device,
-                    gpointer            user_data)
+manager_queue_uevent (BoltManager *mgr,
+                      BoltUEvent  *uevent)
 {
-  BoltManager *mgr;
+  struct udev_device *device = uevent->device;
+  const char *action = uevent->action;
   const char *subsystem;
   const char *devtype;
   const char *syspath;
-
-  mgr = BOLT_MANAGER (user_data);
+  UEvent *ev;
 
   devtype = udev_device_get_devtype (device);
   subsystem = udev_device_get_subsystem (device);
@@ -1716,10 +2277,189 @@ handle_uevent_udev (BoltUdev           *udev,
               subsystem, devtype ? "/" : "", devtype ? : "",
               syspath);
 
-  if (bolt_streq (devtype, "thunderbolt_device"))
-    handle_udev_device_event (mgr, device, action);
-  else if (bolt_streq (devtype, "thunderbolt_domain"))
-    handle_udev_domain_event (mgr, device, action);
+  if (!bolt_streq (devtype, "thunderbolt_device") &&
+      !bolt_streq (devtype, "thunderbolt_domain"))
+    return;
+
+  ev = g_slice_new (UEvent);
+  ev->action = g_strdup (action);
+  ev->device = udev_device_ref (device);
+  ev->seqnum = uevent->seqnum;
+  ev->seq = mgr->uevents_seq++;
+  ev->depth = 0;
+  ev->dropped = FALSE;
+
+  for (const char *c = syspath; *c; c++)
+    if (*c == '/')
+      ev->depth++;
+
+  g_ptr_array_add (mgr->uevents, ev);
+}
+
+static void
+handle_uevent_udev (BoltUdev  *udev,
+                    GPtrArray *uevents,
+                    gpointer   user_data)
+{
+  BoltManager *mgr = BOLT_MANAGER (user_data);
+  gint64 now;
+
+  for (guint i = 0; i < uevents->len; i++)
+    manager_queue_uevent (mgr, g_ptr_array_index (uevents, i));
+
+  if (mgr->uevents->len == 0)
+    return;
+
+  now = g_get_monotonic_time ();
+
+  /* every new event extends the window, up to its limit */
+  if (mgr->uevents_id == 0)
+    mgr->uevents_since = now;
+  else if (now - mgr->uevents_since < UEVENT_COALESCE_MAX_MS * BOLT_USEC_PER_MSEC)
+    g_clear_handle_id (&mgr->uevents_id, g_source_remove);
+
+  if (mgr->uevents_id == 0)
+    mgr->uevents_id = g_timeout_add (UEVENT_COALESCE_MS,
+                                     manager_process_uevents,
+                                     mgr);
+}
+
+static int
+uevent_compare_depth (gconstpointer a,
+                      gconstpointer b)
+{
+  const UEvent *ea = *((UEvent **) a);
+  const UEvent *eb = *((UEvent **) b);
+
+  if (ea->depth != eb->depth)
+    return ea->depth < eb->depth ? -1 : 1;
+
+  return ea->seq < eb->seq ? -1 : (ea->seq > eb->seq);
+}
+
+static void
+manager_coalesce_uevents (GPtrArray *events)
+{
+  g_autoptr(GHashTable) later = NULL;
+  guint dropped = 0;
+  guint n = 0;
+
+  /* walking backwards: a 'change' is superseded by a later
+   * 'change' or 'remove' for the same syspath, as long as
+   * there is no 'add' in between */
+  later = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (guint i = events->len; i > 0; i--)
+    {
+      UEvent *ev = g_ptr_array_index (events, i - 1);
+      const char *syspath = udev_device_get_syspath (ev->device);
+
+      if (g_str_equal (ev->action, "change"))
+        {
+          if (g_hash_table_contains (later, syspath))
+            {
+              ev->dropped = TRUE;
+              dropped++;
+              continue;
+            }
+
+          g_hash_table_add (later, (gpointer) syspath);
+        }
+      else if (g_str_equal (ev->action, "remove"))
+        {
+          g_hash_table_add (later, (gpointer) syspath);
+        }
+      else if (g_str_equal (ev->action, "add"))
+        {
+          g_hash_table_remove (later, syspath);
+        }
+    }
+
+  /* drop the superseded events in one go */
+  for (guint i = 0; dropped > 0 && i < events->len; i++)
+    {
+      UEvent *ev = g_ptr_array_index (events, i);
+
+      if (ev->dropped)
+        uevent_free (ev);
+      else
+        events->pdata[n++] = ev;
+    }
+
+  if (dropped > 0)
+    {
+      g_ptr_array_set_free_func (events, NULL);
+      g_ptr_array_set_size (events, n);
+      g_ptr_array_set_free_func (events, uevent_free);
+    }
+
+  /* within a run of 'add' events, parents come first; their
+   * syspath is a prefix of the one of their children */
+  for (guint i = 0; i < events->len; i++)
+    {
+      guint k = i;
+
+      while (k < events->len &&
+             g_str_equal (((UEvent *) g_ptr_array_index (events, k))->action, "add"))
+        k++;
+
+      if (k - i > 1)
+        qsort (events->pdata + i, k - i, sizeof (gpointer),
+               uevent_compare_depth);
+
+      i = MAX (i, k);
+    }
+
+  if (dropped > 0)
+    bolt_debug (LOG_TOPIC ("udev"), "coalesced %u change events", dropped);
+}
+
+static gboolean
+manager_process_uevents (gpointer user_data)
+{
+  g_autoptr(GPtrArray) events = NULL;
+  g_autoptr(GPtrArray) frozen = NULL;
+  BoltManager *mgr = user_data;
+
+  mgr->uevents_id = 0;
+
+  events = g_steal_pointer (&mgr->uevents);
+  mgr->uevents = g_ptr_array_new_with_free_func (uevent_free);
+
+  manager_coalesce_uevents (events);
+
+  bolt_debug (LOG_TOPIC ("udev"), "processing %u events", events->len);
+
+  /* property changes are collected, so that each object
+   * emits at most one PropertiesChanged for the batch */
+  frozen = g_ptr_array_new_full (mgr->devices->len + 1, g_object_unref);
+
+  g_ptr_array_add (frozen, g_object_ref (mgr));
+  for (guint i = 0; i < mgr->devices->len; i++)
+    g_ptr_array_add (frozen, g_object_ref (g_ptr_array_index (mgr->devices, i)));
+
+  for (guint i = 0; i < frozen->len; i++)
+    g_object_freeze_notify (g_ptr_array_index (frozen, i));
+
+  for (guint i = 0; i < events->len; i++)
+    {
+      UEvent *ev = g_ptr_array_index (events, i);
+      const char *devtype = udev_device_get_devtype (ev->device);
+
+      bolt_sysfs_cache_begin (ev->seqnum);
+
+      if (bolt_streq (devtype, "thunderbolt_device"))
+        handle_udev_device_event (mgr, ev->device, ev->action);
+      else if (bolt_streq (devtype, "thunderbolt_domain"))
+        handle_udev_domain_event (mgr, ev->device, ev->action);
+
+      bolt_sysfs_cache_end ();
+    }
+
+  for (guint i = 0; i < frozen->len; i++)
+    g_object_thaw_notify (g_ptr_array_index (frozen, i));
+
+  return G_SOURCE_REMOVE;
 }
 
 static void
@@ -1848,6 +2588,7 @@ handle_udev_device_event (BoltManager        *mgr,
     }
   else if (g_str_equal (action, "remove"))
     {
+      g_autoptr(GPtrArray) subtree = NULL;
       const char *name;
 
       /* filter out the domain controller */
@@ -1862,10 +2603,21 @@ handle_udev_device_event (BoltManager        *mgr,
       if (!dev)
         return;
 
-      if (bolt_device_get_stored (dev))
-        handle_udev_device_detached (mgr, dev);
-      else
-        handle_udev_device_removed (mgr, dev);
+      /* everything below the device is gone as well; the
+       * children are normally removed already, but if their
+       * events got lost, they are taken down first */
+      subtree = g_ptr_array_new_with_free_func (g_object_unref);
+      manager_topo_subtree (mgr, dev, subtree);
+
+      for (guint i = subtree->len; i > 0; i--)
+        {
+          BoltDevice *d = g_ptr_array_index (subtree, i - 1);
+
+          if (bolt_device_get_stored (d))
+            handle_udev_device_detached (mgr, d);
+          else
+            handle_udev_device_removed (mgr, d);
+        }
     }
 }
 
@@ -1964,11 +2716,14 @@ handle_udev_device_attached (BoltManager        *mgr,
                              struct udev_device *udev)
 {
   g_autoptr(BoltDevice) parent = NULL;
+  g_autofree char *old = NULL;
   const char *syspath;
   BoltStatus status;
 
+  old = g_strdup (bolt_device_get_syspath (dev));
   syspath = udev_device_get_syspath (udev);
   status = bolt_device_connected (dev, domain, udev);
+  manager_reindex_syspath (mgr, dev, old);
 
   bolt_msg (LOG_DEV (dev), "connected: %s (%s)",
             bolt_status_to_string (status), syspath);
@@ -1999,12 +2754,78 @@ static void
 handle_udev_device_detached (BoltManager *mgr,
                              BoltDevice  *dev)
 {
-  const char *syspath;
+  g_autofree char *old = NULL;
 
-  syspath = bolt_device_get_syspath (dev);
-  bolt_msg (LOG_DEV (dev), "disconnected (%s)", syspath);
+  old = g_strdup (bolt_device_get_syspath (dev));
+  bolt_msg (LOG_DEV (dev), "disconnected (%s)", old);
 
   bolt_device_disconnected (dev);
+  manager_reindex_syspath (mgr, dev, old);
+}
+
+static DeviceStub *
+manager_add_stored_stub (BoltManager *mgr,
+                         const char  *uid)
+{
+  g_autoptr(GError) err = NULL;
+  BoltDeviceType type;
+  DeviceStub *stub;
+  gboolean known;
+  gboolean ok;
+
+  known = g_hash_table_contains (mgr->stubs, uid);
+
+  ok = manager_add_stub (mgr, uid, &type, &err);
+  if (!ok)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("store"),
+                     LOG_DIRECT (BOLT_LOG_DEVICE_UID, uid),
+                     "failed to load device (%.7s)", uid);
+      return NULL;
+    }
+
+  stub = g_hash_table_lookup (mgr->stubs, uid);
+
+  bolt_msg (LOG_DEV_UID (uid), "added to store");
+
+  if (!known && bolt_exported_get_connection (BOLT_EXPORTED (mgr)))
+    bolt_exported_emit_signal (BOLT_EXPORTED (mgr),
+                               "DeviceAdded",
+                               g_variant_new ("(o)", stub->opath),
+                               NULL);
+
+  return stub;
+}
+
+static void
+manager_refresh_stored_device (BoltManager *mgr,
+                               BoltDevice  *dev)
+{
+  g_autoptr(BoltDevice) stored = NULL;
+  g_autoptr(GError) err = NULL;
+  const char *label;
+  const char *uid;
+
+  uid = bolt_device_get_uid (dev);
+  stored = bolt_store_get_device (mgr->store, uid, &err);
+
+  if (stored == NULL)
+    {
+      bolt_warn_err (err, LOG_DEV (dev), LOG_TOPIC ("store"),
+                     "failed to load stored device");
+      return;
+    }
+
+  g_object_set (dev,
+                "store", mgr->store,
+                "policy", bolt_device_get_policy (stored),
+                "key", bolt_device_get_keystate (stored),
+                "storetime", bolt_device_get_storetime (stored),
+                NULL);
+
+  label = bolt_device_get_label (stored);
+  if (label != NULL)
+    g_object_set (dev, "label", label, NULL);
 }
 
 static void
@@ -2012,15 +2833,38 @@ handle_store_device_added (BoltStore   *store,
                            const char  *uid,
                            BoltManager *mgr)
 {
-  g_autoptr(BoltDevice) dev = NULL;
   BoltDomain *dom = mgr->domains;
+  BoltPolicy policy;
+  BoltDevice *dev;
+
+  dev = g_hash_table_lookup (mgr->devices_by_uid, uid);
+
+  /* not added by us, but e.g. by provisioning tools or
+   * via an import; not loaded until it is needed */
+  if (dev == NULL)
+    {
+      DeviceStub *stub = manager_add_stored_stub (mgr, uid);
+
+      if (stub == NULL)
+        return;
 
-  dev = manager_find_device_by_uid (mgr, uid, NULL);
+      policy = stub->policy;
+    }
+  else
+    {
+      if (!bolt_device_get_stored (dev))
+        {
+          bolt_msg (LOG_DEV (dev), "added to store");
+          manager_refresh_stored_device (mgr, dev);
+        }
 
-  if (dev == NULL || dom == NULL)
+      policy = bolt_device_get_policy (dev);
+    }
+
+  if (dom == NULL)
     return;
 
-  if (bolt_device_get_policy (dev) != BOLT_POLICY_AUTO)
+  if (policy != BOLT_POLICY_AUTO)
     {
       bolt_info (LOG_TOPIC ("bootacl"),
                  LOG_DEV_UID (uid),
@@ -2028,7 +2872,37 @@ handle_store_device_added (BoltStore   *store,
       return;
     }
 
-  bolt_domain_foreach (dom, bolt_bootacl_add, dev);
+  bolt_domain_foreach (dom, bolt_bootacl_add_uid, (gpointer) uid);
+}
+
+static void
+handle_store_device_changed (BoltStore   *store,
+                             const char  *uid,
+                             BoltManager *mgr)
+{
+  g_autoptr(GError) err = NULL;
+  BoltDeviceType type;
+  BoltDevice *dev;
+  gboolean ok;
+
+  /* changed by other programs, e.g. label or policy */
+  if (g_hash_table_contains (mgr->stubs, uid))
+    {
+      ok = manager_add_stub (mgr, uid, &type, &err);
+
+      if (!ok)
+        bolt_warn_err (err, LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                       "failed to reload device");
+      return;
+    }
+
+  dev = g_hash_table_lookup (mgr->devices_by_uid, uid);
+
+  if (dev == NULL || !bolt_device_get_stored (dev))
+    return;
+
+  bolt_info (LOG_DEV (dev), LOG_TOPIC ("store"), "reloading");
+  manager_refresh_stored_device (mgr, dev);
 }
 
 static void
@@ -2039,12 +2913,37 @@ handle_store_device_removed (BoltStore   *store,
   g_autoptr(BoltDevice) dev = NULL;
   BoltDomain *dom = mgr->domains;
   BoltStatus status;
+  DeviceStub *stub;
+
+  /* never loaded, so just forget about it */
+  stub = g_hash_table_lookup (mgr->stubs, uid);
+
+  if (stub != NULL)
+    {
+      GDBusConnection *bus = bolt_exported_get_connection (BOLT_EXPORTED (mgr));
+
+      bolt_msg (LOG_DEV_UID (uid), "removed from store");
+
+      /* the path was handed out via ListDevices */
+      if (bus != NULL)
+        bolt_exported_emit_signal (BOLT_EXPORTED (mgr),
+                                   "DeviceRemoved",
+                                   g_variant_new ("(o)", stub->opath),
+                                   NULL);
+
+      bolt_domain_foreach (dom, bolt_bootacl_del_uid, (gpointer) uid);
+      manager_remove_stub (mgr, uid);
+      return;
+    }
 
-  dev = manager_find_device_by_uid (mgr, uid, NULL);
+  dev = g_hash_table_lookup (mgr->devices_by_uid, uid);
 
-  if (!dev)
+  if (dev == NULL)
     return;
 
+  /* the reference is dropped by manager_deregister_device */
+  g_object_ref (dev);
+
   bolt_msg (LOG_DEV (dev), "removed from store");
 
   /* TODO: maybe move to a new bolt_device_removed (dev) */
@@ -2136,6 +3035,16 @@ handle_device_generation_changed (BoltDevice  *dev,
   manager_maybe_set_generation (mgr, gen);
 }
 
+static void
+handle_store_reclaimed (GObject    *gobject,
+                        GParamSpec *pspec,
+                        gpointer    user_data)
+{
+  BoltManager *mgr = BOLT_MANAGER (user_data);
+
+  g_object_notify_by_pspec (G_OBJECT (mgr), props[PROP_RECLAIMED]);
+}
+
 static void
 handle_power_state_changed (GObject    *gobject,
                             GParamSpec *pspec,
@@ -2547,17 +3456,27 @@ handle_list_devices (BoltExported          *obj,
                      GError               **error)
 {
   BoltManager *mgr = BOLT_MANAGER (obj);
+  GHashTableIter iter;
+  DeviceStub *stub;
   const char **devs;
+  guint n = 0;
 
-  devs = g_newa (const char *, mgr->devices->len + 1);
+  devs = g_newa (const char *,
+                 mgr->devices->len + g_hash_table_size (mgr->stubs) + 1);
 
   for (guint i = 0; i < mgr->devices->len; i++)
     {
       BoltDevice *d = g_ptr_array_index (mgr->devices, i);
-      devs[i] = bolt_device_get_object_path (d);
+      devs[n++] = bolt_device_get_object_path (d);
     }
 
-  devs[mgr->devices->len] = NULL;
+  /* stubs are materialized on first access via the
+   * devices subtree, see manager_subtree_dispatch */
+  g_hash_table_iter_init (&iter, mgr->stubs);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stub))
+    devs[n++] = stub->opath;
+
+  devs[n] = NULL;
 
   return g_variant_new ("(^ao)", devs);
 }
@@ -2747,6 +3666,433 @@ handle_forget_device (BoltExported          *obj,
   return ok ? g_variant_new ("()") : NULL;
 }
 
+static int
+store_archive_get_fd (GDBusMethodInvocation *inv,
+                      GVariant              *params,
+                      GError               **error)
+{
+  GDBusMessage *msg;
+  GUnixFDList *fds;
+  gint32 idx;
+
+  g_variant_get_child (params, 0, "h", &idx);
+
+  msg = g_dbus_method_invocation_get_message (inv);
+  fds = g_dbus_message_get_unix_fd_list (msg);
+
+  if (fds == NULL || idx < 0 || idx >= g_unix_fd_list_get_length (fds))
+    {
+      g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                           "missing file descriptor");
+      return -1;
+    }
+
+  return g_unix_fd_list_get (fds, idx, error);
+}
+
+/* the archive is exchanged with the client via a file
+ * descriptor, which might be a pipe or a terminal; so the
+ * actual I/O is done in a thread, one chunk at a time,
+ * while the store is only used from the main thread: the
+ * export produces the next chunk once the previous one was
+ * written and the import is fed each chunk once it was
+ * read, so at most one chunk is in memory */
+#define ARCHIVE_CHUNK (64 * 1024) /* in bytes */
+
+typedef struct ArchiveIO
+{
+  BoltManager           *mgr;
+  GDBusMethodInvocation *inv;
+  int                    fd;
+  BoltStoreExport       *exp;
+  BoltStoreImport       *imp;
+  GBytes                *data; /* the current chunk */
+  gboolean               done;
+} ArchiveIO;
+
+static void
+archive_io_free (gpointer data)
+{
+  ArchiveIO *aio = data;
+
+  if (aio->fd > -1)
+    (void) bolt_close (aio->fd, NULL);
+
+  g_clear_pointer (&aio->exp, bolt_store_export_free);
+  g_clear_pointer (&aio->imp, bolt_store_import_free);
+  g_clear_pointer (&aio->data, g_bytes_unref);
+  g_object_unref (aio->inv);
+  g_object_unref (aio->mgr);
+  g_slice_free (ArchiveIO, aio);
+}
+
+static ArchiveIO *
+archive_io_new (BoltManager           *mgr,
+                GDBusMethodInvocation *inv,
+                int                    fd)
+{
+  ArchiveIO *aio = g_slice_new0 (ArchiveIO);
+
+  aio->mgr = g_object_ref (mgr);
+  aio->inv = g_object_ref (inv);
+  aio->fd = fd;
+
+  return aio;
+}
+
+static void
+archive_io_fail (ArchiveIO  *aio,
+                 const char *what,
+                 GError     *error)
+{
+  bolt_warn_err (error, LOG_TOPIC ("store"), "failed to %s archive", what);
+  g_dbus_method_invocation_return_gerror (aio->inv, error);
+  archive_io_free (aio);
+}
+
+static void
+archive_io_run (ArchiveIO          *aio,
+                GTaskThreadFunc     func,
+                GAsyncReadyCallback callback)
+{
+  g_autoptr(GTask) task = NULL;
+
+  /* the chunk is handed over, i.e. only one thread at a
+   * time uses 'aio', which is owned by the callback */
+  task = g_task_new (aio->mgr, NULL, callback, aio);
+  g_task_set_task_data (task, aio, NULL);
+  g_task_run_in_thread (task, func);
+}
+
+static void
+archive_write_thread (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+  g_autoptr(GError) err = NULL;
+  ArchiveIO *aio = task_data;
+  gconstpointer data;
+  gboolean ok;
+  gsize len;
+
+  data = g_bytes_get_data (aio->data, &len);
+  ok = bolt_write_all (aio->fd, data, len, &err);
+
+  if (ok && aio->done)
+    ok = bolt_close (bolt_steal (&aio->fd, -1), &err);
+
+  if (!ok)
+    g_task_return_error (task, g_steal_pointer (&err));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+archive_read_thread (GTask        *task,
+                     gpointer      source_object,
+                     gpointer      task_data,
+                     GCancellable *cancellable)
+{
+  g_autoptr(GError) err = NULL;
+  ArchiveIO *aio = task_data;
+  gboolean ok;
+  char *buf;
+  gsize n;
+
+  buf = g_malloc (ARCHIVE_CHUNK);
+  ok = bolt_read_all (aio->fd, buf, ARCHIVE_CHUNK, &n, &err);
+
+  if (!ok)
+    {
+      g_free (buf);
+      g_task_return_error (task, g_steal_pointer (&err));
+      return;
+    }
+
+  aio->data = g_bytes_new_take (buf, n);
+  g_task_return_boolean (task, TRUE);
+}
+
+static void     export_store_written (GObject      *object,
+                                      GAsyncResult *res,
+                                      gpointer      user_data);
+
+static void
+export_store_next (ArchiveIO *aio)
+{
+  g_autoptr(GOutputStream) out = NULL;
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+
+  out = g_memory_output_stream_new_resizable ();
+  ok = bolt_store_export_step (aio->exp, out, &aio->done, &err);
+
+  if (ok)
+    ok = g_output_stream_close (out, NULL, &err);
+
+  if (!ok)
+    {
+      archive_io_fail (aio, "export", err);
+      return;
+    }
+
+  g_clear_pointer (&aio->data, g_bytes_unref);
+  aio->data = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (out));
+
+  archive_io_run (aio, archive_write_thread, export_store_written);
+}
+
+static void
+export_store_written (GObject      *object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  g_autoptr(GError) err = NULL;
+  ArchiveIO *aio = user_data;
+  gboolean ok;
+  guint count;
+
+  ok = g_task_propagate_boolean (G_TASK (res), &err);
+
+  if (!ok)
+    {
+      archive_io_fail (aio, "write", err);
+      return;
+    }
+  else if (!aio->done)
+    {
+      export_store_next (aio);
+      return;
+    }
+
+  count = bolt_store_export_get_count (aio->exp);
+  bolt_info (LOG_TOPIC ("store"), "exported %u records", count);
+
+  g_dbus_method_invocation_return_value (aio->inv,
+                                         g_variant_new ("(u)", count));
+  archive_io_free (aio);
+}
+
+static void
+import_store_read (GObject      *object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  g_autoptr(GError) err = NULL;
+  ArchiveIO *aio = user_data;
+  gconstpointer data;
+  gboolean ok;
+  guint count = 0;
+  gsize len;
+
+  ok = g_task_propagate_boolean (G_TASK (res), &err);
+
+  if (!ok)
+    {
+      archive_io_fail (aio, "read", err);
+      return;
+    }
+
+  data = g_bytes_get_data (aio->data, &len);
+
+  if (len > 0)
+    ok = bolt_store_import_feed (aio->imp, data, len, &err);
+
+  g_clear_pointer (&aio->data, g_bytes_unref);
+
+  if (ok && len > 0)
+    {
+      archive_io_run (aio, archive_read_thread, import_store_read);
+      return;
+    }
+
+  if (ok)
+    ok = bolt_store_import_finish (aio->imp, &count, &err);
+
+  if (!ok)
+    {
+      archive_io_fail (aio, "import", err);
+      return;
+    }
+
+  g_dbus_method_invocation_return_value (aio->inv,
+                                         g_variant_new ("(u)", count));
+  archive_io_free (aio);
+}
+
+static GVariant *
+handle_export_store (BoltExported          *obj,
+                     GVariant              *params,
+                     GDBusMethodInvocation *inv,
+                     GError               **error)
+{
+  g_auto(GStrv) names = NULL;
+  BoltStoreExportFlags flags = BOLT_STORE_EXPORT_NONE;
+  BoltManager *mgr;
+  ArchiveIO *aio;
+  const char *str;
+  int fd;
+
+  mgr = BOLT_MANAGER (obj);
+
+  g_variant_get_child (params, 1, "&s", &str);
+  names = g_strsplit (str, "|", -1);
+
+  for (guint i = 0; names[i] != NULL; i++)
+    {
+      const char *name = g_strstrip (names[i]);
+
+      if (bolt_streq (name, "keys"))
+        flags |= BOLT_STORE_EXPORT_KEYS;
+      else if (!bolt_strzero (name))
+        {
+          g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                       "invalid flag: %s", name);
+          return NULL;
+        }
+    }
+
+  fd = store_archive_get_fd (inv, params, error);
+  if (fd < 0)
+    return NULL;
+
+  aio = archive_io_new (mgr, inv, fd);
+  aio->exp = bolt_store_export_new (mgr->store, flags);
+
+  export_store_next (aio);
+
+  /* reply is sent once the last chunk was written */
+  return NULL;
+}
+
+static GVariant *
+handle_import_store (BoltExported          *obj,
+                     GVariant              *params,
+                     GDBusMethodInvocation *inv,
+                     GError               **error)
+{
+  g_autoptr(BoltStoreImport) imp = NULL;
+  BoltManager *mgr;
+  ArchiveIO *aio;
+  int fd;
+
+  mgr = BOLT_MANAGER (obj);
+
+  imp = bolt_store_import_new (mgr->store, error);
+  if (imp == NULL)
+    return NULL;
+
+  fd = store_archive_get_fd (inv, params, error);
+  if (fd < 0)
+    return NULL;
+
+  aio = archive_io_new (mgr, inv, fd);
+  aio->imp = g_steal_pointer (&imp);
+
+  archive_io_run (aio, archive_read_thread, import_store_read);
+
+  /* reply is sent once the last chunk was imported */
+  return NULL;
+}
+
+/* stubs are listed under the devices path before they are
+ * materialized; the subtree is only consulted for paths that
+ * have no object registered, i.e. for stubs */
+static char **
+manager_subtree_enumerate (GDBusConnection *connection,
+                           const char      *sender,
+                           const char      *object_path,
+                           gpointer         user_data)
+{
+  BoltManager *mgr = BOLT_MANAGER (user_data);
+  GHashTableIter iter;
+  DeviceStub *stub;
+  GPtrArray *nodes;
+
+  nodes = g_ptr_array_new ();
+
+  for (guint i = 0; i < mgr->devices->len; i++)
+    {
+      BoltDevice *dev = g_ptr_array_index (mgr->devices, i);
+      const char *opath = bolt_device_get_object_path (dev);
+
+      if (opath != NULL)
+        g_ptr_array_add (nodes, g_path_get_basename (opath));
+    }
+
+  g_hash_table_iter_init (&iter, mgr->stubs);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stub))
+    g_ptr_array_add (nodes, g_strdup (stub->node));
+
+  g_ptr_array_add (nodes, NULL);
+
+  return (char **) g_ptr_array_free (nodes, FALSE);
+}
+
+static GDBusInterfaceInfo **
+manager_subtree_introspect (GDBusConnection *connection,
+                            const char      *sender,
+                            const char      *object_path,
+                            const char      *node,
+                            gpointer         user_data)
+{
+  BoltManager *mgr = BOLT_MANAGER (user_data);
+  GDBusInterfaceInfo **infos;
+  BoltExportedClass *klass;
+
+  if (node == NULL || !g_hash_table_contains (mgr->stubs_by_node, node))
+    return NULL;
+
+  klass = g_type_class_ref (BOLT_TYPE_DEVICE);
+
+  infos = g_new0 (GDBusInterfaceInfo *, 2);
+  infos[0] = bolt_exported_class_get_interface_info (klass);
+  g_dbus_interface_info_ref (infos[0]);
+
+  g_type_class_unref (klass);
+
+  return infos;
+}
+
+static const GDBusInterfaceVTable *
+manager_subtree_dispatch (GDBusConnection *connection,
+                          const char      *sender,
+                          const char      *object_path,
+                          const char      *interface_name,
+                          const char      *node,
+                          gpointer        *out_user_data,
+                          gpointer         user_data)
+{
+  BoltManager *mgr = BOLT_MANAGER (user_data);
+  DeviceStub *stub;
+  BoltDevice *dev;
+
+  stub = g_hash_table_lookup (mgr->stubs_by_node, node);
+
+  if (stub == NULL)
+    return NULL;
+
+  bolt_debug (LOG_DEV_UID (stub->uid), LOG_TOPIC ("dbus"),
+              "stub accessed by %s", sender);
+
+  /* this will also export the device, so any further
+   * calls will directly go to the registered object */
+  dev = manager_materialize_stub (mgr, stub->uid);
+
+  if (dev == NULL)
+    return NULL;
+
+  *out_user_data = dev;
+  return bolt_exported_class_get_vtable (BOLT_EXPORTED_GET_CLASS (dev));
+}
+
+static GDBusSubtreeVTable manager_subtree_vtable = {
+  manager_subtree_enumerate,
+  manager_subtree_introspect,
+  manager_subtree_dispatch,
+};
+
 /* public methods */
 gboolean
 bolt_manager_export (BoltManager     *mgr,
@@ -2797,6 +4143,25 @@ bolt_manager_export (BoltManager     *mgr,
                  "exported device at %.43s...", opath);
     }
 
+  mgr->stubs_subtree =
+    g_dbus_connection_register_subtree (connection,
+                                        BOLT_DBUS_PATH_DEVICES,
+                                        &manager_subtree_vtable,
+                                        G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES,
+                                        mgr,
+                                        NULL,
+                                        &err);
+
+  if (mgr->stubs_subtree == 0)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("dbus"),
+                     "failed to register device subtree");
+      g_clear_error (&err);
+
+      /* fall back to exporting all stored devices */
+      manager_materialize_all (mgr);
+    }
+
   return TRUE;
 }
 
@@ -2832,3 +4197,19 @@ bolt_manager_got_the_name (BoltManager *mgr)
                                  NULL);
     }
 }
+
+void
+bolt_manager_flush (BoltManager *mgr)
+{
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+
+  g_return_if_fail (BOLT_IS_MANAGER (mgr));
+
+  bolt_debug (LOG_TOPIC ("store"), "flushing pending changes");
+
+  ok = bolt_store_flush (mgr->store, &err);
+
+  if (!ok)
+    bolt_warn_err (err, LOG_TOPIC ("store"), "failed to flush store");
+}
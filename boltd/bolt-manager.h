@@ -33,4 +33,6 @@ gboolean         bolt_manager_export (BoltManager     *mgr,
 
 void             bolt_manager_got_the_name (BoltManager *mgr);
 
+void             bolt_manager_flush (BoltManager *mgr);
+
 G_END_DECLS
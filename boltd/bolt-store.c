@@ -29,11 +29,29 @@
 #include "bolt-str.h"
 #include "bolt-time.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* ************************************  */
 /* BoltStore */
 
+#define SNAPSHOT_FILE "snapshot"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_DELAY 5 /* in seconds */
+#define SNAPSHOT_TYPE "(uata(ssssiiutiutt)a(sas))"
+
+#define TIMES_FLUSH_DELAY 1 /* in seconds */
+#define TIMES_RETRY_DELAY 30 /* in seconds, after a failed flush */
+#define TIMES_DB_FILE "times.db"
+
+/* first version with the times database */
+#define STORE_VERSION_TIMESDB 2
+
 static void     bolt_store_initable_iface_init (GInitableIface *iface);
 
 
@@ -44,6 +62,114 @@ static gboolean bolt_store_initialize (GInitable    *initable,
 static gboolean bolt_store_init_store (DIR     *root,
                                        GError **error);
 
+/* sub-directories, opened on demand */
+typedef enum StoreDir {
+  STORE_DIR_DEVICES = 0,
+  STORE_DIR_KEYS,
+  STORE_DIR_DOMAINS,
+  STORE_DIR_TIMES,
+
+  STORE_DIR_LAST
+} StoreDir;
+
+static const char *store_dir_names[STORE_DIR_LAST] = {
+  "devices",
+  "keys",
+  "domains",
+  "times"
+};
+
+static int          store_dirfd (BoltStore *store,
+                                 StoreDir   dir,
+                                 gboolean   create,
+                                 GError   **error);
+
+static void         store_dirfd_close (BoltStore *store,
+                                       StoreDir   dir);
+
+/* in-memory index */
+typedef enum StoreTime {
+  STORE_TIME_CONN = 0,
+  STORE_TIME_AUTH,
+
+  STORE_TIME_LAST
+} StoreTime;
+
+typedef struct StoreDevice
+{
+  char          *uid;
+  char          *name;
+  char          *vendor;
+  char          *label;
+  BoltDeviceType type;
+  BoltPolicy     policy;
+  guint          gen;
+  guint64        stime;
+  BoltKeyState   key;
+
+  /* timestamps, 'tflags' indicates which are set */
+  guint          tflags;
+  guint64        times[STORE_TIME_LAST];
+} StoreDevice;
+
+typedef struct StoreDomain
+{
+  char *uid;
+  GStrv bootacl;
+} StoreDomain;
+
+/* timestamps waiting to be written to disk */
+typedef struct StorePending
+{
+  char   *uid;
+  guint   tflags;
+  guint64 times[STORE_TIME_LAST];
+} StorePending;
+
+static void         store_device_free (gpointer data);
+
+static void         store_domain_free (gpointer data);
+
+static void         store_pending_free (gpointer data);
+
+static void         store_tdb_close (BoltStore *store);
+
+static gboolean     store_times_flush (BoltStore *store,
+                                       GError   **error);
+
+static gboolean     store_times_flush_timeout (gpointer user_data);
+
+static void         store_index_setup (BoltStore *store);
+
+static void         store_index_invalidate (BoltStore *store);
+
+static void         store_index_changed (BoltStore *store);
+
+static gboolean     store_index_write_snapshot (BoltStore *store,
+                                                GError   **error);
+
+/* transactions */
+typedef struct StoreTxn StoreTxn;
+
+static void         store_txn_recover (BoltStore *store,
+                                       DIR       *root);
+
+/* change detection */
+static void         store_watch_setup (BoltStore *store);
+
+static void         store_watch_close (BoltStore *store);
+
+static void         store_own_record (BoltStore  *store,
+                                      const char *path);
+
+static void         store_own_record_file (BoltStore *store,
+                                           GFile     *file);
+
+/* garbage collection */
+typedef struct StoreGc StoreGc;
+
+static void         store_gc_free (StoreGc *gc);
+
 struct _BoltStore
 {
   GObject object;
@@ -54,7 +180,47 @@ struct _BoltStore
   GFile  *keys;
   GFile  *times;
 
+  /* directory handles for the *at () calls */
+  int     rootfd;
+  int     dirfds[STORE_DIR_LAST];
+
   guint   version;
+
+  /* index */
+  GHashTable *devidx;       /* uid -> StoreDevice */
+  GHashTable *domidx;       /* uid -> StoreDomain */
+  GHashTable *keyset;       /* uids with a key, NULL if unknown */
+  GFile      *snapshot;
+  gboolean    have_snapshot; /* snapshot on disk is current */
+  gboolean    dirty;         /* index changed since snapshot */
+  guint       snapshot_id;   /* timeout source for writing */
+
+  /* write-behind queue for timestamps */
+  GHashTable *pending;      /* uid -> StorePending */
+  guint       flush_id;     /* timeout source for flushing */
+
+  /* times database */
+  GFile      *timesdb;
+  int         tdb;          /* fd, opened on demand */
+  guint       tdb_count;    /* number of records */
+  guint       tdb_serial;   /* bumped on every change */
+
+  /* active transaction, if any */
+  StoreTxn   *txn;
+
+  /* change detection */
+  int         ifd;          /* inotify fd */
+  int         wdroot;
+  int         wds[4];       /* devices, keys, domains, times */
+  guint       watch;        /* io watch source */
+  GHashTable *changed;      /* uid -> mask of changed dirs */
+  guint       changed_id;   /* timeout source for re-loading */
+  GHashTable *own;          /* path -> StoreStamp, of our writes */
+
+  /* garbage collection */
+  StoreGc    *gc;           /* state of the running pass */
+  guint       gc_id;        /* idle source */
+  guint       reclaimed;    /* total number of removed entries */
 };
 
 
@@ -63,6 +229,7 @@ enum {
 
   PROP_ROOT,
   PROP_VERSION,
+  PROP_RECLAIMED,
 
   PROP_STORE_LAST
 };
@@ -73,6 +240,7 @@ static GParamSpec *store_props[PROP_STORE_LAST] = { NULL, };
 enum {
   SIGNAL_DEVICE_ADDED,
   SIGNAL_DEVICE_REMOVED,
+  SIGNAL_DEVICE_CHANGED,
   SIGNAL_LAST
 };
 
@@ -89,8 +257,67 @@ G_DEFINE_TYPE_WITH_CODE (BoltStore,
 static void
 bolt_store_finalize (GObject *object)
 {
+  g_autoptr(GError) err = NULL;
   BoltStore *store = BOLT_STORE (object);
 
+  if (store->snapshot_id > 0)
+    {
+      g_source_remove (store->snapshot_id);
+      store->snapshot_id = 0;
+    }
+
+  if (store->flush_id > 0)
+    {
+      g_source_remove (store->flush_id);
+      store->flush_id = 0;
+    }
+
+  store_watch_close (store);
+  g_clear_pointer (&store->changed, g_hash_table_unref);
+  g_clear_pointer (&store->own, g_hash_table_unref);
+
+  if (store->gc_id > 0)
+    {
+      g_source_remove (store->gc_id);
+      store->gc_id = 0;
+    }
+
+  g_clear_pointer (&store->gc, store_gc_free);
+
+  if (store->txn != NULL)
+    {
+      bolt_warn (LOG_TOPIC ("store"), "aborting pending transaction");
+      bolt_store_abort (store);
+    }
+
+  if (!bolt_store_flush (store, &err))
+    bolt_warn_err (err, LOG_TOPIC ("store"), "failed to flush");
+
+  /* a failed flush re-arms the timer */
+  if (store->flush_id > 0)
+    {
+      bolt_warn (LOG_TOPIC ("store"),
+                 "dropping unwritten timestamps of %u devices",
+                 g_hash_table_size (store->pending));
+      g_source_remove (store->flush_id);
+      store->flush_id = 0;
+    }
+
+  store_tdb_close (store);
+  g_clear_object (&store->timesdb);
+
+  for (guint i = 0; i < STORE_DIR_LAST; i++)
+    store_dirfd_close (store, i);
+
+  if (store->rootfd > -1)
+    (void) close (bolt_steal (&store->rootfd, -1));
+
+  g_clear_pointer (&store->pending, g_hash_table_unref);
+  g_clear_pointer (&store->devidx, g_hash_table_unref);
+  g_clear_pointer (&store->domidx, g_hash_table_unref);
+  g_clear_pointer (&store->keyset, g_hash_table_unref);
+  g_clear_object (&store->snapshot);
+
   g_clear_object (&store->root);
   g_clear_object (&store->domains);
   g_clear_object (&store->devices);
@@ -103,6 +330,29 @@ bolt_store_finalize (GObject *object)
 static void
 bolt_store_init (BoltStore *store)
 {
+  store->devidx = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         NULL, store_device_free);
+
+  store->domidx = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         NULL, store_domain_free);
+
+  store->pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          NULL, store_pending_free);
+
+  store->tdb = -1;
+
+  store->rootfd = -1;
+  for (guint i = 0; i < STORE_DIR_LAST; i++)
+    store->dirfds[i] = -1;
+
+  store->changed = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, NULL);
+  store->own = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                      g_free, g_free);
+  store->ifd = -1;
+  store->wdroot = -1;
+  for (guint i = 0; i < G_N_ELEMENTS (store->wds); i++)
+    store->wds[i] = -1;
 }
 
 static void
@@ -123,6 +373,10 @@ bolt_store_get_property (GObject    *object,
       g_value_set_uint (value, store->version);
       break;
 
+    case PROP_RECLAIMED:
+      g_value_set_uint (value, store->reclaimed);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -163,6 +417,9 @@ bolt_store_constructed (GObject *obj)
   store->domains = g_file_get_child (store->root, "domains");
   store->keys = g_file_get_child (store->root, "keys");
   store->times = g_file_get_child (store->root, "times");
+
+  store->snapshot = g_file_get_child (store->root, SNAPSHOT_FILE);
+  store->timesdb = g_file_get_child (store->root, TIMES_DB_FILE);
 }
 
 static void
@@ -191,6 +448,13 @@ bolt_store_class_init (BoltStoreClass *klass)
                        G_PARAM_READABLE |
                        G_PARAM_STATIC_STRINGS);
 
+  store_props[PROP_RECLAIMED] =
+    g_param_spec_uint ("reclaimed",
+                       NULL, NULL,
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE |
+                       G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (gobject_class,
                                      PROP_STORE_LAST,
                                      store_props);
@@ -214,6 +478,17 @@ bolt_store_class_init (BoltStoreClass *klass)
                   NULL,
                   G_TYPE_NONE,
                   1, G_TYPE_STRING);
+
+  /* only emitted for changes made by other programs */
+  signals[SIGNAL_DEVICE_CHANGED] =
+    g_signal_new ("device-changed",
+                  G_TYPE_FROM_CLASS (gobject_class),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  1, G_TYPE_STRING);
 }
 
 static void
@@ -243,6 +518,12 @@ bolt_store_initialize (GInitable    *initable,
   if (!ok)
     return FALSE;
 
+  store->rootfd = bolt_openat (dirfd (root), ".",
+                               O_PATH | O_DIRECTORY | O_CLOEXEC,
+                               0, error);
+  if (store->rootfd < 0)
+    return FALSE;
+
   ok = bolt_read_uint_at (dirfd (root),
                           "version",
                           &store->version,
@@ -251,6 +532,12 @@ bolt_store_initialize (GInitable    *initable,
   if (!ok && !bolt_err_notfound (err))
     return bolt_error_propagate (error, &err);
 
+  store_txn_recover (store, root);
+
+  store_index_setup (store);
+
+  store_watch_setup (store);
+
   return TRUE;
 }
 
@@ -292,197 +579,3978 @@ bolt_store_init_store (DIR     *root,
   return ok;
 }
 
-/* public methods */
+/* index entries */
+static void
+store_device_free (gpointer data)
+{
+  StoreDevice *dev = data;
 
-BoltStore *
-bolt_store_new (const char *path, GError **error)
+  g_free (dev->uid);
+  g_free (dev->name);
+  g_free (dev->vendor);
+  g_free (dev->label);
+
+  g_slice_free (StoreDevice, dev);
+}
+
+static void
+store_domain_free (gpointer data)
 {
-  g_autoptr(GFile) root = NULL;
-  BoltStore *store;
+  StoreDomain *dom = data;
 
-  root = g_file_new_for_path (path);
-  store = g_initable_new (BOLT_TYPE_STORE,
-                          NULL, error,
-                          "root", root,
-                          NULL);
-  return store;
+  g_free (dom->uid);
+  g_strfreev (dom->bootacl);
+
+  g_slice_free (StoreDomain, dom);
 }
 
-guint
-bolt_store_get_version (BoltStore *store)
+static const char *store_time_names[STORE_TIME_LAST] = {
+  [STORE_TIME_CONN] = "conntime",
+  [STORE_TIME_AUTH] = "authtime",
+};
+
+static int
+store_time_from_string (const char *timesel)
 {
-  g_return_val_if_fail (BOLT_IS_STORE (store), 0);
+  if (bolt_streq (timesel, "conntime"))
+    return STORE_TIME_CONN;
+  else if (bolt_streq (timesel, "authtime"))
+    return STORE_TIME_AUTH;
 
-  return store->version;
+  return -1;
 }
 
-GKeyFile *
-bolt_store_config_load (BoltStore *store,
-                        GError   **error)
+/* times database
+ *
+ * All well-known timestamps are kept in a single file with
+ * fixed sized records, sorted by uid, so that entries can
+ * be found via binary search and updated in place.
+ * All integers are stored in little endian byte order.
+ */
+#define TIMES_DB_MAGIC "BOLTTDB"
+#define TIMES_DB_VERSION 1
+#define TIMES_DB_UID_MAX 64
+
+typedef struct TimesHeader
 {
-  g_autoptr(GKeyFile) kf = NULL;
-  g_autoptr(GFile) sf = NULL;
-  g_autofree char *data  = NULL;
-  gboolean ok;
-  gsize len;
+  char    magic[8];
+  guint32 version;
+  guint32 count;
+} TimesHeader;
 
-  g_return_val_if_fail (store != NULL, NULL);
-  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+typedef struct TimesRecord
+{
+  char    uid[TIMES_DB_UID_MAX];
+  guint32 tflags;
+  guint32 reserved;
+  guint64 times[STORE_TIME_LAST];
+} TimesRecord;
 
-  sf = g_file_get_child (store->root, CFG_FILE);
-  ok = g_file_load_contents (sf, NULL,
-                             &data, &len,
-                             NULL,
-                             error);
+G_STATIC_ASSERT (sizeof (TimesHeader) == 16);
+G_STATIC_ASSERT (sizeof (TimesRecord) == 88);
 
-  if (!ok)
-    return NULL;
+#define times_record_offset(pos) \
+  ((off_t) sizeof (TimesHeader) + (off_t) (pos) * (off_t) sizeof (TimesRecord))
 
-  kf = g_key_file_new ();
-  ok = g_key_file_load_from_data (kf, data, len, G_KEY_FILE_NONE, error);
+static inline gboolean
+store_times_in_db (BoltStore *store)
+{
+  return store->version >= STORE_VERSION_TIMESDB;
+}
 
-  if (!ok)
-    return NULL;
+static void
+times_record_swap (TimesRecord *rec)
+{
+  /* to and from little endian, a no-op on most machines */
+  rec->tflags = GUINT32_TO_LE (rec->tflags);
+  rec->reserved = GUINT32_TO_LE (rec->reserved);
 
-  return g_steal_pointer (&kf);
+  for (guint i = 0; i < STORE_TIME_LAST; i++)
+    rec->times[i] = GUINT64_TO_LE (rec->times[i]);
 }
 
-gboolean
-bolt_store_config_save (BoltStore *store,
-                        GKeyFile  *config,
-                        GError   **error)
+static gint
+times_record_compare (gconstpointer a,
+                      gconstpointer b)
 {
-  g_autoptr(GFile) sf = NULL;
-  g_autofree char *data  = NULL;
-  gboolean ok;
-  gsize len;
+  const TimesRecord *ra = a;
+  const TimesRecord *rb = b;
 
-  g_return_val_if_fail (store != NULL, FALSE);
-  g_return_val_if_fail (config != NULL, FALSE);
-  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  return strncmp (ra->uid, rb->uid, TIMES_DB_UID_MAX);
+}
 
-  sf = g_file_get_child (store->root, CFG_FILE);
-  data = g_key_file_to_data (config, &len, error);
+static void
+store_tdb_close (BoltStore *store)
+{
+  if (store->tdb < 0)
+    return;
 
-  if (!data)
-    return FALSE;
+  (void) close (store->tdb);
+  store->tdb = -1;
+  store->tdb_count = 0;
+}
 
-  ok = g_file_replace_contents (sf,
-                                data, len,
-                                NULL, FALSE,
-                                0,
-                                NULL,
-                                NULL, error);
+static gboolean
+store_tdb_write_header (int      fd,
+                        guint    count,
+                        GError **error)
+{
+  TimesHeader hdr = {TIMES_DB_MAGIC, };
 
-  return ok;
+  hdr.version = GUINT32_TO_LE (TIMES_DB_VERSION);
+  hdr.count = GUINT32_TO_LE (count);
+
+  return bolt_pwrite_all (fd, &hdr, sizeof (hdr), 0, error);
 }
 
-GStrv
-bolt_store_list_uids (BoltStore  *store,
-                      const char *type,
-                      GError    **error)
+static gboolean
+store_tdb_check_header (int      fd,
+                        gsize    size,
+                        guint   *count,
+                        GError **error)
 {
-  g_autoptr(GError) err = NULL;
-  g_autoptr(GDir) dir   = NULL;
-  g_autoptr(GPtrArray) ids = NULL;
-  g_autofree char *path = NULL;
-  const char *name;
+  TimesHeader hdr;
+  gboolean ok;
+  gsize n;
 
-  g_return_val_if_fail (BOLT_IS_STORE (store), NULL);
-  g_return_val_if_fail (type != NULL, NULL);
-  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+  ok = bolt_pread_all (fd, &hdr, sizeof (hdr), 0, &n, error);
 
-  if (bolt_streq (type, "devices"))
-    path = g_file_get_path (store->devices);
-  if (bolt_streq (type, "domains"))
-    path = g_file_get_path (store->domains);
+  if (!ok)
+    return FALSE;
 
-  if (path == NULL)
+  if (n != sizeof (hdr) ||
+      memcmp (hdr.magic, TIMES_DB_MAGIC, sizeof (hdr.magic)) != 0)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
-                   "unknown stored typed '%s'", type);
-      return NULL;
+      g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                           "times database: invalid header");
+      return FALSE;
     }
 
-  ids = g_ptr_array_new ();
-
-  dir = g_dir_open (path, 0, &err);
-  if (dir == NULL)
+  if (GUINT32_FROM_LE (hdr.version) != TIMES_DB_VERSION)
     {
-      if (bolt_err_notfound (err))
-        return bolt_strv_from_ptr_array (&ids);
-
-      bolt_error_propagate (error, &err);
-      return NULL;
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                   "times database: unsupported version: %u",
+                   GUINT32_FROM_LE (hdr.version));
+      return FALSE;
     }
 
-  while ((name = g_dir_read_name (dir)) != NULL)
-    {
-      if (g_str_has_prefix (name, "."))
-        continue;
+  *count = GUINT32_FROM_LE (hdr.count);
 
-      g_ptr_array_add (ids, g_strdup (name));
+  if (size != (gsize) times_record_offset (*count))
+    {
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                   "times database: size mismatch (%u records, %"
+                   G_GSIZE_FORMAT " bytes)", *count, size);
+      return FALSE;
     }
 
-  return bolt_strv_from_ptr_array (&ids);
+  return TRUE;
 }
 
-gboolean
-bolt_store_put_domain (BoltStore  *store,
-                       BoltDomain *domain,
-                       GError    **error)
+static gboolean
+store_tdb_open (BoltStore *store,
+                gboolean   create,
+                GError   **error)
 {
   g_autoptr(GError) err = NULL;
-  g_autoptr(GFile) entry = NULL;
-  g_autoptr(GKeyFile) kf = NULL;
   g_autofree char *path = NULL;
-  char * const * bootacl = NULL;
-  const char *uid;
+  bolt_autoclose int fd = -1;
+  struct stat st;
+  guint count = 0;
   gboolean ok;
-  gsize len;
+  int flags;
 
-  g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
-  g_return_val_if_fail (BOLT_IS_DOMAIN (domain), FALSE);
-  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  if (store->tdb > -1)
+    return TRUE;
 
-  uid = bolt_domain_get_uid (domain);
-  g_assert (uid);
+  flags = O_RDWR | O_CLOEXEC;
+  if (create)
+    flags |= O_CREAT;
 
-  entry = g_file_get_child (store->domains, uid);
+  path = g_file_get_path (store->timesdb);
+  fd = bolt_open (path, flags, 0644, error);
+
+  if (fd < 0)
+    return FALSE;
 
-  ok = bolt_fs_make_parent_dirs (entry, error);
+  ok = bolt_fstat (fd, &st, error);
   if (!ok)
     return FALSE;
 
-  kf = g_key_file_new ();
-  path = g_file_get_path (entry);
-  ok = g_key_file_load_from_file (kf,
-                                  path,
-                                  G_KEY_FILE_KEEP_COMMENTS,
-                                  &err);
+  if (st.st_size > 0)
+    ok = store_tdb_check_header (fd, st.st_size, &count, &err);
 
-  if (!ok && !bolt_err_notfound (err))
+  if (!ok && !create)
+    return bolt_error_propagate (error, &err);
+
+  if (!ok)
     {
-      bolt_warn_err (err, LOG_TOPIC ("store"),
-                     "error loading existing domain");
-      g_clear_error (&err);
-      /* not fatal, keep going */
-    }
+      /* timestamps are not precious enough to refuse
+       * all further updates because of a bad file */
+      bolt_warn_err (err, LOG_TOPIC ("store"), "resetting times database");
+      ok = bolt_ftruncate (fd, 0, error);
+      if (!ok)
+        return FALSE;
 
-  bootacl = bolt_domain_get_bootacl (domain);
-  len = bolt_strv_length (bootacl);
+      st.st_size = 0;
+      count = 0;
+    }
 
-  g_key_file_set_string_list (kf,
-                              DOMAIN_GROUP,
-                              "bootacl",
-                              (const char * const *) bootacl,
-                              len);
+  if (st.st_size == 0)
+    {
+      ok = store_tdb_write_header (fd, 0, error);
+      if (!ok)
+        return FALSE;
+    }
 
-  ok = g_key_file_save_to_file (kf, path, error);
+  store->tdb = bolt_steal (&fd, -1);
+  store->tdb_count = count;
+
+  return TRUE;
+}
+
+static gboolean
+store_tdb_read (BoltStore   *store,
+                guint        pos,
+                TimesRecord *rec,
+                GError     **error)
+{
+  gboolean ok;
+  gsize n;
+
+  ok = bolt_pread_all (store->tdb, rec, sizeof (TimesRecord),
+                       times_record_offset (pos), &n, error);
+
+  if (!ok)
+    return FALSE;
+
+  if (n != sizeof (TimesRecord))
+    {
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                   "times database: short read for record %u", pos);
+      return FALSE;
+    }
+
+  times_record_swap (rec);
+
+  return TRUE;
+}
+
+static gboolean
+store_tdb_write (BoltStore   *store,
+                 guint        pos,
+                 TimesRecord *rec,
+                 GError     **error)
+{
+  TimesRecord out = *rec;
+
+  times_record_swap (&out);
+  store->tdb_serial++;
+
+  return bolt_pwrite_all (store->tdb, &out, sizeof (out),
+                          times_record_offset (pos), error);
+}
+
+static gboolean
+store_tdb_find (BoltStore   *store,
+                const char  *uid,
+                TimesRecord *rec,
+                guint       *pos,
+                gboolean    *found,
+                GError     **error)
+{
+  guint lo = 0;
+  guint hi = store->tdb_count;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      gboolean ok;
+      int r;
+
+      ok = store_tdb_read (store, mid, rec, error);
+
+      if (!ok)
+        return FALSE;
+
+      r = strncmp (uid, rec->uid, TIMES_DB_UID_MAX);
+
+      if (r == 0)
+        {
+          *pos = mid;
+          *found = TRUE;
+          return TRUE;
+        }
+      else if (r < 0)
+        {
+          hi = mid;
+        }
+      else
+        {
+          lo = mid + 1;
+        }
+    }
+
+  *pos = lo;
+  *found = FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+store_tdb_lookup (BoltStore   *store,
+                  const char  *uid,
+                  TimesRecord *rec,
+                  guint       *index,
+                  GError     **error)
+{
+  g_autoptr(GError) err = NULL;
+  gboolean found = FALSE;
+  gboolean ok;
+  guint pos;
+
+  ok = store_tdb_open (store, FALSE, &err);
+
+  if (ok)
+    ok = store_tdb_find (store, uid, rec, &pos, &found, &err);
+
+  if (!ok && !bolt_err_notfound (err))
+    return bolt_error_propagate (error, &err);
+
+  if (!ok || !found)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "no timestamps for '%s'", uid);
+      return FALSE;
+    }
+
+  if (index != NULL)
+    *index = pos;
+
+  return TRUE;
+}
+
+/* replace the whole database with 'records', which
+ * must be sorted; used for inserts and migration */
+static gboolean
+store_tdb_replace (BoltStore *store,
+                   GArray    *records,
+                   GError   **error)
+{
+  g_autofree char *path = NULL;
+  g_autofree char *target = NULL;
+  bolt_autoclose int root = -1;
+  bolt_autoclose int fd = -1;
+  gboolean ok;
+
+  target = g_file_get_path (store->timesdb);
+  path = g_strdup_printf ("%s.tmp", target);
+
+  fd = bolt_open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644, error);
+
+  if (fd < 0)
+    return FALSE;
+
+  ok = store_tdb_write_header (fd, records->len, error);
+
+  for (guint i = 0; ok && i < records->len; i++)
+    {
+      TimesRecord out = g_array_index (records, TimesRecord, i);
+
+      times_record_swap (&out);
+      ok = bolt_pwrite_all (fd, &out, sizeof (out),
+                            times_record_offset (i), error);
+    }
+
+  if (ok)
+    ok = bolt_fdatasync (fd, error);
+
+  if (ok)
+    ok = bolt_rename (path, target, error);
+
+  if (!ok)
+    {
+      (void) bolt_unlink (path, NULL);
+      return FALSE;
+    }
+
+  store_tdb_close (store);
+  store->tdb_serial++;
+
+  /* the rename must be durable before we return, since a
+   * migration removes the legacy files right afterwards */
+  root = bolt_openat (store->rootfd, ".",
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+                      0, error);
+
+  if (root < 0 || !bolt_fsync (root, error))
+    return FALSE;
+
+  return store_tdb_open (store, FALSE, error);
+}
+
+/* append all records of the (open) database to 'records' */
+static gboolean
+store_tdb_read_all (BoltStore *store,
+                    GArray    *records,
+                    GError   **error)
+{
+  guint start = records->len;
+  guint count = store->tdb_count;
+  gboolean ok;
+  gsize n;
+
+  g_array_set_size (records, start + count);
+
+  ok = bolt_pread_all (store->tdb,
+                       &g_array_index (records, TimesRecord, start),
+                       count * sizeof (TimesRecord),
+                       times_record_offset (0),
+                       &n, error);
+
+  if (ok && n != count * sizeof (TimesRecord))
+    {
+      g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                           "times database: short read");
+      ok = FALSE;
+    }
+
+  if (!ok)
+    {
+      g_array_set_size (records, start);
+      return FALSE;
+    }
+
+  for (guint i = start; i < records->len; i++)
+    times_record_swap (&g_array_index (records, TimesRecord, i));
+
+  return TRUE;
+}
+
+static gboolean
+store_tdb_insert (BoltStore *store,
+                  GArray    *fresh,
+                  GError   **error)
+{
+  g_autoptr(GArray) records = NULL;
+  gboolean ok;
+
+  records = g_array_sized_new (FALSE, TRUE, sizeof (TimesRecord),
+                               store->tdb_count + fresh->len);
+
+  ok = store_tdb_read_all (store, records, error);
+
+  if (!ok)
+    return FALSE;
+
+  g_array_append_vals (records, fresh->data, fresh->len);
+  g_array_sort (records, times_record_compare);
+
+  return store_tdb_replace (store, records, error);
+}
+
+static gboolean
+store_tdb_update (BoltStore  *store,
+                  GHashTable *pending,
+                  guint      *updated,
+                  GError    **error)
+{
+  g_autoptr(GArray) fresh = NULL;
+  GHashTableIter iter;
+  gpointer data;
+  gboolean ok;
+  guint count = 0;
+
+  ok = store_tdb_open (store, TRUE, error);
+
+  if (!ok)
+    return FALSE;
+
+  fresh = g_array_new (FALSE, TRUE, sizeof (TimesRecord));
+
+  g_hash_table_iter_init (&iter, pending);
+  while (g_hash_table_iter_next (&iter, NULL, &data))
+    {
+      StorePending *pt = data;
+      TimesRecord rec;
+      gboolean found;
+      guint pos;
+
+      if (strlen (pt->uid) >= TIMES_DB_UID_MAX)
+        {
+          bolt_warn (LOG_DEV_UID (pt->uid), LOG_TOPIC ("store"),
+                     "uid too long for the times database");
+          /* would never succeed, so do not keep retrying */
+          g_hash_table_iter_remove (&iter);
+          continue;
+        }
+
+      ok = store_tdb_find (store, pt->uid, &rec, &pos, &found, error);
+
+      if (!ok)
+        return FALSE;
+
+      if (!found)
+        {
+          memset (&rec, 0, sizeof (rec));
+          g_strlcpy (rec.uid, pt->uid, sizeof (rec.uid));
+        }
+
+      for (guint i = 0; i < STORE_TIME_LAST; i++)
+        {
+          if ((pt->tflags & (1 << i)) == 0)
+            continue;
+
+          rec.times[i] = pt->times[i];
+          count++;
+        }
+
+      rec.tflags |= pt->tflags;
+
+      if (!found)
+        {
+          g_array_append_val (fresh, rec);
+          continue;
+        }
+
+      ok = store_tdb_write (store, pos, &rec, error);
+
+      if (!ok)
+        return FALSE;
+    }
+
+  if (fresh->len > 0)
+    {
+      g_array_sort (fresh, times_record_compare);
+      ok = store_tdb_insert (store, fresh, error);
+    }
+  else
+    {
+      ok = bolt_fdatasync (store->tdb, error);
+    }
+
+  if (ok && updated)
+    *updated = count;
+
+  return ok;
+}
+
+static gboolean
+store_tdb_clear (BoltStore  *store,
+                 const char *uid,
+                 StoreTime   idx,
+                 GError    **error)
+{
+  TimesRecord rec;
+  gboolean ok;
+  guint pos;
+
+  ok = store_tdb_lookup (store, uid, &rec, &pos, error);
+
+  if (!ok)
+    return FALSE;
+
+  if ((rec.tflags & (1 << idx)) == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "timestamp '%s' not found for '%s'",
+                   store_time_names[idx], uid);
+      return FALSE;
+    }
+
+  rec.tflags &= ~(1 << idx);
+  rec.times[idx] = 0;
+
+  ok = store_tdb_write (store, pos, &rec, error);
+
+  if (ok)
+    ok = bolt_fdatasync (store->tdb, error);
+
+  return ok;
+}
+
+/* convert the pre version 2 layout, i.e. one file per
+ * timestamp, into the database; the names of the files
+ * that were converted are added to 'migrated'. If there
+ * already is a database, e.g. because an earlier upgrade
+ * was interrupted, the legacy files are merged into it,
+ * and timestamps already in the database take precedence */
+static gboolean
+store_tdb_migrate (BoltStore *store,
+                   GPtrArray *migrated,
+                   GError   **error)
+{
+  g_autoptr(GHashTable) index = NULL;
+  g_autoptr(GArray) records = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(DIR) dir = NULL;
+  g_autofree char *path = NULL;
+  struct dirent *de;
+
+  path = g_file_get_path (store->times);
+  dir = bolt_opendir (path, &err);
+
+  if (dir == NULL && !bolt_err_notfound (err))
+    return bolt_error_propagate (error, &err);
+
+  records = g_array_new (FALSE, TRUE, sizeof (TimesRecord));
+  index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  if (store_tdb_open (store, FALSE, &err))
+    {
+      gboolean ok = store_tdb_read_all (store, records, error);
+
+      if (!ok)
+        return FALSE;
+
+      for (guint i = 0; i < records->len; i++)
+        {
+          TimesRecord *rec = &g_array_index (records, TimesRecord, i);
+          char *uid = g_strndup (rec->uid, TIMES_DB_UID_MAX);
+
+          g_hash_table_insert (index, uid, GUINT_TO_POINTER (i));
+        }
+    }
+  else if (!bolt_err_notfound (err))
+    {
+      /* same as store_tdb_open: not precious enough to
+       * block the upgrade, the legacy files are used */
+      bolt_warn_err (err, LOG_TOPIC ("store"),
+                     "ignoring times database");
+    }
+
+  g_clear_error (&err);
+
+  while (dir != NULL && (de = readdir (dir)) != NULL)
+    {
+      g_autoptr(GError) e = NULL;
+      g_autofree char *uid = NULL;
+      TimesRecord *rec;
+      const char *dot;
+      struct stat st;
+      gpointer pos;
+      gboolean ok;
+      int idx;
+
+      if (de->d_type != DT_REG && de->d_type != DT_UNKNOWN)
+        continue;
+
+      dot = strrchr (de->d_name, '.');
+      if (dot == NULL || dot == de->d_name)
+        continue;
+
+      idx = store_time_from_string (dot + 1);
+      if (idx < 0)
+        continue;
+
+      uid = g_strndup (de->d_name, dot - de->d_name);
+
+      if (strlen (uid) >= TIMES_DB_UID_MAX)
+        continue;
+
+      ok = bolt_fstatat (dirfd (dir), de->d_name, &st,
+                         AT_SYMLINK_NOFOLLOW, &e);
+
+      if (!ok || !S_ISREG (st.st_mode))
+        {
+          if (!ok)
+            bolt_warn_err (e, LOG_TOPIC ("store"),
+                           "could not migrate '%s'", de->d_name);
+          continue;
+        }
+
+      if (!g_hash_table_lookup_extended (index, uid, NULL, &pos))
+        {
+          TimesRecord fresh = { {0, }, };
+
+          g_strlcpy (fresh.uid, uid, sizeof (fresh.uid));
+          g_array_append_val (records, fresh);
+
+          pos = GUINT_TO_POINTER (records->len - 1);
+          g_hash_table_insert (index, g_steal_pointer (&uid), pos);
+        }
+
+      rec = &g_array_index (records, TimesRecord, GPOINTER_TO_UINT (pos));
+
+      if ((rec->tflags & (1 << idx)) == 0)
+        {
+          rec->times[idx] = (guint64) st.st_mtime;
+          rec->tflags |= 1 << idx;
+        }
+
+      g_ptr_array_add (migrated, g_strdup (de->d_name));
+    }
+
+  g_array_sort (records, times_record_compare);
+
+  bolt_info (LOG_TOPIC ("store"), "migrating %u timestamps for %u devices",
+             migrated->len, records->len);
+
+  return store_tdb_replace (store, records, error);
+}
+
+static StoreDevice *
+store_device_from_keyfile (const char *uid,
+                           GKeyFile   *kf,
+                           GError    **error)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree char *name = NULL;
+  g_autofree char *vendor = NULL;
+  g_autofree char *typestr = NULL;
+  g_autofree char *polstr = NULL;
+  g_autofree char *label = NULL;
+  BoltDeviceType type;
+  BoltPolicy policy;
+  StoreDevice *dev;
+  guint64 stime;
+  guint gen;
+
+  name = g_key_file_get_string (kf, DEVICE_GROUP, "name", NULL);
+  vendor = g_key_file_get_string (kf, DEVICE_GROUP, "vendor", NULL);
+  typestr = g_key_file_get_string (kf, DEVICE_GROUP, "type", NULL);
+  polstr = g_key_file_get_string (kf, USER_GROUP, "policy", NULL);
+  label = g_key_file_get_string (kf, USER_GROUP, "label", NULL);
+
+  gen = g_key_file_get_int64 (kf, DEVICE_GROUP, "generation", &err);
+  if (err != NULL && !bolt_err_notfound (err))
+    bolt_warn_err (err, LOG_TOPIC ("store"), "invalid generation");
+  g_clear_error (&err);
+
+  type = bolt_enum_from_string (BOLT_TYPE_DEVICE_TYPE, typestr, &err);
+  if (type == BOLT_DEVICE_UNKNOWN_TYPE)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                     "invalid device type");
+      g_clear_error (&err);
+      type = BOLT_DEVICE_PERIPHERAL;
+    }
+
+  policy = bolt_enum_from_string (BOLT_TYPE_POLICY, polstr, &err);
+  if (policy == BOLT_POLICY_UNKNOWN)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                     "invalid policy");
+      g_clear_error (&err);
+      policy = BOLT_POLICY_MANUAL;
+    }
+
+  if (label != NULL)
+    {
+      g_autofree char *tmp = g_steal_pointer (&label);
+      label = bolt_strdup_validate (tmp);
+      if (label == NULL)
+        bolt_warn (LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                   "invalid device label: %s", label);
+    }
+
+  stime = g_key_file_get_uint64 (kf, USER_GROUP, "storetime", &err);
+  if (err != NULL && !bolt_err_notfound (err))
+    bolt_warn_err (err, LOG_TOPIC ("store"), "invalid enroll-time");
+
+  if (name == NULL || vendor == NULL)
+    {
+      g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                           "invalid device entry in store");
+      return NULL;
+    }
+
+  dev = g_slice_new0 (StoreDevice);
+
+  dev->uid = g_strdup (uid);
+  dev->name = g_steal_pointer (&name);
+  dev->vendor = g_steal_pointer (&vendor);
+  dev->label = g_steal_pointer (&label);
+  dev->type = type;
+  dev->policy = policy;
+  dev->gen = gen;
+  dev->stime = stime;
+  dev->key = BOLT_KEY_MISSING;
+
+  return dev;
+}
+
+static StoreDomain *
+store_domain_from_keyfile (const char *uid,
+                           GKeyFile   *kf)
+{
+  g_autoptr(GError) err = NULL;
+  g_auto(GStrv) bootacl = NULL;
+  StoreDomain *dom;
+
+  bootacl = g_key_file_get_string_list (kf,
+                                        DOMAIN_GROUP,
+                                        "bootacl",
+                                        NULL,
+                                        &err);
+
+  if (bootacl == NULL && !bolt_err_notfound (err))
+    {
+      bolt_warn_err (err, LOG_DOM_UID (uid), LOG_TOPIC ("store"),
+                     "failed to parse bootacl for domain '%s'",
+                     uid);
+
+      g_clear_error (&err);
+    }
+
+  if (bolt_strv_isempty (bootacl))
+    g_clear_pointer (&bootacl, g_strfreev);
+
+  dom = g_slice_new0 (StoreDomain);
+  dom->uid = g_strdup (uid);
+  dom->bootacl = g_steal_pointer (&bootacl);
+
+  return dom;
+}
+
+/* directory handles
+ *
+ * All entries are accessed relative to a handle of their
+ * directory, which avoids building (and the kernel walking)
+ * the full path for every single operation. The handles are
+ * opened on first use since the directories themselves are
+ * only created when the first entry is written.
+ */
+static int
+store_dirfd (BoltStore *store,
+             StoreDir   dir,
+             gboolean   create,
+             GError   **error)
+{
+  const char *name = store_dir_names[dir];
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+  int fd;
+
+  if (store->dirfds[dir] > -1)
+    return store->dirfds[dir];
+
+  fd = bolt_openat (store->rootfd, name,
+                    O_PATH | O_DIRECTORY | O_CLOEXEC,
+                    0, &err);
+
+  if (fd < 0 && create && bolt_err_notfound (err))
+    {
+      g_clear_error (&err);
+
+      ok = bolt_mkdirat (store->rootfd, name, 0755, &err);
+      if (ok || bolt_err_exists (err))
+        {
+          g_clear_error (&err);
+          fd = bolt_openat (store->rootfd, name,
+                            O_PATH | O_DIRECTORY | O_CLOEXEC,
+                            0, &err);
+        }
+    }
+
+  if (fd < 0)
+    {
+      bolt_error_propagate (error, &err);
+      return -1;
+    }
+
+  store->dirfds[dir] = fd;
+
+  return fd;
+}
+
+static void
+store_dirfd_close (BoltStore *store,
+                   StoreDir   dir)
+{
+  if (store->dirfds[dir] < 0)
+    return;
+
+  (void) close (store->dirfds[dir]);
+  store->dirfds[dir] = -1;
+}
+
+static gboolean
+store_stat_at (BoltStore   *store,
+               StoreDir     dir,
+               const char  *name,
+               struct stat *st,
+               GError     **error)
+{
+  int fd;
+
+  fd = store_dirfd (store, dir, FALSE, error);
+
+  if (fd < 0)
+    return FALSE;
+
+  return bolt_fstatat (fd, name, st, 0, error);
+}
+
+static GKeyFile *
+store_load_keyfile (BoltStore    *store,
+                    StoreDir      dir,
+                    const char   *name,
+                    GKeyFileFlags flags,
+                    GError      **error)
+{
+  g_autoptr(GKeyFile) kf = NULL;
+  g_autofree char *data = NULL;
+  gboolean ok;
+  gsize len;
+  int fd;
+
+  fd = store_dirfd (store, dir, FALSE, error);
+
+  if (fd < 0)
+    return NULL;
+
+  data = bolt_read_file_at (fd, name, &len, error);
+
+  if (data == NULL)
+    return NULL;
+
+  kf = g_key_file_new ();
+  ok = g_key_file_load_from_data (kf, data, len, flags, error);
+
+  if (!ok)
+    return NULL;
+
+  return g_steal_pointer (&kf);
+}
+
+static BoltKeyState
+store_stat_key (BoltStore  *store,
+                const char *uid)
+{
+  g_autoptr(GError) err = NULL;
+  guint key = BOLT_KEY_MISSING;
+  struct stat st;
+  gboolean ok;
+
+  ok = store_stat_at (store, STORE_DIR_KEYS, uid, &st, &err);
+
+  if (ok)
+    key = BOLT_KEY_HAVE; /* todo: check size */
+  else if (!bolt_err_notfound (err))
+    bolt_warn_err (err, LOG_DEV_UID (uid), "error querying key info");
+
+  return key;
+}
+
+/* key state cache
+ *
+ * Instead of looking at the key file of every single device
+ * when the index is rebuilt, the keys directory is read once
+ * and the names are kept in a set. The set is updated along
+ * with the key files; if its state ever gets uncertain it is
+ * dropped and lookups go to the file system again.
+ */
+static void
+store_keys_scan (BoltStore *store)
+{
+  g_autoptr(GError) err = NULL;
+  g_autoptr(DIR) dir = NULL;
+  g_autofree char *path = NULL;
+  struct dirent *de;
+
+  g_clear_pointer (&store->keyset, g_hash_table_unref);
+
+  path = g_file_get_path (store->keys);
+  dir = bolt_opendir (path, &err);
+
+  if (dir == NULL && !bolt_err_notfound (err))
+    {
+      bolt_warn_err (err, LOG_TOPIC ("store"), "could not scan keys");
+      return;
+    }
+
+  store->keyset = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, NULL);
+
+  while (dir != NULL && (de = readdir (dir)) != NULL)
+    {
+      /* skips '.', '..' and staged transaction files */
+      if (de->d_name[0] == '.' || de->d_type == DT_DIR)
+        continue;
+
+      g_hash_table_add (store->keyset, g_strdup (de->d_name));
+    }
+
+  bolt_debug (LOG_TOPIC ("store"), "found %u keys",
+              g_hash_table_size (store->keyset));
+}
+
+static void
+store_keys_update (BoltStore   *store,
+                   const char  *uid,
+                   BoltKeyState state)
+{
+  if (store->keyset == NULL)
+    return;
+
+  if (state == BOLT_KEY_MISSING)
+    g_hash_table_remove (store->keyset, uid);
+  else
+    g_hash_table_add (store->keyset, g_strdup (uid));
+}
+
+/* NB: called from worker threads during the index rebuild,
+ * when the key set is only ever read */
+static BoltKeyState
+store_probe_key (BoltStore  *store,
+                 const char *uid)
+{
+  if (store->keyset == NULL)
+    return store_stat_key (store, uid);
+
+  if (g_hash_table_contains (store->keyset, uid))
+    return BOLT_KEY_HAVE;
+
+  return BOLT_KEY_MISSING;
+}
+
+static gboolean
+store_probe_time (BoltStore  *store,
+                  const char *uid,
+                  const char *timesel,
+                  guint64    *outval,
+                  GError    **error)
+{
+  g_autofree char *fn = NULL;
+  struct stat st;
+  gboolean ok;
+  int idx;
+
+  idx = store_time_from_string (timesel);
+
+  if (idx > -1 && store_times_in_db (store))
+    {
+      TimesRecord rec;
+
+      ok = store_tdb_lookup (store, uid, &rec, NULL, error);
+
+      if (ok && (rec.tflags & (1 << idx)) == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                       "timestamp '%s' not found for '%s'",
+                       timesel, uid);
+          ok = FALSE;
+        }
+
+      if (ok && outval != NULL)
+        *outval = rec.times[idx];
+
+      return ok;
+    }
+
+  fn = g_strdup_printf ("%s.%s", uid, timesel);
+  ok = store_stat_at (store, STORE_DIR_TIMES, fn, &st, error);
+
+  if (ok && outval != NULL)
+    *outval = (guint64) st.st_mtime;
+
+  return ok;
+}
+
+static void
+store_device_probe_times (BoltStore   *store,
+                          StoreDevice *dev)
+{
+  StorePending *pt;
+
+  dev->tflags = 0;
+  memset (dev->times, 0, sizeof (dev->times));
+
+  if (store_times_in_db (store))
+    {
+      g_autoptr(GError) err = NULL;
+      TimesRecord rec;
+      gboolean ok;
+
+      /* a single lookup for all timestamps */
+      ok = store_tdb_lookup (store, dev->uid, &rec, NULL, &err);
+
+      if (ok)
+        {
+          dev->tflags = rec.tflags;
+          memcpy (dev->times, rec.times, sizeof (dev->times));
+        }
+      else if (!bolt_err_notfound (err))
+        {
+          bolt_warn_err (err, LOG_DEV_UID (dev->uid), LOG_TOPIC ("store"),
+                         "failed to read timestamps");
+        }
+    }
+
+  else
+    {
+      for (guint i = 0; i < STORE_TIME_LAST; i++)
+        {
+          g_autoptr(GError) err = NULL;
+          const char *timesel = store_time_names[i];
+          gboolean ok;
+
+          ok = store_probe_time (store, dev->uid, timesel,
+                                 &dev->times[i], &err);
+
+          if (ok)
+            dev->tflags |= 1 << i;
+          else if (!bolt_err_notfound (err))
+            bolt_warn_err (err, LOG_DEV_UID (dev->uid), LOG_TOPIC ("store"),
+                           "failed to read timestamp '%s'", timesel);
+        }
+    }
+
+  /* timestamps that are not yet written take precedence */
+  pt = g_hash_table_lookup (store->pending, dev->uid);
+
+  if (pt == NULL)
+    return;
+
+  for (guint i = 0; i < STORE_TIME_LAST; i++)
+    if (pt->tflags & (1 << i))
+      dev->times[i] = pt->times[i];
+
+  dev->tflags |= pt->tflags;
+}
+
+static StoreDevice *
+store_load_device (BoltStore  *store,
+                   const char *uid,
+                   GError    **error)
+{
+  g_autoptr(GKeyFile) kf = NULL;
+  StoreDevice *dev;
+  struct stat st;
+
+  kf = store_load_keyfile (store, STORE_DIR_DEVICES, uid,
+                           G_KEY_FILE_NONE, error);
+
+  if (kf == NULL)
+    return NULL;
+
+  dev = store_device_from_keyfile (uid, kf, error);
+
+  if (dev == NULL)
+    return NULL;
+
+  if (dev->stime == 0 &&
+      store_stat_at (store, STORE_DIR_DEVICES, uid, &st, NULL))
+    dev->stime = (guint64) st.st_ctime;
+
+  dev->key = store_probe_key (store, uid);
+
+  /* read timestamps, but failing is not fatal */
+  store_device_probe_times (store, dev);
+
+  return dev;
+}
+
+static StoreDomain *
+store_load_domain (BoltStore  *store,
+                   const char *uid,
+                   GError    **error)
+{
+  g_autoptr(GKeyFile) kf = NULL;
+
+  kf = store_load_keyfile (store, STORE_DIR_DOMAINS, uid,
+                           G_KEY_FILE_NONE, error);
+
+  if (kf == NULL)
+    return NULL;
+
+  return store_domain_from_keyfile (uid, kf);
+}
+
+static void
+store_index_put_device (BoltStore   *store,
+                        StoreDevice *dev)
+{
+  /* NB: the key is owned by the entry, so the old key
+   * must be replaced together with the old value */
+  g_hash_table_replace (store->devidx, dev->uid, dev);
+  store_index_changed (store);
+}
+
+static void
+store_index_put_domain (BoltStore   *store,
+                        StoreDomain *dom)
+{
+  g_hash_table_replace (store->domidx, dom->uid, dom);
+  store_index_changed (store);
+}
+
+static StoreDevice *
+store_lookup_device (BoltStore  *store,
+                     const char *uid,
+                     GError    **error)
+{
+  StoreDevice *dev;
+
+  dev = g_hash_table_lookup (store->devidx, uid);
+
+  if (dev != NULL)
+    return dev;
+
+  /* not (yet) indexed, e.g. added behind our back */
+  dev = store_load_device (store, uid, error);
+
+  if (dev == NULL)
+    return NULL;
+
+  store_index_put_device (store, dev);
+
+  return dev;
+}
+
+static StoreDomain *
+store_lookup_domain (BoltStore  *store,
+                     const char *uid,
+                     GError    **error)
+{
+  StoreDomain *dom;
+
+  dom = g_hash_table_lookup (store->domidx, uid);
+
+  if (dom != NULL)
+    return dom;
+
+  dom = store_load_domain (store, uid, error);
+
+  if (dom == NULL)
+    return NULL;
+
+  store_index_put_domain (store, dom);
+
+  return dom;
+}
+
+/* index snapshot */
+enum {
+  STAMP_DEVICES = 0,
+  STAMP_DOMAINS,
+  STAMP_KEYS,
+  STAMP_TIMES,
+  STAMP_TIMESDB,
+
+  STAMP_LAST
+};
+
+static guint64
+stamp_mix (guint64 hash,
+           guint64 val)
+{
+  /* FNV-1a, on 64 bit values instead of bytes */
+  hash ^= val;
+  hash *= G_GUINT64_CONSTANT (0x100000001b3);
+
+  return hash;
+}
+
+static guint64
+stat_mtime_ns (const struct stat *st)
+{
+  return (guint64) st->st_mtim.tv_sec * G_GUINT64_CONSTANT (1000000000) +
+         (guint64) st->st_mtim.tv_nsec;
+}
+
+static guint64
+store_path_stamp (GFile *file)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(DIR) dir = NULL;
+  struct dirent *de;
+  struct stat st;
+  guint64 sum = 0;
+  int r;
+
+  path = g_file_get_path (file);
+  r = stat (path, &st);
+
+  if (r != 0)
+    return 0;
+
+  if (!S_ISDIR (st.st_mode))
+    return stat_mtime_ns (&st);
+
+  /* the modification time of a directory only changes when
+   * entries are created, removed or renamed, but not when
+   * one of them is modified in place; so (size, mtime) of
+   * every entry is included, summed up so the order in which
+   * the entries are listed does not matter */
+  dir = bolt_opendir (path, NULL);
+
+  while (dir != NULL && (de = readdir (dir)) != NULL)
+    {
+      struct stat est;
+      guint64 h = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+
+      if (de->d_name[0] == '.')
+        continue;
+
+      r = fstatat (dirfd (dir), de->d_name, &est, AT_SYMLINK_NOFOLLOW);
+
+      if (r != 0)
+        continue;
+
+      h = stamp_mix (h, g_str_hash (de->d_name));
+      h = stamp_mix (h, (guint64) est.st_size);
+      h = stamp_mix (h, stat_mtime_ns (&est));
+
+      sum += h;
+    }
+
+  return stamp_mix (stat_mtime_ns (&st), sum) | 1;
+}
+
+static void
+store_index_stamp (BoltStore *store,
+                   guint64   *stamp)
+{
+  stamp[STAMP_DEVICES] = store_path_stamp (store->devices);
+  stamp[STAMP_DOMAINS] = store_path_stamp (store->domains);
+  stamp[STAMP_KEYS] = store_path_stamp (store->keys);
+  stamp[STAMP_TIMES] = store_path_stamp (store->times);
+  stamp[STAMP_TIMESDB] = store_path_stamp (store->timesdb);
+}
+
+static gboolean
+store_index_load_snapshot (BoltStore *store,
+                           GError   **error)
+{
+  g_autoptr(GVariant) snap = NULL;
+  g_autoptr(GVariant) stamps = NULL;
+  g_autoptr(GVariant) devices = NULL;
+  g_autoptr(GVariant) domains = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *data = NULL;
+  guint64 now[STAMP_LAST];
+  const guint64 *have;
+  GVariantIter iter;
+  StoreDevice *dev;
+  gboolean ok;
+  guint32 version;
+  gsize len;
+  gsize n;
+
+  path = g_file_get_path (store->snapshot);
+  ok = g_file_get_contents (path, &data, &len, error);
+
+  if (!ok)
+    return FALSE;
+
+  bytes = g_bytes_new_take (g_steal_pointer (&data), len);
+  snap = g_variant_new_from_bytes (G_VARIANT_TYPE (SNAPSHOT_TYPE),
+                                   bytes, FALSE);
+  g_variant_ref_sink (snap);
+
+  g_variant_get (snap, "(u@at@a(ssssiiutiutt)@a(sas))",
+                 &version, &stamps, &devices, &domains);
+
+  if (version != SNAPSHOT_VERSION)
+    {
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                   "unsupported snapshot version: %u", version);
+      return FALSE;
+    }
+
+  have = g_variant_get_fixed_array (stamps, &n, sizeof (guint64));
+  store_index_stamp (store, now);
+
+  if (n != STAMP_LAST || memcmp (have, now, sizeof (now)) != 0)
+    {
+      g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                           "snapshot is stale");
+      return FALSE;
+    }
+
+  g_variant_iter_init (&iter, devices);
+  for (;; )
+    {
+      gint32 type, policy, key;
+
+      dev = g_slice_new0 (StoreDevice);
+      ok = g_variant_iter_next (&iter, "(ssssiiutiutt)",
+                                &dev->uid,
+                                &dev->name,
+                                &dev->vendor,
+                                &dev->label,
+                                &type,
+                                &policy,
+                                &dev->gen,
+                                &dev->stime,
+                                &key,
+                                &dev->tflags,
+                                &dev->times[STORE_TIME_CONN],
+                                &dev->times[STORE_TIME_AUTH]);
+
+      if (!ok)
+        {
+          g_slice_free (StoreDevice, dev);
+          break;
+        }
+
+      if (*dev->label == '\0')
+        g_clear_pointer (&dev->label, g_free);
+
+      dev->type = type;
+      dev->policy = policy;
+      dev->key = key;
+
+      g_hash_table_replace (store->devidx, dev->uid, dev);
+    }
+
+  g_variant_iter_init (&iter, domains);
+  for (;; )
+    {
+      StoreDomain *dom = g_slice_new0 (StoreDomain);
+
+      ok = g_variant_iter_next (&iter, "(s^as)",
+                                &dom->uid,
+                                &dom->bootacl);
+
+      if (!ok)
+        {
+          g_slice_free (StoreDomain, dom);
+          break;
+        }
+
+      if (bolt_strv_isempty (dom->bootacl))
+        g_clear_pointer (&dom->bootacl, g_strfreev);
+
+      g_hash_table_replace (store->domidx, dom->uid, dom);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+store_index_write_snapshot (BoltStore *store,
+                            GError   **error)
+{
+  static const char *empty[] = {NULL};
+  g_autoptr(GVariant) snap = NULL;
+  g_autofree char *path = NULL;
+  GVariantBuilder devices;
+  GVariantBuilder domains;
+  GHashTableIter iter;
+  guint64 stamp[STAMP_LAST];
+  gpointer data;
+  gboolean ok;
+
+  g_variant_builder_init (&devices, G_VARIANT_TYPE ("a(ssssiiutiutt)"));
+  g_hash_table_iter_init (&iter, store->devidx);
+  while (g_hash_table_iter_next (&iter, NULL, &data))
+    {
+      StoreDevice *dev = data;
+
+      g_variant_builder_add (&devices, "(ssssiiutiutt)",
+                             dev->uid,
+                             dev->name,
+                             dev->vendor,
+                             dev->label ? : "",
+                             (gint32) dev->type,
+                             (gint32) dev->policy,
+                             dev->gen,
+                             dev->stime,
+                             (gint32) dev->key,
+                             dev->tflags,
+                             dev->times[STORE_TIME_CONN],
+                             dev->times[STORE_TIME_AUTH]);
+    }
+
+  g_variant_builder_init (&domains, G_VARIANT_TYPE ("a(sas)"));
+  g_hash_table_iter_init (&iter, store->domidx);
+  while (g_hash_table_iter_next (&iter, NULL, &data))
+    {
+      StoreDomain *dom = data;
+      const char * const *acl = (const char * const *) dom->bootacl;
+
+      g_variant_builder_add (&domains, "(s^as)",
+                             dom->uid,
+                             acl ? : empty);
+    }
+
+  store_index_stamp (store, stamp);
+
+  snap = g_variant_new ("(u@at@a(ssssiiutiutt)@a(sas))",
+                        (guint32) SNAPSHOT_VERSION,
+                        g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                   stamp, STAMP_LAST,
+                                                   sizeof (guint64)),
+                        g_variant_builder_end (&devices),
+                        g_variant_builder_end (&domains));
+
+  g_variant_ref_sink (snap);
+
+  path = g_file_get_path (store->snapshot);
+  ok = g_file_set_contents (path,
+                            g_variant_get_data (snap),
+                            g_variant_get_size (snap),
+                            error);
+
+  if (!ok)
+    return FALSE;
+
+  bolt_debug (LOG_TOPIC ("store"), "snapshot written [%u devices, %u domains]",
+              g_hash_table_size (store->devidx),
+              g_hash_table_size (store->domidx));
+
+  store->have_snapshot = TRUE;
+  store->dirty = FALSE;
+
+  return TRUE;
+}
+
+/* parallel loading of device entries */
+#define STORE_LOAD_PARALLEL_MIN 16
+
+typedef struct StoreLoadJob
+{
+  BoltStore    *store;
+  const char   *uid;
+  StoreDevice  *dev;
+  GError       *error;
+} StoreLoadJob;
+
+static void
+store_load_job_run (gpointer data,
+                    gpointer user_data)
+{
+  StoreLoadJob *job = data;
+
+  /* NB: runs in a worker thread; store_load_device only reads
+   * from the store object, and only after the times database
+   * and the directory handles have been opened, see
+   * store_index_load_devices() */
+  job->dev = store_load_device (job->store, job->uid, &job->error);
+}
+
+static void
+store_index_load_devices (BoltStore *store,
+                          GStrv      uids)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree StoreLoadJob *jobs = NULL;
+  GThreadPool *pool = NULL;
+  guint n = g_strv_length (uids);
+  gint threads;
+
+  if (store_times_in_db (store) && !store_tdb_open (store, FALSE, &err))
+    {
+      if (!bolt_err_notfound (err))
+        bolt_warn_err (err, LOG_TOPIC ("store"), "could not open times database");
+      g_clear_error (&err);
+    }
+
+  /* the workers must not race to open the directory handles;
+   * failures are fine, the entries will then not be found */
+  for (guint i = 0; i < STORE_DIR_LAST; i++)
+    (void) store_dirfd (store, i, FALSE, NULL);
+
+  jobs = g_new0 (StoreLoadJob, n);
+  threads = MIN (g_get_num_processors (), (gint) n);
+
+  if (n >= STORE_LOAD_PARALLEL_MIN && threads > 1)
+    pool = g_thread_pool_new (store_load_job_run, NULL,
+                              threads, TRUE, &err);
+
+  if (pool == NULL && err != NULL)
+    bolt_warn_err (err, LOG_TOPIC ("store"), "could not create thread pool");
+
+  for (guint i = 0; i < n; i++)
+    {
+      StoreLoadJob *job = &jobs[i];
+
+      job->store = store;
+      job->uid = uids[i];
+
+      if (pool == NULL)
+        store_load_job_run (job, NULL);
+      else
+        g_thread_pool_push (pool, job, NULL);
+    }
+
+  /* wait for all jobs to finish */
+  if (pool != NULL)
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+  bolt_debug (LOG_TOPIC ("store"), "loaded %u devices with %d threads",
+              n, pool != NULL ? threads : 1);
+
+  /* merge the results in the original order */
+  for (guint i = 0; i < n; i++)
+    {
+      StoreLoadJob *job = &jobs[i];
+
+      /* invalid entries are not indexed, and thus will be
+       * loaded and reported when they are looked up */
+      if (job->dev == NULL)
+        {
+          g_clear_error (&job->error);
+          continue;
+        }
+
+      g_hash_table_replace (store->devidx, job->dev->uid, job->dev);
+    }
+}
+
+static void
+store_index_rebuild (BoltStore *store)
+{
+  g_autoptr(GError) err = NULL;
+  g_auto(GStrv) devices = NULL;
+  g_auto(GStrv) domains = NULL;
+
+  g_hash_table_remove_all (store->devidx);
+  g_hash_table_remove_all (store->domidx);
+
+  devices = bolt_store_list_uids (store, "devices", &err);
+  if (devices == NULL)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("store"), "failed to list devices");
+      g_clear_error (&err);
+    }
+
+  /* one pass over keys/ instead of one lookup per device */
+  store_keys_scan (store);
+
+  if (devices != NULL)
+    store_index_load_devices (store, devices);
+
+  domains = bolt_store_list_uids (store, "domains", &err);
+  if (domains == NULL)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("store"), "failed to list domains");
+      g_clear_error (&err);
+    }
+
+  for (guint i = 0; domains && domains[i] != NULL; i++)
+    {
+      StoreDomain *dom;
+
+      dom = store_load_domain (store, domains[i], &err);
+
+      if (dom == NULL)
+        {
+          g_clear_error (&err);
+          continue;
+        }
+
+      g_hash_table_replace (store->domidx, dom->uid, dom);
+    }
+}
+
+static void
+store_index_setup (BoltStore *store)
+{
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+
+  ok = store_index_load_snapshot (store, &err);
+
+  if (ok)
+    {
+      store->have_snapshot = TRUE;
+      bolt_info (LOG_TOPIC ("store"), "index loaded from snapshot "
+                 "[%u devices, %u domains]",
+                 g_hash_table_size (store->devidx),
+                 g_hash_table_size (store->domidx));
+      return;
+    }
+
+  if (!bolt_err_notfound (err))
+    bolt_info (LOG_TOPIC ("store"), "ignoring snapshot: %s",
+               err->message);
+
+  g_hash_table_remove_all (store->devidx);
+  g_hash_table_remove_all (store->domidx);
+
+  store_index_rebuild (store);
+
+  bolt_info (LOG_TOPIC ("store"), "index rebuilt [%u devices, %u domains]",
+             g_hash_table_size (store->devidx),
+             g_hash_table_size (store->domidx));
+
+  store_index_changed (store);
+}
+
+static gboolean
+store_snapshot_timeout (gpointer user_data)
+{
+  g_autoptr(GError) err = NULL;
+  BoltStore *store = BOLT_STORE (user_data);
+  gboolean ok;
+
+  store->snapshot_id = 0;
+
+  ok = bolt_store_flush (store, &err);
+  if (!ok)
+    bolt_warn_err (err, LOG_TOPIC ("store"), "failed to flush");
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+store_index_invalidate (BoltStore *store)
+{
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+
+  /* called before the store is modified; removing the
+   * snapshot ensures that we never load one that is not
+   * in sync, e.g. because we crashed before re-writing */
+  if (!store->have_snapshot)
+    return;
+
+  ok = g_file_delete (store->snapshot, NULL, &err);
+  if (!ok && !bolt_err_notfound (err))
+    bolt_warn_err (err, LOG_TOPIC ("store"), "failed to remove snapshot");
+
+  store->have_snapshot = FALSE;
+}
+
+static void
+store_index_changed (BoltStore *store)
+{
+  store->dirty = TRUE;
+
+  if (store->snapshot_id > 0)
+    return;
+
+  store->snapshot_id = g_timeout_add_seconds (SNAPSHOT_DELAY,
+                                              store_snapshot_timeout,
+                                              store);
+}
+
+/* timestamp write-behind */
+static void
+store_pending_free (gpointer data)
+{
+  StorePending *pt = data;
+
+  g_free (pt->uid);
+  g_slice_free (StorePending, pt);
+}
+
+static gboolean
+store_times_write_files (BoltStore *store,
+                         guint     *written,
+                         GError   **error)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree char *path = NULL;
+  GHashTableIter iter;
+  gpointer data;
+  guint count = 0;
+  int r;
+
+  /* pre version 2 layout, one file per timestamp */
+  path = g_file_get_path (store->times);
+  r = g_mkdir_with_parents (path, 0755);
+
+  if (r < 0)
+    {
+      int code = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code),
+                   "could not create times directory: %s",
+                   g_strerror (code));
+      return FALSE;
+    }
+
+  g_hash_table_iter_init (&iter, store->pending);
+  while (g_hash_table_iter_next (&iter, NULL, &data))
+    {
+      StorePending *pt = data;
+
+      for (guint i = 0; i < STORE_TIME_LAST; i++)
+        {
+          g_autoptr(GError) e = NULL;
+          g_autoptr(GFile) gf = NULL;
+          g_autofree char *fn = NULL;
+          guint64 val = pt->times[i];
+          gboolean ok;
+
+          if ((pt->tflags & (1 << i)) == 0)
+            continue;
+
+          fn = g_strdup_printf ("%s.%s", pt->uid, store_time_names[i]);
+          gf = g_file_get_child (store->times, fn);
+
+          ok = bolt_fs_touch (gf, val, val, &e);
+
+          if (ok)
+            store_own_record_file (store, gf);
+
+          /* written ones are done, the rest stays queued */
+          if (ok)
+            {
+              pt->tflags &= ~(1 << i);
+              count++;
+            }
+          else if (err == NULL)
+            err = g_steal_pointer (&e);
+          else
+            bolt_warn_err (e, LOG_DEV_UID (pt->uid), LOG_TOPIC ("store"),
+                           "failed to write timestamp '%s'",
+                           store_time_names[i]);
+        }
+
+      if (pt->tflags == 0)
+        g_hash_table_iter_remove (&iter);
+    }
+
+  *written = count;
+
+  if (err != NULL)
+    return bolt_error_propagate (error, &err);
+
+  return TRUE;
+}
+
+static gboolean
+store_times_flush (BoltStore *store,
+                   GError   **error)
+{
+  guint count = 0;
+  gboolean ok;
+
+  if (store->flush_id > 0)
+    {
+      g_source_remove (store->flush_id);
+      store->flush_id = 0;
+    }
+
+  if (g_hash_table_size (store->pending) == 0)
+    return TRUE;
+
+  store_index_invalidate (store);
+
+  if (store_times_in_db (store))
+    ok = store_tdb_update (store, store->pending, &count, error);
+  else
+    ok = store_times_write_files (store, &count, error);
+
+  /* entries are only removed once they are written; if the
+   * update failed, the rest stays queued and is retried */
+  if (ok)
+    g_hash_table_remove_all (store->pending);
+  else if (g_hash_table_size (store->pending) > 0)
+    store->flush_id = g_timeout_add_seconds (TIMES_RETRY_DELAY,
+                                             store_times_flush_timeout,
+                                             store);
+
+  bolt_debug (LOG_TOPIC ("store"), "flushed %u timestamps", count);
+
+  store_index_changed (store);
+
+  return ok;
+}
+
+static gboolean
+store_times_flush_timeout (gpointer user_data)
+{
+  g_autoptr(GError) err = NULL;
+  BoltStore *store = BOLT_STORE (user_data);
+  gboolean ok;
+
+  store->flush_id = 0;
+
+  ok = store_times_flush (store, &err);
+  if (!ok)
+    bolt_warn_err (err, LOG_TOPIC ("store"), "failed to flush timestamps");
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+store_times_queue (BoltStore  *store,
+                   const char *uid,
+                   StoreTime   idx,
+                   guint64     val)
+{
+  StorePending *pt;
+
+  pt = g_hash_table_lookup (store->pending, uid);
+
+  if (pt == NULL)
+    {
+      pt = g_slice_new0 (StorePending);
+      pt->uid = g_strdup (uid);
+      g_hash_table_insert (store->pending, pt->uid, pt);
+    }
+
+  /* later updates of the same timestamp win */
+  pt->times[idx] = val;
+  pt->tflags |= 1 << idx;
+
+  if (store->flush_id > 0)
+    return;
+
+  store->flush_id = g_timeout_add_seconds (TIMES_FLUSH_DELAY,
+                                           store_times_flush_timeout,
+                                           store);
+}
+
+static gboolean
+store_times_unqueue (BoltStore  *store,
+                     const char *uid,
+                     StoreTime   idx)
+{
+  StorePending *pt;
+  gboolean found;
+
+  pt = g_hash_table_lookup (store->pending, uid);
+
+  if (pt == NULL)
+    return FALSE;
+
+  found = (pt->tflags & (1 << idx)) != 0;
+  pt->tflags &= ~(1 << idx);
+
+  if (pt->tflags == 0)
+    g_hash_table_remove (store->pending, uid);
+
+  return found;
+}
+
+/* transactions
+ *
+ * While a transaction is active, files are not written or
+ * removed directly; instead new content is staged next to
+ * the target as hidden '.<name>.txn' files and the list of
+ * operations is recorded. Staged files are flushed when they
+ * are recorded. On commit, their directories are flushed, the
+ * list is written to a manifest which is moved into place; this
+ * is the commit point. A crash after that is recovered from by
+ * replaying the manifest when the store is opened next time.
+ * The manifest is only removed once the directories with the
+ * applied operations have been flushed.
+ */
+#define TXN_FILE ".transaction"
+#define TXN_FILE_TMP ".transaction.tmp"
+#define TXN_SUFFIX ".txn"
+
+typedef struct StoreTxnOp
+{
+  char *target; /* relative to the store root */
+  char *staged; /* NULL for deletions */
+} StoreTxnOp;
+
+typedef struct StoreTxnSignal
+{
+  guint id;
+  char *uid;
+} StoreTxnSignal;
+
+struct StoreTxn
+{
+  GArray    *ops;     /* StoreTxnOp */
+  GPtrArray *uids;    /* index entries that were touched */
+  GArray    *signals; /* StoreTxnSignal, emitted on commit */
+};
+
+static void
+store_txn_op_clear (gpointer data)
+{
+  StoreTxnOp *op = data;
+
+  g_clear_pointer (&op->target, g_free);
+  g_clear_pointer (&op->staged, g_free);
+}
+
+static void
+store_txn_signal_clear (gpointer data)
+{
+  StoreTxnSignal *sig = data;
+
+  g_clear_pointer (&sig->uid, g_free);
+}
+
+static StoreTxn *
+store_txn_new (void)
+{
+  StoreTxn *txn = g_slice_new0 (StoreTxn);
+
+  txn->ops = g_array_new (FALSE, TRUE, sizeof (StoreTxnOp));
+  g_array_set_clear_func (txn->ops, store_txn_op_clear);
+
+  txn->uids = g_ptr_array_new_with_free_func (g_free);
+
+  txn->signals = g_array_new (FALSE, TRUE, sizeof (StoreTxnSignal));
+  g_array_set_clear_func (txn->signals, store_txn_signal_clear);
+
+  return txn;
+}
+
+static void
+store_txn_free (StoreTxn *txn)
+{
+  g_array_unref (txn->ops);
+  g_ptr_array_unref (txn->uids);
+  g_array_unref (txn->signals);
+  g_slice_free (StoreTxn, txn);
+}
+
+static int
+store_txn_find_op (StoreTxn   *txn,
+                   const char *target)
+{
+  for (guint i = 0; i < txn->ops->len; i++)
+    {
+      StoreTxnOp *op = &g_array_index (txn->ops, StoreTxnOp, i);
+
+      if (bolt_streq (op->target, target))
+        return (int) i;
+    }
+
+  return -1;
+}
+
+static void
+store_txn_add_op (StoreTxn   *txn,
+                  const char *target,
+                  const char *staged)
+{
+  StoreTxnOp op;
+  int idx;
+
+  /* the last operation on a target wins */
+  idx = store_txn_find_op (txn, target);
+  if (idx > -1)
+    g_array_remove_index (txn->ops, idx);
+
+  op.target = g_strdup (target);
+  op.staged = g_strdup (staged);
+
+  g_array_append_val (txn->ops, op);
+}
+
+static void
+store_txn_touch (BoltStore  *store,
+                 const char *uid)
+{
+  if (store->txn == NULL)
+    return;
+
+  g_ptr_array_add (store->txn->uids, g_strdup (uid));
+}
+
+static void
+store_emit (BoltStore  *store,
+            guint       id,
+            const char *uid)
+{
+  StoreTxnSignal sig;
+
+  if (store->txn == NULL)
+    {
+      g_signal_emit (store, signals[id], 0, uid);
+      return;
+    }
+
+  sig.id = id;
+  sig.uid = g_strdup (uid);
+  g_array_append_val (store->txn->signals, sig);
+}
+
+static GFile *
+store_txn_staged_file (GFile *target)
+{
+  g_autoptr(GFile) parent = NULL;
+  g_autofree char *name = NULL;
+  g_autofree char *sname = NULL;
+
+  name = g_file_get_basename (target);
+  sname = g_strdup_printf (".%s" TXN_SUFFIX, name);
+  parent = g_file_get_parent (target);
+
+  return g_file_get_child (parent, sname);
+}
+
+static int
+store_txn_stage (BoltStore *store,
+                 GFile     *target,
+                 int        mode,
+                 GError   **error)
+{
+  g_autoptr(GFile) staged = NULL;
+  g_autofree char *path = NULL;
+
+  staged = store_txn_staged_file (target);
+  path = g_file_get_path (staged);
+
+  return bolt_open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    mode, error);
+}
+
+/* finish staging 'target' via the file in 'fd', which was
+ * obtained from store_txn_stage: if 'ok', i.e. the content
+ * was written successfully, the data is flushed and the
+ * operation is recorded; otherwise, or if that fails, the
+ * staged file as well as any operation for the target are
+ * dropped, so no partial data can ever get committed */
+static gboolean
+store_txn_staged (BoltStore *store,
+                  GFile     *target,
+                  int       *fd,
+                  gboolean   ok,
+                  GError   **error)
+{
+  g_autoptr(GFile) staged = NULL;
+  g_autofree char *rt = NULL;
+  g_autofree char *rs = NULL;
+  int idx;
+
+  staged = store_txn_staged_file (target);
+  rt = g_file_get_relative_path (store->root, target);
+
+  if (ok)
+    ok = bolt_fsync (*fd, error);
+
+  if (ok)
+    ok = bolt_close (bolt_steal (fd, -1), error);
+
+  if (ok)
+    {
+      rs = g_file_get_relative_path (store->root, staged);
+      store_txn_add_op (store->txn, rt, rs);
+      return TRUE;
+    }
+
+  idx = store_txn_find_op (store->txn, rt);
+  if (idx > -1)
+    g_array_remove_index (store->txn->ops, idx);
+
+  (void) g_file_delete (staged, NULL, NULL);
+
+  return FALSE;
+}
+
+static gboolean
+store_replace_file (BoltStore  *store,
+                    GFile      *target,
+                    const char *data,
+                    gsize       len,
+                    GError    **error)
+{
+  bolt_autoclose int fd = -1;
+  gboolean ok;
+
+  if (store->txn == NULL)
+    {
+      ok = g_file_replace_contents (target,
+                                    data, len,
+                                    NULL, FALSE,
+                                    0,
+                                    NULL,
+                                    NULL, error);
+      if (ok)
+        store_own_record_file (store, target);
+
+      return ok;
+    }
+
+  fd = store_txn_stage (store, target, 0666, error);
+
+  if (fd < 0)
+    return FALSE;
+
+  ok = bolt_write_all (fd, data, len, error);
+
+  return store_txn_staged (store, target, &fd, ok, error);
+}
+
+static gboolean
+store_delete_file (BoltStore *store,
+                   GFile     *target,
+                   GError   **error)
+{
+  g_autofree char *rt = NULL;
+  gboolean have;
+  gboolean ok;
+  int idx;
+
+  if (store->txn == NULL)
+    {
+      ok = g_file_delete (target, NULL, error);
+      if (ok)
+        store_own_record_file (store, target);
+
+      return ok;
+    }
+
+  rt = g_file_get_relative_path (store->root, target);
+  idx = store_txn_find_op (store->txn, rt);
+
+  /* staged within this transaction, i.e. the file exists,
+   * unless the staged operation is a deletion itself */
+  if (idx > -1)
+    {
+      StoreTxnOp *op = &g_array_index (store->txn->ops, StoreTxnOp, idx);
+      have = op->staged != NULL;
+
+      if (have)
+        {
+          g_autoptr(GFile) staged = g_file_resolve_relative_path (store->root,
+                                                                  op->staged);
+          (void) g_file_delete (staged, NULL, NULL);
+        }
+    }
+  else
+    {
+      have = g_file_query_exists (target, NULL);
+    }
+
+  if (!have)
+    {
+      g_autofree char *path = g_file_get_path (target);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "could not delete '%s': no such file", path);
+      return FALSE;
+    }
+
+  store_txn_add_op (store->txn, rt, NULL);
+
+  return TRUE;
+}
+
+static gboolean
+store_txn_parse (const char *data,
+                 GArray     *ops,
+                 GError    **error)
+{
+  g_auto(GStrv) lines = NULL;
+  guint count = 0;
+  guint n;
+
+  lines = g_strsplit (data, "\n", -1);
+  n = g_strv_length (lines);
+
+  /* last line is empty, because of the trailing newline */
+  if (n < 2 || !bolt_strzero (lines[n - 1]) ||
+      !g_str_has_prefix (lines[n - 2], "C\t"))
+    {
+      g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                           "transaction: missing commit record");
+      return FALSE;
+    }
+
+  for (guint i = 0; i < n - 2; i++)
+    {
+      g_auto(GStrv) fields = g_strsplit (lines[i], "\t", 3);
+      StoreTxnOp op = {NULL, NULL};
+      guint k = g_strv_length (fields);
+
+      if (k == 3 && bolt_streq (fields[0], "R"))
+        {
+          op.staged = g_strdup (fields[1]);
+          op.target = g_strdup (fields[2]);
+        }
+      else if (k == 2 && bolt_streq (fields[0], "D"))
+        {
+          op.target = g_strdup (fields[1]);
+        }
+      else
+        {
+          g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                       "transaction: invalid record at line %u", i + 1);
+          return FALSE;
+        }
+
+      g_array_append_val (ops, op);
+      count++;
+    }
+
+  if (count != (guint) g_ascii_strtoull (lines[n - 2] + 2, NULL, 10))
+    {
+      g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                           "transaction: record count mismatch");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+store_txn_apply (int     rootfd,
+                 GArray *ops)
+{
+  for (guint i = 0; i < ops->len; i++)
+    {
+      g_autoptr(GError) err = NULL;
+      StoreTxnOp *op = &g_array_index (ops, StoreTxnOp, i);
+      gboolean ok;
+
+      /* NB: must be idempotent, since it might be replayed */
+      if (op->staged != NULL)
+        {
+          ok = bolt_renameat (rootfd, op->staged, rootfd, op->target, &err);
+
+          if (!ok && bolt_err_notfound (err))
+            ok = TRUE; /* already applied */
+        }
+      else
+        {
+          ok = bolt_unlink_at (rootfd, op->target, 0, &err);
+
+          if (!ok && bolt_err_notfound (err))
+            ok = TRUE;
+        }
+
+      if (!ok)
+        bolt_warn_err (err, LOG_TOPIC ("store"),
+                       "transaction: failed to apply '%s'", op->target);
+    }
+}
+
+/* flush the directories of all targets, which are
+ * the directories of the staged files as well */
+static gboolean
+store_txn_sync_dirs (int     rootfd,
+                     GArray *ops,
+                     GError **error)
+{
+  g_autoptr(GHashTable) dirs = NULL;
+  GHashTableIter iter;
+  const char *dir;
+
+  dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (guint i = 0; i < ops->len; i++)
+    {
+      StoreTxnOp *op = &g_array_index (ops, StoreTxnOp, i);
+      g_hash_table_add (dirs, g_path_get_dirname (op->target));
+    }
+
+  g_hash_table_iter_init (&iter, dirs);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &dir, NULL))
+    {
+      bolt_autoclose int fd = -1;
+
+      fd = bolt_openat (rootfd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+                        0, error);
+
+      if (fd < 0 || !bolt_fsync (fd, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+store_txn_write_manifest (int      rootfd,
+                          GString *manifest,
+                          GError **error)
+{
+  bolt_autoclose int fd = -1;
+  gboolean ok;
+
+  fd = bolt_openat (rootfd, TXN_FILE_TMP,
+                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0666, error);
+
+  if (fd < 0)
+    return FALSE;
+
+  ok = bolt_write_all (fd, manifest->str, manifest->len, error);
+
+  if (ok)
+    ok = bolt_fsync (fd, error);
+
+  if (ok)
+    ok = bolt_close (bolt_steal (&fd, -1), error);
+
+  return ok;
+}
+
+static void
+store_txn_discard (int     rootfd,
+                   GArray *ops)
+{
+  for (guint i = 0; i < ops->len; i++)
+    {
+      StoreTxnOp *op = &g_array_index (ops, StoreTxnOp, i);
+
+      if (op->staged != NULL)
+        (void) bolt_unlink_at (rootfd, op->staged, 0, NULL);
+    }
+}
+
+static void
+store_txn_cleanup_dir (GFile *dir)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(DIR) d = NULL;
+  struct dirent *de;
+
+  path = g_file_get_path (dir);
+  d = bolt_opendir (path, NULL);
+
+  if (d == NULL)
+    return;
+
+  while ((de = readdir (d)) != NULL)
+    {
+      if (de->d_name[0] != '.' || !g_str_has_suffix (de->d_name, TXN_SUFFIX))
+        continue;
+
+      bolt_debug (LOG_TOPIC ("store"), "removing stale '%s'", de->d_name);
+      (void) bolt_unlink_at (dirfd (d), de->d_name, 0, NULL);
+    }
+}
+
+static void
+store_txn_recover (BoltStore *store,
+                   DIR       *root)
+{
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GArray) ops = NULL;
+  g_autofree char *base = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *data = NULL;
+  gboolean ok;
+
+  base = g_file_get_path (store->root);
+  path = g_build_filename (base, TXN_FILE, NULL);
+  ok = g_file_get_contents (path, &data, NULL, &err);
+
+  if (!ok && !g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+    bolt_warn_err (err, LOG_TOPIC ("store"), "could not read transaction");
+
+  if (ok)
+    {
+      ops = g_array_new (FALSE, TRUE, sizeof (StoreTxnOp));
+      g_array_set_clear_func (ops, store_txn_op_clear);
+
+      ok = store_txn_parse (data, ops, &err);
+
+      if (ok)
+        {
+          bolt_info (LOG_TOPIC ("store"), "replaying transaction [%u ops]",
+                     ops->len);
+          store_txn_apply (dirfd (root), ops);
+
+          /* the snapshot might predate the transaction */
+          (void) bolt_unlink_at (dirfd (root), SNAPSHOT_FILE, 0, NULL);
+
+          ok = store_txn_sync_dirs (dirfd (root), ops, &err);
+        }
+      else
+        {
+          bolt_warn_err (err, LOG_TOPIC ("store"), "discarding transaction");
+          ok = TRUE;
+        }
+
+      /* keep the manifest, if the applied changes might not
+       * be durable yet, to replay it the next time around */
+      if (ok)
+        (void) bolt_unlink_at (dirfd (root), TXN_FILE, 0, NULL);
+      else
+        bolt_warn_err (err, LOG_TOPIC ("store"), "could not sync transaction");
+    }
+
+  (void) bolt_unlink_at (dirfd (root), TXN_FILE_TMP, 0, NULL);
+
+  /* left-overs of transactions that were never committed */
+  store_txn_cleanup_dir (store->devices);
+  store_txn_cleanup_dir (store->domains);
+  store_txn_cleanup_dir (store->keys);
+}
+
+static void
+store_txn_rollback (BoltStore *store,
+                    StoreTxn  *txn,
+                    int        rootfd)
+{
+  if (rootfd > -1)
+    store_txn_discard (rootfd, txn->ops);
+
+  /* the index might have been updated for staged operations,
+   * forget the entries, they will be re-loaded from disk; the
+   * same goes for the key set, which might have been changed */
+  g_clear_pointer (&store->keyset, g_hash_table_unref);
+
+  for (guint i = 0; i < txn->uids->len; i++)
+    {
+      const char *uid = g_ptr_array_index (txn->uids, i);
+      g_hash_table_remove (store->devidx, uid);
+    }
+
+  if (txn->uids->len > 0)
+    store_index_changed (store);
+}
+
+/* change detection
+ *
+ * Entries can be added, changed or removed by other
+ * programs while we are running, e.g. by provisioning
+ * tools. The store directories are watched via inotify
+ * and changed entries are re-loaded individually, after
+ * a short delay to coalesce bursts of events. For each
+ * file we write or remove ourselves, a stamp of the result
+ * is recorded; events for files that still match their
+ * stamp are ours and are ignored right away.
+ */
+#define WATCH_DELAY 250 /* ms */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+                      IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef enum StoreWatchDir
+{
+  WATCH_DEVICES = STORE_DIR_DEVICES,
+  WATCH_KEYS    = STORE_DIR_KEYS,
+  WATCH_DOMAINS = STORE_DIR_DOMAINS,
+  WATCH_TIMES   = STORE_DIR_TIMES,
+
+  WATCH_LAST    = STORE_DIR_LAST
+} StoreWatchDir;
+
+typedef struct StoreStamp
+{
+  gboolean        exists;
+  ino_t           ino;
+  off_t           size;
+  struct timespec ctim;
+} StoreStamp;
+
+static gboolean
+store_own_stat (BoltStore  *store,
+                const char *path,
+                StoreStamp *stamp)
+{
+  struct stat st;
+  int r;
+
+  r = fstatat (store->rootfd, path, &st, 0);
+
+  if (r < 0 && errno != ENOENT)
+    return FALSE;
+
+  stamp->exists = r == 0;
+
+  if (stamp->exists)
+    {
+      stamp->ino = st.st_ino;
+      stamp->size = st.st_size;
+      stamp->ctim = st.st_ctim;
+    }
+
+  return TRUE;
+}
+
+static void
+store_own_record (BoltStore  *store,
+                  const char *path)
+{
+  StoreStamp *stamp;
+
+  if (store->ifd < 0 || path == NULL)
+    return;
+
+  stamp = g_new0 (StoreStamp, 1);
+
+  if (!store_own_stat (store, path, stamp))
+    {
+      g_hash_table_remove (store->own, path);
+      g_free (stamp);
+      return;
+    }
+
+  g_hash_table_insert (store->own, g_strdup (path), stamp);
+}
+
+static void
+store_own_record_file (BoltStore *store,
+                       GFile     *file)
+{
+  g_autofree char *path = NULL;
+
+  if (store->ifd < 0)
+    return;
+
+  path = g_file_get_relative_path (store->root, file);
+  store_own_record (store, path);
+}
+
+/* TRUE if the file is exactly as we left it */
+static gboolean
+store_own_check (BoltStore    *store,
+                 StoreWatchDir dir,
+                 const char   *name)
+{
+  g_autofree char *path = NULL;
+  StoreStamp now = {FALSE, };
+  StoreStamp *stamp;
+  gboolean own;
+
+  path = g_strdup_printf ("%s/%s", store_dir_names[dir], name);
+  stamp = g_hash_table_lookup (store->own, path);
+
+  if (stamp == NULL)
+    return FALSE;
+
+  own = store_own_stat (store, path, &now) &&
+        now.exists == stamp->exists &&
+        (!now.exists ||
+         (now.ino == stamp->ino &&
+          now.size == stamp->size &&
+          now.ctim.tv_sec == stamp->ctim.tv_sec &&
+          now.ctim.tv_nsec == stamp->ctim.tv_nsec));
+
+  /* foreign changes, as well as removals, are final */
+  if (!own || !now.exists)
+    g_hash_table_remove (store->own, path);
+
+  return own;
+}
+
+static void
+store_watch_mark (BoltStore    *store,
+                  StoreWatchDir dir,
+                  const char   *name)
+{
+  g_autofree char *uid = NULL;
+  gpointer val;
+  guint mask;
+
+  /* hidden files are temporary or staged ones */
+  if (name == NULL || name[0] == '.')
+    return;
+
+  if (store_own_check (store, dir, name))
+    return;
+
+  if (dir == WATCH_TIMES)
+    {
+      const char *dot = strchr (name, '.');
+
+      if (dot == NULL)
+        return;
+
+      uid = g_strndup (name, dot - name);
+    }
+  else
+    {
+      uid = g_strdup (name);
+    }
+
+  val = g_hash_table_lookup (store->changed, uid);
+  mask = GPOINTER_TO_UINT (val) | (1U << dir);
+
+  g_hash_table_insert (store->changed,
+                       g_steal_pointer (&uid),
+                       GUINT_TO_POINTER (mask));
+}
+
+static void
+store_watch_rescan (BoltStore    *store,
+                    StoreWatchDir dir)
+{
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GFile) gf = NULL;
+  g_autoptr(GDir) d = NULL;
+  g_autofree char *path = NULL;
+  GHashTableIter iter;
+  gpointer key;
+  const char *name;
+
+  gf = g_file_get_child (store->root, store_dir_names[dir]);
+  path = g_file_get_path (gf);
+  d = g_dir_open (path, 0, &err);
+
+  while (d != NULL && (name = g_dir_read_name (d)) != NULL)
+    store_watch_mark (store, dir, name);
+
+  if (d == NULL && !bolt_err_notfound (err))
+    bolt_warn_err (err, LOG_TOPIC ("store"), "could not scan '%s'",
+                   store_dir_names[dir]);
+
+  /* entries we know about might be gone */
+  if (dir == WATCH_DEVICES || dir == WATCH_KEYS || dir == WATCH_TIMES)
+    g_hash_table_iter_init (&iter, store->devidx);
+  else
+    g_hash_table_iter_init (&iter, store->domidx);
+
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    store_watch_mark (store, dir, key);
+}
+
+static void
+store_watch_add (BoltStore    *store,
+                 StoreWatchDir dir)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(GFile) gf = NULL;
+  int wd;
+
+  gf = g_file_get_child (store->root, store_dir_names[dir]);
+  path = g_file_get_path (gf);
+
+  wd = inotify_add_watch (store->ifd, path, WATCH_EVENTS | IN_ONLYDIR);
+
+  if (wd < 0 && errno != ENOENT)
+    bolt_warn (LOG_TOPIC ("store"), "could not watch '%s': %s",
+               store_dir_names[dir], g_strerror (errno));
+
+  store->wds[dir] = wd;
+}
+
+static void
+store_watch_reload (BoltStore  *store,
+                    const char *uid,
+                    guint       mask)
+{
+  g_autoptr(GError) err = NULL;
+  StoreDevice *have;
+  StoreDevice *dev;
+
+  /* the key set must not be trusted for foreign changes */
+  if (mask & (1U << WATCH_KEYS))
+    store_keys_update (store, uid, store_stat_key (store, uid));
+
+  if (mask & (1U << WATCH_DOMAINS))
+    {
+      StoreDomain *dom = store_load_domain (store, uid, &err);
+
+      if (dom != NULL)
+        store_index_put_domain (store, dom);
+      else if (bolt_err_notfound (err) &&
+               g_hash_table_remove (store->domidx, uid))
+        store_index_changed (store);
+      else if (!bolt_err_notfound (err))
+        bolt_warn_err (err, LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                       "could not reload domain");
+
+      g_clear_error (&err);
+    }
+
+  have = g_hash_table_lookup (store->devidx, uid);
+
+  if (mask & (1U << WATCH_DEVICES))
+    {
+      dev = store_load_device (store, uid, &err);
+
+      if (dev != NULL)
+        {
+          store_index_put_device (store, dev);
+
+          if (have == NULL)
+            {
+              bolt_info (LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                         "device added externally");
+              g_signal_emit (store, signals[SIGNAL_DEVICE_ADDED], 0, uid);
+            }
+          else
+            {
+              bolt_info (LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                         "device changed externally");
+              g_signal_emit (store, signals[SIGNAL_DEVICE_CHANGED], 0, uid);
+            }
+        }
+      else if (bolt_err_notfound (err) && have != NULL)
+        {
+          bolt_info (LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                     "device removed externally");
+          g_hash_table_remove (store->devidx, uid);
+          store_index_changed (store);
+          g_signal_emit (store, signals[SIGNAL_DEVICE_REMOVED], 0, uid);
+        }
+      else if (!bolt_err_notfound (err))
+        {
+          bolt_warn_err (err, LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                         "could not reload device");
+        }
+
+      /* key and times got re-probed as well */
+      return;
+    }
+
+  if (have == NULL)
+    return;
+
+  if (mask & (1U << WATCH_KEYS))
+    have->key = store_probe_key (store, uid);
+
+  if (mask & (1U << WATCH_TIMES))
+    store_device_probe_times (store, have);
+
+  store_index_changed (store);
+
+  if (mask & (1U << WATCH_KEYS))
+    g_signal_emit (store, signals[SIGNAL_DEVICE_CHANGED], 0, uid);
+}
+
+static gboolean
+store_watch_timeout (gpointer user_data)
+{
+  g_autoptr(GHashTable) changed = NULL;
+  BoltStore *store = user_data;
+  GHashTableIter iter;
+  gpointer key, val;
+
+  /* not while a transaction is staging changes */
+  if (store->txn != NULL)
+    return G_SOURCE_CONTINUE;
+
+  store->changed_id = 0;
+
+  changed = g_steal_pointer (&store->changed);
+  store->changed = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, NULL);
+
+  bolt_debug (LOG_TOPIC ("store"), "processing changes [%u entries]",
+              g_hash_table_size (changed));
+
+  store_index_invalidate (store);
+
+  g_hash_table_iter_init (&iter, changed);
+  while (g_hash_table_iter_next (&iter, &key, &val))
+    store_watch_reload (store, key, GPOINTER_TO_UINT (val));
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+store_watch_event (GIOChannel  *source,
+                   GIOCondition condition,
+                   gpointer     user_data)
+{
+  BoltStore *store = user_data;
+  char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  ssize_t n;
+
+  while ((n = read (store->ifd, buf, sizeof (buf))) > 0)
+    {
+      char *p = buf;
+
+      while (p < buf + n)
+        {
+          const struct inotify_event *ev = (const struct inotify_event *) p;
+          const char *name = ev->len > 0 ? ev->name : NULL;
+
+          p += sizeof (struct inotify_event) + ev->len;
+
+          if (ev->mask & IN_Q_OVERFLOW)
+            {
+              bolt_warn (LOG_TOPIC ("store"), "event queue overflow");
+              for (guint i = 0; i < WATCH_LAST; i++)
+                store_watch_rescan (store, i);
+              continue;
+            }
+
+          if (ev->wd == store->wdroot)
+            {
+              /* sub-directories are created on demand */
+              for (guint i = 0; name && i < WATCH_LAST; i++)
+                {
+                  if (!bolt_streq (name, store_dir_names[i]))
+                    continue;
+
+                  store_watch_add (store, i);
+                  store_watch_rescan (store, i);
+                }
+              continue;
+            }
+
+          for (guint i = 0; i < WATCH_LAST; i++)
+            {
+              if (ev->wd != store->wds[i])
+                continue;
+
+              if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                {
+                  (void) inotify_rm_watch (store->ifd, store->wds[i]);
+                  store->wds[i] = -1;
+                  /* the handle refers to the old directory */
+                  store_dirfd_close (store, i);
+                  store_watch_rescan (store, i);
+                }
+              else
+                {
+                  store_watch_mark (store, i, name);
+                }
+
+              break;
+            }
+        }
+    }
+
+  if (n < 0 && errno != EAGAIN && errno != EINTR)
+    {
+      bolt_warn (LOG_TOPIC ("store"), "failed to read events: %s",
+                 g_strerror (errno));
+      store->watch = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  if (g_hash_table_size (store->changed) > 0 && store->changed_id == 0)
+    store->changed_id = g_timeout_add (WATCH_DELAY,
+                                       store_watch_timeout,
+                                       store);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+store_watch_close (BoltStore *store)
+{
+  if (store->watch > 0)
+    {
+      g_source_remove (store->watch);
+      store->watch = 0;
+    }
+
+  if (store->changed_id > 0)
+    {
+      g_source_remove (store->changed_id);
+      store->changed_id = 0;
+    }
+
+  if (store->ifd > -1)
+    (void) bolt_close (bolt_steal (&store->ifd, -1), NULL);
+}
+
+static void
+store_watch_setup (BoltStore *store)
+{
+  g_autoptr(GIOChannel) ch = NULL;
+  g_autofree char *path = NULL;
+
+  store->ifd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+
+  if (store->ifd < 0)
+    {
+      bolt_warn (LOG_TOPIC ("store"), "could not setup inotify: %s",
+                 g_strerror (errno));
+      return;
+    }
+
+  path = g_file_get_path (store->root);
+  store->wdroot = inotify_add_watch (store->ifd, path,
+                                     IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+
+  if (store->wdroot < 0)
+    {
+      bolt_warn (LOG_TOPIC ("store"), "could not watch store: %s",
+                 g_strerror (errno));
+      store_watch_close (store);
+      return;
+    }
+
+  for (guint i = 0; i < WATCH_LAST; i++)
+    store_watch_add (store, i);
+
+  ch = g_io_channel_unix_new (store->ifd);
+  store->watch = g_io_add_watch (ch, G_IO_IN, store_watch_event, store);
+}
+
+/* export and import
+ *
+ * The archive is a stream of records, each consisting
+ * of a header line '<kind> <uid> <length>' followed by
+ * the raw data and a newline. It starts with a magic
+ * line and is terminated by an 'end <count>' line:
+ *
+ *   bolt-store-archive 1
+ *   device <uid> <len>
+ *   <device entry>
+ *   key <uid> 64
+ *   <key>
+ *   times <uid> <len>
+ *   conntime=<secs>
+ *   authtime=<secs>
+ *   domain <uid> <len>
+ *   <domain entry>
+ *   end <count>
+ *
+ * Records are written and read one at a time: an export
+ * proceeds in steps of a few entries and an import is fed
+ * chunk by chunk, so memory usage does not depend on the
+ * number of records and the main loop is never blocked by
+ * the whole archive.
+ */
+#define ARCHIVE_MAGIC "bolt-store-archive"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_RECORD_MAX (64 * 1024)
+#define ARCHIVE_HEADER_MAX 256 /* '<kind> <uid> <length>' */
+#define ARCHIVE_CHUNK (64 * 1024) /* bytes read at once */
+#define EXPORT_STEP 64 /* devices or domains per step */
+#define IMPORT_BATCH 512 /* records per transaction */
+
+static gboolean
+archive_write_record (GOutputStream *out,
+                      const char    *kind,
+                      const char    *uid,
+                      const char    *data,
+                      gsize          len,
+                      GError       **error)
+{
+  g_autofree char *hdr = NULL;
+  gboolean ok;
+
+  hdr = g_strdup_printf ("%s %s %" G_GSIZE_FORMAT "\n", kind, uid, len);
+
+  ok = g_output_stream_write_all (out, hdr, strlen (hdr), NULL, NULL, error);
+
+  if (ok)
+    ok = g_output_stream_write_all (out, data, len, NULL, NULL, error);
+
+  if (ok)
+    ok = g_output_stream_write_all (out, "\n", 1, NULL, NULL, error);
+
+  return ok;
+}
+
+static gboolean
+archive_write_file (GOutputStream *out,
+                    const char    *kind,
+                    GFile         *dir,
+                    const char    *uid,
+                    GError       **error)
+{
+  g_autoptr(GFile) gf = NULL;
+  g_autofree char *data = NULL;
+  gboolean ok;
+  gsize len;
+
+  gf = g_file_get_child (dir, uid);
+  ok = g_file_load_contents (gf, NULL, &data, &len, NULL, error);
+
+  if (!ok)
+    return FALSE;
+
+  return archive_write_record (out, kind, uid, data, len, error);
+}
+
+static gboolean
+store_export_times (BoltStore     *store,
+                    GOutputStream *out,
+                    StoreDevice   *dev,
+                    guint         *count,
+                    GError       **error)
+{
+  g_autoptr(GString) data = NULL;
+  StorePending *pt;
+
+  pt = g_hash_table_lookup (store->pending, dev->uid);
+  data = g_string_new ("");
+
+  for (guint i = 0; i < STORE_TIME_LAST; i++)
+    {
+      guint64 val = dev->times[i];
+
+      if (pt != NULL && pt->tflags & (1 << i))
+        val = pt->times[i];
+
+      if (val == 0)
+        continue;
+
+      g_string_append_printf (data, "%s=%" G_GUINT64_FORMAT "\n",
+                              store_time_names[i], val);
+    }
+
+  if (data->len == 0)
+    return TRUE;
+
+  *count += 1;
+
+  return archive_write_record (out, "times", dev->uid,
+                               data->str, data->len,
+                               error);
+}
+
+static gboolean
+archive_check_uid (const char *uid,
+                   GError    **error)
+{
+  if (bolt_strzero (uid) || uid[0] == '.' || strchr (uid, '/') != NULL)
+    {
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                   "archive: invalid uid '%s'", uid ? : "");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+store_import_device (BoltStore  *store,
+                     const char *uid,
+                     const char *data,
+                     gsize       len,
+                     GError    **error)
+{
+  g_autoptr(GKeyFile) kf = NULL;
+  g_autoptr(GFile) entry = NULL;
+  StoreDevice *have;
+  StoreDevice *dev;
+  gboolean ok;
+
+  kf = g_key_file_new ();
+  ok = g_key_file_load_from_data (kf, data, len, G_KEY_FILE_KEEP_COMMENTS, error);
+
+  if (!ok)
+    return FALSE;
+
+  dev = store_device_from_keyfile (uid, kf, error);
+
+  if (dev == NULL)
+    return FALSE;
+
+  entry = g_file_get_child (store->devices, uid);
+  ok = store_replace_file (store, entry, data, len, error);
+
+  if (!ok)
+    {
+      store_device_free (dev);
+      return FALSE;
+    }
+
+  have = g_hash_table_lookup (store->devidx, uid);
+  if (have != NULL)
+    {
+      dev->key = have->key;
+      dev->tflags = have->tflags;
+      memcpy (dev->times, have->times, sizeof (dev->times));
+    }
+  else
+    {
+      dev->key = store_probe_key (store, uid);
+      store_device_probe_times (store, dev);
+      store_emit (store, SIGNAL_DEVICE_ADDED, uid);
+    }
+
+  store_index_put_device (store, dev);
+  store_txn_touch (store, uid);
+
+  return TRUE;
+}
+
+static gboolean
+store_import_key (BoltStore  *store,
+                  const char *uid,
+                  const char *data,
+                  gsize       len,
+                  GError    **error)
+{
+  bolt_autoclose int fd = -1;
+  g_autoptr(GFile) keypath = NULL;
+  StoreDevice *dev;
+  gboolean ok;
+
+  if (len != BOLT_KEY_CHARS)
+    {
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_BADKEY,
+                   "archive: invalid key size for '%s'", uid);
+      return FALSE;
+    }
+
+  /* devices are written before their keys, so the device
+   * is known by now if it is in the archive or the store */
+  dev = g_hash_table_lookup (store->devidx, uid);
+  if (dev == NULL)
+    {
+      bolt_warn (LOG_TOPIC ("store"), LOG_DEV_UID (uid),
+                 "archive: skipping key without device");
+      return TRUE;
+    }
+
+  keypath = g_file_get_child (store->keys, uid);
+  fd = store_txn_stage (store, keypath, 0600, error);
+
+  if (fd < 0)
+    return FALSE;
+
+  ok = bolt_write_all (fd, data, len, error);
+  ok = store_txn_staged (store, keypath, &fd, ok, error);
+
+  if (ok)
+    {
+      dev->key = BOLT_KEY_HAVE;
+      store_txn_touch (store, uid);
+      store_index_changed (store);
+    }
+
+  return ok;
+}
+
+static gboolean
+store_import_times (BoltStore  *store,
+                    const char *uid,
+                    const char *data,
+                    GError    **error)
+{
+  g_auto(GStrv) lines = NULL;
+
+  lines = g_strsplit (data, "\n", -1);
+
+  for (guint i = 0; lines[i] != NULL; i++)
+    {
+      g_auto(GStrv) kv = NULL;
+      guint64 val;
+      gboolean ok;
+      int idx;
+
+      if (bolt_strzero (lines[i]))
+        continue;
+
+      kv = g_strsplit (lines[i], "=", 2);
+      idx = store_time_from_string (kv[0]);
+
+      if (idx < 0 || kv[1] == NULL)
+        continue;
+
+      ok = bolt_str_parse_as_uint64 (kv[1], &val, error);
+      if (!ok)
+        return FALSE;
+
+      /* flushed in one go at the end of the import */
+      store_times_queue (store, uid, idx, val);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+store_import_domain (BoltStore  *store,
+                     const char *uid,
+                     const char *data,
+                     gsize       len,
+                     GError    **error)
+{
+  g_autoptr(GKeyFile) kf = NULL;
+  g_autoptr(GFile) entry = NULL;
+  gboolean ok;
+
+  kf = g_key_file_new ();
+  ok = g_key_file_load_from_data (kf, data, len, G_KEY_FILE_KEEP_COMMENTS, error);
+
+  if (!ok)
+    return FALSE;
+
+  entry = g_file_get_child (store->domains, uid);
+  ok = store_replace_file (store, entry, data, len, error);
+
+  if (!ok)
+    return FALSE;
+
+  store_index_put_domain (store, store_domain_from_keyfile (uid, kf));
+
+  return TRUE;
+}
+
+static gboolean
+store_import_record (BoltStore  *store,
+                     const char *kind,
+                     const char *uid,
+                     const char *data,
+                     gsize       len,
+                     GError    **error)
+{
+  if (bolt_streq (kind, "device"))
+    return store_import_device (store, uid, data, len, error);
+  else if (bolt_streq (kind, "key"))
+    return store_import_key (store, uid, data, len, error);
+  else if (bolt_streq (kind, "times"))
+    return store_import_times (store, uid, data, error);
+  else if (bolt_streq (kind, "domain"))
+    return store_import_domain (store, uid, data, len, error);
+
+  g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+               "archive: unknown record type '%s'", kind);
+  return FALSE;
+}
+
+struct _BoltStoreImport
+{
+  BoltStore  *store;
+  GByteArray *buf;     /* unparsed data */
+  gboolean    started; /* magic line seen */
+  gboolean    done;    /* end line seen */
+  guint       n;       /* records parsed */
+  guint       count;   /* records committed */
+};
+
+/* parses and applies all complete records in the buffer
+ * and keeps the rest for the next chunk; must be called
+ * within a transaction */
+static gboolean
+store_import_parse (BoltStoreImport *im,
+                    GError         **error)
+{
+  BoltStore *store = im->store;
+  gsize off = 0;
+  gboolean ok = TRUE;
+
+  while (ok && !im->done)
+    {
+      g_autofree char *line = NULL;
+      g_autofree char *data = NULL;
+      g_auto(GStrv) hdr = NULL;
+      const char *start;
+      const char *nl;
+      gsize avail;
+      gsize hlen;
+      guint64 len;
+
+      start = (const char *) im->buf->data + off;
+      avail = im->buf->len - off;
+      nl = memchr (start, '\n', avail);
+
+      if (nl == NULL)
+        {
+          if (avail > ARCHIVE_HEADER_MAX)
+            {
+              g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                           "archive: invalid record header at %u", im->n);
+              ok = FALSE;
+            }
+
+          break;
+        }
+
+      hlen = nl - start + 1;
+      line = g_strndup (start, hlen - 1);
+
+      if (!im->started)
+        {
+          if (!bolt_streq (line, ARCHIVE_MAGIC " " G_STRINGIFY (ARCHIVE_VERSION)))
+            {
+              g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                                   "archive: unknown format");
+              ok = FALSE;
+              break;
+            }
+
+          im->started = TRUE;
+          off += hlen;
+          continue;
+        }
+
+      hdr = g_strsplit (line, " ", 3);
+
+      if (bolt_streq (hdr[0], "end"))
+        {
+          if (hdr[1] == NULL || g_ascii_strtoull (hdr[1], NULL, 10) != im->n)
+            {
+              g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                                   "archive: record count mismatch");
+              ok = FALSE;
+              break;
+            }
+
+          im->done = TRUE;
+          off += hlen;
+          break;
+        }
+
+      if (g_strv_length (hdr) != 3 || !archive_check_uid (hdr[1], error))
+        {
+          if (error && *error == NULL)
+            g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                         "archive: invalid record header at %u", im->n);
+          ok = FALSE;
+          break;
+        }
+
+      ok = bolt_str_parse_as_uint64 (hdr[2], &len, error);
+      if (!ok)
+        break;
+
+      if (len > ARCHIVE_RECORD_MAX)
+        {
+          g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                       "archive: record %u too large", im->n);
+          ok = FALSE;
+          break;
+        }
+
+      /* wait for the rest of the record */
+      if (avail < hlen + len + 1)
+        break;
+
+      if (start[hlen + len] != '\n')
+        {
+          g_set_error (error, BOLT_ERROR, BOLT_ERROR_FAILED,
+                       "archive: invalid record at %u", im->n);
+          ok = FALSE;
+          break;
+        }
+
+      data = g_strndup (start + hlen, len);
+
+      ok = store_import_record (store, hdr[0], hdr[1], data, len, error);
+      if (!ok)
+        break;
+
+      im->n++;
+      off += hlen + len + 1;
+
+      if (im->n % IMPORT_BATCH != 0)
+        continue;
+
+      /* one durable flush per batch */
+      ok = bolt_store_commit (store, error);
+      bolt_store_begin (store);
+
+      if (ok)
+        im->count = im->n;
+    }
+
+  g_byte_array_remove_range (im->buf, 0, off);
+
+  return ok;
+}
+
+/* garbage collection
+ *
+ * Keys, timestamps and journals can outlive the entry they
+ * belong to, e.g. after a failed removal or when entries
+ * were deleted externally. The collector runs in small
+ * steps from an idle source, one phase at a time.
+ */
+#define GC_BATCH 32 /* entries per step */
+
+typedef enum StoreGcPhase
+{
+  GC_PHASE_KEYS = 0,
+  GC_PHASE_TIMES,
+  GC_PHASE_TIMESDB,
+  GC_PHASE_JOURNALS,
+
+  GC_PHASE_DONE
+} StoreGcPhase;
+
+static const char *store_gc_names[GC_PHASE_DONE] = {
+  "keys",
+  "times",
+  "times database",
+  "journals"
+};
+
+struct StoreGc
+{
+  StoreGcPhase phase;
+  GStrv        names;  /* entries of the current phase */
+  guint        pos;
+  guint        reclaimed[GC_PHASE_DONE];
+
+  /* times database phase */
+  GArray      *keep;   /* records that survive */
+  guint        serial; /* of the database when the scan started */
+  guint        dropped;
+};
+
+static void
+store_gc_free (StoreGc *gc)
+{
+  g_strfreev (gc->names);
+  g_clear_pointer (&gc->keep, g_array_unref);
+  g_slice_free (StoreGc, gc);
+}
+
+static GStrv
+store_gc_list (GFile *dir)
+{
+  g_autoptr(GPtrArray) names = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GDir) d = NULL;
+  g_autofree char *path = NULL;
+  const char *name;
+
+  names = g_ptr_array_new ();
+
+  path = g_file_get_path (dir);
+  d = g_dir_open (path, 0, &err);
+
+  if (d == NULL && !bolt_err_notfound (err))
+    bolt_warn_err (err, LOG_TOPIC ("gc"), "could not list '%s'", path);
+
+  while (d != NULL && (name = g_dir_read_name (d)) != NULL)
+    {
+      /* hidden files are temporary or staged ones */
+      if (name[0] == '.')
+        continue;
+
+      g_ptr_array_add (names, g_strdup (name));
+    }
+
+  return bolt_strv_from_ptr_array (&names);
+}
+
+static gboolean
+store_gc_is_orphan (BoltStore  *store,
+                    StoreDir    dir,
+                    const char *uid)
+{
+  g_autoptr(GError) err = NULL;
+  GHashTable *index;
+  struct stat st;
+  gboolean ok;
+
+  if (dir == STORE_DIR_DOMAINS)
+    index = store->domidx;
+  else
+    index = store->devidx;
+
+  if (g_hash_table_contains (index, uid))
+    return FALSE;
+
+  /* not in the index should mean gone, but be careful */
+  ok = store_stat_at (store, dir, uid, &st, &err);
+
+  return !ok && bolt_err_notfound (err);
+}
+
+static gboolean
+store_gc_entry (BoltStore  *store,
+                StoreGc    *gc,
+                const char *name)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree char *uid = NULL;
+  StoreDir dir;
+  gboolean ok;
+  int fd;
+
+  switch (gc->phase)
+    {
+    case GC_PHASE_KEYS:
+      if (!store_gc_is_orphan (store, STORE_DIR_DEVICES, name))
+        return FALSE;
+
+      dir = STORE_DIR_KEYS;
+      break;
+
+    case GC_PHASE_TIMES:
+      uid = g_strdup (name);
+      if (strchr (uid, '.') != NULL)
+        *strchr (uid, '.') = '\0';
+
+      if (!store_gc_is_orphan (store, STORE_DIR_DEVICES, uid))
+        return FALSE;
+
+      dir = STORE_DIR_TIMES;
+      break;
+
+    case GC_PHASE_JOURNALS:
+      if (!store_gc_is_orphan (store, STORE_DIR_DOMAINS, name))
+        return FALSE;
+
+      ok = bolt_store_del_journal (store, "bootacl", name, &err);
+      if (!ok)
+        bolt_warn_err (err, LOG_TOPIC ("gc"), "could not remove journal");
+
+      return ok;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  fd = store_dirfd (store, dir, FALSE, &err);
+  ok = fd > -1 && bolt_unlink_at (fd, name, 0, &err);
+
+  if (!ok && !bolt_err_notfound (err))
+    {
+      bolt_warn_err (err, LOG_TOPIC ("gc"), "could not remove '%s'", name);
+      return FALSE;
+    }
+
+  if (ok)
+    {
+      g_autofree char *path = NULL;
+
+      path = g_strdup_printf ("%s/%s", store_dir_names[dir], name);
+      store_own_record (store, path);
+    }
+
+  if (gc->phase == GC_PHASE_KEYS)
+    store_keys_update (store, name, BOLT_KEY_MISSING);
+
+  bolt_debug (LOG_TOPIC ("gc"), "removed orphaned %s '%s'",
+              store_gc_names[gc->phase], name);
+
+  return ok;
+}
+
+/* scans GC_BATCH records of the times database per step,
+ * collecting the ones to keep; the database is rewritten
+ * once at the end of the scan, unless it was modified in
+ * between, in which case the phase is skipped for now.
+ * Returns TRUE when the phase is done. */
+static gboolean
+store_gc_timesdb (BoltStore *store,
+                  StoreGc   *gc)
+{
+  g_autoptr(GError) err = NULL;
+  guint n = 0;
+  gboolean ok;
+
+  if (gc->keep == NULL)
+    {
+      if (!store_times_in_db (store))
+        return TRUE;
+
+      ok = store_tdb_open (store, FALSE, &err);
+
+      if (!ok)
+        {
+          if (!bolt_err_notfound (err))
+            bolt_warn_err (err, LOG_TOPIC ("gc"), "could not open times database");
+          return TRUE;
+        }
+
+      gc->keep = g_array_sized_new (FALSE, FALSE,
+                                    sizeof (TimesRecord),
+                                    store->tdb_count);
+      gc->serial = store->tdb_serial;
+      gc->dropped = 0;
+      gc->pos = 0;
+    }
+
+  if (gc->serial != store->tdb_serial || store->tdb < 0)
+    {
+      bolt_debug (LOG_TOPIC ("gc"), "times database changed, skipping");
+      return TRUE;
+    }
+
+  while (gc->pos < store->tdb_count && n++ < GC_BATCH)
+    {
+      g_autofree char *uid = NULL;
+      TimesRecord rec;
+
+      ok = store_tdb_read (store, gc->pos++, &rec, &err);
+
+      if (!ok)
+        {
+          bolt_warn_err (err, LOG_TOPIC ("gc"), "could not read times database");
+          return TRUE;
+        }
+
+      uid = g_strndup (rec.uid, sizeof (rec.uid));
+
+      /* records without any timestamp are dead weight too */
+      if (rec.tflags == 0 ||
+          store_gc_is_orphan (store, STORE_DIR_DEVICES, uid))
+        {
+          gc->dropped++;
+          continue;
+        }
+
+      g_array_append_val (gc->keep, rec);
+    }
+
+  if (gc->pos < store->tdb_count)
+    return FALSE;
+
+  if (gc->dropped == 0)
+    return TRUE;
+
+  ok = store_tdb_replace (store, gc->keep, &err);
+
+  if (!ok)
+    {
+      bolt_warn_err (err, LOG_TOPIC ("gc"), "could not compact times database");
+      return TRUE;
+    }
+
+  gc->reclaimed[gc->phase] += gc->dropped;
+
+  return TRUE;
+}
+
+/* returns TRUE when the pass is complete */
+static gboolean
+store_gc_step (BoltStore *store,
+               StoreGc   *gc)
+{
+  guint n = 0;
+
+  if (gc->phase == GC_PHASE_TIMESDB)
+    {
+      if (!store_gc_timesdb (store, gc))
+        return FALSE;
+
+      g_clear_pointer (&gc->keep, g_array_unref);
+      gc->phase++;
+      return FALSE;
+    }
+
+  if (gc->names == NULL)
+    {
+      g_autoptr(GFile) dir = NULL;
+
+      if (gc->phase == GC_PHASE_JOURNALS)
+        dir = g_file_get_child (store->root, "bootacl");
+      else
+        dir = g_file_get_child (store->root, store_gc_names[gc->phase]);
+
+      gc->names = store_gc_list (dir);
+      gc->pos = 0;
+    }
+
+  while (gc->names[gc->pos] != NULL && n++ < GC_BATCH)
+    {
+      const char *name = gc->names[gc->pos++];
+
+      if (store_gc_entry (store, gc, name))
+        gc->reclaimed[gc->phase]++;
+    }
+
+  if (gc->names[gc->pos] != NULL)
+    return FALSE;
+
+  g_clear_pointer (&gc->names, g_strfreev);
+  gc->phase++;
+
+  return gc->phase == GC_PHASE_DONE;
+}
+
+static guint
+store_gc_finish (BoltStore *store,
+                 StoreGc   *gc)
+{
+  guint total = 0;
+
+  for (guint i = 0; i < GC_PHASE_DONE; i++)
+    total += gc->reclaimed[i];
+
+  bolt_info (LOG_TOPIC ("gc"),
+             "reclaimed %u entries [keys: %u, times: %u, records: %u, journals: %u]",
+             total,
+             gc->reclaimed[GC_PHASE_KEYS],
+             gc->reclaimed[GC_PHASE_TIMES],
+             gc->reclaimed[GC_PHASE_TIMESDB],
+             gc->reclaimed[GC_PHASE_JOURNALS]);
+
+  if (total > 0)
+    {
+      store->reclaimed += total;
+      g_object_notify_by_pspec (G_OBJECT (store), store_props[PROP_RECLAIMED]);
+    }
+
+  return total;
+}
+
+static gboolean
+store_gc_idle (gpointer user_data)
+{
+  BoltStore *store = user_data;
+  gboolean done;
+
+  /* not while a transaction is staging changes */
+  if (store->txn != NULL)
+    return G_SOURCE_CONTINUE;
+
+  done = store_gc_step (store, store->gc);
+
+  if (!done)
+    return G_SOURCE_CONTINUE;
+
+  store_gc_finish (store, store->gc);
+  g_clear_pointer (&store->gc, store_gc_free);
+  store->gc_id = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
+/* public methods */
+
+BoltStore *
+bolt_store_new (const char *path, GError **error)
+{
+  g_autoptr(GFile) root = NULL;
+  BoltStore *store;
+
+  root = g_file_new_for_path (path);
+  store = g_initable_new (BOLT_TYPE_STORE,
+                          NULL, error,
+                          "root", root,
+                          NULL);
+  return store;
+}
+
+guint
+bolt_store_get_version (BoltStore *store)
+{
+  g_return_val_if_fail (BOLT_IS_STORE (store), 0);
+
+  return store->version;
+}
+
+GKeyFile *
+bolt_store_config_load (BoltStore *store,
+                        GError   **error)
+{
+  g_autoptr(GKeyFile) kf = NULL;
+  g_autoptr(GFile) sf = NULL;
+  g_autofree char *data  = NULL;
+  gboolean ok;
+  gsize len;
+
+  g_return_val_if_fail (store != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  sf = g_file_get_child (store->root, CFG_FILE);
+  ok = g_file_load_contents (sf, NULL,
+                             &data, &len,
+                             NULL,
+                             error);
+
+  if (!ok)
+    return NULL;
+
+  kf = g_key_file_new ();
+  ok = g_key_file_load_from_data (kf, data, len, G_KEY_FILE_NONE, error);
+
+  if (!ok)
+    return NULL;
+
+  return g_steal_pointer (&kf);
+}
+
+gboolean
+bolt_store_config_save (BoltStore *store,
+                        GKeyFile  *config,
+                        GError   **error)
+{
+  g_autoptr(GFile) sf = NULL;
+  g_autofree char *data  = NULL;
+  gboolean ok;
+  gsize len;
+
+  g_return_val_if_fail (store != NULL, FALSE);
+  g_return_val_if_fail (config != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  sf = g_file_get_child (store->root, CFG_FILE);
+  data = g_key_file_to_data (config, &len, error);
+
+  if (!data)
+    return FALSE;
+
+  ok = g_file_replace_contents (sf,
+                                data, len,
+                                NULL, FALSE,
+                                0,
+                                NULL,
+                                NULL, error);
+
+  return ok;
+}
+
+GStrv
+bolt_store_list_uids (BoltStore  *store,
+                      const char *type,
+                      GError    **error)
+{
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GDir) dir   = NULL;
+  g_autoptr(GPtrArray) ids = NULL;
+  g_autofree char *path = NULL;
+  const char *name;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), NULL);
+  g_return_val_if_fail (type != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (bolt_streq (type, "devices"))
+    path = g_file_get_path (store->devices);
+  if (bolt_streq (type, "domains"))
+    path = g_file_get_path (store->domains);
+
+  if (path == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "unknown stored typed '%s'", type);
+      return NULL;
+    }
+
+  ids = g_ptr_array_new ();
+
+  dir = g_dir_open (path, 0, &err);
+  if (dir == NULL)
+    {
+      if (bolt_err_notfound (err))
+        return bolt_strv_from_ptr_array (&ids);
+
+      bolt_error_propagate (error, &err);
+      return NULL;
+    }
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      if (g_str_has_prefix (name, "."))
+        continue;
+
+      g_ptr_array_add (ids, g_strdup (name));
+    }
+
+  return bolt_strv_from_ptr_array (&ids);
+}
+
+gboolean
+bolt_store_put_domain (BoltStore  *store,
+                       BoltDomain *domain,
+                       GError    **error)
+{
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GFile) entry = NULL;
+  g_autoptr(GKeyFile) kf = NULL;
+  g_autofree char *data = NULL;
+  char * const * bootacl = NULL;
+  const char *uid;
+  gboolean ok;
+  gsize len;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
+  g_return_val_if_fail (BOLT_IS_DOMAIN (domain), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  uid = bolt_domain_get_uid (domain);
+  g_assert (uid);
+
+  if (store_dirfd (store, STORE_DIR_DOMAINS, TRUE, error) < 0)
+    return FALSE;
+
+  kf = store_load_keyfile (store, STORE_DIR_DOMAINS, uid,
+                           G_KEY_FILE_KEEP_COMMENTS, &err);
+
+  if (kf == NULL)
+    {
+      if (!bolt_err_notfound (err))
+        bolt_warn_err (err, LOG_TOPIC ("store"),
+                       "error loading existing domain");
+      g_clear_error (&err);
+      /* not fatal, keep going */
+      kf = g_key_file_new ();
+    }
+
+  entry = g_file_get_child (store->domains, uid);
+
+  bootacl = bolt_domain_get_bootacl (domain);
+  len = bolt_strv_length (bootacl);
+
+  g_key_file_set_string_list (kf,
+                              DOMAIN_GROUP,
+                              "bootacl",
+                              (const char * const *) bootacl,
+                              len);
+
+  data = g_key_file_to_data (kf, &len, error);
+
+  if (!data)
+    return FALSE;
+
+  store_index_invalidate (store);
+
+  /* also records the write as our own for the watcher */
+  ok = store_replace_file (store, entry, data, len, error);
 
   if (!ok)
     return FALSE;
 
+  store_index_put_domain (store, store_domain_from_keyfile (uid, kf));
+
   g_object_set (G_OBJECT (domain),
                 "store", store,
                 NULL);
@@ -495,49 +4563,22 @@ bolt_store_get_domain (BoltStore  *store,
                        const char *uid,
                        GError    **error)
 {
-  g_autoptr(GKeyFile) kf = NULL;
-  g_autoptr(GFile) db = NULL;
-  g_autoptr(GError) err = NULL;
-  g_auto(GStrv) bootacl = NULL;
-  g_autofree char *path = NULL;
+  StoreDomain *dom;
   BoltDomain *domain = NULL;
-  gboolean ok;
 
   g_return_val_if_fail (store != NULL, NULL);
   g_return_val_if_fail (uid != NULL, NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  db = g_file_get_child (store->domains, uid);
-  path = g_file_get_path (db);
-
-  kf = g_key_file_new ();
-  ok = g_key_file_load_from_file (kf, path, G_KEY_FILE_NONE, error);
+  dom = store_lookup_domain (store, uid, error);
 
-  if (!ok)
+  if (dom == NULL)
     return NULL;
 
-  bootacl = g_key_file_get_string_list (kf,
-                                        DOMAIN_GROUP,
-                                        "bootacl",
-                                        NULL,
-                                        &err);
-
-  if (bootacl == NULL && !bolt_err_notfound (err))
-    {
-      bolt_warn_err (err, LOG_DOM_UID (uid), LOG_TOPIC ("store"),
-                     "failed to parse bootacl for domain '%s'",
-                     uid);
-
-      g_clear_error (&err);
-    }
-
-  if (bolt_strv_isempty (bootacl))
-    g_clear_pointer (&bootacl, g_strfreev);
-
   domain = g_object_new (BOLT_TYPE_DOMAIN,
                          "store", store,
                          "uid", uid,
-                         "bootacl", bootacl,
+                         "bootacl", dom->bootacl,
                          NULL);
 
   return domain;
@@ -548,9 +4589,10 @@ bolt_store_del_domain (BoltStore  *store,
                        BoltDomain *domain,
                        GError    **error)
 {
-  g_autoptr(GFile) path = NULL;
+  g_autofree char *path = NULL;
   const char *uid;
   gboolean ok;
+  int fd;
 
   g_return_val_if_fail (store != NULL, FALSE);
   g_return_val_if_fail (domain != NULL, FALSE);
@@ -562,12 +4604,20 @@ bolt_store_del_domain (BoltStore  *store,
 
   uid = bolt_domain_get_uid (domain);
 
-  path = g_file_get_child (store->domains, uid);
-  ok = g_file_delete (path, NULL, error);
+  store_index_invalidate (store);
+
+  fd = store_dirfd (store, STORE_DIR_DOMAINS, FALSE, error);
+  ok = fd > -1 && bolt_unlink_at (fd, uid, 0, error);
 
   if (!ok)
     return FALSE;
 
+  path = g_strdup_printf ("%s/%s", store_dir_names[STORE_DIR_DOMAINS], uid);
+  store_own_record (store, path);
+
+  g_hash_table_remove (store->domidx, uid);
+  store_index_changed (store);
+
   g_object_set (domain,
                 "store", NULL,
                 NULL);
@@ -586,11 +4636,13 @@ bolt_store_put_device (BoltStore  *store,
   g_autoptr(GKeyFile) kf = NULL;
   g_autoptr(GError) err = NULL;
   g_autofree char *data = NULL;
-  g_autofree char *path = NULL;
   BoltDeviceType type;
+  StoreDevice *have;
+  StoreDevice *dev;
   const char *uid;
   const char *label;
   gboolean fresh;
+  gboolean own;
   gboolean ok;
   guint64 ctime;
   guint64 atime;
@@ -607,29 +4659,23 @@ bolt_store_put_device (BoltStore  *store,
   uid = bolt_device_get_uid (device);
   g_assert (uid);
 
-  entry = g_file_get_child (store->devices, uid);
-
-  ok = bolt_fs_make_parent_dirs (entry, error);
-  if (!ok)
+  if (store_dirfd (store, STORE_DIR_DEVICES, TRUE, error) < 0)
     return FALSE;
 
-  kf = g_key_file_new ();
-
-  path = g_file_get_path (entry);
-
-  ok = g_key_file_load_from_file (kf,
-                                  path,
-                                  G_KEY_FILE_KEEP_COMMENTS,
-                                  &err);
+  kf = store_load_keyfile (store, STORE_DIR_DEVICES, uid,
+                           G_KEY_FILE_KEEP_COMMENTS, &err);
 
-  if (!ok)
+  if (kf == NULL)
     {
       if (!bolt_err_notfound (err))
         bolt_warn_err (err, LOG_TOPIC ("store"), LOG_DEV_UID (uid),
                        "could not load previously stored device");
       g_clear_error (&err);
+      kf = g_key_file_new ();
     }
 
+  entry = g_file_get_child (store->devices, uid);
+
   g_key_file_set_string (kf, DEVICE_GROUP, "name", bolt_device_get_name (device));
   g_key_file_set_string (kf, DEVICE_GROUP, "vendor", bolt_device_get_vendor (device));
 
@@ -666,6 +4712,16 @@ bolt_store_put_device (BoltStore  *store,
   if (!data)
     return FALSE;
 
+  dev = store_device_from_keyfile (uid, kf, error);
+
+  if (dev == NULL)
+    return FALSE;
+
+  /* the key and the entry are written together */
+  own = store->txn == NULL;
+  if (own)
+    bolt_store_begin (store);
+
   keystate = bolt_device_get_keystate (device);
   if (key)
     {
@@ -677,167 +4733,138 @@ bolt_store_put_device (BoltStore  *store,
         keystate = bolt_key_get_state (key);
     }
 
-  ok = g_file_replace_contents (entry,
-                                data, len,
-                                NULL, FALSE,
-                                0,
-                                NULL,
-                                NULL, error);
-
-  if (!ok)
-    return FALSE;
-
-  fresh = bolt_device_get_stored (device) == FALSE;
-
-  g_object_set (device,
-                "store", store,
-                "policy", policy,
-                "key", keystate,
-                "storetime", stime,
-                NULL);
-
-  if (fresh)
-    g_signal_emit (store, signals[SIGNAL_DEVICE_ADDED], 0, uid);
-
-  ctime = bolt_device_get_conntime (device);
-  atime = bolt_device_get_authtime (device);
-
-  bolt_store_put_times (store, uid, NULL,
-                        "conntime", ctime,
-                        "authtime", atime,
-                        NULL);
-  return TRUE;
-}
-
-BoltDevice *
-bolt_store_get_device (BoltStore  *store,
-                       const char *uid,
-                       GError    **error)
-{
-  g_autoptr(GKeyFile) kf = NULL;
-  g_autoptr(GFile) db = NULL;
-  g_autoptr(GError) err = NULL;
-  g_autofree char *name = NULL;
-  g_autofree char *vendor = NULL;
-  g_autofree char *data  = NULL;
-  g_autofree char *typestr = NULL;
-  g_autofree char *polstr = NULL;
-  g_autofree char *label = NULL;
-  BoltDeviceType type;
-  BoltPolicy policy;
-  BoltKeyState key;
-  gboolean ok;
-  guint64 stime;
-  guint64 atime = 0;
-  guint64 ctime = 0;
-  guint gen;
-  gsize len;
-
-  g_return_val_if_fail (BOLT_IS_STORE (store), NULL);
-  g_return_val_if_fail (uid != NULL, NULL);
-  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
-
-  db = g_file_get_child (store->devices, uid);
-  ok = g_file_load_contents (db, NULL,
-                             &data, &len,
-                             NULL,
-                             error);
-
-  if (!ok)
-    return NULL;
-
-  kf = g_key_file_new ();
-  ok = g_key_file_load_from_data (kf, data, len, G_KEY_FILE_NONE, error);
-
-  if (!ok)
-    return NULL;
-
-  name = g_key_file_get_string (kf, DEVICE_GROUP, "name", NULL);
-  vendor = g_key_file_get_string (kf, DEVICE_GROUP, "vendor", NULL);
-  typestr = g_key_file_get_string (kf, DEVICE_GROUP, "type", NULL);
-  polstr = g_key_file_get_string (kf, USER_GROUP, "policy", NULL);
-  label = g_key_file_get_string (kf, USER_GROUP, "label", NULL);
+  store_index_invalidate (store);
 
-  gen = g_key_file_get_int64 (kf, DEVICE_GROUP, "generation", &err);
-  if (err != NULL && !bolt_err_notfound (err))
-    bolt_warn_err (err, LOG_TOPIC ("store"), "invalid generation");
-  g_clear_error (&err);
+  ok = store_replace_file (store, entry, data, len, error);
 
-  type = bolt_enum_from_string (BOLT_TYPE_DEVICE_TYPE, typestr, &err);
-  if (type == BOLT_DEVICE_UNKNOWN_TYPE)
+  if (!ok)
     {
-      bolt_warn_err (err, LOG_TOPIC ("store"), LOG_DEV_UID (uid),
-                     "invalid device type");
-      g_clear_error (&err);
-      type = BOLT_DEVICE_PERIPHERAL;
+      store_device_free (dev);
+      if (own)
+        bolt_store_abort (store);
+      return FALSE;
     }
 
-  policy = bolt_enum_from_string (BOLT_TYPE_POLICY, polstr, &err);
-  if (policy == BOLT_POLICY_UNKNOWN)
+  /* key state and timestamps are not part of the
+   * device entry itself, carry them over */
+  have = g_hash_table_lookup (store->devidx, uid);
+  if (have != NULL)
     {
-      bolt_warn_err (err, LOG_TOPIC ("store"), LOG_DEV_UID (uid),
-                     "invalid policy");
-      g_clear_error (&err);
-      policy = BOLT_POLICY_MANUAL;
+      dev->key = have->key;
+      dev->tflags = have->tflags;
+      memcpy (dev->times, have->times, sizeof (dev->times));
     }
-
-  if (label != NULL)
+  else
     {
-      g_autofree char *tmp = g_steal_pointer (&label);
-      label = bolt_strdup_validate (tmp);
-      if (label == NULL)
-        bolt_warn (LOG_TOPIC ("store"), LOG_DEV_UID (uid),
-                   "invalid device label: %s", label);
+      dev->key = store_probe_key (store, uid);
+      store_device_probe_times (store, dev);
     }
 
-  stime = g_key_file_get_uint64 (kf, USER_GROUP, "storetime", &err);
-  if (err != NULL && !bolt_err_notfound (err))
-    bolt_warn_err (err, LOG_TOPIC ("store"), "invalid enroll-time");
+  if (key && keystate != BOLT_KEY_MISSING)
+    dev->key = BOLT_KEY_HAVE;
 
-  if (stime == 0)
-    {
-      g_autoptr(GFileInfo) info = NULL;
+  store_index_put_device (store, dev);
+  store_txn_touch (store, uid);
 
-      info = g_file_query_info (db,
-                                "time::changed",
-                                G_FILE_QUERY_INFO_NONE,
-                                NULL, NULL);
-      if (info != NULL)
-        stime = g_file_info_get_attribute_uint64 (info, "time::changed");
-    }
+  fresh = bolt_device_get_stored (device) == FALSE;
+
+  g_object_set (device,
+                "store", store,
+                "policy", policy,
+                "key", keystate,
+                "storetime", stime,
+                NULL);
 
-  key = bolt_store_have_key (store, uid);
+  if (fresh)
+    store_emit (store, SIGNAL_DEVICE_ADDED, uid);
 
-  if (name == NULL || vendor == NULL)
+  if (own && !bolt_store_commit (store, error))
     {
-      g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_FAILED,
-                           "invalid device entry in store");
-      return NULL;
+      if (fresh)
+        g_object_set (device, "store", NULL, NULL);
+      return FALSE;
     }
 
-  /* read timestamps, but failing is not fatal */
-  bolt_store_get_times (store, uid, NULL,
-                        "conntime", &ctime,
-                        "authtime", &atime,
+  ctime = bolt_device_get_conntime (device);
+  atime = bolt_device_get_authtime (device);
+
+  bolt_store_put_times (store, uid, NULL,
+                        "conntime", ctime,
+                        "authtime", atime,
                         NULL);
+  return TRUE;
+}
+
+BoltDevice *
+bolt_store_get_device (BoltStore  *store,
+                       const char *uid,
+                       GError    **error)
+{
+  StoreDevice *dev;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), NULL);
+  g_return_val_if_fail (uid != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  dev = store_lookup_device (store, uid, error);
+
+  if (dev == NULL)
+    return NULL;
 
   return g_object_new (BOLT_TYPE_DEVICE,
                        "uid", uid,
-                       "name", name,
-                       "vendor", vendor,
-                       "generation", gen,
-                       "type", type,
+                       "name", dev->name,
+                       "vendor", dev->vendor,
+                       "generation", dev->gen,
+                       "type", dev->type,
                        "status", BOLT_STATUS_DISCONNECTED,
                        "store", store,
-                       "policy", policy,
-                       "key", key,
-                       "storetime", stime,
-                       "conntime", ctime,
-                       "authtime", atime,
-                       "label", label,
+                       "policy", dev->policy,
+                       "key", dev->key,
+                       "storetime", dev->stime,
+                       "conntime", dev->times[STORE_TIME_CONN],
+                       "authtime", dev->times[STORE_TIME_AUTH],
+                       "label", dev->label,
                        NULL);
 }
 
+gboolean
+bolt_store_peek_device (BoltStore      *store,
+                        const char     *uid,
+                        char          **name,
+                        char          **vendor,
+                        BoltDeviceType *type,
+                        BoltPolicy     *policy,
+                        GError        **error)
+{
+  StoreDevice *dev;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
+  g_return_val_if_fail (uid != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  /* like bolt_store_get_device but without creating
+   * the device object, for a quick look at the basics */
+  dev = store_lookup_device (store, uid, error);
+
+  if (dev == NULL)
+    return FALSE;
+
+  if (name != NULL)
+    *name = g_strdup (dev->name);
+
+  if (vendor != NULL)
+    *vendor = g_strdup (dev->vendor);
+
+  if (type != NULL)
+    *type = dev->type;
+
+  if (policy != NULL)
+    *policy = dev->policy;
+
+  return TRUE;
+}
+
 gboolean
 bolt_store_del_device (BoltStore  *store,
                        const char *uid,
@@ -850,11 +4877,19 @@ bolt_store_del_device (BoltStore  *store,
   g_return_val_if_fail (uid != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  store_index_invalidate (store);
+
   devpath = g_file_get_child (store->devices, uid);
-  ok = g_file_delete (devpath, NULL, error);
+  ok = store_delete_file (store, devpath, error);
 
-  if (ok)
-    g_signal_emit (store, signals[SIGNAL_DEVICE_REMOVED], 0, uid);
+  if (!ok)
+    return FALSE;
+
+  if (g_hash_table_remove (store->devidx, uid))
+    store_index_changed (store);
+
+  store_txn_touch (store, uid);
+  store_emit (store, SIGNAL_DEVICE_REMOVED, uid);
 
   return ok;
 }
@@ -866,28 +4901,46 @@ bolt_store_get_time (BoltStore  *store,
                      guint64    *outval,
                      GError    **error)
 {
-  g_autoptr(GFile) gf = NULL;
-  g_autoptr(GFileInfo) info = NULL;
-  g_autofree char *fn = NULL;
-  gboolean ok;
+  StoreDevice *dev;
+  int idx;
 
   g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
   g_return_val_if_fail (uid != NULL, FALSE);
   g_return_val_if_fail (timesel != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-  fn = g_strdup_printf ("%s.%s", uid, timesel);
-  gf = g_file_get_child (store->times, fn);
+  idx = store_time_from_string (timesel);
 
-  info = g_file_query_info (gf, "time::modified",
-                            G_FILE_QUERY_INFO_NONE,
-                            NULL, error);
+  if (idx > -1)
+    {
+      StorePending *pt = g_hash_table_lookup (store->pending, uid);
 
-  ok = info != NULL;
-  if (ok && outval != NULL)
-    *outval = g_file_info_get_attribute_uint64 (info, "time::modified");
+      if (pt != NULL && (pt->tflags & (1 << idx)) != 0)
+        {
+          if (outval != NULL)
+            *outval = pt->times[idx];
 
-  return ok;
+          return TRUE;
+        }
+    }
+
+  dev = g_hash_table_lookup (store->devidx, uid);
+
+  if (dev == NULL || idx < 0)
+    return store_probe_time (store, uid, timesel, outval, error);
+
+  if ((dev->tflags & (1 << idx)) == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "timestamp '%s' not found for '%s'",
+                   timesel, uid);
+      return FALSE;
+    }
+
+  if (outval != NULL)
+    *outval = dev->times[idx];
+
+  return TRUE;
 }
 
 gboolean
@@ -941,13 +4994,35 @@ bolt_store_put_time (BoltStore  *store,
 {
   g_autoptr(GFile) gf = NULL;
   g_autofree char *fn = NULL;
+  StoreDevice *dev;
   gboolean ok;
+  int idx;
 
   g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
   g_return_val_if_fail (uid != NULL, FALSE);
   g_return_val_if_fail (timesel != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  idx = store_time_from_string (timesel);
+
+  if (idx > -1)
+    {
+      /* well-known timestamps are written in batches,
+       * see store_times_flush() */
+      store_times_queue (store, uid, idx, val);
+
+      dev = g_hash_table_lookup (store->devidx, uid);
+
+      if (dev != NULL)
+        {
+          dev->times[idx] = val;
+          dev->tflags |= 1 << idx;
+          store_index_changed (store);
+        }
+
+      return TRUE;
+    }
+
   fn = g_strdup_printf ("%s.%s", uid, timesel);
   gf = g_file_get_child (store->times, fn);
 
@@ -955,6 +5030,8 @@ bolt_store_put_time (BoltStore  *store,
   if (!ok)
     return FALSE;
 
+  store_index_invalidate (store);
+
   ok = bolt_fs_touch (gf, val, val, error);
 
   return ok;
@@ -1021,18 +5098,61 @@ bolt_store_del_time (BoltStore  *store,
                      const char *timesel,
                      GError    **error)
 {
-  g_autoptr(GFile) pathfile = NULL;
+  g_autoptr(GError) err = NULL;
   g_autofree char *name = NULL;
+  gboolean queued = FALSE;
+  StoreDevice *dev;
   gboolean ok;
+  int idx;
 
   g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
   g_return_val_if_fail (uid != NULL, FALSE);
   g_return_val_if_fail (timesel != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-  name = g_strdup_printf ("%s.%s", uid, timesel);
-  pathfile = g_file_get_child (store->times, name);
-  ok = g_file_delete (pathfile, NULL, error);
+  idx = store_time_from_string (timesel);
+
+  if (idx > -1)
+    queued = store_times_unqueue (store, uid, idx);
+
+  store_index_invalidate (store);
+
+  if (idx > -1 && store_times_in_db (store))
+    {
+      ok = store_tdb_clear (store, uid, idx, &err);
+    }
+  else
+    {
+      int fd = store_dirfd (store, STORE_DIR_TIMES, FALSE, &err);
+
+      name = g_strdup_printf ("%s.%s", uid, timesel);
+      ok = fd > -1 && bolt_unlink_at (fd, name, 0, &err);
+
+      if (ok)
+        {
+          g_autofree char *path = NULL;
+
+          path = g_strdup_printf ("%s/%s",
+                                  store_dir_names[STORE_DIR_TIMES],
+                                  name);
+          store_own_record (store, path);
+        }
+    }
+
+  /* not yet flushed to disk, i.e. it did exist */
+  if (!ok && queued && bolt_err_notfound (err))
+    ok = TRUE;
+  else if (!ok)
+    bolt_error_propagate (error, &err);
+
+  dev = g_hash_table_lookup (store->devidx, uid);
+
+  if (dev != NULL && idx > -1)
+    {
+      dev->times[idx] = 0;
+      dev->tflags &= ~(1 << idx);
+      store_index_changed (store);
+    }
 
   return ok;
 }
@@ -1057,26 +5177,248 @@ bolt_store_del_times (BoltStore  *store,
     {
       g_autoptr(GError) err = NULL;
 
-      ok = bolt_store_del_time (store, uid, ts, &err);
+      ok = bolt_store_del_time (store, uid, ts, &err);
+
+      if (!ok && !bolt_err_notfound (err))
+        {
+          if (error != NULL)
+            {
+              res = bolt_error_propagate (error, &err);
+              break;
+            }
+
+          /* error variable NULL, caller doesn't care, we keep going */
+          bolt_warn_err (err, LOG_DEV_UID (uid), LOG_TOPIC ("store"),
+                         "failed to delete timestamp '%s'", ts);
+        }
+    }
+  va_end (args);
+
+  return res;
+}
+
+gboolean
+bolt_store_flush (BoltStore *store,
+                  GError   **error)
+{
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  /* timestamps first, so the snapshot matches the disk */
+  ok = store_times_flush (store, &err);
+
+  if (!ok)
+    bolt_warn_err (err, LOG_TOPIC ("store"), "failed to flush timestamps");
+
+  if (store->snapshot_id > 0)
+    {
+      g_source_remove (store->snapshot_id);
+      store->snapshot_id = 0;
+    }
+
+  if (!store->dirty)
+    return TRUE;
+
+  return store_index_write_snapshot (store, error);
+}
+
+
+guint
+bolt_store_gc (BoltStore *store)
+{
+  StoreGc *gc;
+  guint total;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), 0);
+  g_return_val_if_fail (store->txn == NULL, 0);
+
+  /* a full pass, supersedes a scheduled one */
+  if (store->gc_id > 0)
+    {
+      g_source_remove (store->gc_id);
+      store->gc_id = 0;
+    }
+
+  g_clear_pointer (&store->gc, store_gc_free);
+
+  gc = g_slice_new0 (StoreGc);
+
+  while (!store_gc_step (store, gc))
+    ;
+
+  total = store_gc_finish (store, gc);
+  store_gc_free (gc);
+
+  return total;
+}
+
+void
+bolt_store_gc_start (BoltStore *store)
+{
+  g_return_if_fail (BOLT_IS_STORE (store));
+
+  if (store->gc_id > 0)
+    return;
+
+  bolt_debug (LOG_TOPIC ("gc"), "scheduling collection");
+
+  store->gc = g_slice_new0 (StoreGc);
+  store->gc_id = g_idle_add_full (G_PRIORITY_LOW,
+                                  store_gc_idle,
+                                  store,
+                                  NULL);
+}
+
+guint
+bolt_store_get_reclaimed (BoltStore *store)
+{
+  g_return_val_if_fail (BOLT_IS_STORE (store), 0);
+
+  return store->reclaimed;
+}
+
+void
+bolt_store_begin (BoltStore *store)
+{
+  g_return_if_fail (BOLT_IS_STORE (store));
+  g_return_if_fail (store->txn == NULL);
+
+  store->txn = store_txn_new ();
+}
+
+gboolean
+bolt_store_commit (BoltStore *store,
+                   GError   **error)
+{
+  g_autoptr(GString) manifest = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(DIR) root = NULL;
+  g_autofree char *path = NULL;
+  StoreTxn *txn;
+  gboolean ok;
+  int rootfd;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
+  g_return_val_if_fail (store->txn != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  txn = g_steal_pointer (&store->txn);
+
+  path = g_file_get_path (store->root);
+  root = bolt_opendir (path, &err);
+
+  if (root == NULL)
+    {
+      /* we cannot even clean up the staged files, they
+       * will be removed when the store is opened again */
+      store_txn_rollback (store, txn, -1);
+      store_txn_free (txn);
+      return bolt_error_propagate (error, &err);
+    }
+
+  rootfd = dirfd (root);
+
+  if (txn->ops->len == 0)
+    goto done;
+
+  manifest = g_string_new ("");
+  for (guint i = 0; i < txn->ops->len; i++)
+    {
+      StoreTxnOp *op = &g_array_index (txn->ops, StoreTxnOp, i);
+
+      if (op->staged)
+        g_string_append_printf (manifest, "R\t%s\t%s\n", op->staged, op->target);
+      else
+        g_string_append_printf (manifest, "D\t%s\n", op->target);
+    }
+  g_string_append_printf (manifest, "C\t%u\n", txn->ops->len);
+
+  /* the staged files themselves were flushed when they
+   * were recorded, now make their directory entries durable */
+  ok = store_txn_sync_dirs (rootfd, txn->ops, &err);
+
+  if (ok)
+    ok = store_txn_write_manifest (rootfd, manifest, &err);
+
+  if (ok)
+    ok = bolt_renameat (rootfd, TXN_FILE_TMP, rootfd, TXN_FILE, &err);
+
+  /* commit point: once the rename is durable, the
+   * transaction will be applied, even after a crash */
+  if (ok)
+    ok = bolt_fsync (rootfd, &err);
+
+  if (!ok)
+    {
+      (void) bolt_unlink_at (rootfd, TXN_FILE_TMP, 0, NULL);
+      (void) bolt_unlink_at (rootfd, TXN_FILE, 0, NULL);
+      store_txn_rollback (store, txn, rootfd);
+      store_txn_free (txn);
+      return bolt_error_propagate (error, &err);
+    }
+
+  store_txn_apply (rootfd, txn->ops);
+
+  for (guint i = 0; i < txn->ops->len; i++)
+    {
+      StoreTxnOp *op = &g_array_index (txn->ops, StoreTxnOp, i);
+      const char *name;
+
+      store_own_record (store, op->target);
+
+      if (!g_str_has_prefix (op->target, "keys/"))
+        continue;
+
+      /* the key set follows the files, not the staging */
+      name = op->target + strlen ("keys/");
+      store_keys_update (store, name,
+                         op->staged ? BOLT_KEY_HAVE : BOLT_KEY_MISSING);
+    }
+
+  /* the manifest must stay until the renames are durable,
+   * otherwise a crash could lose parts of the transaction */
+  ok = store_txn_sync_dirs (rootfd, txn->ops, &err);
+
+  if (ok)
+    ok = bolt_unlink_at (rootfd, TXN_FILE, 0, &err);
 
-      if (!ok && !bolt_err_notfound (err))
-        {
-          if (error != NULL)
-            {
-              res = bolt_error_propagate (error, &err);
-              break;
-            }
+  if (!ok)
+    bolt_warn_err (err, LOG_TOPIC ("store"), "could not remove transaction");
 
-          /* error variable NULL, caller doesn't care, we keep going */
-          bolt_warn_err (err, LOG_DEV_UID (uid), LOG_TOPIC ("store"),
-                         "failed to delete timestamp '%s'", ts);
-        }
+done:
+  for (guint i = 0; i < txn->signals->len; i++)
+    {
+      StoreTxnSignal *sig = &g_array_index (txn->signals, StoreTxnSignal, i);
+      g_signal_emit (store, signals[sig->id], 0, sig->uid);
     }
-  va_end (args);
 
-  return res;
+  store_txn_free (txn);
+
+  return TRUE;
 }
 
+void
+bolt_store_abort (BoltStore *store)
+{
+  g_autoptr(DIR) root = NULL;
+  g_autofree char *path = NULL;
+  StoreTxn *txn;
+
+  g_return_if_fail (BOLT_IS_STORE (store));
+  g_return_if_fail (store->txn != NULL);
+
+  txn = g_steal_pointer (&store->txn);
+
+  path = g_file_get_path (store->root);
+  root = bolt_opendir (path, NULL);
+
+  store_txn_rollback (store, txn, root ? dirfd (root) : -1);
+
+  store_txn_free (txn);
+}
 
 gboolean
 bolt_store_put_key (BoltStore  *store,
@@ -1085,6 +5427,7 @@ bolt_store_put_key (BoltStore  *store,
                     GError    **error)
 {
   g_autoptr(GFile) keypath = NULL;
+  StoreDevice *dev;
   gboolean ok;
 
   g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
@@ -1092,11 +5435,45 @@ bolt_store_put_key (BoltStore  *store,
   g_return_val_if_fail (BOLT_IS_KEY (key), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  if (store_dirfd (store, STORE_DIR_KEYS, TRUE, error) < 0)
+    return FALSE;
+
   keypath = g_file_get_child (store->keys, uid);
-  ok = bolt_fs_make_parent_dirs (keypath, error);
 
-  if (ok)
-    ok = bolt_key_save_file (key, keypath, error);
+  store_index_invalidate (store);
+
+  if (store->txn != NULL)
+    {
+      bolt_autoclose int fd = -1;
+      BoltSecurity level;
+
+      fd = store_txn_stage (store, keypath, 0600, error);
+      ok = fd > -1;
+
+      if (ok)
+        {
+          ok = bolt_key_write_to (key, fd, &level, error);
+          ok = store_txn_staged (store, keypath, &fd, ok, error);
+        }
+    }
+  else
+    {
+      ok = bolt_key_save_file (key, keypath, error);
+
+      if (ok)
+        {
+          store_own_record_file (store, keypath);
+          store_keys_update (store, uid, BOLT_KEY_HAVE);
+        }
+    }
+
+  dev = g_hash_table_lookup (store->devidx, uid);
+  if (ok && dev != NULL)
+    {
+      dev->key = BOLT_KEY_HAVE;
+      store_txn_touch (store, uid);
+      store_index_changed (store);
+    }
 
   return ok;
 }
@@ -1105,23 +5482,17 @@ BoltKeyState
 bolt_store_have_key (BoltStore  *store,
                      const char *uid)
 {
-  g_autoptr(GFileInfo) keyinfo = NULL;
-  g_autoptr(GFile) keypath = NULL;
-  g_autoptr(GError) err = NULL;
-  guint key = BOLT_KEY_MISSING;
+  StoreDevice *dev;
 
-  g_return_val_if_fail (BOLT_IS_STORE (store), key);
-  g_return_val_if_fail (uid != NULL, key);
+  g_return_val_if_fail (BOLT_IS_STORE (store), BOLT_KEY_MISSING);
+  g_return_val_if_fail (uid != NULL, BOLT_KEY_MISSING);
 
-  keypath = g_file_get_child (store->keys, uid);
-  keyinfo = g_file_query_info (keypath, "standard::*", 0, NULL, &err);
+  dev = g_hash_table_lookup (store->devidx, uid);
 
-  if (keyinfo != NULL)
-    key = BOLT_KEY_HAVE; /* todo: check size */
-  else if (!bolt_err_notfound (err))
-    bolt_warn_err (err, LOG_DEV_UID (uid), "error querying key info");
+  if (dev != NULL)
+    return dev->key;
 
-  return key;
+  return store_probe_key (store, uid);
 }
 
 BoltKey *
@@ -1146,14 +5517,29 @@ bolt_store_del_key (BoltStore  *store,
                     GError    **error)
 {
   g_autoptr(GFile) keypath = NULL;
+  StoreDevice *dev;
   gboolean ok;
 
   g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
   g_return_val_if_fail (uid != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  store_index_invalidate (store);
+
   keypath = g_file_get_child (store->keys, uid);
-  ok = g_file_delete (keypath, NULL, error);
+  ok = store_delete_file (store, keypath, error);
+
+  /* within a transaction, the key set is updated on commit */
+  if (ok && store->txn == NULL)
+    store_keys_update (store, uid, BOLT_KEY_MISSING);
+
+  dev = g_hash_table_lookup (store->devidx, uid);
+  if (ok && dev != NULL)
+    {
+      dev->key = BOLT_KEY_MISSING;
+      store_txn_touch (store, uid);
+      store_index_changed (store);
+    }
 
   return ok;
 }
@@ -1165,6 +5551,7 @@ bolt_store_del (BoltStore  *store,
 {
   g_autoptr(GError) err = NULL;
   const char *uid;
+  gboolean own;
   gboolean ok;
 
   g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
@@ -1173,18 +5560,31 @@ bolt_store_del (BoltStore  *store,
 
   uid = bolt_device_get_uid (dev);
 
+  own = store->txn == NULL;
+  if (own)
+    bolt_store_begin (store);
+
   ok = bolt_store_del_key (store, uid, &err);
   if (!ok && !bolt_err_notfound (err))
     {
       g_propagate_prefixed_error (error,
                                   g_steal_pointer (&err),
                                   "could not delete key: ");
+      if (own)
+        bolt_store_abort (store);
       return FALSE;
     }
 
   ok = bolt_store_del_device (store, uid, error);
 
   if (!ok)
+    {
+      if (own)
+        bolt_store_abort (store);
+      return FALSE;
+    }
+
+  if (own && !bolt_store_commit (store, error))
     return FALSE;
 
   bolt_store_del_times (store, uid, NULL,
@@ -1200,6 +5600,365 @@ bolt_store_del (BoltStore  *store,
   return ok;
 }
 
+struct _BoltStoreExport
+{
+  BoltStore           *store;
+  BoltStoreExportFlags flags;
+  GStrv                devices;
+  GStrv                domains;
+  guint                ndevices;
+  guint                ndomains;
+  guint                pos;     /* in devices, then domains */
+  guint                count;   /* records written */
+  gboolean             started; /* magic line written */
+  gboolean             done;    /* end line written */
+};
+
+static GStrv
+archive_sorted_uids (GHashTable *idx,
+                     guint      *len)
+{
+  g_autofree gpointer *uids = NULL;
+
+  uids = g_hash_table_get_keys_as_array (idx, len);
+  qsort (uids, *len, sizeof (gpointer), bolt_comparefn_strcmp);
+
+  return g_strdupv ((char **) uids);
+}
+
+static gboolean
+store_export_device (BoltStoreExport *ex,
+                     GOutputStream   *out,
+                     const char      *uid,
+                     GError         **error)
+{
+  BoltStore *store = ex->store;
+  StoreDevice *dev;
+  gboolean ok;
+
+  /* removed since the export started */
+  dev = g_hash_table_lookup (store->devidx, uid);
+  if (dev == NULL)
+    return TRUE;
+
+  ok = archive_write_file (out, "device", store->devices, uid, error);
+  if (!ok)
+    return FALSE;
+  ex->count++;
+
+  if ((ex->flags & BOLT_STORE_EXPORT_KEYS) && dev->key != BOLT_KEY_MISSING)
+    {
+      ok = archive_write_file (out, "key", store->keys, uid, error);
+      if (!ok)
+        return FALSE;
+      ex->count++;
+    }
+
+  return store_export_times (store, out, dev, &ex->count, error);
+}
+
+static gboolean
+store_export_domain (BoltStoreExport *ex,
+                     GOutputStream   *out,
+                     const char      *uid,
+                     GError         **error)
+{
+  BoltStore *store = ex->store;
+  gboolean ok;
+
+  if (!g_hash_table_contains (store->domidx, uid))
+    return TRUE;
+
+  ok = archive_write_file (out, "domain", store->domains, uid, error);
+  if (!ok)
+    return FALSE;
+  ex->count++;
+
+  return TRUE;
+}
+
+BoltStoreExport *
+bolt_store_export_new (BoltStore           *store,
+                       BoltStoreExportFlags flags)
+{
+  BoltStoreExport *ex;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), NULL);
+
+  ex = g_slice_new0 (BoltStoreExport);
+  ex->store = g_object_ref (store);
+  ex->flags = flags;
+
+  /* the entries are fixed now, later changes to the
+   * store only remove records from the archive */
+  ex->devices = archive_sorted_uids (store->devidx, &ex->ndevices);
+  ex->domains = archive_sorted_uids (store->domidx, &ex->ndomains);
+
+  return ex;
+}
+
+void
+bolt_store_export_free (BoltStoreExport *ex)
+{
+  if (ex == NULL)
+    return;
+
+  g_strfreev (ex->devices);
+  g_strfreev (ex->domains);
+  g_object_unref (ex->store);
+  g_slice_free (BoltStoreExport, ex);
+}
+
+gboolean
+bolt_store_export_step (BoltStoreExport *ex,
+                        GOutputStream   *out,
+                        gboolean        *done,
+                        GError         **error)
+{
+  gboolean ok = TRUE;
+  guint total;
+
+  g_return_val_if_fail (ex != NULL, FALSE);
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (out), FALSE);
+  g_return_val_if_fail (done != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (!ex->started)
+    {
+      ok = g_output_stream_write_all (out,
+                                      ARCHIVE_MAGIC " " G_STRINGIFY (ARCHIVE_VERSION) "\n",
+                                      strlen (ARCHIVE_MAGIC " " G_STRINGIFY (ARCHIVE_VERSION) "\n"),
+                                      NULL, NULL, error);
+      if (!ok)
+        return FALSE;
+
+      ex->started = TRUE;
+    }
+
+  total = ex->ndevices + ex->ndomains;
+
+  for (guint i = 0; ok && i < EXPORT_STEP && ex->pos < total; i++)
+    {
+      guint pos = ex->pos++;
+
+      if (pos < ex->ndevices)
+        ok = store_export_device (ex, out, ex->devices[pos], error);
+      else
+        ok = store_export_domain (ex, out, ex->domains[pos - ex->ndevices], error);
+    }
+
+  if (ok && !ex->done && ex->pos == total)
+    {
+      g_autofree char *end = NULL;
+
+      end = g_strdup_printf ("end %u\n", ex->count);
+      ok = g_output_stream_write_all (out, end, strlen (end), NULL, NULL, error);
+      ex->done = ok;
+    }
+
+  if (ok)
+    ok = g_output_stream_flush (out, NULL, error);
+
+  *done = ex->done;
+
+  return ok;
+}
+
+guint
+bolt_store_export_get_count (BoltStoreExport *ex)
+{
+  g_return_val_if_fail (ex != NULL, 0);
+
+  return ex->count;
+}
+
+gboolean
+bolt_store_export (BoltStore           *store,
+                   GOutputStream       *out,
+                   BoltStoreExportFlags flags,
+                   guint               *count,
+                   GError             **error)
+{
+  g_autoptr(BoltStoreExport) ex = NULL;
+  gboolean done = FALSE;
+  gboolean ok = TRUE;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (out), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  ex = bolt_store_export_new (store, flags);
+
+  while (ok && !done)
+    ok = bolt_store_export_step (ex, out, &done, error);
+
+  if (ok && count != NULL)
+    *count = ex->count;
+
+  return ok;
+}
+
+BoltStoreImport *
+bolt_store_import_new (BoltStore *store,
+                       GError   **error)
+{
+  GFile *dirs[] = {store->devices, store->keys, store->domains};
+  BoltStoreImport *im;
+  gboolean ok;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  for (guint i = 0; i < G_N_ELEMENTS (dirs); i++)
+    {
+      g_autoptr(GFile) probe = g_file_get_child (dirs[i], "probe");
+
+      ok = bolt_fs_make_parent_dirs (probe, error);
+      if (!ok)
+        return NULL;
+    }
+
+  store_index_invalidate (store);
+
+  im = g_slice_new0 (BoltStoreImport);
+  im->store = g_object_ref (store);
+  im->buf = g_byte_array_new ();
+
+  return im;
+}
+
+void
+bolt_store_import_free (BoltStoreImport *im)
+{
+  if (im == NULL)
+    return;
+
+  g_byte_array_unref (im->buf);
+  g_object_unref (im->store);
+  g_slice_free (BoltStoreImport, im);
+}
+
+gboolean
+bolt_store_import_feed (BoltStoreImport *im,
+                        const void      *data,
+                        gsize            len,
+                        GError         **error)
+{
+  BoltStore *store;
+  gboolean ok;
+
+  g_return_val_if_fail (im != NULL, FALSE);
+  g_return_val_if_fail (data != NULL || len == 0, FALSE);
+  g_return_val_if_fail (im->store->txn == NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  store = im->store;
+
+  /* anything after the end is ignored */
+  if (im->done || len == 0)
+    return TRUE;
+
+  g_byte_array_append (im->buf, data, len);
+
+  /* records are applied in batches, each of which is a
+   * transaction that does not outlive this call, so that
+   * other users of the store are not caught up in it; a
+   * failure keeps the completed batches */
+  bolt_store_begin (store);
+
+  ok = store_import_parse (im, error);
+
+  if (ok)
+    ok = bolt_store_commit (store, error);
+  else
+    bolt_store_abort (store);
+
+  if (ok)
+    im->count = im->n;
+
+  return ok;
+}
+
+gboolean
+bolt_store_import_finish (BoltStoreImport *im,
+                          guint           *count,
+                          GError         **error)
+{
+  g_autoptr(GError) err = NULL;
+  gboolean ok = TRUE;
+
+  g_return_val_if_fail (im != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (!im->started && im->buf->len == 0)
+    {
+      g_set_error_literal (&err, BOLT_ERROR, BOLT_ERROR_FAILED,
+                           "archive: empty");
+      ok = FALSE;
+    }
+  else if (!im->done)
+    {
+      g_set_error_literal (&err, BOLT_ERROR, BOLT_ERROR_FAILED,
+                           "archive: truncated");
+      ok = FALSE;
+    }
+
+  /* all timestamps are written together */
+  if (ok)
+    ok = store_times_flush (im->store, &err);
+
+  bolt_info (LOG_TOPIC ("store"), "imported %u records", im->count);
+
+  if (count != NULL)
+    *count = im->count;
+
+  if (!ok)
+    return bolt_error_propagate (error, &err);
+
+  return TRUE;
+}
+
+gboolean
+bolt_store_import (BoltStore    *store,
+                   GInputStream *in,
+                   guint        *count,
+                   GError      **error)
+{
+  g_autoptr(BoltStoreImport) im = NULL;
+  g_autofree char *buf = NULL;
+  gboolean ok = TRUE;
+  gssize n;
+
+  g_return_val_if_fail (BOLT_IS_STORE (store), FALSE);
+  g_return_val_if_fail (G_IS_INPUT_STREAM (in), FALSE);
+  g_return_val_if_fail (store->txn == NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  im = bolt_store_import_new (store, error);
+  if (im == NULL)
+    return FALSE;
+
+  buf = g_malloc (ARCHIVE_CHUNK);
+
+  do
+    {
+      n = g_input_stream_read (in, buf, ARCHIVE_CHUNK, NULL, error);
+
+      if (n > 0)
+        ok = bolt_store_import_feed (im, buf, n, error);
+    }
+  while (ok && n > 0);
+
+  if (n < 0 || !ok)
+    {
+      if (count != NULL)
+        *count = im->count;
+      return FALSE;
+    }
+
+  return bolt_store_import_finish (im, count, error);
+}
+
 BoltJournal *
 bolt_store_open_journal (BoltStore  *store,
                          const char *type,
@@ -1275,8 +6034,10 @@ bolt_store_upgrade (BoltStore *store,
                     gboolean  *upgrade,
                     GError   **error)
 {
+  g_autoptr(GPtrArray) migrated = NULL;
   g_autoptr(DIR) root = NULL;
   g_autofree char *path = NULL;
+  bolt_autoclose int vfd = -1;
   gboolean need_upgrade;
   gboolean ok;
 
@@ -1297,6 +6058,20 @@ bolt_store_upgrade (BoltStore *store,
   if (!root)
     return FALSE;
 
+  migrated = g_ptr_array_new_with_free_func (g_free);
+
+  if (store->version < STORE_VERSION_TIMESDB)
+    {
+      /* pending timestamps must be on disk to be migrated */
+      ok = store_times_flush (store, error);
+      if (!ok)
+        return FALSE;
+
+      ok = store_tdb_migrate (store, migrated, error);
+      if (!ok)
+        return FALSE;
+    }
+
   ok = bolt_write_int_at (dirfd (root),
                           ".version-upgrade",
                           BOLT_STORE_VERSION,
@@ -1304,11 +6079,17 @@ bolt_store_upgrade (BoltStore *store,
   if (!ok)
     return FALSE;
 
-  ok = bolt_renameat (dirfd (root),
-                      ".version-upgrade",
-                      dirfd (root),
-                      "version",
-                      error);
+  vfd = bolt_openat (dirfd (root), ".version-upgrade",
+                     O_RDONLY | O_CLOEXEC, 0, error);
+
+  ok = vfd > -1 && bolt_fsync (vfd, error);
+
+  if (ok)
+    ok = bolt_renameat (dirfd (root),
+                        ".version-upgrade",
+                        dirfd (root),
+                        "version",
+                        error);
 
   if (!ok)
     {
@@ -1316,9 +6097,28 @@ bolt_store_upgrade (BoltStore *store,
       return FALSE;
     }
 
+  /* the legacy files must only be removed once the new
+   * version is durable; otherwise a crash could leave us
+   * with the old version but without the legacy files */
+  ok = bolt_fsync (dirfd (root), error);
+  if (!ok)
+    return FALSE;
+
   store->version = BOLT_STORE_VERSION;
   g_object_notify_by_pspec (G_OBJECT (store),
                             store_props[PROP_VERSION]);
 
+  /* the new version is committed, the old files can go */
+  for (guint i = 0; i < migrated->len; i++)
+    {
+      g_autoptr(GError) err = NULL;
+      const char *name = g_ptr_array_index (migrated, i);
+      int fd = store_dirfd (store, STORE_DIR_TIMES, FALSE, &err);
+
+      if (fd < 0 || !bolt_unlink_at (fd, name, 0, &err))
+        bolt_warn_err (err, LOG_TOPIC ("store"),
+                       "could not remove '%s'", name);
+    }
+
   return ok;
 }
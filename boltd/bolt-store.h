@@ -30,12 +30,17 @@
 
 G_BEGIN_DECLS
 
-#define BOLT_STORE_VERSION 1
+#define BOLT_STORE_VERSION 2
 
 /* BoltStore - database for devices, keys */
 #define BOLT_TYPE_STORE bolt_store_get_type ()
 G_DECLARE_FINAL_TYPE (BoltStore, bolt_store, BOLT, STORE, GObject);
 
+typedef enum BoltStoreExportFlags {
+  BOLT_STORE_EXPORT_NONE = 0,
+  BOLT_STORE_EXPORT_KEYS = 1 << 0,
+} BoltStoreExportFlags;
+
 BoltStore *       bolt_store_new (const char *path,
                                   GError    **error);
 
@@ -78,6 +83,14 @@ BoltDevice *      bolt_store_get_device (BoltStore  *store,
                                          const char *uid,
                                          GError    **error);
 
+gboolean          bolt_store_peek_device (BoltStore      *store,
+                                          const char     *uid,
+                                          char          **name,
+                                          char          **vendor,
+                                          BoltDeviceType *type,
+                                          BoltPolicy     *policy,
+                                          GError        **error);
+
 gboolean          bolt_store_del_device (BoltStore  *store,
                                          const char *uid,
                                          GError    **error);
@@ -114,6 +127,22 @@ gboolean          bolt_store_del_times (BoltStore  *store,
                                         GError    **error,
                                         ...) G_GNUC_NULL_TERMINATED;
 
+gboolean          bolt_store_flush (BoltStore *store,
+                                    GError   **error);
+
+guint             bolt_store_gc (BoltStore *store);
+
+void              bolt_store_gc_start (BoltStore *store);
+
+guint             bolt_store_get_reclaimed (BoltStore *store);
+
+void              bolt_store_begin (BoltStore *store);
+
+gboolean          bolt_store_commit (BoltStore *store,
+                                     GError   **error);
+
+void              bolt_store_abort (BoltStore *store);
+
 gboolean          bolt_store_put_key (BoltStore  *store,
                                       const char *uid,
                                       BoltKey    *key,
@@ -130,6 +159,52 @@ gboolean          bolt_store_del_key (BoltStore  *store,
                                       const char *uid,
                                       GError    **error);
 
+/* export and import */
+typedef struct _BoltStoreExport BoltStoreExport;
+
+BoltStoreExport * bolt_store_export_new (BoltStore           *store,
+                                         BoltStoreExportFlags flags);
+
+void              bolt_store_export_free (BoltStoreExport *ex);
+
+gboolean          bolt_store_export_step (BoltStoreExport *ex,
+                                          GOutputStream   *out,
+                                          gboolean        *done,
+                                          GError         **error);
+
+guint             bolt_store_export_get_count (BoltStoreExport *ex);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (BoltStoreExport, bolt_store_export_free);
+
+typedef struct _BoltStoreImport BoltStoreImport;
+
+BoltStoreImport * bolt_store_import_new (BoltStore *store,
+                                         GError   **error);
+
+void              bolt_store_import_free (BoltStoreImport *im);
+
+gboolean          bolt_store_import_feed (BoltStoreImport *im,
+                                          const void      *data,
+                                          gsize            len,
+                                          GError         **error);
+
+gboolean          bolt_store_import_finish (BoltStoreImport *im,
+                                            guint           *count,
+                                            GError         **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (BoltStoreImport, bolt_store_import_free);
+
+gboolean          bolt_store_export (BoltStore           *store,
+                                     GOutputStream       *out,
+                                     BoltStoreExportFlags flags,
+                                     guint               *count,
+                                     GError             **error);
+
+gboolean          bolt_store_import (BoltStore    *store,
+                                     GInputStream *in,
+                                     guint        *count,
+                                     GError      **error);
+
 BoltJournal *     bolt_store_open_journal (BoltStore  *store,
                                            const char *type,
                                            const char *name,
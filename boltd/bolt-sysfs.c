@@ -28,14 +28,320 @@
 #include "bolt-names.h"
 #include "bolt-str.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libudev.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 typedef struct udev_device udev_device;
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (udev_device, udev_device_unref);
 
+/* BoltSysfsSnapshot - all attributes of a thunderbolt device
+ * that bolt uses, read in one go: the device directory is opened
+ * once and every attribute is read via openat(2) and pread(2)
+ * into a single buffer. */
+
+/* sysfs attributes are at most a page */
+#define SNAPSHOT_ATTR_MAX 4096
+
+static const char *snapshot_attrs[] = {
+  BOLT_SYSFS_UNIQUE_ID,
+  "authorized",
+  "key",
+  "boot",
+  BOLT_SYSFS_GENERATION,
+  BOLT_SYSFS_RX_LANES,
+  BOLT_SYSFS_RX_SPEED,
+  BOLT_SYSFS_TX_LANES,
+  BOLT_SYSFS_TX_SPEED,
+  "vendor",
+  "vendor_name",
+  "device",
+  "device_name",
+  /* the parent device is the parent directory */
+  "../" BOLT_SYSFS_UNIQUE_ID,
+};
+
+#define SNAPSHOT_N_ATTRS G_N_ELEMENTS (snapshot_attrs)
+#define SNAPSHOT_PARENT_UID "../" BOLT_SYSFS_UNIQUE_ID
+
+struct _BoltSysfsSnapshot
+{
+  gint                ref_count;
+
+  struct udev_device *udev;
+  gint64              ctim;
+
+  /* values are NUL terminated, at 'offset' into 'arena',
+   * or if 'offset' is negative, the errno of the read */
+  GString *arena;
+  gint     offset[SNAPSHOT_N_ATTRS];
+};
+
+static int
+snapshot_read_attr (int         dirfd,
+                    const char *name,
+                    GString    *arena)
+{
+  gsize at = arena->len;
+  ssize_t n;
+  int fd;
+
+  fd = openat (dirfd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+
+  if (fd < 0)
+    return -errno;
+
+  g_string_set_size (arena, at + SNAPSHOT_ATTR_MAX);
+
+  do
+    n = pread (fd, arena->str + at, SNAPSHOT_ATTR_MAX, 0);
+  while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    {
+      int code = errno;
+
+      g_string_truncate (arena, at);
+      close (fd);
+
+      return -code;
+    }
+
+  close (fd);
+
+  /* like libudev, drop trailing newlines */
+  while (n > 0 && arena->str[at + n - 1] == '\n')
+    n--;
+
+  g_string_truncate (arena, at + n);
+  g_string_append_c (arena, '\0');
+
+  return (int) at;
+}
+
+BoltSysfsSnapshot *
+bolt_sysfs_snapshot_new (struct udev_device *udev,
+                         GError            **error)
+{
+  BoltSysfsSnapshot *snap;
+  const char *syspath;
+  struct stat sb;
+  int dirfd;
+  int r;
+
+  g_return_val_if_fail (udev != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  syspath = udev_device_get_syspath (udev);
+
+  dirfd = open (syspath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirfd < 0)
+    {
+      int code = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code),
+                   "could not open '%s': %s",
+                   syspath, g_strerror (code));
+      return NULL;
+    }
+
+  snap = g_slice_new0 (BoltSysfsSnapshot);
+  snap->ref_count = 1;
+  snap->udev = udev_device_ref (udev);
+  snap->arena = g_string_sized_new (256);
+
+  r = fstat (dirfd, &sb);
+  snap->ctim = r == 0 ? MAX ((gint64) sb.st_ctim.tv_sec, 0) : 0;
+
+  for (guint i = 0; i < SNAPSHOT_N_ATTRS; i++)
+    snap->offset[i] = snapshot_read_attr (dirfd, snapshot_attrs[i], snap->arena);
+
+  close (dirfd);
+
+  return snap;
+}
+
+BoltSysfsSnapshot *
+bolt_sysfs_snapshot_ref (BoltSysfsSnapshot *snap)
+{
+  g_return_val_if_fail (snap != NULL, NULL);
+
+  g_atomic_int_inc (&snap->ref_count);
+
+  return snap;
+}
+
+void
+bolt_sysfs_snapshot_unref (BoltSysfsSnapshot *snap)
+{
+  g_return_if_fail (snap != NULL);
+
+  if (!g_atomic_int_dec_and_test (&snap->ref_count))
+    return;
+
+  udev_device_unref (snap->udev);
+  g_string_free (snap->arena, TRUE);
+  g_slice_free (BoltSysfsSnapshot, snap);
+}
+
+struct udev_device *
+bolt_sysfs_snapshot_get_device (BoltSysfsSnapshot *snap)
+{
+  g_return_val_if_fail (snap != NULL, NULL);
+
+  return snap->udev;
+}
+
+/* NB: like udev_device_get_sysattr_value, sets errno if
+ * the attribute could not be read */
+const char *
+bolt_sysfs_snapshot_get (BoltSysfsSnapshot *snap,
+                         const char        *attr)
+{
+  g_return_val_if_fail (snap != NULL, NULL);
+  g_return_val_if_fail (attr != NULL, NULL);
+
+  for (guint i = 0; i < SNAPSHOT_N_ATTRS; i++)
+    {
+      if (!g_str_equal (attr, snapshot_attrs[i]))
+        continue;
+
+      if (snap->offset[i] < 0)
+        {
+          errno = -snap->offset[i];
+          return NULL;
+        }
+
+      return snap->arena->str + snap->offset[i];
+    }
+
+  /* not part of the snapshot */
+  return udev_device_get_sysattr_value (snap->udev, attr);
+}
+
+static const char *
+snapshot_get_sysattr_value (BoltSysfsSnapshot *snap,
+                            const char        *attr,
+                            GError           **error)
+{
+  const char *val;
+
+  g_return_val_if_fail (snap != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  val = bolt_sysfs_snapshot_get (snap, attr);
+
+  if (val == NULL)
+    {
+      int code = errno;
+      const char *path = udev_device_get_syspath (snap->udev);
+
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_UDEV,
+                   "could not get '%s' for %s: %s",
+                   attr, path, g_strerror (code));
+    }
+
+  return val;
+}
+
+const char *
+bolt_sysfs_snapshot_get_unique_id (BoltSysfsSnapshot *snap,
+                                   GError           **error)
+{
+  g_return_val_if_fail (snap != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  return snapshot_get_sysattr_value (snap, BOLT_SYSFS_UNIQUE_ID, error);
+}
+
+/* per uevent attribute cache: while a uevent is being handled,
+ * i.e. between bolt_sysfs_cache_begin and bolt_sysfs_cache_end,
+ * values read via libudev are cached, keyed by the sysfs path,
+ * no matter which udev_device object asks. So reads of the same
+ * attribute, e.g. the security level of the domain via the parent
+ * or via a device created from the syspath, are only done once.
+ * Outside of that scope nothing is cached. Must only be used from
+ * the main thread. */
+static struct
+{
+  GHashTable        *paths;  /* syspath -> attribute -> value */
+  unsigned long long seqnum; /* of the current uevent, 0 if none */
+  guint              hits;   /* lookups for the current uevent */
+  guint              misses;
+} sysfs_cache;
+
+static const char *
+sysfs_cache_get_sysattr (struct udev_device *dev,
+                         const char         *attr)
+{
+  GHashTable *values = NULL;
+  const char *syspath;
+  const char *val;
+
+  syspath = udev_device_get_syspath (dev);
+
+  if (sysfs_cache.seqnum == 0 || syspath == NULL)
+    return udev_device_get_sysattr_value (dev, attr);
+
+  if (sysfs_cache.paths == NULL)
+    sysfs_cache.paths = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free,
+                                               (GDestroyNotify) g_hash_table_unref);
+
+  values = g_hash_table_lookup (sysfs_cache.paths, syspath);
+
+  if (values == NULL)
+    {
+      values = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                      g_free, g_free);
+      g_hash_table_insert (sysfs_cache.paths, g_strdup (syspath), values);
+    }
+
+  val = g_hash_table_lookup (values, attr);
+
+  if (val != NULL)
+    {
+      sysfs_cache.hits++;
+      return val;
+    }
+
+  sysfs_cache.misses++;
+  val = udev_device_get_sysattr_value (dev, attr);
+
+  if (val != NULL)
+    g_hash_table_insert (values, g_strdup (attr), g_strdup (val));
+
+  return val;
+}
+
+void
+bolt_sysfs_cache_begin (unsigned long long seqnum)
+{
+  /* values of an earlier uevent are stale */
+  bolt_sysfs_cache_end ();
+
+  sysfs_cache.seqnum = seqnum;
+}
+
+void
+bolt_sysfs_cache_end (void)
+{
+  if (sysfs_cache.hits + sysfs_cache.misses > 0)
+    bolt_debug (LOG_TOPIC ("sysfs"), "uevent %llu: %u cached, %u read",
+                sysfs_cache.seqnum, sysfs_cache.hits, sysfs_cache.misses);
+
+  sysfs_cache.seqnum = 0;
+  sysfs_cache.hits = 0;
+  sysfs_cache.misses = 0;
+
+  if (sysfs_cache.paths != NULL)
+    g_hash_table_remove_all (sysfs_cache.paths);
+}
+
+/* device identification */
 void
 bolt_ident_clear (BoltIdent *id)
 {
@@ -43,6 +349,10 @@ bolt_ident_clear (BoltIdent *id)
     return;
 
   udev_device_unref (id->udev);
+
+  if (id->snap)
+    bolt_sysfs_snapshot_unref (id->snap);
+
   memset (id, 0, sizeof (BoltIdent));
 }
 
@@ -56,7 +366,7 @@ sysfs_get_sysattr_value (struct udev_device *dev,
   g_return_val_if_fail (dev != NULL, NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  val = udev_device_get_sysattr_value (dev, attr);
+  val = sysfs_cache_get_sysattr (dev, attr);
 
   if (val == NULL)
     {
@@ -193,50 +503,51 @@ bolt_sysfs_security_for_device (struct udev_device *udev,
       return BOLT_SECURITY_UNKNOWN;
     }
 
-  v = udev_device_get_sysattr_value (parent, "security");
+  v = sysfs_cache_get_sysattr (parent, "security");
   s = bolt_enum_from_string (BOLT_TYPE_SECURITY, v, error);
 
   return s;
 }
 
 static const char *
-read_sysattr_name (struct udev_device *udev,
-                   const char         *attr,
-                   GError            **error)
+read_sysattr_name (BoltSysfsSnapshot *snap,
+                   const char        *attr,
+                   GError           **error)
 {
   g_autofree char *s = NULL;
   const char *v;
 
   s = g_strdup_printf ("%s_name", attr);
-  v = udev_device_get_sysattr_value (udev, s);
+  v = bolt_sysfs_snapshot_get (snap, s);
 
   if (v != NULL)
     return v;
 
-  return sysfs_get_sysattr_value (udev, attr, error);
+  return snapshot_get_sysattr_value (snap, attr, error);
 }
 
 gboolean
-bolt_sysfs_device_ident (struct udev_device *udev,
-                         BoltIdent          *id,
-                         GError            **error)
+bolt_sysfs_device_ident (BoltSysfsSnapshot *snap,
+                         BoltIdent         *id,
+                         GError           **error)
 {
   const char *name;
   const char *vendor;
 
-  g_return_val_if_fail (udev != NULL, FALSE);
+  g_return_val_if_fail (snap != NULL, FALSE);
   g_return_val_if_fail (id != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-  vendor = read_sysattr_name (udev, "vendor", error);
+  vendor = read_sysattr_name (snap, "vendor", error);
   if (vendor == NULL)
     return FALSE;
 
-  name = read_sysattr_name (udev, "device", error);
+  name = read_sysattr_name (snap, "device", error);
   if (name == NULL)
     return FALSE;
 
-  id->udev = udev_device_ref (udev);
+  id->udev = udev_device_ref (snap->udev);
+  id->snap = bolt_sysfs_snapshot_ref (snap);
   id->name = name;
   id->vendor = vendor;
 
@@ -244,9 +555,9 @@ bolt_sysfs_device_ident (struct udev_device *udev,
 }
 
 gboolean
-bolt_sysfs_host_ident (struct udev_device *dev,
-                       BoltIdent          *id,
-                       GError            **error)
+bolt_sysfs_host_ident (BoltSysfsSnapshot *snap,
+                       BoltIdent         *id,
+                       GError           **error)
 {
   g_autoptr(udev_device) dmi = NULL;
   struct udev *udev;
@@ -255,20 +566,20 @@ bolt_sysfs_host_ident (struct udev_device *dev,
   const char *attr;
   gboolean ok;
 
-  g_return_val_if_fail (dev != NULL, FALSE);
+  g_return_val_if_fail (snap != NULL, FALSE);
   g_return_val_if_fail (id != NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
   /* First check if the host controller has normal device ident,
    * which should be present for all controller that have a DROM. */
-  ok = bolt_sysfs_device_ident (dev, id, NULL);
+  ok = bolt_sysfs_device_ident (snap, id, NULL);
   if (ok)
     return TRUE;
 
   /* On embedded thunderbolt controllers without DROM, we
    * fall back to using the SMBIOS/DMI system information */
 
-  udev = udev_device_get_udev (dev);
+  udev = udev_device_get_udev (snap->udev);
   dmi = udev_device_new_from_syspath (udev, BOLT_SYSFS_DMI_ID);
 
   if (dmi == NULL)
@@ -310,84 +621,179 @@ bolt_sysfs_host_ident (struct udev_device *dev,
   return TRUE;
 }
 
+/* enumeration */
+static guint
+sysfs_path_depth (const char *syspath)
+{
+  guint depth = 0;
+
+  for (const char *c = syspath; *c; c++)
+    if (*c == '/')
+      depth++;
+
+  return depth;
+}
+
 static int
-bolt_syfs_count_tb_devices (struct udev        *udev,
-                            struct udev_device *parent,
-                            GError            **error)
+sysfs_compare_topology (gconstpointer a,
+                        gconstpointer b)
 {
-  struct udev_enumerate *e;
-  struct udev_list_entry *l, *devices;
-  int r, count = 0;
+  struct udev_device *da = *((struct udev_device **) a);
+  struct udev_device *db = *((struct udev_device **) b);
+  const char *pa = udev_device_get_syspath (da);
+  const char *pb = udev_device_get_syspath (db);
+  guint depth_a = sysfs_path_depth (pa);
+  guint depth_b = sysfs_path_depth (pb);
 
-  e = udev_enumerate_new (udev);
+  if (depth_a != depth_b)
+    return depth_a < depth_b ? -1 : 1;
 
-  udev_enumerate_add_match_subsystem (e, "thunderbolt");
-  udev_enumerate_add_match_property (e, "DEVTYPE", "thunderbolt_device");
+  return strcmp (pa, pb);
+}
 
-  if (parent)
-    udev_enumerate_add_match_parent (e, parent);
+/* the kernel names domains 'domainN' and devices 'N-ROUTE',
+ * with the route string in hex; services ('N-ROUTE.M'),
+ * retimers ('N-ROUTE:P.M') and the like can therefore be
+ * skipped by name, before any udev device is created */
+static gboolean
+sysfs_name_is_candidate (const char *name)
+{
+  const char *p = name;
 
-  r = udev_enumerate_scan_devices (e);
-  if (r < 0)
+  if (g_str_has_prefix (name, "domain"))
     {
-      g_set_error (error, BOLT_ERROR, BOLT_ERROR_UDEV,
-                   "failed to scan udev: %s",
-                   g_strerror (-r));
-      return r;
+      p += strlen ("domain");
+      name = p;
+
+      while (g_ascii_isdigit (*p))
+        p++;
+
+      return p != name && *p == '\0';
     }
 
-  devices = udev_enumerate_get_list_entry (e);
-  udev_list_entry_foreach (l, devices)
-    count++;
+  while (g_ascii_isdigit (*p))
+    p++;
 
-  udev_enumerate_unref (e);
+  if (p == name || *p++ != '-')
+    return FALSE;
 
-  return count;
+  name = p;
+
+  while (g_ascii_isxdigit (*p))
+    p++;
+
+  return p != name && *p == '\0';
 }
 
-int
-bolt_sysfs_count_hosts (struct udev *udev,
-                        GError     **error)
+GPtrArray *
+bolt_sysfs_enumerate (struct udev *udev,
+                      GError     **error)
 {
-  struct udev_enumerate *e;
-  struct udev_list_entry *l, *devices;
-  int r, count = 0;
+  g_autoptr(GPtrArray) res = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(DIR) dir = NULL;
+  struct dirent *de;
 
-  e = udev_enumerate_new (udev);
+  g_return_val_if_fail (udev != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  udev_enumerate_add_match_subsystem (e, "thunderbolt");
-  udev_enumerate_add_match_property (e, "DEVTYPE", "thunderbolt_domain");
+  dir = bolt_opendir (BOLT_SYSFS_THUNDERBOLT_BUS, &err);
 
-  r = udev_enumerate_scan_devices (e);
-  if (r < 0)
+  /* fall back to the class directory, if the bus one does not
+   * exist, which for example is the case with umockdev */
+  if (dir == NULL && g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
     {
-      g_set_error (error, BOLT_ERROR, BOLT_ERROR_UDEV,
-                   "failed to scan udev: %s",
-                   g_strerror (-r));
-      return r;
+      g_clear_error (&err);
+      dir = bolt_opendir (BOLT_SYSFS_THUNDERBOLT_CLASS, &err);
     }
 
-  devices = udev_enumerate_get_list_entry (e);
-  udev_list_entry_foreach (l, devices)
+  res = g_ptr_array_new_with_free_func ((GDestroyNotify) udev_device_unref);
+
+  /* no thunderbolt support at all */
+  if (dir == NULL && g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    return g_steal_pointer (&res);
+  else if (dir == NULL)
     {
-      struct udev_device *udevice = NULL;
-      const char *syspath;
-      int n;
+      g_propagate_error (error, g_steal_pointer (&err));
+      return NULL;
+    }
 
-      syspath = udev_list_entry_get_name (l);
-      udevice = udev_device_new_from_syspath (udev, syspath);
+  while ((de = readdir (dir)) != NULL)
+    {
+      struct udev_device *dev;
+      const char *devtype;
 
-      if (udevice == NULL)
+      if (!sysfs_name_is_candidate (de->d_name))
         continue;
 
-      n = bolt_syfs_count_tb_devices (udev, udevice, NULL);
-      if (n > 0)
-        count++;
+      dev = udev_device_new_from_subsystem_sysname (udev,
+                                                    "thunderbolt",
+                                                    de->d_name);
+      if (dev == NULL)
+        continue;
+
+      devtype = udev_device_get_devtype (dev);
+
+      /* only domains and devices, in case the name alone
+       * was misleading */
+      if (!bolt_streq (devtype, "thunderbolt_domain") &&
+          !bolt_streq (devtype, "thunderbolt_device"))
+        {
+          udev_device_unref (dev);
+          continue;
+        }
 
-      udev_device_unref (udevice);
+      g_ptr_array_add (res, dev);
     }
 
-  udev_enumerate_unref (e);
+  /* parents before their children */
+  g_ptr_array_sort (res, sysfs_compare_topology);
+
+  return g_steal_pointer (&res);
+}
+
+int
+bolt_sysfs_count_hosts (struct udev *udev,
+                        GError     **error)
+{
+  g_autoptr(GPtrArray) devices = NULL;
+  g_autoptr(GPtrArray) domains = NULL;
+  int count = 0;
+
+  devices = bolt_sysfs_enumerate (udev, error);
+
+  if (devices == NULL)
+    return -1;
+
+  domains = g_ptr_array_new ();
+
+  /* domains are sorted before the devices */
+  for (guint i = 0; i < devices->len; i++)
+    {
+      struct udev_device *dev = g_ptr_array_index (devices, i);
+      const char *devtype = udev_device_get_devtype (dev);
+      const char *syspath = udev_device_get_syspath (dev);
+
+      if (bolt_streq (devtype, "thunderbolt_domain"))
+        {
+          g_ptr_array_add (domains, (gpointer) syspath);
+          continue;
+        }
+
+      /* a domain counts if there is any device on it */
+      for (guint k = 0; k < domains->len; k++)
+        {
+          const char *dom = g_ptr_array_index (domains, k);
+          gsize n = strlen (dom);
+
+          if (strncmp (syspath, dom, n) || syspath[n] != '/')
+            continue;
+
+          g_ptr_array_remove_index_fast (domains, k);
+          count++;
+          break;
+        }
+    }
 
   return count;
 }
@@ -428,16 +834,11 @@ bolt_sysfs_nhi_id_for_domain (struct udev_device *udev,
 }
 
 static gint
-sysfs_get_sysattr_value_as_int (struct udev_device *udev,
-                                const char         *attr)
+sysattr_parse_int (const char *str)
 {
-  const char *str;
   gboolean ok;
   gint val;
 
-  g_return_val_if_fail (udev != NULL, FALSE);
-
-  str = udev_device_get_sysattr_value (udev, attr);
   if (str == NULL)
     return -errno;
 
@@ -449,15 +850,33 @@ sysfs_get_sysattr_value_as_int (struct udev_device *udev,
   return val;
 }
 
+static gint
+sysfs_get_sysattr_value_as_int (struct udev_device *udev,
+                                const char         *attr)
+{
+  g_return_val_if_fail (udev != NULL, FALSE);
+
+  return sysattr_parse_int (sysfs_cache_get_sysattr (udev, attr));
+}
+
+static gint
+snapshot_get_sysattr_value_as_int (BoltSysfsSnapshot *snap,
+                                   const char        *attr)
+{
+  g_return_val_if_fail (snap != NULL, FALSE);
+
+  return sysattr_parse_int (bolt_sysfs_snapshot_get (snap, attr));
+}
+
 static gssize
-sysfs_get_sysattr_size (struct udev_device *udev,
-                        const char         *attr)
+snapshot_get_sysattr_size (BoltSysfsSnapshot *snap,
+                           const char        *attr)
 {
   const char *str;
 
-  g_return_val_if_fail (udev != NULL, FALSE);
+  g_return_val_if_fail (snap != NULL, FALSE);
 
-  str = udev_device_get_sysattr_value (udev, attr);
+  str = bolt_sysfs_snapshot_get (snap, attr);
   if (str == NULL)
     return -errno;
 
@@ -465,8 +884,8 @@ sysfs_get_sysattr_size (struct udev_device *udev,
 }
 
 void
-bolt_sysfs_read_link_speed (struct udev_device *udev,
-                            BoltLinkSpeed      *speed)
+bolt_sysfs_read_link_speed (BoltSysfsSnapshot *snap,
+                            BoltLinkSpeed     *speed)
 {
   struct
   {
@@ -482,23 +901,22 @@ bolt_sysfs_read_link_speed (struct udev_device *udev,
   for (unsigned i = 0; i < G_N_ELEMENTS (entries); i++)
     {
       const char *name = entries[i].name;
-      int res = sysfs_get_sysattr_value_as_int (udev, name);
+      int res = snapshot_get_sysattr_value_as_int (snap, name);
 
       *entries[i].item = res > 0 ? res : 0;
     }
 }
 
 gboolean
-bolt_sysfs_info_for_device (struct udev_device *udev,
-                            gboolean            full,
-                            BoltDevInfo        *info,
-                            GError            **error)
+bolt_sysfs_info_for_device (BoltSysfsSnapshot *snap,
+                            gboolean           full,
+                            BoltDevInfo       *info,
+                            GError           **error)
 {
-  struct udev_device *parent;
   int auth;
   int gen;
 
-  g_return_val_if_fail (udev != NULL, FALSE);
+  g_return_val_if_fail (snap != NULL, FALSE);
   g_return_val_if_fail (info != NULL, FALSE);
 
   info->keysize = -1;
@@ -508,7 +926,7 @@ bolt_sysfs_info_for_device (struct udev_device *udev,
   info->generation = 0;
   info->syspath = NULL;
 
-  auth = sysfs_get_sysattr_value_as_int (udev, "authorized");
+  auth = snapshot_get_sysattr_value_as_int (snap, "authorized");
   info->authorized = auth;
 
   if (auth < 0)
@@ -520,26 +938,22 @@ bolt_sysfs_info_for_device (struct udev_device *udev,
       return FALSE;
     }
 
-  info->keysize = sysfs_get_sysattr_size (udev, "key");
-  info->boot = sysfs_get_sysattr_value_as_int (udev, "boot");
+  info->keysize = snapshot_get_sysattr_size (snap, "key");
+  info->boot = snapshot_get_sysattr_value_as_int (snap, "boot");
 
   if (full == FALSE)
     return TRUE;
 
   info->full = TRUE;
-  info->ctim = bolt_sysfs_device_get_time (udev, BOLT_ST_CTIME);
-  info->syspath = udev_device_get_syspath (udev);
-
-  parent = udev_device_get_parent (udev);
-
-  if (parent != NULL)
-    info->parent = udev_device_get_sysattr_value (parent, "unique_id");
+  info->ctim = snap->ctim;
+  info->syspath = udev_device_get_syspath (snap->udev);
+  info->parent = bolt_sysfs_snapshot_get (snap, SNAPSHOT_PARENT_UID);
 
-  gen = sysfs_get_sysattr_value_as_int (udev, BOLT_SYSFS_GENERATION);
+  gen = snapshot_get_sysattr_value_as_int (snap, BOLT_SYSFS_GENERATION);
   if (gen > 0)
     info->generation = gen;
 
-  bolt_sysfs_read_link_speed (udev, &info->linkspeed);
+  bolt_sysfs_read_link_speed (snap, &info->linkspeed);
 
   return TRUE;
 }
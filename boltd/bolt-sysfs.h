@@ -31,17 +31,43 @@ struct udev_device;
 
 G_BEGIN_DECLS
 
+/* Attribute snapshot of a single device */
+typedef struct _BoltSysfsSnapshot BoltSysfsSnapshot;
+
+BoltSysfsSnapshot *  bolt_sysfs_snapshot_new (struct udev_device *udev,
+                                              GError            **error);
+
+BoltSysfsSnapshot *  bolt_sysfs_snapshot_ref (BoltSysfsSnapshot *snap);
+
+void                 bolt_sysfs_snapshot_unref (BoltSysfsSnapshot *snap);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (BoltSysfsSnapshot, bolt_sysfs_snapshot_unref);
+
+struct udev_device * bolt_sysfs_snapshot_get_device (BoltSysfsSnapshot *snap);
+
+const char *         bolt_sysfs_snapshot_get (BoltSysfsSnapshot *snap,
+                                              const char        *attr);
+
+const char *         bolt_sysfs_snapshot_get_unique_id (BoltSysfsSnapshot *snap,
+                                                        GError           **error);
+
+/* Per uevent attribute cache */
+void                 bolt_sysfs_cache_begin (unsigned long long seqnum);
+
+void                 bolt_sysfs_cache_end (void);
+
 /* Device identification */
 typedef struct _BoltIdent BoltIdent;
 struct _BoltIdent
 {
   struct udev_device *udev;
+  BoltSysfsSnapshot  *snap;
 
   const char         *name;
   const char         *vendor;
 };
 
-#define BOLT_IDENT_INIT {NULL, NULL, NULL}
+#define BOLT_IDENT_INIT {NULL, NULL, NULL, NULL}
 
 void                 bolt_ident_clear (BoltIdent *id);
 
@@ -68,13 +94,16 @@ struct udev_device * bolt_sysfs_domain_for_device (struct udev_device  *udev,
 BoltSecurity         bolt_sysfs_security_for_device (struct udev_device *udev,
                                                      GError            **error);
 
-gboolean             bolt_sysfs_device_ident (struct udev_device *udev,
-                                              BoltIdent          *id,
-                                              GError            **error);
+gboolean             bolt_sysfs_device_ident (BoltSysfsSnapshot *snap,
+                                              BoltIdent         *id,
+                                              GError           **error);
 
-gboolean             bolt_sysfs_host_ident (struct udev_device *udev,
-                                            BoltIdent          *id,
-                                            GError            **error);
+gboolean             bolt_sysfs_host_ident (BoltSysfsSnapshot *snap,
+                                            BoltIdent         *id,
+                                            GError           **error);
+
+GPtrArray *          bolt_sysfs_enumerate (struct udev *udev,
+                                           GError     **error);
 
 int                  bolt_sysfs_count_hosts (struct udev *udev,
                                              GError     **error);
@@ -103,13 +132,13 @@ typedef struct _BoltDevInfo
 
 } BoltDevInfo;
 
-gboolean             bolt_sysfs_info_for_device (struct udev_device *udev,
-                                                 gboolean            full,
-                                                 BoltDevInfo        *info,
-                                                 GError            **error);
+gboolean             bolt_sysfs_info_for_device (BoltSysfsSnapshot *snap,
+                                                 gboolean           full,
+                                                 BoltDevInfo       *info,
+                                                 GError           **error);
 
-void                 bolt_sysfs_read_link_speed (struct udev_device *udev,
-                                                 BoltLinkSpeed      *speed);
+void                 bolt_sysfs_read_link_speed (BoltSysfsSnapshot *snap,
+                                                 BoltLinkSpeed     *speed);
 
 gboolean             bolt_sysfs_read_boot_acl (struct udev_device *udev,
                                                GStrv              *out,
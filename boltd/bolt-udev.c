@@ -23,10 +23,16 @@
 #include "bolt-udev.h"
 
 #include "bolt-error.h"
+#include "bolt-log.h"
+#include "bolt-names.h"
+#include "bolt-str.h"
 #include "bolt-sysfs.h"
 
 #include <libudev.h>
+#include <poll.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include <errno.h>
 
@@ -41,6 +47,95 @@ static void     udev_initable_iface_init (GInitableIface *iface);
 static gboolean bolt_udev_initialize (GInitable    *initable,
                                       GCancellable *cancellable,
                                       GError      **error);
+
+/* UEventData - what the reader thread hands over for each
+ *   uevent; only plain data, since libudev contexts and the
+ *   objects created from them must not be shared by threads.
+ *   The main context creates the device from its own context */
+typedef struct UEventData
+{
+  char   *action;
+  char   *syspath;
+  guint64 seqnum;
+} UEventData;
+
+static void
+uevent_data_free (UEventData *data)
+{
+  g_free (data->action);
+  g_free (data->syspath);
+  g_slice_free (UEventData, data);
+}
+
+/* UEventRing - lock-free, single producer, single consumer
+ *   queue of received uevents; the producer is the reader
+ *   thread, the consumer the main context */
+#define RING_SIZE 256 /* must be a power of two */
+
+typedef struct UEventRing
+{
+  UEventData *slots[RING_SIZE];
+  gint        head; /* next to write, advanced by the producer */
+  gint        tail; /* next to read, advanced by the consumer */
+} UEventRing;
+
+static gboolean
+ring_push (UEventRing *ring,
+           UEventData *data)
+{
+  guint head = (guint) g_atomic_int_get (&ring->head);
+  guint tail = (guint) g_atomic_int_get (&ring->tail);
+
+  if (head - tail == RING_SIZE)
+    return FALSE;
+
+  ring->slots[head & (RING_SIZE - 1)] = data;
+
+  /* full barrier, publishes the slot */
+  g_atomic_int_set (&ring->head, (gint) (head + 1));
+
+  return TRUE;
+}
+
+static UEventData *
+ring_pop (UEventRing *ring)
+{
+  guint tail = (guint) g_atomic_int_get (&ring->tail);
+  guint head = (guint) g_atomic_int_get (&ring->head);
+  UEventData *data;
+
+  if (head == tail)
+    return NULL;
+
+  data = ring->slots[tail & (RING_SIZE - 1)];
+  ring->slots[tail & (RING_SIZE - 1)] = NULL;
+
+  g_atomic_int_set (&ring->tail, (gint) (tail + 1));
+
+  return data;
+}
+
+static gboolean
+ring_is_empty (UEventRing *ring)
+{
+  return g_atomic_int_get (&ring->head) == g_atomic_int_get (&ring->tail);
+}
+
+static guint
+ring_depth (UEventRing *ring)
+{
+  guint head = (guint) g_atomic_int_get (&ring->head);
+  guint tail = (guint) g_atomic_int_get (&ring->tail);
+
+  return head - tail;
+}
+
+static gboolean
+ring_is_full (UEventRing *ring)
+{
+  return ring_depth (ring) == RING_SIZE;
+}
+
 /*  */
 struct _BoltUdev
 {
@@ -51,15 +146,39 @@ struct _BoltUdev
   struct udev_monitor *monitor;
   GSource             *source;
 
+  /* reader thread, owns the monitor and its udev context */
+  struct udev  *reader_udev;
+  GThread      *reader;
+  int           stopfd;
+  gint          stopping;
+  UEventRing    ring;
+  GMutex        lock; /* protects waiting for room in the ring */
+  GCond         cond;
+  GMainContext *context;
+
+  /* syspath -> udev_device, main context only; needed
+   * for 'remove' uevents, when sysfs is already gone */
+  GHashTable   *devices;
+
+  /* statistics, logged at debug level */
+  struct {
+    guint64 wakeups;   /* dispatches that emitted uevents */
+    guint64 events;    /* uevents emitted in total */
+    guint   max_batch; /* most uevents emitted in one dispatch */
+    guint   max_depth; /* most uevents queued at a dispatch */
+  } stats;
+
   /* properties */
   char *name;
   GStrv filter;
+  guint budget;
 };
 
 enum {
   PROP_0,
   PROP_NAME,
   PROP_FILTER,
+  PROP_BUDGET,
 
   PROP_LAST
 };
@@ -68,6 +187,7 @@ static GParamSpec *props[PROP_LAST] = { NULL, };
 
 enum {
   SIGNAL_UEVENT,
+  SIGNAL_UEVENT_BATCH,
   SIGNAL_LAST,
 };
 
@@ -85,16 +205,54 @@ bolt_udev_finalize (GObject *object)
 {
   BoltUdev *udev = BOLT_UDEV (object);
 
-  if (udev->monitor)
+  UEventData *data;
+
+  bolt_debug (LOG_TOPIC ("udev"),
+              "%" G_GUINT64_FORMAT " uevents in %" G_GUINT64_FORMAT
+              " dispatches [max batch: %u, max queued: %u]",
+              udev->stats.events, udev->stats.wakeups,
+              udev->stats.max_batch, udev->stats.max_depth);
+
+  if (udev->reader)
     {
-      udev_monitor_unref (udev->monitor);
-      udev->monitor = NULL;
+      const guint64 one = 1;
+      ssize_t n;
+
+      g_atomic_int_set (&udev->stopping, TRUE);
+
+      n = write (udev->stopfd, &one, sizeof (one));
+      if (n != sizeof (one))
+        bolt_bug ("could not wake up uevent reader");
+
+      g_mutex_lock (&udev->lock);
+      g_cond_signal (&udev->cond);
+      g_mutex_unlock (&udev->lock);
+
+      g_thread_join (udev->reader);
+      udev->reader = NULL;
+    }
+
+  if (udev->stopfd > -1)
+    close (udev->stopfd);
 
+  if (udev->source)
+    {
       g_source_destroy (udev->source);
       g_source_unref (udev->source);
       udev->source = NULL;
     }
 
+  while ((data = ring_pop (&udev->ring)) != NULL)
+    uevent_data_free (data);
+
+  g_clear_pointer (&udev->devices, g_hash_table_unref);
+  g_mutex_clear (&udev->lock);
+  g_cond_clear (&udev->cond);
+
+  g_clear_pointer (&udev->monitor, udev_monitor_unref);
+  g_clear_pointer (&udev->reader_udev, udev_unref);
+  g_clear_pointer (&udev->context, g_main_context_unref);
+
   g_clear_pointer (&udev->udev, udev_unref);
 
   g_clear_pointer (&udev->name, g_free);
@@ -122,6 +280,10 @@ bolt_udev_get_property (GObject    *object,
       g_value_set_boxed (value, udev->filter);
       break;
 
+    case PROP_BUDGET:
+      g_value_set_uint (value, udev->budget);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -145,6 +307,10 @@ bolt_udev_set_property (GObject      *object,
       udev->filter = g_value_dup_boxed (value);
       break;
 
+    case PROP_BUDGET:
+      udev->budget = g_value_get_uint (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -153,6 +319,14 @@ bolt_udev_set_property (GObject      *object,
 static void
 bolt_udev_init (BoltUdev *udev)
 {
+  udev->stopfd = -1;
+
+  g_mutex_init (&udev->lock);
+  g_cond_init (&udev->cond);
+
+  udev->devices = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free,
+                                         (GDestroyNotify) udev_device_unref);
 }
 
 static void
@@ -180,6 +354,15 @@ bolt_udev_class_init (BoltUdevClass *klass)
                         G_PARAM_CONSTRUCT_ONLY |
                         G_PARAM_STATIC_STRINGS);
 
+  props[PROP_BUDGET] =
+    g_param_spec_uint ("budget",
+                       NULL, NULL,
+                       1, RING_SIZE,
+                       BOLT_UDEV_BUDGET_DEFAULT,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (gobject_class,
                                      PROP_LAST,
                                      props);
@@ -196,6 +379,21 @@ bolt_udev_class_init (BoltUdevClass *klass)
                   2,
                   G_TYPE_STRING,
                   G_TYPE_POINTER);
+
+  /* emitted once per dispatch, after "uevent" was emitted for
+   * each device; the array of BoltUEvent entries is only valid
+   * for the duration of the signal emission */
+  signals[SIGNAL_UEVENT_BATCH] =
+    g_signal_new ("uevent-batch",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL,
+                  NULL,
+                  g_cclosure_marshal_generic,
+                  G_TYPE_NONE,
+                  1,
+                  G_TYPE_POINTER);
 }
 
 static void
@@ -234,22 +432,17 @@ monitor_add_filter (struct udev_monitor *monitor,
 }
 
 static gboolean
-setup_monitor (BoltUdev      *udev,
+setup_monitor (struct udev   *udev,
                const char    *name,
                const GStrv    filter,
-               GSourceFunc    callback,
                udev_monitor **monitor_out,
-               GSource      **watch_out,
                GError       **error)
 {
   g_autoptr(udev_monitor) monitor = NULL;
-  g_autoptr(GIOChannel) channel = NULL;
-  GSource *watch;
   gboolean ok;
-  int fd;
   int res;
 
-  monitor = udev_monitor_new_from_netlink (udev->udev, name);
+  monitor = udev_monitor_new_from_netlink (udev, name);
   if (monitor == NULL)
     {
       g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_UDEV,
@@ -274,53 +467,266 @@ setup_monitor (BoltUdev      *udev,
       return FALSE;
     }
 
-  fd = udev_monitor_get_fd (monitor);
-
-  if (fd < 0)
+  if (udev_monitor_get_fd (monitor) < 0)
     {
       g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_UDEV,
                            "udev: could not obtain fd for monitoring");
       return FALSE;
     }
 
-  channel = g_io_channel_unix_new (fd);
-  watch   = g_io_create_watch (channel, G_IO_IN);
-
-  g_source_set_callback (watch, callback, udev, NULL);
-  g_source_attach (watch, g_main_context_get_thread_default ());
-
   *monitor_out = udev_monitor_ref (monitor);
-  *watch_out   = watch;
 
   return TRUE;
 }
 
+/* reader thread */
+
+/* blocks while the ring is full, i.e. the main context is
+ * behind; the netlink socket buffers for us in the meantime.
+ * Returns FALSE if we were asked to stop while waiting */
 static gboolean
-handle_uevent_udev (GIOChannel  *source,
-                    GIOCondition condition,
-                    gpointer     user_data)
+reader_push (BoltUdev   *udev,
+             UEventData *data)
 {
-  g_autoptr(udev_device) device = NULL;
+  while (!ring_push (&udev->ring, data))
+    {
+      g_main_context_wakeup (udev->context);
+
+      g_mutex_lock (&udev->lock);
+
+      while (ring_is_full (&udev->ring) &&
+             !g_atomic_int_get (&udev->stopping))
+        g_cond_wait (&udev->cond, &udev->lock);
+
+      g_mutex_unlock (&udev->lock);
+
+      if (g_atomic_int_get (&udev->stopping))
+        return FALSE;
+    }
+
+  g_main_context_wakeup (udev->context);
+
+  return TRUE;
+}
+
+static gpointer
+reader_thread (gpointer user_data)
+{
+  BoltUdev *udev = user_data;
+  struct pollfd fds[2];
+
+  fds[0].fd = udev_monitor_get_fd (udev->monitor);
+  fds[0].events = POLLIN;
+  fds[1].fd = udev->stopfd;
+  fds[1].events = POLLIN;
+
+  while (!g_atomic_int_get (&udev->stopping))
+    {
+      struct udev_device *dev;
+      int r;
+
+      r = poll (fds, G_N_ELEMENTS (fds), -1);
+
+      if (r < 0 && errno == EINTR)
+        continue;
+      else if (r < 0)
+        {
+          bolt_warn (LOG_TOPIC ("udev"), "could not poll monitor: %s",
+                     g_strerror (errno));
+          break;
+        }
+
+      if (fds[1].revents != 0)
+        break;
+
+      /* drain everything the kernel has queued up */
+      while ((dev = udev_monitor_receive_device (udev->monitor)) != NULL)
+        {
+          const char *action = udev_device_get_action (dev);
+          const char *syspath = udev_device_get_syspath (dev);
+          UEventData *data = NULL;
+
+          if (action != NULL && syspath != NULL)
+            {
+              data = g_slice_new (UEventData);
+              data->action = g_strdup (action);
+              data->syspath = g_strdup (syspath);
+              data->seqnum = udev_device_get_seqnum (dev);
+            }
+
+          udev_device_unref (dev);
+
+          if (data != NULL && !reader_push (udev, data))
+            {
+              uevent_data_free (data);
+              return NULL;
+            }
+        }
+    }
+
+  return NULL;
+}
+
+/* main context side of the ring */
+typedef struct UEventSource
+{
+  GSource   source;
   BoltUdev *udev;
-  const char *action;
-  const char *syspath;
+} UEventSource;
+
+static gboolean
+uevent_source_prepare (GSource *source,
+                       gint    *timeout)
+{
+  UEventSource *us = (UEventSource *) source;
 
-  udev = BOLT_UDEV (user_data);
-  device = udev_monitor_receive_device (udev->monitor);
+  *timeout = -1;
 
-  if (device == NULL)
+  return !ring_is_empty (&us->udev->ring);
+}
+
+static gboolean
+uevent_source_check (GSource *source)
+{
+  UEventSource *us = (UEventSource *) source;
+
+  return !ring_is_empty (&us->udev->ring);
+}
+
+static gboolean
+uevent_source_dispatch (GSource    *source,
+                        GSourceFunc callback,
+                        gpointer    user_data)
+{
+  if (callback == NULL)
     return G_SOURCE_CONTINUE;
 
-  action = udev_device_get_action (device);
-  if (action == NULL)
+  return callback (user_data);
+}
+
+static GSourceFuncs uevent_source_funcs = {
+  uevent_source_prepare,
+  uevent_source_check,
+  uevent_source_dispatch,
+  NULL,
+};
+
+static void
+bolt_uevent_free (BoltUEvent *ev)
+{
+  g_free (ev->action);
+  udev_device_unref (ev->device);
+  g_slice_free (BoltUEvent, ev);
+}
+
+/* the device for a uevent, created from the context of the
+ * main thread; for 'remove' the sysfs entry is gone already,
+ * so the one that was created for an earlier uevent, or by
+ * the enumeration, is used */
+static struct udev_device *
+uevent_get_device (BoltUdev   *udev,
+                   UEventData *data)
+{
+  struct udev_device *dev = NULL;
+  gboolean remove;
+
+  remove = bolt_streq (data->action, "remove");
+
+  if (!remove)
+    dev = udev_device_new_from_syspath (udev->udev, data->syspath);
+
+  if (dev != NULL)
+    {
+      g_hash_table_insert (udev->devices,
+                           g_strdup (data->syspath),
+                           udev_device_ref (dev));
+      return dev;
+    }
+
+  dev = g_hash_table_lookup (udev->devices, data->syspath);
+
+  if (dev != NULL)
+    udev_device_ref (dev);
+
+  if (remove)
+    g_hash_table_remove (udev->devices, data->syspath);
+
+  return dev;
+}
+
+static gboolean
+handle_uevent_udev (gpointer user_data)
+{
+  g_autoptr(BoltUdev) udev = NULL;
+  g_autoptr(GPtrArray) batch = NULL;
+  UEventData *data;
+  guint depth;
+
+  /* a handler might drop the last reference */
+  udev = g_object_ref (BOLT_UDEV (user_data));
+
+  depth = ring_depth (&udev->ring);
+
+  if (depth == 0)
     return G_SOURCE_CONTINUE;
 
-  syspath = udev_device_get_syspath (device);
-  if (syspath == NULL)
+  udev->stats.max_depth = MAX (udev->stats.max_depth, depth);
+
+  /* drain up to the budget; whatever is left over will
+   * be dispatched in the next main loop iteration, which
+   * gives other sources a chance to run in between */
+  batch = g_ptr_array_new_full (MIN (depth, udev->budget),
+                                (GDestroyNotify) bolt_uevent_free);
+
+  while (batch->len < udev->budget &&
+         (data = ring_pop (&udev->ring)) != NULL)
+    {
+      struct udev_device *dev;
+      BoltUEvent *ev;
+
+      dev = uevent_get_device (udev, data);
+
+      if (dev == NULL)
+        {
+          bolt_debug (LOG_TOPIC ("udev"), "%s: no device for %s",
+                      data->action, data->syspath);
+          uevent_data_free (data);
+          continue;
+        }
+
+      ev = g_slice_new (BoltUEvent);
+      ev->action = g_steal_pointer (&data->action);
+      ev->device = dev;
+      ev->seqnum = data->seqnum;
+
+      uevent_data_free (data);
+      g_ptr_array_add (batch, ev);
+
+      /* attribute reads of the handlers share one cache */
+      bolt_sysfs_cache_begin (ev->seqnum);
+
+      g_signal_emit (udev, signals[SIGNAL_UEVENT], 0,
+                     ev->action, ev->device);
+
+      bolt_sysfs_cache_end ();
+    }
+
+  /* there is room in the ring now, for a waiting reader */
+  g_mutex_lock (&udev->lock);
+  g_cond_signal (&udev->cond);
+  g_mutex_unlock (&udev->lock);
+
+  if (batch->len == 0)
     return G_SOURCE_CONTINUE;
 
-  g_signal_emit (udev, signals[SIGNAL_UEVENT], 0,
-                 action, device);
+  udev->stats.wakeups++;
+  udev->stats.events += batch->len;
+  udev->stats.max_batch = MAX (udev->stats.max_batch, batch->len);
+
+  bolt_debug (LOG_TOPIC ("udev"), "dispatched %u of %u queued uevents",
+              batch->len, depth);
+
+  g_signal_emit (udev, signals[SIGNAL_UEVENT_BATCH], 0, batch);
 
   return G_SOURCE_CONTINUE;
 }
@@ -330,23 +736,59 @@ bolt_udev_initialize (GInitable    *initable,
                       GCancellable *cancellable,
                       GError      **error)
 {
+  g_autoptr(GError) err = NULL;
   BoltUdev *udev = BOLT_UDEV (initable);
+  UEventSource *us;
   gboolean ok;
 
   udev->udev = udev_new ();
-  if (udev->udev == NULL)
+  udev->reader_udev = udev_new ();
+
+  if (udev->udev == NULL || udev->reader_udev == NULL)
     {
       g_set_error_literal (error, BOLT_ERROR, BOLT_ERROR_UDEV,
                            "udev: could not create udev handle");
       return FALSE;
     }
 
-  ok = setup_monitor (udev, udev->name,
+  /* the monitor is only ever used by the reader thread,
+   * and libudev contexts must not be shared by threads */
+  ok = setup_monitor (udev->reader_udev,
+                      udev->name,
                       udev->filter,
-                      (GSourceFunc) handle_uevent_udev,
-                      &udev->monitor, &udev->source,
+                      &udev->monitor,
                       error);
-  return ok;
+  if (!ok)
+    return FALSE;
+
+  udev->stopfd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (udev->stopfd < 0)
+    {
+      g_set_error (error, BOLT_ERROR, BOLT_ERROR_UDEV,
+                   "udev: could not create eventfd: %s",
+                   g_strerror (errno));
+      return FALSE;
+    }
+
+  udev->context = g_main_context_ref_thread_default ();
+
+  udev->source = g_source_new (&uevent_source_funcs, sizeof (UEventSource));
+  us = (UEventSource *) udev->source;
+  us->udev = udev;
+
+  g_source_set_callback (udev->source, handle_uevent_udev, udev, NULL);
+  g_source_attach (udev->source, udev->context);
+
+  udev->reader = g_thread_try_new ("uevent-reader", reader_thread, udev, &err);
+
+  if (udev->reader == NULL)
+    {
+      g_propagate_prefixed_error (error, g_steal_pointer (&err),
+                                  "udev: could not start reader: ");
+      return FALSE;
+    }
+
+  return TRUE;
 }
 
 /* public methods */
@@ -406,6 +848,33 @@ bolt_udev_device_new_from_syspath (BoltUdev   *udev,
 }
 
 /* thunderbolt specific helpers */
+GPtrArray *
+bolt_udev_enumerate_thunderbolt (BoltUdev *udev,
+                                 GError  **error)
+{
+  GPtrArray *devices;
+
+  g_return_val_if_fail (BOLT_IS_UDEV (udev), NULL);
+
+  devices = bolt_sysfs_enumerate (udev->udev, error);
+
+  if (devices == NULL)
+    return NULL;
+
+  /* so that their 'remove' uevents can be delivered */
+  for (guint i = 0; i < devices->len; i++)
+    {
+      struct udev_device *dev = g_ptr_array_index (devices, i);
+      const char *syspath = udev_device_get_syspath (dev);
+
+      g_hash_table_insert (udev->devices,
+                           g_strdup (syspath),
+                           udev_device_ref (dev));
+    }
+
+  return devices;
+}
+
 int
 bolt_udev_count_hosts (BoltUdev *udev,
                        GError  **error)
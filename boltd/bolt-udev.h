@@ -33,6 +33,8 @@ struct udev_enumerate;
 #define BOLT_TYPE_UDEV bolt_udev_get_type ()
 G_DECLARE_FINAL_TYPE (BoltUdev, bolt_udev, BOLT, UDEV, GObject);
 
+#define BOLT_UDEV_BUDGET_DEFAULT 64 /* uevents per dispatch */
+
 BoltUdev  *             bolt_udev_new (const char         *name,
                                        const char * const *filter,
                                        GError            **error);
@@ -44,7 +46,18 @@ struct udev_device * bolt_udev_device_new_from_syspath (BoltUdev   *udev,
                                                         const char *syspath,
                                                         GError    **error);
 
+/* BoltUEvent - a uevent as delivered via "uevent-batch" */
+typedef struct BoltUEvent
+{
+  char               *action;
+  struct udev_device *device; /* created from our own context */
+  guint64             seqnum;
+} BoltUEvent;
+
 /* thunderbolt specific helpers */
+GPtrArray *          bolt_udev_enumerate_thunderbolt (BoltUdev *udev,
+                                                      GError  **error);
+
 int                  bolt_udev_count_hosts (BoltUdev *udev,
                                             GError  **error);
 
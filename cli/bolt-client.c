@@ -26,6 +26,7 @@
 #include "bolt-str.h"
 
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 
 static void         handle_dbus_device_added (GObject    *self,
                                               GDBusProxy *bus_proxy,
@@ -1125,6 +1126,80 @@ bolt_client_forget_device_finish (BoltClient   *client,
   return TRUE;
 }
 
+static gboolean
+client_call_with_fd (BoltClient *client,
+                     const char *method,
+                     GVariant   *params,
+                     int         fd,
+                     guint      *count,
+                     GError    **error)
+{
+  g_autoptr(GUnixFDList) fds = NULL;
+  g_autoptr(GVariant) val = NULL;
+  g_autoptr(GError) err = NULL;
+
+  fds = g_unix_fd_list_new ();
+  if (g_unix_fd_list_append (fds, fd, error) < 0)
+    return FALSE;
+
+  /* large stores take a while, so no timeout */
+  val = g_dbus_proxy_call_with_unix_fd_list_sync (G_DBUS_PROXY (client),
+                                                  method,
+                                                  params,
+                                                  G_DBUS_CALL_FLAGS_NONE,
+                                                  G_MAXINT,
+                                                  fds,
+                                                  NULL,
+                                                  NULL,
+                                                  &err);
+
+  if (val == NULL)
+    {
+      bolt_error_propagate_stripped (error, &err);
+      return FALSE;
+    }
+
+  if (count != NULL)
+    g_variant_get (val, "(u)", count);
+
+  return TRUE;
+}
+
+gboolean
+bolt_client_export_store (BoltClient *client,
+                          int         fd,
+                          const char *flags,
+                          guint      *count,
+                          GError    **error)
+{
+  g_return_val_if_fail (BOLT_IS_CLIENT (client), FALSE);
+  g_return_val_if_fail (fd > -1, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return client_call_with_fd (client,
+                              "ExportStore",
+                              g_variant_new ("(hs)", 0, flags ? : ""),
+                              fd, count,
+                              error);
+}
+
+gboolean
+bolt_client_import_store (BoltClient *client,
+                          int         fd,
+                          guint      *count,
+                          GError    **error)
+{
+  g_return_val_if_fail (BOLT_IS_CLIENT (client), FALSE);
+  g_return_val_if_fail (fd > -1, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return client_call_with_fd (client,
+                              "ImportStore",
+                              g_variant_new ("(h)", 0),
+                              fd, count,
+                              error);
+}
+
 BoltPower *
 bolt_client_new_power_client (BoltClient   *client,
                               GCancellable *cancellable,
@@ -134,6 +134,17 @@ gboolean        bolt_client_forget_device_finish (BoltClient   *client,
                                                   GAsyncResult *res,
                                                   GError      **error);
 
+gboolean        bolt_client_export_store (BoltClient *client,
+                                          int         fd,
+                                          const char *flags,
+                                          guint      *count,
+                                          GError    **error);
+
+gboolean        bolt_client_import_store (BoltClient *client,
+                                          int         fd,
+                                          guint      *count,
+                                          GError    **error);
+
 BoltPower *     bolt_client_new_power_client (BoltClient   *client,
                                               GCancellable *cancellable,
                                               GError      **error);
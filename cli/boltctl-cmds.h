@@ -55,5 +55,8 @@ int monitor (BoltClient *client,
 int power (BoltClient *client,
            int         argc,
            char      **argv);
+int store (BoltClient *client,
+           int         argc,
+           char      **argv);
 
 G_END_DECLS
@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2026 The bolt authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "boltctl.h"
+#include "boltctl-cmds.h"
+
+#include "bolt-io.h"
+#include "bolt-str.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int
+open_archive (const char *path,
+              gboolean    writing,
+              GError    **error)
+{
+  int flags;
+
+  if (path == NULL || bolt_streq (path, "-"))
+    {
+      int fd = dup (writing ? STDOUT_FILENO : STDIN_FILENO);
+
+      if (fd < 0)
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                     "could not duplicate fd: %s", g_strerror (errno));
+
+      return fd;
+    }
+
+  if (writing)
+    flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  else
+    flags = O_RDONLY | O_CLOEXEC;
+
+  /* the archive might contain keys */
+  return bolt_open (path, flags, 0600, error);
+}
+
+static int
+store_export (BoltClient *client, int argc, char **argv)
+{
+  g_autoptr(GOptionContext) optctx = NULL;
+  g_autoptr(GError) error = NULL;
+  bolt_autoclose int fd = -1;
+  gboolean keys = FALSE;
+  const char *path = NULL;
+  gboolean ok;
+  guint count;
+  GOptionEntry options[] = {
+    { "keys", 'k', 0, G_OPTION_ARG_NONE, &keys, "Include the keys", NULL },
+    { NULL }
+  };
+
+  optctx = g_option_context_new ("[FILE] - Export the store");
+  g_option_context_add_main_entries (optctx, options, NULL);
+
+  if (!g_option_context_parse (optctx, &argc, &argv, &error))
+    return usage_error (error);
+
+  if (!check_argc (argc, 0, 1, &error))
+    return usage_error (error);
+
+  if (argc > 1)
+    path = argv[1];
+
+  fd = open_archive (path, TRUE, &error);
+  if (fd < 0)
+    return report_error ("could not open archive", error);
+
+  ok = bolt_client_export_store (client, fd,
+                                 keys ? "keys" : "",
+                                 &count, &error);
+  if (!ok)
+    {
+      g_printerr ("Failed to export store: %s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  g_printerr ("exported %u records\n", count);
+
+  return EXIT_SUCCESS;
+}
+
+static int
+store_import (BoltClient *client, int argc, char **argv)
+{
+  g_autoptr(GOptionContext) optctx = NULL;
+  g_autoptr(GError) error = NULL;
+  bolt_autoclose int fd = -1;
+  const char *path = NULL;
+  gboolean ok;
+  guint count;
+
+  optctx = g_option_context_new ("[FILE] - Import into the store");
+
+  if (!g_option_context_parse (optctx, &argc, &argv, &error))
+    return usage_error (error);
+
+  if (!check_argc (argc, 0, 1, &error))
+    return usage_error (error);
+
+  if (argc > 1)
+    path = argv[1];
+
+  fd = open_archive (path, FALSE, &error);
+  if (fd < 0)
+    return report_error ("could not open archive", error);
+
+  ok = bolt_client_import_store (client, fd, &count, &error);
+  if (!ok)
+    {
+      g_printerr ("Failed to import store: %s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  g_printerr ("imported %u records\n", count);
+
+  return EXIT_SUCCESS;
+}
+
+static SubCommand store_commands[] = {
+  {"export",    store_export,   "Export devices, domains and times"},
+  {"import",    store_import,   "Import a previously exported store"},
+  {NULL,        NULL,           NULL},
+};
+
+int
+store (BoltClient *client, int argc, char **argv)
+{
+  g_autoptr(GOptionContext) optctx = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *summary = NULL;
+  const SubCommand *cmd = NULL;
+
+  optctx = g_option_context_new ("COMMAND - Export or import the store");
+
+  summary = subcommands_make_summary (store_commands);
+  g_option_context_set_summary (optctx, summary);
+  g_option_context_set_strict_posix (optctx, TRUE);
+
+  if (!g_option_context_parse (optctx, &argc, &argv, &error))
+    return usage_error (error);
+
+  if (argc < 2)
+    return usage_error_need_arg ("COMMAND");
+
+  cmd = subcommands_find (store_commands, argv[1], &error);
+  if (cmd == NULL)
+    return usage_error (error);
+
+  return subcommand_run (cmd, client, argc, argv);
+}
@@ -386,6 +386,7 @@ static SubCommand subcommands[] = {
   {"list",         list_devices,  "List connected and stored devices"},
   {"monitor",      monitor,       "Listen and print changes"},
   {"power",        power,         "Force power configuration of the controller"},
+  {"store",        store,         "Export or import the device database"},
   {NULL,           NULL,          NULL},
 };
 
@@ -220,6 +220,101 @@ bolt_write_all (int         fd,
   return ok;
 }
 
+gboolean
+bolt_pread_all (int      fd,
+                void    *buf,
+                gsize    nbytes,
+                off_t    offset,
+                gsize   *nread,
+                GError **error)
+{
+  char *data = buf;
+  gsize count = 0;
+  gboolean ok = TRUE;
+
+  g_return_val_if_fail (buf != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  while (nbytes > 0)
+    {
+      ssize_t n;
+
+      n = pread (fd, data, nbytes, offset);
+
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          g_set_error (error, G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       "read error: %s",
+                       g_strerror (errno));
+          ok = FALSE;
+          break;
+        }
+      else if (n == 0)
+        {
+          break;
+        }
+
+      data += n;
+      count += n;
+      offset += n;
+      nbytes -= n;
+    }
+
+  if (nread)
+    *nread = count;
+
+  return ok;
+}
+
+gboolean
+bolt_pwrite_all (int         fd,
+                 const void *buf,
+                 gsize       nbytes,
+                 off_t       offset,
+                 GError    **error)
+{
+  const char *data = buf;
+
+  g_return_val_if_fail (buf != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  while (nbytes > 0)
+    {
+      ssize_t n;
+
+      n = pwrite (fd, data, nbytes, offset);
+
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          g_set_error (error, G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       "write error: %s",
+                       g_strerror (errno));
+          return FALSE;
+        }
+      else if (n == 0)
+        {
+          g_set_error (error, G_IO_ERROR,
+                       g_io_error_from_errno (EIO),
+                       "write error (zero write)");
+          return FALSE;
+        }
+
+      data += n;
+      offset += n;
+      nbytes -= n;
+    }
+
+  return TRUE;
+}
+
 DIR *
 bolt_opendir (const char *path,
               GError    **error)
@@ -458,6 +553,54 @@ bolt_write_file_at (int         dirfd,
   return ok;
 }
 
+char *
+bolt_read_file_at (int         dirfd,
+                   const char *name,
+                   gsize      *len,
+                   GError    **error)
+{
+  g_autofree char *data = NULL;
+  struct stat st;
+  gsize n = 0;
+  gboolean ok;
+  int fd;
+
+  g_return_val_if_fail (name != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  fd = bolt_openat (dirfd, name, O_CLOEXEC | O_RDONLY, 0, error);
+
+  if (fd < 0)
+    return NULL;
+
+  ok = bolt_fstat (fd, &st, error);
+
+  if (ok && !S_ISREG (st.st_mode))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
+                   "could not read %s: not a regular file", name);
+      ok = FALSE;
+    }
+
+  if (ok)
+    {
+      data = g_malloc (st.st_size + 1);
+      ok = bolt_read_all (fd, data, st.st_size, &n, error);
+    }
+
+  (void) close (fd);
+
+  if (!ok)
+    return NULL;
+
+  data[n] = '\0';
+
+  if (len)
+    *len = n;
+
+  return g_steal_pointer (&data);
+}
+
 char *
 bolt_read_value_at (int         dirfd,
                     const char *name,
@@ -842,6 +985,29 @@ bolt_fdatasync (int      fd,
   return FALSE;
 }
 
+gboolean
+bolt_fsync (int      fd,
+            GError **error)
+{
+  int code;
+  int r;
+
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  r = fsync (fd);
+
+  if (r == 0)
+    return TRUE;
+
+  code = errno;
+  g_set_error (error, G_IO_ERROR,
+               g_io_error_from_errno (code),
+               "could not sync file: %s",
+               g_strerror (code));
+
+  return FALSE;
+}
+
 gboolean
 bolt_lseek (int      fd,
             off_t    offset,
@@ -55,6 +55,19 @@ gboolean   bolt_write_all (int         fd,
                            gssize      nbytes,
                            GError    **error);
 
+gboolean   bolt_pread_all (int      fd,
+                           void    *buf,
+                           gsize    nbytes,
+                           off_t    offset,
+                           gsize   *nread,
+                           GError **error);
+
+gboolean   bolt_pwrite_all (int         fd,
+                            const void *buf,
+                            gsize       nbytes,
+                            off_t       offset,
+                            GError    **error);
+
 gboolean   bolt_ftruncate (int      fd,
                            off_t    size,
                            GError **error);
@@ -98,6 +111,11 @@ gboolean   bolt_write_file_at (int         dirfd,
                                gssize      len,
                                GError    **error);
 
+char *     bolt_read_file_at (int         dirfd,
+                              const char *name,
+                              gsize      *len,
+                              GError    **error);
+
 char *     bolt_read_value_at (int         dirfd,
                                const char *name,
                                GError    **error);
@@ -157,6 +175,9 @@ gboolean   bolt_fstatat (int          dirfd,
 gboolean   bolt_fdatasync (int      fd,
                            GError **error);
 
+gboolean   bolt_fsync (int      fd,
+                       GError **error);
+
 gboolean   bolt_lseek (int      fd,
                        off_t    offset,
                        int      whence,
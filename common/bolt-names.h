@@ -74,6 +74,9 @@ G_BEGIN_DECLS
 #define BOLT_SYSFS_TX_LANES "tx_lanes"
 #define BOLT_SYSFS_TX_SPEED "tx_speed"
 
+#define BOLT_SYSFS_THUNDERBOLT_BUS "/sys/bus/thunderbolt/devices"
+#define BOLT_SYSFS_THUNDERBOLT_CLASS "/sys/class/thunderbolt"
+
 #define BOLT_SYSFS_DMI_ID "/sys/class/dmi/id"
 #define BOLT_SYSFS_DMI_SYS_VENDOR "sys_vendor"
 #define BOLT_SYSFS_DMI_PRODUCT_NAME "product_name"
@@ -0,0 +1,540 @@
+/*
+ * Copyright © 2026 The bolt authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "bolt-bench.h"
+#include "bolt-dbus.h"
+#include "bolt-test.h"
+
+#include "bolt-journal.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Fault injection
+ *
+ * All writes to the journal end up in write(2), and all
+ * syncs in fdatasync(2), which we interpose. Only calls for
+ * the file with the inode given to fault_arm are affected,
+ * everything else is passed on.
+ */
+typedef enum FaultMode {
+  FAULT_NONE = 0,
+  FAULT_SHORT,   /* only write half of the data */
+  FAULT_NOSPACE, /* fail with ENOSPC once the budget is used */
+  FAULT_SYNC,    /* writes succeed, fdatasync fails with EIO */
+} FaultMode;
+
+static struct
+{
+  FaultMode mode;
+  dev_t     dev;
+  ino_t     ino;
+  gsize     budget;
+  guint     hits;
+} fault;
+
+static void
+fault_arm (const char *path, FaultMode mode, gsize budget)
+{
+  struct stat st;
+  int r;
+
+  r = g_stat (path, &st);
+  g_assert_cmpint (r, ==, 0);
+
+  fault.dev = st.st_dev;
+  fault.ino = st.st_ino;
+  fault.budget = budget;
+  fault.hits = 0;
+  fault.mode = mode;
+}
+
+static void
+fault_disarm (void)
+{
+  fault.mode = FAULT_NONE;
+}
+
+static gboolean
+fault_match (int fd)
+{
+  struct stat st;
+  int r;
+
+  r = fstat (fd, &st);
+
+  return r == 0 && st.st_dev == fault.dev && st.st_ino == fault.ino;
+}
+
+ssize_t
+write (int fd, const void *buf, size_t count)
+{
+  if (fault.mode != FAULT_NONE && count > 0 && fault_match (fd))
+    {
+      fault.hits++;
+
+      if (fault.mode == FAULT_SHORT)
+        {
+          count = MAX (count / 2, 1);
+        }
+      else if (fault.mode == FAULT_NOSPACE)
+        {
+          if (fault.budget == 0)
+            {
+              errno = ENOSPC;
+              return -1;
+            }
+
+          count = MIN (count, fault.budget);
+          fault.budget -= count;
+        }
+    }
+
+  return syscall (SYS_write, fd, buf, count);
+}
+
+int
+fdatasync (int fd)
+{
+  if (fault.mode == FAULT_SYNC && fault_match (fd))
+    {
+      fault.hits++;
+      errno = EIO;
+      return -1;
+    }
+
+  return syscall (SYS_fdatasync, fd);
+}
+
+/* helper */
+static char *
+bench_make_uid (guint i)
+{
+  return g_strdup_printf ("%08x-5a4b-4c3d-9e2f-%012x", i, i);
+}
+
+static BoltJournal *
+bench_open (GFile *root, const char *name, guint *n)
+{
+  g_autoptr(BoltJournal) j = NULL;
+  g_autoptr(GError) err = NULL;
+  const BoltJournalItem *item;
+  BoltJournalIter iter;
+  gboolean ok;
+
+  j = bolt_journal_new (root, name, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  /* loading is lazy, force it */
+  ok = bolt_journal_iter_init (&iter, j, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  *n = 0;
+  while (bolt_journal_iter_next (&iter, &item))
+    (*n)++;
+
+  return g_steal_pointer (&j);
+}
+
+static void
+bench_fill (BoltJournal *j, guint n, guint ids)
+{
+  g_autoptr(GHashTable) diff = NULL;
+  g_autoptr(GError) err = NULL;
+  gboolean ok;
+
+  diff = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  /* batches of distinct ids, cycling through 'ids' of them */
+  for (guint i = 0; i < n; i++)
+    {
+      int op = (i / ids) % 2 ? '-' : '+';
+
+      g_hash_table_insert (diff, bench_make_uid (i % ids), GINT_TO_POINTER (op));
+
+      if (g_hash_table_size (diff) < 10000 && i + 1 < n && (i + 1) % ids != 0)
+        continue;
+
+      ok = bolt_journal_put_diff (j, diff, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+
+      g_hash_table_remove_all (diff);
+    }
+}
+
+static void
+bench_put_done (GObject      *source,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+  g_autoptr(GError) err = NULL;
+  guint *outstanding = user_data;
+  gboolean ok;
+
+  ok = bolt_journal_put_finish (BOLT_JOURNAL (source), res, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  (*outstanding)--;
+}
+
+static void
+bench_put_failed (GObject      *source,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  g_autoptr(GError) err = NULL;
+  guint *outstanding = user_data;
+  gboolean ok;
+
+  ok = bolt_journal_put_finish (BOLT_JOURNAL (source), res, &err);
+  g_assert_error (err, G_IO_ERROR, G_IO_ERROR_NO_SPACE);
+  g_assert_false (ok);
+
+  (*outstanding)--;
+}
+
+static void
+bench_journal (gconstpointer user_data)
+{
+  g_autoptr(BoltJournal) j = NULL;
+  g_autoptr(GPtrArray) arr = NULL;
+  g_autoptr(GString) text = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GFile) root = NULL;
+  g_auto(BoltTmpDir) dir = NULL;
+  g_autofree char *path = NULL;
+  guint n = GPOINTER_TO_UINT (user_data);
+  guint ids = MAX (n / 2, 1);
+  guint puts = MIN (n, 1000);
+  guint outstanding = 0;
+  guint count;
+  gboolean ok;
+  BoltBench b;
+
+  if (n > 100000 && !g_test_slow ())
+    {
+      g_test_skip ("large journals need '-m slow'");
+      return;
+    }
+
+  dir = bolt_tmp_dir_make ("bolt.bench.XXXXXX", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (dir);
+
+  root = g_file_new_for_path (dir);
+
+  /* half of the records are superseded, which is below
+   * the threshold for compaction */
+  j = bolt_journal_new (root, "journal", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  bolt_bench_begin (&b, "put_diff");
+  bench_fill (j, n, ids);
+  bolt_bench_end (&b, n);
+
+  g_clear_object (&j);
+
+  bolt_bench_begin (&b, "open");
+  j = bench_open (root, "journal", &count);
+  bolt_bench_end (&b, n);
+
+  g_assert_cmpuint (count, ==, ids);
+
+  bolt_bench_begin (&b, "list");
+  arr = bolt_journal_list (j, &err);
+  bolt_bench_end (&b, arr->len);
+
+  g_assert_no_error (err);
+  g_assert_cmpuint (arr->len, ==, ids);
+
+  bolt_bench_begin (&b, "put");
+  for (guint i = 0; i < puts; i++)
+    {
+      g_autofree char *uid = bench_make_uid (i);
+
+      ok = bolt_journal_put (j, uid, BOLT_JOURNAL_ADDED, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+  bolt_bench_end (&b, puts);
+
+  bolt_bench_begin (&b, "put_async");
+  for (guint i = 0; i < puts; i++)
+    {
+      g_autofree char *uid = bench_make_uid (i);
+
+      bolt_journal_put_async (j, uid, BOLT_JOURNAL_REMOVED, NULL,
+                              bench_put_done, &outstanding);
+      outstanding++;
+    }
+
+  while (outstanding > 0)
+    g_main_context_iteration (NULL, TRUE);
+  bolt_bench_end (&b, puts);
+
+  bolt_bench_begin (&b, "reset");
+  ok = bolt_journal_reset (j, &err);
+  bolt_bench_end (&b, 1);
+
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  g_clear_object (&j);
+
+  /* the old text format */
+  text = g_string_sized_new (n * 64);
+  for (guint i = 0; i < n; i++)
+    {
+      g_autofree char *uid = bench_make_uid (i % ids);
+      const char *op = (i / ids) % 2 ? "-" : "+";
+
+      g_string_append_printf (text, "%s %s %016X\n", uid, op, i);
+    }
+
+  path = g_build_filename (dir, "text", NULL);
+  ok = g_file_set_contents (path, text->str, text->len, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  bolt_bench_begin (&b, "upgrade");
+  j = bench_open (root, "text", &count);
+  bolt_bench_end (&b, n);
+
+  g_assert_cmpuint (count, ==, ids);
+}
+
+static void
+bench_faults (void)
+{
+  g_autoptr(BoltJournal) j = NULL;
+  g_autoptr(GHashTable) diff = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GFile) root = NULL;
+  g_auto(BoltTmpDir) dir = NULL;
+  g_autofree char *path = NULL;
+  const guint n = 1000;
+  guint outstanding = 0;
+  struct stat st;
+  goffset size;
+  guint warnings;
+  guint count;
+  gboolean ok;
+  BoltBench b;
+  int r;
+
+  dir = bolt_tmp_dir_make ("bolt.bench.XXXXXX", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (dir);
+
+  root = g_file_new_for_path (dir);
+  path = g_build_filename (dir, "journal", NULL);
+
+  j = bolt_journal_new (root, "journal", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  bench_fill (j, n, n);
+
+  /* short writes are retried transparently */
+  fault_arm (path, FAULT_SHORT, 0);
+
+  bolt_bench_begin (&b, "put (short)");
+  for (guint i = 0; i < n; i++)
+    {
+      g_autofree char *uid = bench_make_uid (i);
+
+      ok = bolt_journal_put (j, uid, BOLT_JOURNAL_REMOVED, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+  bolt_bench_end (&b, n);
+
+  g_assert_cmpuint (fault.hits, >, n);
+  fault_disarm ();
+
+  g_clear_object (&j);
+  j = bench_open (root, "journal", &count);
+  g_assert_cmpuint (count, ==, n);
+
+  /* running out of space in the middle of a record */
+  bolt_bench_set_quiet (TRUE);
+
+  fault_arm (path, FAULT_NOSPACE, BOLT_JOURNAL_RECORD_SIZE * 10 +
+             BOLT_JOURNAL_RECORD_SIZE / 2);
+
+  for (guint i = 0; i < 10; i++)
+    {
+      g_autofree char *uid = bench_make_uid (n + i);
+
+      ok = bolt_journal_put (j, uid, BOLT_JOURNAL_ADDED, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+
+  ok = bolt_journal_put (j, "torn", BOLT_JOURNAL_ADDED, &err);
+  g_assert_error (err, G_IO_ERROR, G_IO_ERROR_NO_SPACE);
+  g_assert_false (ok);
+  g_clear_error (&err);
+
+  /* the partial record was cut off right away */
+  r = g_stat (path, &st);
+  g_assert_cmpint (r, ==, 0);
+  g_assert_cmpint ((st.st_size - BOLT_JOURNAL_HEADER_SIZE) % BOLT_JOURNAL_RECORD_SIZE, ==, 0);
+
+  /* same for a diff */
+  diff = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (guint i = 0; i < 10; i++)
+    g_hash_table_insert (diff, bench_make_uid (n + 100 + i), GINT_TO_POINTER ('+'));
+
+  fault_arm (path, FAULT_NOSPACE, BOLT_JOURNAL_RECORD_SIZE * 5 +
+             BOLT_JOURNAL_RECORD_SIZE / 2);
+
+  ok = bolt_journal_put_diff (j, diff, &err);
+  g_assert_error (err, G_IO_ERROR, G_IO_ERROR_NO_SPACE);
+  g_assert_false (ok);
+  g_clear_error (&err);
+
+  r = g_stat (path, &st);
+  g_assert_cmpint (r, ==, 0);
+  g_assert_cmpint ((st.st_size - BOLT_JOURNAL_HEADER_SIZE) % BOLT_JOURNAL_RECORD_SIZE, ==, 0);
+
+  /* and for a group commit, where none of the failed
+   * but complete records must stay in the file */
+  size = st.st_size;
+
+  fault_arm (path, FAULT_NOSPACE, BOLT_JOURNAL_RECORD_SIZE * 5 +
+             BOLT_JOURNAL_RECORD_SIZE / 2);
+
+  for (guint i = 0; i < 10; i++)
+    {
+      g_autofree char *uid = bench_make_uid (n + 200 + i);
+
+      bolt_journal_put_async (j, uid, BOLT_JOURNAL_ADDED, NULL,
+                              bench_put_failed, &outstanding);
+      outstanding++;
+    }
+
+  while (outstanding > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  r = g_stat (path, &st);
+  g_assert_cmpint (r, ==, 0);
+  g_assert_cmpint (st.st_size, ==, size);
+
+  /* a diff that could not be synced is an error, and
+   * its records are not left in the file either */
+  fault_arm (path, FAULT_SYNC, 0);
+
+  ok = bolt_journal_put_diff (j, diff, &err);
+  g_assert_error (err, G_IO_ERROR, G_IO_ERROR_FAILED);
+  g_assert_false (ok);
+  g_clear_error (&err);
+
+  g_assert_cmpuint (fault.hits, ==, 1);
+
+  r = g_stat (path, &st);
+  g_assert_cmpint (r, ==, 0);
+  g_assert_cmpint (st.st_size, ==, size);
+
+  fault_disarm ();
+
+  /* the journal recovers on its own, by re-loading */
+  bolt_bench_begin (&b, "recover (enospc)");
+  ok = bolt_journal_put (j, "after", BOLT_JOURNAL_ADDED, &err);
+  bolt_bench_end (&b, 1);
+
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  g_clear_object (&j);
+  j = bench_open (root, "journal", &count);
+  g_assert_cmpuint (count, ==, n + 11);
+
+  /* a torn tail, i.e. a crash in the middle of a write */
+  g_clear_object (&j);
+
+  r = g_stat (path, &st);
+  g_assert_cmpint (r, ==, 0);
+
+  r = truncate (path, st.st_size - BOLT_JOURNAL_RECORD_SIZE / 3);
+  g_assert_cmpint (r, ==, 0);
+
+  warnings = bolt_bench_warnings ();
+
+  bolt_bench_begin (&b, "recover (torn)");
+  j = bench_open (root, "journal", &count);
+  bolt_bench_end (&b, 1);
+
+  g_assert_cmpuint (count, ==, n + 10);
+  g_assert_cmpuint (bolt_bench_warnings (), >, warnings);
+
+  r = g_stat (path, &st);
+  g_assert_cmpint (r, ==, 0);
+  g_assert_cmpint ((st.st_size - BOLT_JOURNAL_HEADER_SIZE) % BOLT_JOURNAL_RECORD_SIZE, ==, 0);
+
+  bolt_bench_set_quiet (FALSE);
+}
+
+int
+main (int argc, char **argv)
+{
+  static const guint sizes[] = {1000, 100000, 1000000};
+
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_log_set_writer_func (bolt_bench_logger, NULL, NULL);
+
+  bolt_dbus_ensure_resources ();
+
+  if (!g_test_perf ())
+    {
+      g_printerr ("benchmarks need to be run with '-m perf'\n");
+      return 0;
+    }
+
+  for (guint i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      g_autofree char *name = NULL;
+
+      name = g_strdup_printf ("/bench/journal/%u", sizes[i]);
+      g_test_add_data_func (name,
+                            GUINT_TO_POINTER (sizes[i]),
+                            bench_journal);
+    }
+
+  g_test_add_func ("/bench/journal/faults", bench_faults);
+
+  return g_test_run ();
+}
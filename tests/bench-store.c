@@ -0,0 +1,275 @@
+/*
+ * Copyright © 2026 The bolt authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "bolt-bench.h"
+#include "bolt-dbus.h"
+#include "bolt-error.h"
+#include "bolt-io.h"
+#include "bolt-test.h"
+
+#include "bolt-domain.h"
+#include "bolt-store.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <fcntl.h>
+#include <locale.h>
+#include <stdlib.h>
+
+static char *
+bench_make_uid (char kind, guint i)
+{
+  return g_strdup_printf ("%c%07x-5a4b-4c3d-9e2f-%012x", kind, i, i);
+}
+
+static void
+bench_reopen (BoltStore **store, const char *path, gboolean snapshot)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree char *fn = NULL;
+
+  /* closing the store writes the snapshot */
+  g_clear_object (store);
+
+  if (!snapshot)
+    {
+      fn = g_build_filename (path, "snapshot", NULL);
+      (void) g_unlink (fn);
+    }
+
+  *store = bolt_store_new (path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (*store);
+}
+
+static void
+bench_store (gconstpointer user_data)
+{
+  g_autoptr(GPtrArray) devices = NULL;
+  g_autoptr(BoltStore) store = NULL;
+  g_autoptr(BoltKey) key = NULL;
+  g_autoptr(GError) err = NULL;
+  g_auto(BoltTmpDir) dir = NULL;
+  g_auto(GStrv) uids = NULL;
+  g_autoptr(DIR) root = NULL;
+  g_autoptr(DIR) times = NULL;
+  guint n = GPOINTER_TO_UINT (user_data);
+  gboolean ok;
+  gboolean up;
+  BoltBench b;
+
+  if (n > 10000 && !g_test_slow ())
+    {
+      g_test_skip ("large stores need '-m slow'");
+      return;
+    }
+
+  dir = bolt_tmp_dir_make ("bolt.bench.XXXXXX", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (dir);
+
+  store = bolt_store_new (dir, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (store);
+
+  key = bolt_key_new (NULL);
+  g_assert_nonnull (key);
+
+  devices = g_ptr_array_new_full (n, g_object_unref);
+
+  for (guint i = 0; i < n; i++)
+    {
+      g_autofree char *uid = bench_make_uid ('a', i);
+      BoltDevice *dev;
+
+      dev = g_object_new (BOLT_TYPE_DEVICE,
+                          "uid", uid,
+                          "name", "Thunderbolt Dock",
+                          "vendor", "GNOME.org",
+                          "status", BOLT_STATUS_DISCONNECTED,
+                          NULL);
+
+      g_ptr_array_add (devices, dev);
+    }
+
+  /* populate */
+  bolt_bench_begin (&b, "put_device");
+  for (guint i = 0; i < n; i++)
+    {
+      BoltDevice *dev = g_ptr_array_index (devices, i);
+
+      ok = bolt_store_put_device (store, dev, BOLT_POLICY_AUTO,
+                                  i % 2 ? key : NULL,
+                                  &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+  bolt_bench_end (&b, n);
+
+  for (guint i = 0; i < n; i++)
+    {
+      g_autoptr(BoltDomain) dom = NULL;
+      g_autofree char *uid = bench_make_uid ('d', i);
+
+      dom = g_object_new (BOLT_TYPE_DOMAIN,
+                          "uid", uid,
+                          "bootacl", NULL,
+                          NULL);
+
+      ok = bolt_store_put_domain (store, dom, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+
+  bolt_bench_begin (&b, "put_times");
+  for (guint i = 0; i < n; i++)
+    {
+      BoltDevice *dev = g_ptr_array_index (devices, i);
+      const char *uid = bolt_device_get_uid (dev);
+
+      ok = bolt_store_put_times (store, uid, &err,
+                                 "conntime", (guint64) 574416000 + i,
+                                 "authtime", (guint64) 574416000 + i,
+                                 NULL);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+
+  /* timestamps are written behind, include that */
+  ok = bolt_store_flush (store, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  bolt_bench_end (&b, n);
+
+  /* loading */
+  g_clear_object (&store);
+
+  bolt_bench_begin (&b, "new (snapshot)");
+  bench_reopen (&store, dir, TRUE);
+  bolt_bench_end (&b, 1);
+
+  g_clear_object (&store);
+
+  bolt_bench_begin (&b, "new (rebuild)");
+  bench_reopen (&store, dir, FALSE);
+  bolt_bench_end (&b, 1);
+
+  bolt_bench_begin (&b, "list_uids");
+  for (guint i = 0; i < 10; i++)
+    {
+      g_clear_pointer (&uids, g_strfreev);
+      uids = bolt_store_list_uids (store, "devices", &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (uids);
+    }
+  bolt_bench_end (&b, 10);
+
+  g_assert_cmpuint (g_strv_length (uids), ==, n);
+
+  bolt_bench_begin (&b, "get_device");
+  for (guint i = 0; i < n; i++)
+    {
+      g_autoptr(BoltDevice) dev = NULL;
+
+      dev = bolt_store_get_device (store, uids[i], &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (dev);
+    }
+  bolt_bench_end (&b, n);
+
+  /* upgrade: convert the store back to the layout
+   * with one file per timestamp */
+  g_clear_object (&store);
+
+  root = bolt_opendir (dir, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (root);
+
+  ok = bolt_unlink_at (dirfd (root), "version", 0, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_unlink_at (dirfd (root), "times.db", 0, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_mkdirat (dirfd (root), "times", 0755, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  times = bolt_opendir_at (dirfd (root), "times", O_RDONLY, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (times);
+
+  for (guint i = 0; i < n; i++)
+    {
+      g_autofree char *fn = NULL;
+
+      fn = g_strdup_printf ("%s.conntime", uids[i]);
+      ok = bolt_write_file_at (dirfd (times), fn, "", 0, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+
+  bench_reopen (&store, dir, FALSE);
+  g_assert_cmpuint (bolt_store_get_version (store), ==, 0);
+
+  bolt_bench_begin (&b, "upgrade");
+  ok = bolt_store_upgrade (store, &up, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_true (up);
+  bolt_bench_end (&b, n);
+
+  g_clear_object (&store);
+}
+
+int
+main (int argc, char **argv)
+{
+  static const guint sizes[] = {100, 10000, 100000};
+
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_log_set_writer_func (bolt_bench_logger, NULL, NULL);
+
+  bolt_dbus_ensure_resources ();
+
+  if (!g_test_perf ())
+    {
+      g_printerr ("benchmarks need to be run with '-m perf'\n");
+      return 0;
+    }
+
+  for (guint i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      g_autofree char *name = NULL;
+
+      name = g_strdup_printf ("/bench/store/%u", sizes[i]);
+      g_test_add_data_func (name,
+                            GUINT_TO_POINTER (sizes[i]),
+                            bench_store);
+    }
+
+  return g_test_run ();
+}
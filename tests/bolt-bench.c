@@ -0,0 +1,140 @@
+/*
+ * Copyright © 2026 The bolt authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "bolt-bench.h"
+
+#include <stdlib.h>
+
+/* Allocation counting
+ *
+ * On glibc the allocator can be interposed by the executable,
+ * which lets us count every allocation, including the ones of
+ * GLib, without any external tooling. Sanitizers interpose the
+ * allocator themselves, so the counting is disabled for them.
+ */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define HAVE_ALLOC_COUNTER 1
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb,
+                            size_t size);
+extern void *__libc_realloc (void  *ptr,
+                             size_t size);
+
+static gint alloc_count = 0;
+
+void *
+malloc (size_t size)
+{
+  g_atomic_int_inc (&alloc_count);
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+  g_atomic_int_inc (&alloc_count);
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  g_atomic_int_inc (&alloc_count);
+  return __libc_realloc (ptr, size);
+}
+
+guint
+bolt_bench_allocs (void)
+{
+  return (guint) g_atomic_int_get (&alloc_count);
+}
+#else
+#define HAVE_ALLOC_COUNTER 0
+
+guint
+bolt_bench_allocs (void)
+{
+  return 0;
+}
+#endif
+
+void
+bolt_bench_begin (BoltBench *b, const char *name)
+{
+  b->name = name;
+  b->allocs = bolt_bench_allocs ();
+  g_test_timer_start ();
+}
+
+void
+bolt_bench_end (BoltBench *b, guint ops)
+{
+  gdouble secs = g_test_timer_elapsed ();
+  guint allocs = bolt_bench_allocs () - b->allocs;
+  gdouble rate = secs > 0 ? ops / secs : 0;
+
+  if (HAVE_ALLOC_COUNTER)
+    g_test_maximized_result (rate,
+                             "%-16s %7u ops %8.3f s %12.0f ops/s %9.1f allocs/op",
+                             b->name, ops, secs, rate,
+                             ops > 0 ? (gdouble) allocs / ops : 0);
+  else
+    g_test_maximized_result (rate,
+                             "%-16s %7u ops %8.3f s %12.0f ops/s",
+                             b->name, ops, secs, rate);
+}
+
+/* logging */
+static gint bench_warnings = 0;
+static gint bench_quiet = FALSE;
+
+GLogWriterOutput
+bolt_bench_logger (GLogLevelFlags   log_level,
+                   const GLogField *fields,
+                   gsize            n_fields,
+                   gpointer         user_data)
+{
+  /* the daemon code is chatty at info level, and the output
+   * would then mostly measure the terminal */
+  if (log_level & (G_LOG_LEVEL_INFO | G_LOG_LEVEL_DEBUG | G_LOG_LEVEL_MESSAGE))
+    return G_LOG_WRITER_HANDLED;
+
+  if (log_level & G_LOG_LEVEL_WARNING)
+    {
+      g_atomic_int_inc (&bench_warnings);
+
+      if (g_atomic_int_get (&bench_quiet))
+        return G_LOG_WRITER_HANDLED;
+    }
+
+  return g_log_writer_standard_streams (log_level, fields, n_fields, user_data);
+}
+
+void
+bolt_bench_set_quiet (gboolean quiet)
+{
+  g_atomic_int_set (&bench_quiet, quiet);
+}
+
+guint
+bolt_bench_warnings (void)
+{
+  return (guint) g_atomic_int_get (&bench_warnings);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2026 The bolt authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* BoltBench - time (and count allocations of) a section */
+typedef struct BoltBench
+{
+  const char *name;
+  guint       allocs;
+} BoltBench;
+
+void               bolt_bench_begin (BoltBench  *b,
+                                     const char *name);
+
+void               bolt_bench_end (BoltBench *b,
+                                   guint      ops);
+
+guint              bolt_bench_allocs (void);
+
+/* logging: drops everything below warnings, counts
+ * the latter and only prints them if not quiet */
+GLogWriterOutput   bolt_bench_logger (GLogLevelFlags   log_level,
+                                      const GLogField *fields,
+                                      gsize            n_fields,
+                                      gpointer         user_data);
+
+void               bolt_bench_set_quiet (gboolean quiet);
+
+guint              bolt_bench_warnings (void);
+
+G_END_DECLS
@@ -1065,6 +1065,57 @@ test_io_write_file_at (TestIO *tt, gconstpointer user_data)
   g_assert_true (strncmp (data, ref, 5) == 0);
 }
 
+static void
+test_io_read_file_at (TestIO *tt, gconstpointer user_data)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(DIR) dir = NULL;
+  g_autofree char *data = NULL;
+  static const char *ref = "The world is everything that is the case.";
+  gboolean ok;
+  gsize len;
+
+  dir = bolt_opendir (tt->path, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (dir);
+
+  data = bolt_read_file_at (dirfd (dir), "test.txt", &len, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_null (data);
+  g_clear_error (&error);
+
+  ok = bolt_write_file_at (dirfd (dir), "test.txt", ref, -1, &error);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+
+  data = bolt_read_file_at (dirfd (dir), "test.txt", &len, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (data);
+  g_assert_cmpuint (len, ==, strlen (ref));
+  g_assert_cmpstr (data, ==, ref);
+  g_clear_pointer (&data, g_free);
+
+  /* empty files are fine */
+  ok = bolt_write_file_at (dirfd (dir), "empty.txt", "", 0, &error);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+
+  data = bolt_read_file_at (dirfd (dir), "empty.txt", NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (data);
+  g_assert_cmpstr (data, ==, "");
+  g_clear_pointer (&data, g_free);
+
+  /* directories are not */
+  ok = bolt_mkdirat (dirfd (dir), "subdir", 0755, &error);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+
+  data = bolt_read_file_at (dirfd (dir), "subdir", NULL, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE);
+  g_assert_null (data);
+}
+
 static void
 test_io_write_int_at (TestIO *tt, gconstpointer user_data)
 {
@@ -2536,6 +2587,13 @@ main (int argc, char **argv)
               test_io_write_file_at,
               test_io_tear_down);
 
+  g_test_add ("/common/io/read_file_at",
+              TestIO,
+              NULL,
+              test_io_setup,
+              test_io_read_file_at,
+              test_io_tear_down);
+
   g_test_add ("/common/io/write_int_at",
               TestIO,
               NULL,
@@ -24,6 +24,7 @@
 
 #include "bolt-dbus.h"
 #include "bolt-fs.h"
+#include "bolt-io.h"
 #include "bolt-test.h"
 
 #include <glib.h>
@@ -34,6 +35,7 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 
 typedef struct
@@ -302,11 +304,6 @@ test_journal_diff (TestJournal *tt, gconstpointer user_data)
   };
   guint k;
 
-  /* bolt_journal_put_diff uses bolt_copy_bytes, which in turn uses
-  * copy_file_range(2) internally, which was added in linux 4.5. */
-  skip_test_unless (bolt_check_kernel_version (4, 5) || g_test_thorough (),
-                    "linux kernel < 4.5, copy_file_range syscall missing");
-
   j = bolt_journal_new (tt->root, "diff", &err);
 
   /* the first and the last elements are  added "manually"
@@ -372,11 +369,6 @@ test_journal_diff_fresh (TestJournal *tt, gconstpointer user_data)
   };
   guint k;
 
-  /* bolt_journal_put_diff uses bolt_copy_bytes, which in turn uses
-  * copy_file_range(2) internally, which was added in linux 4.5. */
-  skip_test_unless (bolt_check_kernel_version (4, 5) || g_test_thorough (),
-                    "linux kernel < 4.5, copy_file_range syscall missing");
-
   j = bolt_journal_new (tt->root, "diff_fresh", &err);
 
   g_assert_true (bolt_journal_is_fresh (j));
@@ -444,6 +436,471 @@ test_journal_invalid_file (TestJournal *tt, gconstpointer user_data)
   g_test_trap_assert_passed ();
   g_test_trap_assert_stderr ("*invalid entry*");
 }
+static guint
+count_records (const char *path)
+{
+  struct stat st;
+  int r;
+
+  r = g_stat (path, &st);
+  g_assert_cmpint (r, ==, 0);
+
+  if (st.st_size == 0)
+    return 0;
+
+  g_assert_cmpint (st.st_size, >=, BOLT_JOURNAL_HEADER_SIZE);
+  g_assert_cmpint ((st.st_size - BOLT_JOURNAL_HEADER_SIZE) % BOLT_JOURNAL_RECORD_SIZE, ==, 0);
+
+  return (st.st_size - BOLT_JOURNAL_HEADER_SIZE) / BOLT_JOURNAL_RECORD_SIZE;
+}
+
+static void
+test_journal_compact (TestJournal *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltJournal) j = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GPtrArray) arr = NULL;
+  g_autofree char *path = NULL;
+  BoltJournalItem *item;
+  gboolean ok;
+  guint records;
+
+  j = bolt_journal_new (tt->root, "compact", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  path = g_build_filename (tt->path, "compact", NULL);
+
+  ok = bolt_journal_put (j, "aaaa", BOLT_JOURNAL_ADDED, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  /* flip the same entry over and over */
+  for (guint i = 0; i < 1000; i++)
+    {
+      BoltJournalOp op = i % 2 ? BOLT_JOURNAL_ADDED : BOLT_JOURNAL_REMOVED;
+
+      ok = bolt_journal_put (j, "bbbb", op, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+
+  /* the file never grows much beyond the threshold */
+  records = count_records (path);
+  g_assert_cmpuint (records, >, 0);
+  g_assert_cmpuint (records, <, 100);
+
+  arr = bolt_journal_list (j, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (arr);
+  g_assert_cmpuint (arr->len, ==, 2);
+
+  item = g_ptr_array_index (arr, 0);
+  g_assert_cmpstr (item->id, ==, "aaaa");
+  g_assert_cmpint (item->op, ==, BOLT_JOURNAL_ADDED);
+
+  item = g_ptr_array_index (arr, 1);
+  g_assert_cmpstr (item->id, ==, "bbbb");
+  g_assert_cmpint (item->op, ==, BOLT_JOURNAL_ADDED);
+
+  /* the folded state survives re-opening */
+  g_clear_pointer (&arr, g_ptr_array_unref);
+  g_clear_object (&j);
+
+  j = bolt_journal_new (tt->root, "compact", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  arr = bolt_journal_list (j, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (arr);
+  g_assert_cmpuint (arr->len, ==, 2);
+
+  item = g_ptr_array_index (arr, 1);
+  g_assert_cmpstr (item->id, ==, "bbbb");
+  g_assert_cmpint (item->op, ==, BOLT_JOURNAL_ADDED);
+}
+
+static void
+test_journal_iter (TestJournal *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltJournal) j = NULL;
+  g_autoptr(GPtrArray) arr = NULL;
+  g_autoptr(GError) err = NULL;
+  const BoltJournalItem *item;
+  BoltJournalIter iter;
+  gboolean ok;
+  guint n = 0;
+
+  j = bolt_journal_new (tt->root, "iter", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  /* empty */
+  ok = bolt_journal_iter_init (&iter, j, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_false (bolt_journal_iter_next (&iter, &item));
+
+  for (guint i = 0; i < 20; i++)
+    {
+      g_autofree char *id = g_strdup_printf ("id-%02u", i % 5);
+      BoltJournalOp op = i % 3 ? BOLT_JOURNAL_ADDED : BOLT_JOURNAL_REMOVED;
+
+      ok = bolt_journal_put (j, id, op, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+
+  arr = bolt_journal_list (j, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (arr);
+  g_assert_cmpuint (arr->len, ==, 5);
+
+  /* same entries, same order, but borrowed */
+  ok = bolt_journal_iter_init (&iter, j, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  while (bolt_journal_iter_next (&iter, &item))
+    {
+      BoltJournalItem *have = g_ptr_array_index (arr, n++);
+
+      g_assert_cmpstr (item->id, ==, have->id);
+      g_assert_cmpint (item->op, ==, have->op);
+      g_assert_cmpuint (item->ts, ==, have->ts);
+    }
+
+  g_assert_cmpuint (n, ==, arr->len);
+}
+
+typedef struct PutData
+{
+  GMainLoop *loop;
+  guint      outstanding;
+  guint      failed;
+} PutData;
+
+static void
+put_done (GObject      *source,
+          GAsyncResult *res,
+          gpointer      user_data)
+{
+  g_autoptr(GError) err = NULL;
+  PutData *data = user_data;
+  gboolean ok;
+
+  ok = bolt_journal_put_finish (BOLT_JOURNAL (source), res, &err);
+
+  if (!ok)
+    data->failed++;
+
+  if (--data->outstanding == 0)
+    g_main_loop_quit (data->loop);
+}
+
+static void
+test_journal_group_commit (TestJournal *tt, gconstpointer user_data)
+{
+  g_autoptr(GMainLoop) loop = NULL;
+  g_autoptr(BoltJournal) j = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GPtrArray) arr = NULL;
+  g_autofree char *path = NULL;
+  BoltJournalItem *item;
+  PutData data = {NULL, };
+  gboolean ok;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  data.loop = loop;
+
+  j = bolt_journal_new (tt->root, "group", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  path = g_build_filename (tt->path, "group", NULL);
+
+  for (guint i = 0; i < 10; i++)
+    {
+      g_autofree char *id = g_strdup_printf ("id-%02u", i);
+
+      bolt_journal_put_async (j, id, BOLT_JOURNAL_ADDED, NULL,
+                              put_done, &data);
+      data.outstanding++;
+    }
+
+  /* visible right away, but not yet written */
+  g_assert_false (bolt_journal_is_fresh (j));
+  g_assert_cmpuint (count_records (path), ==, 0);
+
+  arr = bolt_journal_list (j, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (arr);
+  g_assert_cmpuint (arr->len, ==, 10);
+  g_clear_pointer (&arr, g_ptr_array_unref);
+
+  g_main_loop_run (loop);
+
+  g_assert_cmpuint (data.outstanding, ==, 0);
+  g_assert_cmpuint (data.failed, ==, 0);
+  g_assert_cmpuint (count_records (path), ==, 10);
+
+  /* a synchronous put writes out the pending entries
+   * first, so the later change wins */
+  bolt_journal_put_async (j, "id-00", BOLT_JOURNAL_ADDED, NULL,
+                          put_done, &data);
+  data.outstanding++;
+
+  ok = bolt_journal_put (j, "id-00", BOLT_JOURNAL_REMOVED, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  g_assert_cmpuint (count_records (path), ==, 12);
+
+  g_main_loop_run (loop);
+
+  g_assert_cmpuint (data.outstanding, ==, 0);
+  g_assert_cmpuint (data.failed, ==, 0);
+  g_assert_cmpuint (count_records (path), ==, 12);
+
+  g_clear_object (&j);
+
+  j = bolt_journal_new (tt->root, "group", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  arr = bolt_journal_list (j, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (arr);
+  g_assert_cmpuint (arr->len, ==, 10);
+
+  item = g_ptr_array_index (arr, 9);
+  g_assert_cmpstr (item->id, ==, "id-00");
+  g_assert_cmpint (item->op, ==, BOLT_JOURNAL_REMOVED);
+
+  /* pending puts fail when the journal is reset */
+  bolt_journal_put_async (j, "id-01", BOLT_JOURNAL_REMOVED, NULL,
+                          put_done, &data);
+  data.outstanding++;
+
+  ok = bolt_journal_reset (j, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  g_main_loop_run (loop);
+
+  g_assert_cmpuint (data.outstanding, ==, 0);
+  g_assert_cmpuint (data.failed, ==, 1);
+  g_assert_cmpuint (count_records (path), ==, 0);
+  g_assert_true (bolt_journal_is_fresh (j));
+}
+
+static void
+test_journal_torn (TestJournal *tt, gconstpointer user_data)
+{
+  if (g_test_subprocess ())
+    {
+      g_autoptr(BoltJournal) j = NULL;
+      g_autoptr(GPtrArray) arr = NULL;
+      g_autoptr(GError) err = NULL;
+      g_autofree char *path = NULL;
+      BoltJournalItem *item;
+      gboolean ok;
+      int r;
+
+      g_log_set_writer_func (nonfatal_logger, NULL, NULL);
+
+      path = g_build_filename (tt->path, "torn", NULL);
+
+      j = bolt_journal_new (tt->root, "torn", &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (j);
+
+      ok = bolt_journal_put (j, "aaaa", BOLT_JOURNAL_ADDED, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+
+      ok = bolt_journal_put (j, "bbbb", BOLT_JOURNAL_REMOVED, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+
+      g_clear_object (&j);
+
+      /* cut the last record in half */
+      r = truncate (path,
+                    BOLT_JOURNAL_HEADER_SIZE +
+                    BOLT_JOURNAL_RECORD_SIZE +
+                    BOLT_JOURNAL_RECORD_SIZE / 2);
+      g_assert_cmpint (r, ==, 0);
+
+      j = bolt_journal_new (tt->root, "torn", &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (j);
+
+      arr = bolt_journal_list (j, &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (arr);
+      g_assert_cmpuint (arr->len, ==, 1);
+
+      /* the next entry must not be glued to the torn one */
+      ok = bolt_journal_put (j, "cccc", BOLT_JOURNAL_ADDED, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+
+      g_assert_cmpuint (count_records (path), ==, 2);
+
+      g_clear_pointer (&arr, g_ptr_array_unref);
+      g_clear_object (&j);
+
+      j = bolt_journal_new (tt->root, "torn", &err);
+      g_assert_no_error (err);
+
+      arr = bolt_journal_list (j, &err);
+      g_assert_no_error (err);
+      g_assert_cmpuint (arr->len, ==, 2);
+
+      item = g_ptr_array_index (arr, 1);
+      g_assert_cmpstr (item->id, ==, "cccc");
+
+      exit (0);
+    }
+
+  g_test_trap_subprocess (NULL, 0, 0);
+  g_test_trap_assert_passed ();
+  g_test_trap_assert_stderr ("*incomplete entry*");
+}
+
+static void
+test_journal_checksum (TestJournal *tt, gconstpointer user_data)
+{
+  if (g_test_subprocess ())
+    {
+      g_autoptr(BoltJournal) j = NULL;
+      g_autoptr(GPtrArray) arr = NULL;
+      g_autoptr(GError) err = NULL;
+      g_autofree char *path = NULL;
+      bolt_autoclose int fd = -1;
+      BoltJournalItem *item;
+      gboolean ok;
+      ssize_t n;
+
+      g_log_set_writer_func (nonfatal_logger, NULL, NULL);
+
+      path = g_build_filename (tt->path, "crc", NULL);
+
+      j = bolt_journal_new (tt->root, "crc", &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (j);
+
+      ok = bolt_journal_put (j, "aaaa", BOLT_JOURNAL_ADDED, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+
+      ok = bolt_journal_put (j, "bbbb", BOLT_JOURNAL_ADDED, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+
+      g_clear_object (&j);
+
+      /* flip the id of the first record: 'aaaa' -> 'baaa' */
+      fd = open (path, O_WRONLY | O_CLOEXEC);
+      g_assert_cmpint (fd, >, -1);
+
+      n = pwrite (fd, "b", 1, BOLT_JOURNAL_HEADER_SIZE);
+      g_assert_cmpint (n, ==, 1);
+
+      j = bolt_journal_new (tt->root, "crc", &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (j);
+
+      arr = bolt_journal_list (j, &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (arr);
+      g_assert_cmpuint (arr->len, ==, 1);
+
+      item = g_ptr_array_index (arr, 0);
+      g_assert_cmpstr (item->id, ==, "bbbb");
+
+      /* corruption in the middle is not mistaken for a torn write */
+      g_assert_cmpuint (count_records (path), ==, 2);
+
+      exit (0);
+    }
+
+  g_test_trap_subprocess (NULL, 0, 0);
+  g_test_trap_assert_passed ();
+  g_test_trap_assert_stderr ("*invalid entry*");
+}
+
+static void
+test_journal_upgrade (TestJournal *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltJournal) j = NULL;
+  g_autoptr(GPtrArray) arr = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *data = NULL;
+  BoltJournalItem *item;
+  gboolean ok;
+
+  path = g_build_filename (tt->path, "text", NULL);
+  ok = g_file_set_contents (path,
+                            "aaaa + 0000000000000001\n"
+                            "bbbb + 0000000000000002\n"
+                            "aaaa - 0000000000000003\n",
+                            -1, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  j = bolt_journal_new (tt->root, "text", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  g_assert_false (bolt_journal_is_fresh (j));
+
+  arr = bolt_journal_list (j, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (arr);
+  g_assert_cmpuint (arr->len, ==, 2);
+
+  /* converted to the folded state, in the binary format */
+  ok = g_file_get_contents (path, &data, NULL, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_true (g_str_has_prefix (data, "boltjrnl"));
+  g_assert_cmpuint (count_records (path), ==, 2);
+
+  ok = bolt_journal_put (j, "cccc", BOLT_JOURNAL_ADDED, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  g_clear_pointer (&arr, g_ptr_array_unref);
+  g_clear_object (&j);
+
+  j = bolt_journal_new (tt->root, "text", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (j);
+
+  arr = bolt_journal_list (j, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (arr);
+  g_assert_cmpuint (arr->len, ==, 3);
+
+  item = g_ptr_array_index (arr, 0);
+  g_assert_cmpstr (item->id, ==, "bbbb");
+  g_assert_cmpint (item->op, ==, BOLT_JOURNAL_ADDED);
+  g_assert_cmpuint (item->ts, ==, 2);
+
+  item = g_ptr_array_index (arr, 1);
+  g_assert_cmpstr (item->id, ==, "aaaa");
+  g_assert_cmpint (item->op, ==, BOLT_JOURNAL_REMOVED);
+  g_assert_cmpuint (item->ts, ==, 3);
+
+  item = g_ptr_array_index (arr, 2);
+  g_assert_cmpstr (item->id, ==, "cccc");
+  g_assert_cmpint (item->op, ==, BOLT_JOURNAL_ADDED);
+}
+
 static void
 test_journal_op_stringops (TestJournal *tt, gconstpointer user_data)
 {
@@ -528,6 +985,48 @@ main (int argc, char **argv)
               test_journal_invalid_file,
               test_journal_tear_down);
 
+  g_test_add ("/journal/compact",
+              TestJournal,
+              NULL,
+              test_journal_setup,
+              test_journal_compact,
+              test_journal_tear_down);
+
+  g_test_add ("/journal/iter",
+              TestJournal,
+              NULL,
+              test_journal_setup,
+              test_journal_iter,
+              test_journal_tear_down);
+
+  g_test_add ("/journal/group_commit",
+              TestJournal,
+              NULL,
+              test_journal_setup,
+              test_journal_group_commit,
+              test_journal_tear_down);
+
+  g_test_add ("/journal/torn",
+              TestJournal,
+              NULL,
+              test_journal_setup,
+              test_journal_torn,
+              test_journal_tear_down);
+
+  g_test_add ("/journal/checksum",
+              TestJournal,
+              NULL,
+              test_journal_setup,
+              test_journal_checksum,
+              test_journal_tear_down);
+
+  g_test_add ("/journal/upgrade",
+              TestJournal,
+              NULL,
+              test_journal_setup,
+              test_journal_upgrade,
+              test_journal_tear_down);
+
   g_test_add ("/journal/op/string",
               TestJournal,
               NULL,
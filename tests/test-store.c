@@ -517,11 +517,16 @@ test_store_times (TestStore *tt, gconstpointer user_data)
   g_autoptr(BoltDevice) stored = NULL;
   g_autoptr(GError) error = NULL;
   char uid[] = "fbc83890-e9bf-45e5-a777-b3728490989c";
+  TestContext *ctx = (TestContext *) user_data;
+  g_autofree char *fn = NULL;
   guint64 authin = 574423871;
   guint64 connin = 574416000;
   guint64 authout;
   guint64 connout;
+  struct stat st;
+  off_t size;
   gboolean ok;
+  int r;
 
   dev = g_object_new (BOLT_TYPE_DEVICE,
                       "uid", uid,
@@ -687,6 +692,74 @@ test_store_times (TestStore *tt, gconstpointer user_data)
   connout = bolt_device_get_conntime (stored);
 
   g_assert_cmpuint (connout, ==, 0);
+
+  /* timestamps are written lazily, check flushing */
+  ok = bolt_store_put_time (tt->store, uid, "authtime", authin, &error);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+
+  fn = g_build_filename (tt->path, "times.db", NULL);
+  r = stat (fn, &st);
+  g_assert_cmpint (r, !=, 0);
+
+  /* a failed flush keeps the timestamps queued */
+  r = g_mkdir (fn, 0755);
+  g_assert_cmpint (r, ==, 0);
+
+  test_context_set_logger (ctx, null_logger);
+  ok = bolt_store_flush (tt->store, &error);
+  test_context_set_logger (ctx, g_log_writer_default);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+
+  r = g_rmdir (fn);
+  g_assert_cmpint (r, ==, 0);
+
+  ok = bolt_store_flush (tt->store, &error);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+
+  r = stat (fn, &st);
+  g_assert_cmpint (r, ==, 0);
+  g_assert_true (S_ISREG (st.st_mode));
+  size = st.st_size;
+
+  authout = 0;
+  ok = bolt_store_get_time (tt->store, uid, "authtime", &authout, &error);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+  g_assert_cmpuint (authout, ==, authin);
+
+  /* existing records are updated in place */
+  authin += 42;
+  ok = bolt_store_put_time (tt->store, uid, "authtime", authin, &error);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+
+  ok = bolt_store_flush (tt->store, &error);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+
+  r = stat (fn, &st);
+  g_assert_cmpint (r, ==, 0);
+  g_assert_cmpint (st.st_size, ==, size);
+
+  /* check a fresh store instance reads it back */
+  g_clear_object (&tt->store);
+  tt->store = bolt_store_new (tt->path, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (tt->store);
+
+  authout = 0;
+  ok = bolt_store_get_time (tt->store, uid, "authtime", &authout, &error);
+  g_assert_no_error (error);
+  g_assert_true (ok);
+  g_assert_cmpuint (authout, ==, authin);
+
+  ok = bolt_store_get_time (tt->store, uid, "conntime", &connout, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_false (ok);
+  g_clear_error (&error);
 }
 
 static void
@@ -857,152 +930,1211 @@ test_store_journal (TestStore *tt, gconstpointer user_data)
 }
 
 static void
-test_store_upgrade (TestStore *tt, gconstpointer user_data)
+test_store_snapshot (TestStore *tt, gconstpointer user_data)
 {
   g_autoptr(BoltDevice) dev = NULL;
+  g_autoptr(BoltDevice) stored = NULL;
+  g_autoptr(BoltKey) key = NULL;
   g_autoptr(GError) err = NULL;
   g_autoptr(DIR) root = NULL;
+  g_autofree char *fn = NULL;
+  g_autoptr(GKeyFile) kf = NULL;
+  g_autofree char *data = NULL;
   char uid[] = "fbc83890-e9bf-45e5-a777-b3728490989c";
-  guint version;
-  gboolean up;
+  BoltKeyState keystate;
+  struct stat st;
   gboolean ok;
-
-  /* simulate a version 0 store, i.e. has some entries,
-   * but no 'version' file */
+  gsize len;
+  int fd;
+  int r;
 
   root = bolt_opendir (tt->path, &err);
   g_assert_no_error (err);
   g_assert_nonnull (root);
 
-  version = bolt_store_get_version (tt->store);
-  g_assert_cmpuint (version, ==, BOLT_STORE_VERSION);
-
   dev = g_object_new (BOLT_TYPE_DEVICE,
                       "uid", uid,
                       "name", "Laptop",
                       "vendor", "GNOME.org",
                       "status", BOLT_STATUS_DISCONNECTED,
+                      "label", "My Laptop",
+                      "conntime", (guint64) 574416000,
                       NULL);
 
-  ok = bolt_store_put_device (tt->store, dev, BOLT_POLICY_AUTO, NULL, &err);
+  key = bolt_key_new (NULL);
+  g_assert_nonnull (key);
+
+  ok = bolt_store_put_device (tt->store, dev, BOLT_POLICY_AUTO, key, &err);
   g_assert_no_error (err);
   g_assert_true (ok);
 
-  /* close the store, delete 'version' */
+  /* closing the store writes the snapshot */
   g_clear_object (&tt->store);
 
-  ok = bolt_unlink_at (dirfd (root), "version", 0, &err);
+  r = fstatat (dirfd (root), "snapshot", &st, 0);
+  g_assert_cmpint (r, ==, 0);
+
+  tt->store = bolt_store_new (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (tt->store);
+
+  stored = bolt_store_get_device (tt->store, uid, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (stored);
+
+  g_assert_cmpstr (bolt_device_get_name (stored), ==, "Laptop");
+  g_assert_cmpstr (bolt_device_get_vendor (stored), ==, "GNOME.org");
+  g_assert_cmpstr (bolt_device_get_label (stored), ==, "My Laptop");
+  g_assert_cmpuint (bolt_device_get_policy (stored), ==, BOLT_POLICY_AUTO);
+  g_assert_cmpuint (bolt_device_get_keystate (stored), ==, BOLT_KEY_HAVE);
+  g_assert_cmpuint (bolt_device_get_conntime (stored), ==, 574416000);
+  g_assert_cmpuint (bolt_device_get_authtime (stored), ==, 0);
+  g_clear_object (&stored);
+
+  /* modifying the store invalidates the snapshot */
+  ok = bolt_store_del_key (tt->store, uid, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  r = fstatat (dirfd (root), "snapshot", &st, 0);
+  g_assert_cmpint (r, !=, 0);
+
+  keystate = bolt_store_have_key (tt->store, uid);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_MISSING);
+
+  g_clear_object (&tt->store);
+
+  /* changes behind our back make the snapshot stale */
+  fn = g_build_filename (tt->path, "keys", uid, NULL);
+  ok = g_file_set_contents (fn, "deadbeef", -1, &err);
   g_assert_no_error (err);
   g_assert_true (ok);
 
-  /* re-create the store object */
   tt->store = bolt_store_new (tt->path, &err);
   g_assert_no_error (err);
   g_assert_nonnull (tt->store);
 
-  version = bolt_store_get_version (tt->store);
-  g_assert_cmpuint (version, ==, 0);
+  keystate = bolt_store_have_key (tt->store, uid);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_HAVE);
 
-  /* no upgrade the store */
-  ok = bolt_store_upgrade (tt->store, &up, &err);
+  g_clear_object (&tt->store);
+
+  r = fstatat (dirfd (root), "snapshot", &st, 0);
+  g_assert_cmpint (r, ==, 0);
+
+  /* an entry that is modified in place, i.e. without a
+   * change to the directory, makes it stale as well */
+  g_clear_pointer (&fn, g_free);
+  fn = g_build_filename (tt->path, "devices", uid, NULL);
+  kf = g_key_file_new ();
+  ok = g_key_file_load_from_file (kf, fn, G_KEY_FILE_KEEP_COMMENTS, &err);
   g_assert_no_error (err);
   g_assert_true (ok);
-  g_assert_true (up);
 
-  /* assert the upgrade changed the version */
-  version = bolt_store_get_version (tt->store);
-  g_assert_cmpuint (version, ==, BOLT_STORE_VERSION);
+  g_key_file_set_string (kf, "device", "name", "Desktop");
+  data = g_key_file_to_data (kf, &len, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (data);
 
-  /* upgrade again, check it did not do anything */
-  ok = bolt_store_upgrade (tt->store, &up, &err);
+  fd = bolt_open (fn, O_WRONLY | O_TRUNC | O_CLOEXEC, 0, &err);
+  g_assert_no_error (err);
+  g_assert_cmpint (fd, >, -1);
+
+  ok = bolt_write_all (fd, data, len, &err);
   g_assert_no_error (err);
   g_assert_true (ok);
-  g_assert_false (up);
+  close (fd);
 
-  version = bolt_store_get_version (tt->store);
-  g_assert_cmpuint (version, ==, BOLT_STORE_VERSION);
+  tt->store = bolt_store_new (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (tt->store);
 
-  /* ensure 'upgrade' argument is optional */
-  ok = bolt_store_upgrade (tt->store, NULL, &err);
+  stored = bolt_store_get_device (tt->store, uid, &err);
   g_assert_no_error (err);
-  g_assert_true (ok);
+  g_assert_nonnull (stored);
 
+  g_assert_cmpstr (bolt_device_get_name (stored), ==, "Desktop");
 }
 
-int
-main (int argc, char **argv)
+static void
+test_store_keys (TestStore *tt, gconstpointer user_data)
 {
-  TestContext test_context;
+  g_autoptr(BoltKey) key = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autofree char *fn = NULL;
+  g_autofree char *snapshot = NULL;
+  char uid[] = "fbc83890-e9bf-45e5-a777-b3728490989c";
+  const char *orphan = "2e7a61c8-59b4-4f0e-a2d3-6c1b9e8f4a57";
+  BoltKeyState keystate;
+  gboolean ok;
 
-  setlocale (LC_ALL, "");
+  key = bolt_key_new (NULL);
+  g_assert_nonnull (key);
 
-  g_test_init (&argc, &argv, NULL);
+  /* every other device gets a key */
+  for (guint i = 0; i < 6; i++)
+    {
+      g_autoptr(BoltDevice) dev = NULL;
+
+      uid[0] = 'a' + i;
+      dev = g_object_new (BOLT_TYPE_DEVICE,
+                          "uid", uid,
+                          "name", "Dock",
+                          "vendor", "GNOME.org",
+                          "status", BOLT_STATUS_DISCONNECTED,
+                          NULL);
+
+      ok = bolt_store_put_device (tt->store, dev,
+                                  BOLT_POLICY_AUTO,
+                                  i % 2 ? key : NULL,
+                                  &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
 
-  g_log_set_writer_func (test_context_logger, &test_context, NULL);
+  /* a key without a device entry, and a stale staged file */
+  fn = g_build_filename (tt->path, "keys", orphan, NULL);
+  ok = g_file_set_contents (fn, "deadbeef", -1, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_clear_pointer (&fn, g_free);
 
-  bolt_dbus_ensure_resources ();
+  fn = g_build_filename (tt->path, "keys", ".aaaa.txn", NULL);
+  ok = g_file_set_contents (fn, "deadbeef", -1, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
 
-  g_test_add ("/daemon/key",
-              TestStore,
-              &test_context,
-              test_store_setup,
-              test_key,
-              test_store_tear_down);
+  /* force a rebuild of the index, i.e. a scan of keys/ */
+  g_clear_object (&tt->store);
 
-  g_test_add ("/daemon/store/basic",
-              TestStore,
-              &test_context,
-              test_store_setup,
-              test_store_basic,
-              test_store_tear_down);
+  snapshot = g_build_filename (tt->path, "snapshot", NULL);
+  g_assert_cmpint (g_unlink (snapshot), ==, 0);
 
-  g_test_add ("/daemon/store/update",
-              TestStore,
-              &test_context,
-              test_store_setup,
-              test_store_update,
-              test_store_tear_down);
+  tt->store = bolt_store_new (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (tt->store);
 
-  g_test_add ("/daemon/store/config",
-              TestStore,
-              &test_context,
-              test_store_setup,
-              test_store_config,
-              test_store_tear_down);
+  for (guint i = 0; i < 6; i++)
+    {
+      g_autoptr(BoltDevice) stored = NULL;
 
-  g_test_add ("/daemon/store/invalid_data",
-              TestStore,
-              &test_context,
-              test_store_setup,
-              test_store_invalid_data,
-              test_store_tear_down);
+      uid[0] = 'a' + i;
+      stored = bolt_store_get_device (tt->store, uid, &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (stored);
 
-  g_test_add ("/daemon/store/times",
-              TestStore,
-              &test_context,
-              test_store_setup,
-              test_store_times,
-              test_store_tear_down);
+      keystate = bolt_device_get_keystate (stored);
+      g_assert_cmpuint (keystate, ==, i % 2 ? BOLT_KEY_HAVE : BOLT_KEY_MISSING);
+    }
 
-  g_test_add ("/daemon/store/domain",
-              TestStore,
-              &test_context,
-              test_store_setup,
-              test_store_domain,
-              test_store_tear_down);
+  keystate = bolt_store_have_key (tt->store, orphan);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_HAVE);
 
-  g_test_add ("/daemon/store/journal",
-              TestStore,
-              &test_context,
-              test_store_setup,
-              test_store_journal,
-              test_store_tear_down);
+  keystate = bolt_store_have_key (tt->store, "aaaa");
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_MISSING);
 
-  g_test_add ("/daemon/store/upgrade",
-              TestStore,
-              &test_context,
-              test_store_setup,
-              test_store_upgrade,
+  /* the set follows put and delete */
+  ok = bolt_store_del_key (tt->store, orphan, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  keystate = bolt_store_have_key (tt->store, orphan);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_MISSING);
+
+  ok = bolt_store_put_key (tt->store, orphan, key, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  keystate = bolt_store_have_key (tt->store, orphan);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_HAVE);
+
+  /* an aborted transaction does not leave a stale state */
+  bolt_store_begin (tt->store);
+
+  ok = bolt_store_del_key (tt->store, orphan, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  bolt_store_abort (tt->store);
+
+  keystate = bolt_store_have_key (tt->store, orphan);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_HAVE);
+
+  /* committed transactions update the set */
+  bolt_store_begin (tt->store);
+
+  ok = bolt_store_del_key (tt->store, orphan, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_store_commit (tt->store, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  keystate = bolt_store_have_key (tt->store, orphan);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_MISSING);
+
+  bolt_store_begin (tt->store);
+
+  ok = bolt_store_put_key (tt->store, orphan, key, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_store_commit (tt->store, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  keystate = bolt_store_have_key (tt->store, orphan);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_HAVE);
+}
+
+static void
+test_store_load (TestStore *tt, gconstpointer user_data)
+{
+  g_autoptr(GError) err = NULL;
+  g_autoptr(DIR) root = NULL;
+  const guint n = 64;
+  gboolean ok;
+
+  root = bolt_opendir (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (root);
+
+  for (guint i = 0; i < n; i++)
+    {
+      g_autoptr(BoltDevice) dev = NULL;
+      g_autofree char *uid = NULL;
+      g_autofree char *name = NULL;
+
+      uid = g_strdup_printf ("fbc83890-e9bf-45e5-a777-b372849%05u", i);
+      name = g_strdup_printf ("Device %u", i);
+
+      dev = g_object_new (BOLT_TYPE_DEVICE,
+                          "uid", uid,
+                          "name", name,
+                          "vendor", "GNOME.org",
+                          "status", BOLT_STATUS_DISCONNECTED,
+                          "conntime", (guint64) 574416000 + i,
+                          NULL);
+
+      ok = bolt_store_put_device (tt->store, dev, BOLT_POLICY_AUTO, NULL, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+
+  /* force re-loading all entries from disk */
+  g_clear_object (&tt->store);
+
+  ok = bolt_unlink_at (dirfd (root), "snapshot", 0, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  tt->store = bolt_store_new (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (tt->store);
+
+  for (guint i = 0; i < n; i++)
+    {
+      g_autoptr(BoltDevice) dev = NULL;
+      g_autofree char *uid = NULL;
+      g_autofree char *name = NULL;
+
+      uid = g_strdup_printf ("fbc83890-e9bf-45e5-a777-b372849%05u", i);
+      name = g_strdup_printf ("Device %u", i);
+
+      dev = bolt_store_get_device (tt->store, uid, &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (dev);
+
+      g_assert_cmpstr (bolt_device_get_name (dev), ==, name);
+      g_assert_cmpuint (bolt_device_get_policy (dev), ==, BOLT_POLICY_AUTO);
+      g_assert_cmpuint (bolt_device_get_conntime (dev), ==, 574416000 + i);
+    }
+}
+
+static void
+test_store_transaction (TestStore *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltDevice) dev = NULL;
+  g_autoptr(BoltDevice) stored = NULL;
+  g_autoptr(BoltKey) key = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(DIR) root = NULL;
+  g_autofree char *fn = NULL;
+  g_autofree char *data = NULL;
+  char uid[] = "fbc83890-e9bf-45e5-a777-b3728490989c";
+  BoltKeyState keystate;
+  struct stat st;
+  gboolean ok;
+  int r;
+
+  root = bolt_opendir (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (root);
+
+  dev = g_object_new (BOLT_TYPE_DEVICE,
+                      "uid", uid,
+                      "name", "Laptop",
+                      "vendor", "GNOME.org",
+                      "status", BOLT_STATUS_DISCONNECTED,
+                      NULL);
+
+  key = bolt_key_new (NULL);
+  g_assert_nonnull (key);
+
+  /* aborted transactions leave nothing behind */
+  bolt_store_begin (tt->store);
+
+  ok = bolt_store_put_device (tt->store, dev, BOLT_POLICY_AUTO, key, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  fn = g_build_filename (tt->path, "devices", uid, NULL);
+  r = stat (fn, &st);
+  g_assert_cmpint (r, !=, 0);
+
+  bolt_store_abort (tt->store);
+
+  stored = bolt_store_get_device (tt->store, uid, &err);
+  g_assert_nonnull (err);
+  g_assert_true (bolt_err_notfound (err));
+  g_assert_null (stored);
+  g_clear_error (&err);
+
+  keystate = bolt_store_have_key (tt->store, uid);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_MISSING);
+
+  r = fstatat (dirfd (root), "devices/.fbc83890-e9bf-45e5-a777-b3728490989c.txn", &st, 0);
+  g_assert_cmpint (r, !=, 0);
+
+  /* committed transactions are visible */
+  g_object_set (dev, "store", NULL, NULL);
+  bolt_store_begin (tt->store);
+
+  ok = bolt_store_put_device (tt->store, dev, BOLT_POLICY_AUTO, key, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_store_commit (tt->store, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  r = stat (fn, &st);
+  g_assert_cmpint (r, ==, 0);
+
+  r = fstatat (dirfd (root), ".transaction", &st, 0);
+  g_assert_cmpint (r, !=, 0);
+
+  g_clear_object (&tt->store);
+  tt->store = bolt_store_new (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (tt->store);
+
+  stored = bolt_store_get_device (tt->store, uid, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (stored);
+  g_assert_cmpuint (bolt_device_get_policy (stored), ==, BOLT_POLICY_AUTO);
+  g_assert_cmpuint (bolt_device_get_keystate (stored), ==, BOLT_KEY_HAVE);
+  g_clear_object (&stored);
+
+  /* a committed, but not yet applied, transaction is
+   * replayed when the store is opened the next time */
+  g_clear_object (&tt->store);
+
+  g_clear_pointer (&fn, g_free);
+  fn = g_build_filename (tt->path, "keys", ".fbc83890-e9bf-45e5-a777-b3728490989c.txn", NULL);
+  ok = g_file_set_contents (fn, "", 0, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  g_clear_pointer (&fn, g_free);
+  fn = g_build_filename (tt->path, ".transaction", NULL);
+  data = g_strdup_printf ("D\tkeys/%s\nD\tdevices/%s\nC\t2\n", uid, uid);
+  ok = g_file_set_contents (fn, data, -1, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  tt->store = bolt_store_new (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (tt->store);
+
+  stored = bolt_store_get_device (tt->store, uid, &err);
+  g_assert_nonnull (err);
+  g_assert_true (bolt_err_notfound (err));
+  g_assert_null (stored);
+  g_clear_error (&err);
+
+  keystate = bolt_store_have_key (tt->store, uid);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_MISSING);
+
+  r = fstatat (dirfd (root), ".transaction", &st, 0);
+  g_assert_cmpint (r, !=, 0);
+
+  /* stale staged files got removed */
+  r = fstatat (dirfd (root), "keys/.fbc83890-e9bf-45e5-a777-b3728490989c.txn", &st, 0);
+  g_assert_cmpint (r, !=, 0);
+}
+
+static void
+on_store_device_changed (BoltStore  *store,
+                         const char *uid,
+                         gpointer    user_data)
+{
+  char **out = user_data;
+
+  g_free (*out);
+  *out = g_strdup (uid);
+}
+
+static void
+wait_for_uid (char **uid)
+{
+  gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+
+  while (*uid == NULL && g_get_monotonic_time () < deadline)
+    g_main_context_iteration (NULL, FALSE);
+}
+
+static void
+test_store_watch (TestStore *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltDevice) stored = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autofree char *added = NULL;
+  g_autofree char *removed = NULL;
+  g_autofree char *fn = NULL;
+  g_autofree char *dir = NULL;
+  char uid[] = "fbc83890-e9bf-45e5-a777-b3728490989c";
+  const char *data =
+    "[device]\n"
+    "name=Laptop\n"
+    "vendor=GNOME.org\n"
+    "type=peripheral\n"
+    "[user]\n"
+    "policy=auto\n";
+  gboolean ok;
+  int r;
+
+  g_signal_connect (tt->store, "device-added",
+                    G_CALLBACK (on_store_device_changed),
+                    &added);
+
+  g_signal_connect (tt->store, "device-removed",
+                    G_CALLBACK (on_store_device_changed),
+                    &removed);
+
+  /* the devices directory does not exist yet */
+  dir = g_build_filename (tt->path, "devices", NULL);
+  r = g_mkdir (dir, 0755);
+  g_assert_cmpint (r, ==, 0);
+
+  fn = g_build_filename (dir, uid, NULL);
+  ok = g_file_set_contents (fn, data, -1, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  wait_for_uid (&added);
+  g_assert_cmpstr (added, ==, uid);
+
+  stored = bolt_store_get_device (tt->store, uid, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (stored);
+  g_assert_cmpstr (bolt_device_get_name (stored), ==, "Laptop");
+  g_assert_cmpuint (bolt_device_get_policy (stored), ==, BOLT_POLICY_AUTO);
+  g_clear_object (&stored);
+
+  r = g_unlink (fn);
+  g_assert_cmpint (r, ==, 0);
+
+  wait_for_uid (&removed);
+  g_assert_cmpstr (removed, ==, uid);
+
+  stored = bolt_store_get_device (tt->store, uid, &err);
+  g_assert_nonnull (err);
+  g_assert_true (bolt_err_notfound (err));
+  g_assert_null (stored);
+}
+
+static void
+test_store_watch_own (TestStore *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltDevice) dev = NULL;
+  g_autoptr(BoltDevice) stored = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autofree char *changed = NULL;
+  g_autofree char *fn = NULL;
+  g_autofree char *data = NULL;
+  char uid[] = "fbc83890-e9bf-45e5-a777-b3728490989c";
+  gint64 deadline;
+  gboolean ok;
+
+  g_signal_connect (tt->store, "device-changed",
+                    G_CALLBACK (on_store_device_changed),
+                    &changed);
+
+  dev = g_object_new (BOLT_TYPE_DEVICE,
+                      "uid", uid,
+                      "name", "Laptop",
+                      "vendor", "GNOME.org",
+                      "status", BOLT_STATUS_DISCONNECTED,
+                      NULL);
+
+  /* our own changes must not be reported */
+  for (guint i = 0; i < 2; i++)
+    {
+      ok = bolt_store_put_device (tt->store, dev, BOLT_POLICY_AUTO,
+                                  NULL, &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+
+  deadline = g_get_monotonic_time () + 750 * G_TIME_SPAN_MILLISECOND;
+  while (g_get_monotonic_time () < deadline)
+    g_main_context_iteration (NULL, FALSE);
+
+  g_assert_null (changed);
+
+  /* but changes by others are */
+  fn = g_build_filename (tt->path, "devices", uid, NULL);
+  data = g_strdup ("[device]\n"
+                   "name=Laptop\n"
+                   "vendor=GNOME.org\n"
+                   "type=peripheral\n"
+                   "[user]\n"
+                   "policy=manual\n"
+                   "label=Work\n");
+
+  ok = g_file_set_contents (fn, data, -1, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  wait_for_uid (&changed);
+  g_assert_cmpstr (changed, ==, uid);
+
+  stored = bolt_store_get_device (tt->store, uid, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (stored);
+  g_assert_cmpuint (bolt_device_get_policy (stored), ==, BOLT_POLICY_MANUAL);
+  g_assert_cmpstr (bolt_device_get_label (stored), ==, "Work");
+}
+
+static void
+test_store_export (TestStore *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltStore) store = NULL;
+  g_autoptr(BoltDevice) dev = NULL;
+  g_autoptr(BoltDevice) stored = NULL;
+  g_autoptr(BoltDomain) dom = NULL;
+  g_autoptr(BoltDomain) sd = NULL;
+  g_autoptr(BoltKey) key = NULL;
+  g_autoptr(GOutputStream) out = NULL;
+  g_autoptr(GInputStream) in = NULL;
+  g_autoptr(GBytes) archive = NULL;
+  g_autoptr(BoltStoreImport) im = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *keydata = NULL;
+  g_autofree char *keypath = NULL;
+  g_autofree char *orphan = NULL;
+  const char *uid = "884c6edd-7118-4b21-b186-b02d396ecca0";
+  const char *data;
+  gsize len;
+  char dev_uid[] = "fbc83890-e9bf-45e5-a777-b3728490989c";
+  BoltKeyState keystate;
+  guint exported;
+  guint imported;
+  gboolean ok;
+
+  dom = g_object_new (BOLT_TYPE_DOMAIN,
+                      "uid", uid,
+                      "bootacl", NULL,
+                      NULL);
+
+  ok = bolt_store_put_domain (tt->store, dom, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  key = bolt_key_new (NULL);
+  g_assert_nonnull (key);
+
+  for (guint i = 0; i < 4; i++)
+    {
+      dev_uid[0] = 'a' + i;
+      dev = g_object_new (BOLT_TYPE_DEVICE,
+                          "uid", dev_uid,
+                          "name", "Dock",
+                          "vendor", "GNOME.org",
+                          "status", BOLT_STATUS_DISCONNECTED,
+                          "conntime", (guint64) 574416000 + i,
+                          NULL);
+
+      ok = bolt_store_put_device (tt->store, dev,
+                                  BOLT_POLICY_AUTO,
+                                  i % 2 ? key : NULL,
+                                  &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+      g_clear_object (&dev);
+    }
+
+  out = g_memory_output_stream_new_resizable ();
+
+  /* without keys: 4 devices, 4 times and 1 domain */
+  ok = bolt_store_export (tt->store, out, BOLT_STORE_EXPORT_NONE,
+                          &exported, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_cmpuint (exported, ==, 9);
+
+  g_clear_object (&out);
+  out = g_memory_output_stream_new_resizable ();
+
+  ok = bolt_store_export (tt->store, out, BOLT_STORE_EXPORT_KEYS,
+                          &exported, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_cmpuint (exported, ==, 11);
+
+  ok = g_output_stream_close (out, NULL, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  archive = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (out));
+
+  /* import into a fresh store */
+  path = g_dir_make_tmp ("bolt.import.XXXXXX", &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (path);
+
+  store = bolt_store_new (path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (store);
+
+  in = g_memory_input_stream_new_from_bytes (archive);
+  ok = bolt_store_import (store, in, &imported, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_cmpuint (imported, ==, exported);
+
+  for (guint i = 0; i < 4; i++)
+    {
+      dev_uid[0] = 'a' + i;
+      stored = bolt_store_get_device (store, dev_uid, &err);
+      g_assert_no_error (err);
+      g_assert_nonnull (stored);
+
+      g_assert_cmpstr (bolt_device_get_name (stored), ==, "Dock");
+      g_assert_cmpuint (bolt_device_get_policy (stored), ==, BOLT_POLICY_AUTO);
+      g_assert_cmpuint (bolt_device_get_conntime (stored), ==, 574416000 + i);
+
+      keystate = bolt_store_have_key (store, dev_uid);
+      g_assert_cmpuint (keystate, ==, i % 2 ? BOLT_KEY_HAVE : BOLT_KEY_MISSING);
+      g_clear_object (&stored);
+    }
+
+  sd = bolt_store_get_domain (store, uid, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (sd);
+
+  /* records can be split across chunks in any way */
+  im = bolt_store_import_new (store, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (im);
+
+  data = g_bytes_get_data (archive, &len);
+  for (gsize off = 0; off < len; off += 7)
+    {
+      ok = bolt_store_import_feed (im, data + off, MIN (7, len - off), &err);
+      g_assert_no_error (err);
+      g_assert_true (ok);
+    }
+
+  ok = bolt_store_import_finish (im, &imported, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_cmpuint (imported, ==, exported);
+
+  /* and a missing end is noticed */
+  g_clear_pointer (&im, bolt_store_import_free);
+  im = bolt_store_import_new (store, &err);
+  g_assert_no_error (err);
+
+  ok = bolt_store_import_feed (im, data, len / 2, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_store_import_finish (im, &imported, &err);
+  g_assert_error (err, BOLT_ERROR, BOLT_ERROR_FAILED);
+  g_assert_false (ok);
+  g_clear_error (&err);
+
+  /* corrupt archives are rejected */
+  g_clear_object (&in);
+  in = g_memory_input_stream_new_from_data ("bolt-store-archive 1\ndevice x 99\n",
+                                            -1, NULL);
+  ok = bolt_store_import (store, in, &imported, &err);
+  g_assert_nonnull (err);
+  g_assert_false (ok);
+  g_clear_error (&err);
+
+  /* keys of devices in neither the archive nor the store are skipped */
+  g_clear_object (&in);
+  keydata = g_strnfill (BOLT_KEY_CHARS, 'f');
+  orphan = g_strdup_printf ("bolt-store-archive 1\nkey %s %d\n%s\nend 1\n",
+                            "orphan", BOLT_KEY_CHARS, keydata);
+  in = g_memory_input_stream_new_from_data (orphan, -1, NULL);
+  ok = bolt_store_import (store, in, &imported, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  keystate = bolt_store_have_key (store, "orphan");
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_MISSING);
+
+  keypath = g_build_filename (path, "keys", "orphan", NULL);
+  g_assert_false (g_file_test (keypath, G_FILE_TEST_EXISTS));
+
+  g_clear_object (&store);
+  ok = bolt_fs_cleanup_dir (path, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+}
+
+static void
+test_store_gc (TestStore *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltDevice) dev = NULL;
+  g_autoptr(BoltKey) key = NULL;
+  g_autoptr(BoltJournal) journal = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autofree char *times = NULL;
+  g_autofree char *legacy = NULL;
+  const char *uid = "c6b5e5a4-56b3-4a1b-9b1e-59c0b8d5d2a1";
+  const char *ghost = "d9e47b2a-3c1f-4e67-8d0a-21f5c3b7a6e9";
+  const char *domain = "0ea7b3c2-9a4d-4e21-b5a8-7f6c3d2e1b0a";
+  BoltKeyState keystate;
+  guint reclaimed;
+  gboolean ok;
+  guint n;
+
+  dev = g_object_new (BOLT_TYPE_DEVICE,
+                      "uid", uid,
+                      "name", "Laptop",
+                      "vendor", "GNOME.org",
+                      "status", BOLT_STATUS_DISCONNECTED,
+                      NULL);
+
+  key = bolt_key_new (NULL);
+  g_assert_nonnull (key);
+
+  ok = bolt_store_put_device (tt->store, dev, BOLT_POLICY_AUTO, key, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_store_put_time (tt->store, uid, "conntime", 574416000, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_store_flush (tt->store, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  /* nothing to collect yet */
+  n = bolt_store_gc (tt->store);
+  g_assert_cmpuint (n, ==, 0);
+
+  /* only drop the device entry, leaving key and times behind */
+  ok = bolt_store_del_device (tt->store, uid, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  keystate = bolt_store_have_key (tt->store, uid);
+  g_assert_cmpuint (keystate, !=, BOLT_KEY_MISSING);
+
+  /* a stale legacy timestamp file */
+  times = g_build_filename (tt->path, "times", NULL);
+  g_assert_cmpint (g_mkdir_with_parents (times, 0755), ==, 0);
+
+  legacy = g_strdup_printf ("%s/%s.conntime", times, ghost);
+  ok = g_file_set_contents (legacy, "", 0, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  /* and a journal for a domain that was never stored */
+  journal = bolt_store_open_journal (tt->store, "bootacl", domain, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (journal);
+  g_clear_object (&journal);
+
+  /* key, times.db record, legacy file and journal */
+  n = bolt_store_gc (tt->store);
+  g_assert_cmpuint (n, ==, 4);
+
+  keystate = bolt_store_have_key (tt->store, uid);
+  g_assert_cmpuint (keystate, ==, BOLT_KEY_MISSING);
+
+  g_assert_false (g_file_test (legacy, G_FILE_TEST_EXISTS));
+
+  ok = bolt_store_has_journal (tt->store, "bootacl", domain);
+  g_assert_false (ok);
+
+  /* second pass finds nothing */
+  n = bolt_store_gc (tt->store);
+  g_assert_cmpuint (n, ==, 0);
+
+  g_object_get (tt->store, "reclaimed", &reclaimed, NULL);
+  g_assert_cmpuint (reclaimed, ==, 4);
+  g_assert_cmpuint (bolt_store_get_reclaimed (tt->store), ==, 4);
+}
+
+static void
+test_store_upgrade (TestStore *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltDevice) dev = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GFile) gf = NULL;
+  g_autoptr(DIR) root = NULL;
+  g_autofree char *fn = NULL;
+  char uid[] = "fbc83890-e9bf-45e5-a777-b3728490989c";
+  guint64 authin = 574423871;
+  guint64 authout = 0;
+  guint version;
+  gboolean up;
+  gboolean ok;
+
+  /* simulate a version 0 store, i.e. has some entries,
+   * but no 'version' file */
+
+  root = bolt_opendir (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (root);
+
+  version = bolt_store_get_version (tt->store);
+  g_assert_cmpuint (version, ==, BOLT_STORE_VERSION);
+
+  dev = g_object_new (BOLT_TYPE_DEVICE,
+                      "uid", uid,
+                      "name", "Laptop",
+                      "vendor", "GNOME.org",
+                      "status", BOLT_STATUS_DISCONNECTED,
+                      NULL);
+
+  ok = bolt_store_put_device (tt->store, dev, BOLT_POLICY_AUTO, NULL, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  /* close the store, delete 'version' and the times
+   * database, create timestamps in the old format */
+  g_clear_object (&tt->store);
+
+  ok = bolt_unlink_at (dirfd (root), "version", 0, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_unlink_at (dirfd (root), "times.db", 0, &err);
+  if (!ok)
+    {
+      g_assert_true (bolt_err_notfound (err));
+      g_clear_error (&err);
+    }
+
+  fn = g_strdup_printf ("%s/times/%s.authtime", tt->path, uid);
+  gf = g_file_new_for_path (fn);
+  ok = bolt_fs_make_parent_dirs (gf, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_fs_touch (gf, authin, authin, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  /* re-create the store object */
+  tt->store = bolt_store_new (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (tt->store);
+
+  version = bolt_store_get_version (tt->store);
+  g_assert_cmpuint (version, ==, 0);
+
+  /* no upgrade the store */
+  ok = bolt_store_upgrade (tt->store, &up, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_true (up);
+
+  /* assert the upgrade changed the version */
+  version = bolt_store_get_version (tt->store);
+  g_assert_cmpuint (version, ==, BOLT_STORE_VERSION);
+
+  /* timestamps have been migrated */
+  ok = g_file_query_exists (gf, NULL);
+  g_assert_false (ok);
+
+  ok = bolt_store_get_time (tt->store, uid, "authtime", &authout, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_cmpuint (authout, ==, authin);
+
+  /* upgrade again, check it did not do anything */
+  ok = bolt_store_upgrade (tt->store, &up, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_false (up);
+
+  version = bolt_store_get_version (tt->store);
+  g_assert_cmpuint (version, ==, BOLT_STORE_VERSION);
+
+  /* ensure 'upgrade' argument is optional */
+  ok = bolt_store_upgrade (tt->store, NULL, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+}
+
+static void
+test_store_upgrade_resume (TestStore *tt, gconstpointer user_data)
+{
+  g_autoptr(BoltDevice) dev = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GFile) authf = NULL;
+  g_autoptr(GFile) connf = NULL;
+  g_autoptr(DIR) root = NULL;
+  g_autofree char *fn = NULL;
+  char uid[] = "fbc83890-e9bf-45e5-a777-b3728490989c";
+  guint64 authin = 574423871;
+  guint64 connin = 574423899;
+  guint64 legacy = 474423871;
+  guint64 authout = 0;
+  guint64 connout = 0;
+  guint version;
+  gboolean up;
+  gboolean ok;
+
+  /* simulate an upgrade that was interrupted after the
+   * times database was written but before the version
+   * was committed, i.e. times.db and the legacy files
+   * are both present */
+
+  root = bolt_opendir (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (root);
+
+  dev = g_object_new (BOLT_TYPE_DEVICE,
+                      "uid", uid,
+                      "name", "Laptop",
+                      "vendor", "GNOME.org",
+                      "status", BOLT_STATUS_DISCONNECTED,
+                      NULL);
+
+  ok = bolt_store_put_device (tt->store, dev, BOLT_POLICY_AUTO, NULL, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_store_put_time (tt->store, uid, "authtime", authin, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_store_flush (tt->store, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  g_clear_object (&tt->store);
+
+  ok = bolt_unlink_at (dirfd (root), "version", 0, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  /* NB: times.db is kept in place */
+  fn = g_build_filename (tt->path, "times.db", NULL);
+  g_assert_true (g_file_test (fn, G_FILE_TEST_IS_REGULAR));
+  g_clear_pointer (&fn, g_free);
+
+  /* an older authtime, and a conntime only in the legacy files */
+  fn = g_strdup_printf ("%s/times/%s.authtime", tt->path, uid);
+  authf = g_file_new_for_path (fn);
+  ok = bolt_fs_make_parent_dirs (authf, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  ok = bolt_fs_touch (authf, legacy, legacy, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  g_clear_pointer (&fn, g_free);
+  fn = g_strdup_printf ("%s/times/%s.conntime", tt->path, uid);
+  connf = g_file_new_for_path (fn);
+
+  ok = bolt_fs_touch (connf, connin, connin, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  tt->store = bolt_store_new (tt->path, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (tt->store);
+
+  version = bolt_store_get_version (tt->store);
+  g_assert_cmpuint (version, ==, 0);
+
+  ok = bolt_store_upgrade (tt->store, &up, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_true (up);
+
+  version = bolt_store_get_version (tt->store);
+  g_assert_cmpuint (version, ==, BOLT_STORE_VERSION);
+
+  g_assert_false (g_file_query_exists (authf, NULL));
+  g_assert_false (g_file_query_exists (connf, NULL));
+
+  /* the database wins over the legacy file ... */
+  ok = bolt_store_get_time (tt->store, uid, "authtime", &authout, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_cmpuint (authout, ==, authin);
+
+  /* ... and the legacy file fills in what is missing */
+  ok = bolt_store_get_time (tt->store, uid, "conntime", &connout, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_cmpuint (connout, ==, connin);
+}
+
+int
+main (int argc, char **argv)
+{
+  TestContext test_context;
+
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_log_set_writer_func (test_context_logger, &test_context, NULL);
+
+  bolt_dbus_ensure_resources ();
+
+  g_test_add ("/daemon/key",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_key,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/basic",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_basic,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/update",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_update,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/config",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_config,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/invalid_data",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_invalid_data,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/times",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_times,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/domain",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_domain,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/journal",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_journal,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/upgrade",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_upgrade,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/upgrade_resume",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_upgrade_resume,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/snapshot",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_snapshot,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/load",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_load,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/keys",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_keys,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/transaction",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_transaction,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/watch",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_watch,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/watch/own",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_watch_own,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/export",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_export,
+              test_store_tear_down);
+
+  g_test_add ("/daemon/store/gc",
+              TestStore,
+              &test_context,
+              test_store_setup,
+              test_store_gc,
               test_store_tear_down);
 
   return g_test_run ();
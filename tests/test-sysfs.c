@@ -64,6 +64,19 @@ test_sysfs_tear_down (TestSysfs *tt, gconstpointer user)
   g_clear_pointer (&tt->udev, udev_unref);
 }
 
+static BoltSysfsSnapshot *
+snapshot_for_device (struct udev_device *udevice)
+{
+  g_autoptr(GError) err = NULL;
+  BoltSysfsSnapshot *snap;
+
+  snap = bolt_sysfs_snapshot_new (udevice, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (snap);
+
+  return snap;
+}
+
 static void
 count_domains (gpointer data,
                gpointer user_data)
@@ -146,6 +159,7 @@ check_ident (TestSysfs *tt, const char *host)
 
   for (gsize i = 0; i < G_N_ELEMENTS (fields); i++)
     {
+      g_autoptr(BoltSysfsSnapshot) snap = NULL;
       g_autoptr(udev_device) udevice = NULL;
       g_autoptr(GError) err = NULL;
       const char *syspath;
@@ -165,7 +179,8 @@ check_ident (TestSysfs *tt, const char *host)
       udevice = udev_device_new_from_syspath (tt->udev, syspath);
       g_assert_nonnull (udevice);
 
-      ok = bolt_sysfs_device_ident (udevice, &ident, &err);
+      snap = snapshot_for_device (udevice);
+      ok = bolt_sysfs_device_ident (snap, &ident, &err);
 
       g_assert_no_error (err);
       g_assert_true (ok);
@@ -173,6 +188,7 @@ check_ident (TestSysfs *tt, const char *host)
       g_assert_nonnull (*(fields[i].target));
 
       mock_sysfs_device_remove (tt->sysfs, dev);
+      g_clear_pointer (&snap, bolt_sysfs_snapshot_unref);
       g_clear_pointer (&udevice, udev_device_unref);
 
       /* remove the fallback, re-plug the device */
@@ -188,7 +204,8 @@ check_ident (TestSysfs *tt, const char *host)
       g_assert_null (*(fields[i].target));
 
       /* fallback is removed */
-      ok = bolt_sysfs_device_ident (udevice, &ident, &err);
+      snap = snapshot_for_device (udevice);
+      ok = bolt_sysfs_device_ident (snap, &ident, &err);
       g_assert_error (err, BOLT_ERROR, BOLT_ERROR_UDEV);
       g_assert_false (ok);
       g_assert_null (ident.udev);
@@ -201,6 +218,7 @@ check_ident (TestSysfs *tt, const char *host)
 static void
 test_sysfs_device_ident (TestSysfs *tt, gconstpointer user)
 {
+  g_autoptr(BoltSysfsSnapshot) snap = NULL;
   g_autoptr(udev_device) udevice = NULL;
   g_autoptr(GError) err = NULL;
   g_auto(BoltIdent) ident = BOLT_IDENT_INIT;
@@ -226,14 +244,17 @@ test_sysfs_device_ident (TestSysfs *tt, gconstpointer user)
   udevice = udev_device_new_from_syspath (tt->udev, syspath);
   g_assert_nonnull (udevice);
 
-  ok = bolt_sysfs_device_ident (udevice, &ident, &err);
+  snap = snapshot_for_device (udevice);
+  ok = bolt_sysfs_device_ident (snap, &ident, &err);
   g_assert_no_error (err);
   g_assert_true (ok);
 
   g_assert_true (ident.udev == udevice);
+  g_assert_true (ident.snap == snap);
   g_assert_cmpstr (id.device_name, ==, ident.name);
   g_assert_cmpstr (id.vendor_name, ==, ident.vendor);
 
+  g_clear_pointer (&snap, bolt_sysfs_snapshot_unref);
   g_clear_pointer (&udevice, udev_device_unref);
 
   /* clear function */
@@ -249,6 +270,7 @@ test_sysfs_device_ident (TestSysfs *tt, gconstpointer user)
 static void
 test_sysfs_host_ident (TestSysfs *tt, gconstpointer user)
 {
+  g_autoptr(BoltSysfsSnapshot) snap = NULL;
   g_autoptr(udev_device) udevice = NULL;
   g_autoptr(GError) err = NULL;
   g_auto(BoltIdent) ident = BOLT_IDENT_INIT;
@@ -295,7 +317,8 @@ test_sysfs_host_ident (TestSysfs *tt, gconstpointer user)
   udevice = udev_device_new_from_syspath (tt->udev, syspath);
   g_assert_nonnull (udevice);
 
-  ok = bolt_sysfs_host_ident (udevice, &ident, &err);
+  snap = snapshot_for_device (udevice);
+  ok = bolt_sysfs_host_ident (snap, &ident, &err);
   g_assert_no_error (err);
   g_assert_true (ok);
 
@@ -303,6 +326,7 @@ test_sysfs_host_ident (TestSysfs *tt, gconstpointer user)
   g_assert_cmpstr (id.device_name, ==, ident.name);
   g_assert_cmpstr (id.vendor_name, ==, ident.vendor);
 
+  g_clear_pointer (&snap, bolt_sysfs_snapshot_unref);
   g_clear_pointer (&udevice, udev_device_unref);
   bolt_ident_clear (&ident);
 
@@ -315,7 +339,8 @@ test_sysfs_host_ident (TestSysfs *tt, gconstpointer user)
   udevice = udev_device_new_from_syspath (tt->udev, syspath);
   g_assert_nonnull (udevice);
 
-  ok = bolt_sysfs_host_ident (udevice, &ident, &err);
+  snap = snapshot_for_device (udevice);
+  ok = bolt_sysfs_host_ident (snap, &ident, &err);
   g_assert_error (err, BOLT_ERROR, BOLT_ERROR_UDEV);
   g_assert_false (ok);
   g_clear_error (&err);
@@ -331,7 +356,7 @@ test_sysfs_host_ident (TestSysfs *tt, gconstpointer user)
                                    dmi_ids[i].product_version);
       g_assert_nonnull (dmi);
 
-      ok = bolt_sysfs_host_ident (udevice, &ident, &err);
+      ok = bolt_sysfs_host_ident (snap, &ident, &err);
       g_assert_no_error (err);
       g_assert_true (ok);
 
@@ -420,6 +445,7 @@ test_sysfs_domain_for_device (TestSysfs *tt, gconstpointer user)
 static void
 test_sysfs_info_for_device (TestSysfs *tt, gconstpointer user)
 {
+  g_autoptr(BoltSysfsSnapshot) snap = NULL;
   g_autoptr(udev_device) udevice = NULL;
   g_autoptr(GError) err = NULL;
   const char *domain;
@@ -468,7 +494,8 @@ test_sysfs_info_for_device (TestSysfs *tt, gconstpointer user)
   udevice = udev_device_new_from_syspath (tt->udev, syspath);
   g_assert_nonnull (udevice);
 
-  ok = bolt_sysfs_info_for_device (udevice, TRUE, &info, &err);
+  snap = snapshot_for_device (udevice);
+  ok = bolt_sysfs_info_for_device (snap, TRUE, &info, &err);
   g_assert_no_error (err);
   g_assert_true (ok);
 
@@ -482,6 +509,196 @@ test_sysfs_info_for_device (TestSysfs *tt, gconstpointer user)
   g_assert_cmpuint (info.linkspeed.tx.lanes, ==, ls.tx.lanes);
 }
 
+static void
+test_sysfs_snapshot (TestSysfs *tt, gconstpointer user)
+{
+  g_autoptr(BoltSysfsSnapshot) snap = NULL;
+  g_autoptr(udev_device) udevice = NULL;
+  g_autoptr(GError) err = NULL;
+  const char *domain;
+  const char *host;
+  const char *dock;
+  const char *syspath;
+  const char *uid;
+  const char *val;
+  MockDevId hostid = {
+    .vendor_id = 0x42,
+    .vendor_name = "GNOME.org",
+    .device_id = 0x42,
+    .device_name = "Laptop",
+    .unique_id = "884c6edd-7118-4b21-b186-b02d396ecca0",
+  };
+  MockDevId dockid = {
+    .vendor_id = 0x42,
+    .vendor_name = "GNOME.org",
+    .device_id = 0x42,
+    .device_name = "Thunderbolt Dock",
+    .unique_id = "884c6edd-7118-4b21-b186-b02d396ecca1",
+  };
+  BoltLinkSpeed ls = {
+    .rx.speed = 10,
+    .rx.lanes = 1,
+    .tx.speed = 20,
+    .tx.lanes = 2
+  };
+  const char *attrs[] = {
+    "unique_id",
+    "authorized",
+    "boot",
+    "generation",
+    "rx_lanes",
+    "rx_speed",
+    "tx_lanes",
+    "tx_speed",
+    "vendor_name",
+    "device_name",
+  };
+
+  domain = mock_sysfs_domain_add (tt->sysfs, BOLT_SECURITY_SECURE, NULL);
+  g_assert_nonnull (domain);
+
+  host = mock_sysfs_host_add (tt->sysfs, domain, &hostid);
+  g_assert_nonnull (host);
+
+  dock = mock_sysfs_device_add (tt->sysfs, host, &dockid, 1, NULL, 1, &ls);
+  g_assert_nonnull (dock);
+
+  syspath = mock_sysfs_device_get_syspath (tt->sysfs, dock);
+  udevice = udev_device_new_from_syspath (tt->udev, syspath);
+  g_assert_nonnull (udevice);
+
+  snap = bolt_sysfs_snapshot_new (udevice, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (snap);
+
+  g_assert_true (bolt_sysfs_snapshot_get_device (snap) == udevice);
+
+  /* the snapshot must agree with libudev */
+  for (gsize i = 0; i < G_N_ELEMENTS (attrs); i++)
+    {
+      const char *want = udev_device_get_sysattr_value (udevice, attrs[i]);
+
+      val = bolt_sysfs_snapshot_get (snap, attrs[i]);
+      g_assert_cmpstr (val, ==, want);
+    }
+
+  uid = bolt_sysfs_snapshot_get_unique_id (snap, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (uid, ==, dockid.unique_id);
+
+  val = bolt_sysfs_snapshot_get (snap, "../unique_id");
+  g_assert_cmpstr (val, ==, hostid.unique_id);
+
+  /* attributes not in the snapshot are read via libudev */
+  val = bolt_sysfs_snapshot_get (snap, "nonexistent");
+  g_assert_null (val);
+
+  /* values stay valid after the device is gone */
+  mock_sysfs_device_remove (tt->sysfs, dock);
+
+  val = bolt_sysfs_snapshot_get (snap, "authorized");
+  g_assert_cmpstr (val, ==, "1");
+
+  uid = bolt_sysfs_snapshot_get_unique_id (snap, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (uid, ==, dockid.unique_id);
+
+  /* but a new snapshot cannot be taken */
+  g_clear_pointer (&snap, bolt_sysfs_snapshot_unref);
+
+  snap = bolt_sysfs_snapshot_new (udevice, &err);
+  g_assert_error (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_null (snap);
+}
+
+static gint
+find_syspath (GPtrArray *devices, const char *syspath)
+{
+  for (guint i = 0; i < devices->len; i++)
+    {
+      struct udev_device *dev = g_ptr_array_index (devices, i);
+
+      if (bolt_streq (udev_device_get_syspath (dev), syspath))
+        return (gint) i;
+    }
+
+  return -1;
+}
+
+static void
+test_sysfs_enumerate (TestSysfs *tt, gconstpointer user)
+{
+  g_autoptr(GPtrArray) devices = NULL;
+  g_autoptr(GError) err = NULL;
+  MockDevId hostid = {
+    .vendor_id = 0x42,
+    .vendor_name = "GNOME.org",
+    .device_id = 0x42,
+    .device_name = "Laptop",
+    .unique_id = "884c6edd-7118-4b21-b186-b02d396ecca0",
+  };
+  MockDevId dockid = {
+    .vendor_id = 0x42,
+    .vendor_name = "GNOME.org",
+    .device_id = 0x42,
+    .device_name = "Thunderbolt Dock",
+    .unique_id = "884c6edd-7118-4b21-b186-b02d396ecca1",
+  };
+  const char *domains[2];
+  const char *hosts[2];
+  const char *docks[2];
+
+  devices = bolt_sysfs_enumerate (tt->udev, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (devices);
+  g_assert_cmpuint (devices->len, ==, 0);
+  g_clear_pointer (&devices, g_ptr_array_unref);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (domains); i++)
+    {
+      domains[i] = mock_sysfs_domain_add (tt->sysfs, BOLT_SECURITY_SECURE, NULL);
+      g_assert_nonnull (domains[i]);
+
+      hosts[i] = mock_sysfs_host_add (tt->sysfs, domains[i], &hostid);
+      g_assert_nonnull (hosts[i]);
+
+      docks[i] = mock_sysfs_device_add (tt->sysfs, hosts[i], &dockid,
+                                        0, NULL, 0, NULL);
+      g_assert_nonnull (docks[i]);
+    }
+
+  devices = bolt_sysfs_enumerate (tt->udev, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (devices);
+
+  /* the nhi devices are not part of the result */
+  g_assert_cmpuint (devices->len, ==, 3 * G_N_ELEMENTS (domains));
+
+  /* parents must come before their children */
+  for (gsize i = 0; i < G_N_ELEMENTS (domains); i++)
+    {
+      const char *syspath;
+      gint d, h, k;
+
+      syspath = mock_sysfs_domain_get_syspath (tt->sysfs, domains[i]);
+      d = find_syspath (devices, syspath);
+
+      syspath = mock_sysfs_device_get_syspath (tt->sysfs, hosts[i]);
+      h = find_syspath (devices, syspath);
+
+      syspath = mock_sysfs_device_get_syspath (tt->sysfs, docks[i]);
+      k = find_syspath (devices, syspath);
+
+      g_assert_cmpint (d, >, -1);
+      g_assert_cmpint (h, >, d);
+      g_assert_cmpint (k, >, h);
+    }
+
+  g_assert_cmpint (bolt_sysfs_count_hosts (tt->udev, NULL),
+                   ==,
+                   (int) G_N_ELEMENTS (domains));
+}
+
 static void
 test_sysfs_nhi_id_for_domain (TestSysfs *tt, gconstpointer user)
 {
@@ -1475,6 +1692,76 @@ test_bootacl_update_offline (TestBootacl *tt, gconstpointer user)
   test_bootacl_read_acl (tt, &sysacl);
 }
 
+static void
+bootacl_async_done (GObject      *source,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  GAsyncResult **result = user_data;
+
+  *result = g_object_ref (res);
+}
+
+static void
+test_bootacl_update_async (TestBootacl *tt, gconstpointer user)
+{
+  g_autoptr(GError) err = NULL;
+  g_autoptr(BoltStore) store = NULL;
+  g_autoptr(GAsyncResult) res = NULL;
+  g_auto(BoltTmpDir) dir = NULL;
+  BoltDomain *dom = tt->dom;
+  const char *uuid = "deadbabe-0200-0100-ffff-ffffffffffff";
+  gboolean ok;
+
+  dir = bolt_tmp_dir_make ("bolt.sysfs.XXXXXX", NULL);
+  store = bolt_store_new (dir, &err);
+
+  g_assert_no_error (err);
+  g_assert_nonnull (store);
+
+  ok = bolt_store_put_domain (store, dom, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  bolt_domain_disconnected (dom);
+
+  /* the acl is only updated once the entry is durable */
+  bolt_domain_bootacl_add_async (dom, uuid, NULL, bootacl_async_done, &res);
+  g_assert_false (bolt_domain_bootacl_contains (dom, uuid));
+
+  while (res == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  ok = bolt_domain_bootacl_add_finish (dom, res, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_true (bolt_domain_bootacl_contains (dom, uuid));
+  g_clear_object (&res);
+
+  /* adding it again fails right away */
+  bolt_domain_bootacl_add_async (dom, uuid, NULL, bootacl_async_done, &res);
+
+  while (res == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  ok = bolt_domain_bootacl_add_finish (dom, res, &err);
+  g_assert_error (err, G_IO_ERROR, G_IO_ERROR_EXISTS);
+  g_assert_false (ok);
+  g_clear_error (&err);
+  g_clear_object (&res);
+
+  bolt_domain_bootacl_del_async (dom, uuid, NULL, bootacl_async_done, &res);
+  g_assert_true (bolt_domain_bootacl_contains (dom, uuid));
+
+  while (res == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  ok = bolt_domain_bootacl_del_finish (dom, res, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_false (bolt_domain_bootacl_contains (dom, uuid));
+}
+
 static gboolean
 bootacl_allocator (BoltDomain *domain,
                    GStrv       bootacl,
@@ -1587,6 +1874,20 @@ main (int argc, char **argv)
               test_sysfs_info_for_device,
               test_sysfs_tear_down);
 
+  g_test_add ("/sysfs/snapshot",
+              TestSysfs,
+              NULL,
+              test_sysfs_setup,
+              test_sysfs_snapshot,
+              test_sysfs_tear_down);
+
+  g_test_add ("/sysfs/enumerate",
+              TestSysfs,
+              NULL,
+              test_sysfs_setup,
+              test_sysfs_enumerate,
+              test_sysfs_tear_down);
+
   g_test_add ("/sysfs/domain_get_nhi_id",
               TestSysfs,
               NULL,
@@ -1657,6 +1958,13 @@ main (int argc, char **argv)
               test_bootacl_update_offline,
               test_bootacl_tear_down);
 
+  g_test_add ("/sysfs/domain/bootacl/update_async",
+              TestBootacl,
+              NULL,
+              test_bootacl_setup,
+              test_bootacl_update_async,
+              test_bootacl_tear_down);
+
   g_test_add ("/sysfs/domain/bootacl/allocate",
               TestBootacl,
               NULL,
@@ -24,6 +24,7 @@
 
 #include "bolt-dbus.h"
 #include "bolt-str.h"
+#include "bolt-sysfs.h"
 #include "bolt-test.h"
 #include "mock-sysfs.h"
 
@@ -208,6 +209,192 @@ test_udev_basic (TestUdev *tt, gconstpointer user)
   udev_device_unref (dev);
 }
 
+typedef struct
+{
+  GMainLoop *loop;
+
+  guint      batches;
+  guint      events;
+  guint      should;
+  gboolean   timedout;
+} UEventBatch;
+
+static void
+got_uevent_batch (BoltUdev  *udev,
+                  GPtrArray *uevents,
+                  gpointer   user_data)
+{
+  UEventBatch *b = user_data;
+
+  g_assert_cmpuint (uevents->len, >, 0);
+
+  for (guint i = 0; i < uevents->len; i++)
+    {
+      BoltUEvent *ev = g_ptr_array_index (uevents, i);
+
+      g_assert_cmpstr (ev->action, ==, "add");
+      g_assert_nonnull (ev->device);
+      g_assert_nonnull (udev_device_get_syspath (ev->device));
+    }
+
+  b->batches++;
+  b->events += uevents->len;
+
+  if (b->events >= b->should)
+    g_main_loop_quit (b->loop);
+}
+
+static gboolean
+got_batch_timeout (gpointer user_data)
+{
+  UEventBatch *b = user_data;
+
+  b->timedout = TRUE;
+  g_main_loop_quit (b->loop);
+
+  return FALSE;
+}
+
+static void
+test_udev_batch (TestUdev *tt, gconstpointer user)
+{
+  g_autoptr(GMainLoop) loop = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(BoltUdev) udev = NULL;
+  const char *filter[] = {"thunderbolt", NULL};
+  UEventBatch b = {NULL, };
+  const guint n = 8;
+  guint budget;
+  guint tid;
+
+  udev = bolt_udev_new ("udev", filter, &err);
+
+  g_assert_nonnull (udev);
+  g_assert_no_error (err);
+
+  g_object_get (udev, "budget", &budget, NULL);
+  g_assert_cmpuint (budget, ==, BOLT_UDEV_BUDGET_DEFAULT);
+
+  /* limit the budget so a burst needs more than one dispatch */
+  g_object_set (udev, "budget", 3, NULL);
+
+  g_signal_connect (udev, "uevent-batch", (GCallback) got_uevent_batch, &b);
+
+  /* the whole burst is queued before the main loop runs */
+  for (guint i = 0; i < n; i++)
+    {
+      const char *domain;
+
+      domain = mock_sysfs_domain_add (tt->sysfs, BOLT_SECURITY_NONE, NULL);
+      g_assert_nonnull (domain);
+    }
+
+  loop = b.loop = g_main_loop_new (NULL, FALSE);
+  b.should = n;
+
+  tid = g_timeout_add_seconds (2, got_batch_timeout, &b);
+  g_main_loop_run (loop);
+
+  if (!b.timedout)
+    g_source_remove (tid);
+
+  g_assert_false (b.timedout);
+  g_assert_cmpuint (b.events, ==, n);
+  g_assert_cmpuint (b.batches, <=, n);
+  g_assert_cmpuint (b.batches, >=, n / 3);
+}
+
+static void
+test_udev_sysfs_cache (TestUdev *tt, gconstpointer user)
+{
+  g_autoptr(udev_device) first = NULL;
+  g_autoptr(udev_device) other = NULL;
+  g_autoptr(GError) err = NULL;
+  g_autoptr(BoltUdev) udev = NULL;
+  UEvent ev = { NULL, };
+  const char *filter[] = {"thunderbolt", NULL};
+  const char *domain;
+  BoltSecurity security;
+  gboolean iommu;
+  gboolean ok;
+  gint n;
+
+  udev = bolt_udev_new ("udev", filter, &err);
+  g_assert_no_error (err);
+  g_assert_nonnull (udev);
+
+  g_signal_connect (udev, "uevent", (GCallback) got_uevent, &ev);
+
+  domain = mock_sysfs_domain_add (tt->sysfs, BOLT_SECURITY_NONE,
+                                  "iommu", "0",
+                                  NULL);
+  n = wait_for_event (&ev, 2);
+
+  g_assert_false (ev.timedout);
+  g_assert_cmpint (n, ==, 1);
+  g_assert_nonnull (ev.dev);
+
+  first = udev_device_ref (ev.dev);
+
+  /* a fresh object for the same path, which has not read
+   * any attribute itself, i.e. libudev has nothing cached */
+  other = udev_device_new_from_syspath (udev_device_get_udev (first),
+                                        udev_device_get_syspath (first));
+  g_assert_nonnull (other);
+
+  bolt_sysfs_cache_begin (1);
+
+  ok = bolt_sysfs_read_iommu (first, &iommu, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_false (iommu);
+
+  security = bolt_sysfs_security_for_device (first, &err);
+  g_assert_no_error (err);
+  g_assert_cmpint (security, ==, BOLT_SECURITY_NONE);
+
+  ok = mock_syfs_domain_iommu_set (tt->sysfs, domain, "1", &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+
+  /* within the scope of a uevent, the values are shared by
+   * all objects for the same path, even if sysfs changed */
+  ok = bolt_sysfs_read_iommu (other, &iommu, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_false (iommu);
+
+  security = bolt_sysfs_security_for_device (other, &err);
+  g_assert_no_error (err);
+  g_assert_cmpint (security, ==, BOLT_SECURITY_NONE);
+
+  bolt_sysfs_cache_end ();
+
+  /* outside of it nothing is cached */
+  ok = bolt_sysfs_read_iommu (other, &iommu, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_true (iommu);
+
+  n = wait_for_event (&ev, 2);
+
+  g_assert_false (ev.timedout);
+  g_assert_cmpint (n, ==, 1);
+  g_assert_cmpstr (ev.action, ==, "change");
+
+  /* and the next uevent for the path starts afresh */
+  bolt_sysfs_cache_begin (2);
+
+  ok = bolt_sysfs_read_iommu (ev.dev, &iommu, &err);
+  g_assert_no_error (err);
+  g_assert_true (ok);
+  g_assert_true (iommu);
+
+  bolt_sysfs_cache_end ();
+
+  uevent_clear (&ev);
+}
+
 static void
 test_udev_detect_force_power (TestUdev *tt, gconstpointer user)
 {
@@ -281,6 +468,20 @@ main (int argc, char **argv)
               test_udev_basic,
               test_udev_tear_down);
 
+  g_test_add ("/udev/batch",
+              TestUdev,
+              NULL,
+              test_udev_setup,
+              test_udev_batch,
+              test_udev_tear_down);
+
+  g_test_add ("/udev/sysfs_cache",
+              TestUdev,
+              NULL,
+              test_udev_setup,
+              test_udev_sysfs_cache,
+              test_udev_tear_down);
+
   g_test_add ("/udev/detect_force_power",
               TestUdev,
               NULL,